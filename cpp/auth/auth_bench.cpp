@@ -0,0 +1,336 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Per-call cost of bearer token authentication, from the validator alone up
+// to UnaryCall over TLS on loopback, with the token cache cold (every call
+// brings a token it hasn't seen) and warm (every call brings the same one),
+// and the cost of new TLS connections with and without session resumption:
+//
+//   auth_bench --benchmark_filter='EndToEnd'
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <grpc/grpc_security.h>
+#include <grpcpp/grpcpp.h>
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include "auth_sample.grpc.pb.h"
+#include "auth_service.h"
+#include "bearer_processor.h"
+#include "token_cache.h"
+#include "token_validator.h"
+
+namespace
+{
+
+constexpr char kSecret[] = "auth_bench secret";
+// Distinct tokens cycled through by the cold benchmarks, and the cache size
+// they run with: a quarter of them, so that each token has been evicted by
+// the time it comes round again.
+constexpr size_t kColdTokens = 4096;
+constexpr size_t kColdCacheEntries = kColdTokens / 4;
+
+std::vector<std::string> MakeTokens(size_t count)
+{
+    auth::SignedTokenValidator signer(kSecret);
+    std::vector<std::string> tokens;
+    for (size_t i = 0; i < count; i++)
+    {
+        auth::Identity identity;
+        identity.username = "user" + std::to_string(i);
+        identity.oauth_scope = "test.read test.write";
+        identity.expires = std::chrono::system_clock::now() + std::chrono::hours(1);
+        tokens.push_back(signer.Sign(identity));
+    }
+    return tokens;
+}
+
+const std::vector<std::string> &Tokens()
+{
+    static const std::vector<std::string> tokens = MakeTokens(kColdTokens);
+    return tokens;
+}
+
+// The validator chain the server builds: signed tokens, |delay_ms| of
+// simulated remote validation, and a cache with room for a quarter of the
+// cold tokens.
+class Validators
+{
+  public:
+    explicit Validators(int delay_ms) : signed_(kSecret)
+    {
+        validator_ = &signed_;
+        if (delay_ms > 0)
+        {
+            delayed_ = std::make_unique<auth::DelayedValidator>(validator_, std::chrono::milliseconds(delay_ms));
+            validator_ = delayed_.get();
+        }
+        auth::CachingValidator::Options options;
+        options.max_entries = kColdCacheEntries;
+        // One shard, so that the bound is exact.
+        options.shards = 1;
+        cache_ = std::make_unique<auth::CachingValidator>(validator_, options);
+        validator_ = cache_.get();
+    }
+
+    auth::TokenValidator *get()
+    {
+        return validator_;
+    }
+
+  private:
+    auth::SignedTokenValidator signed_;
+    std::unique_ptr<auth::DelayedValidator> delayed_;
+    std::unique_ptr<auth::CachingValidator> cache_;
+    auth::TokenValidator *validator_;
+};
+
+// Which token a call brings: range(0) 0 is a different one each time (cold),
+// 1 always the first (warm).
+const std::string &TokenOf(const benchmark::State &state, size_t i)
+{
+    return Tokens()[state.range(0) != 0 ? 0 : i % kColdTokens];
+}
+
+void BM_SignToken(benchmark::State &state)
+{
+    auth::SignedTokenValidator signer(kSecret);
+    auth::Identity identity;
+    identity.username = "user";
+    identity.oauth_scope = "test.read test.write";
+    identity.expires = std::chrono::system_clock::now() + std::chrono::hours(1);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(signer.Sign(identity));
+}
+BENCHMARK(BM_SignToken);
+
+// Full validation of every token, without a cache.
+void BM_ValidateToken(benchmark::State &state)
+{
+    auth::SignedTokenValidator validator(kSecret);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        auth::Identity identity;
+        benchmark::DoNotOptimize(validator.Validate(Tokens()[i++ % kColdTokens], &identity));
+    }
+}
+BENCHMARK(BM_ValidateToken);
+
+// Through the cache, cold or warm (range(0)), with range(1) ms of simulated
+// remote validation behind it.
+void BM_CachedValidate(benchmark::State &state)
+{
+    Validators validators(static_cast<int>(state.range(1)));
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        auth::Identity identity;
+        if (!validators.get()->Validate(TokenOf(state, i++), &identity))
+        {
+            state.SkipWithError("token rejected");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_CachedValidate)->ArgNames({"warm", "delay_ms"})->ArgsProduct({{0, 1}, {0, 1}});
+
+// A key and self-signed certificate for "localhost" and 127.0.0.1, made once
+// per run so that nothing needs to be on disk.
+struct Certificate
+{
+    std::string key;
+    std::string cert;
+};
+
+std::string ToPem(BIO *bio)
+{
+    char *data = nullptr;
+    long size = BIO_get_mem_data(bio, &data);
+    std::string pem(data, size);
+    BIO_free(bio);
+    return pem;
+}
+
+const Certificate &GetCertificate()
+{
+    static const Certificate certificate = [] {
+        EVP_PKEY *key = EVP_EC_gen("P-256");
+        X509 *x509 = X509_new();
+        X509_set_version(x509, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+        X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+        X509_gmtime_adj(X509_getm_notAfter(x509), 24 * 3600);
+        X509_set_pubkey(x509, key);
+        X509_NAME *name = X509_get_subject_name(x509);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>("localhost"), -1,
+                                   -1, 0);
+        X509_set_issuer_name(x509, name);
+        X509V3_CTX ctx;
+        X509V3_set_ctx_nodb(&ctx);
+        X509V3_set_ctx(&ctx, x509, x509, nullptr, nullptr, 0);
+        X509_EXTENSION *san = X509V3_EXT_conf_nid(nullptr, &ctx, NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1");
+        X509_add_ext(x509, san, -1);
+        X509_EXTENSION_free(san);
+        X509_sign(x509, key, EVP_sha256());
+
+        Certificate made;
+        BIO *key_pem = BIO_new(BIO_s_mem());
+        PEM_write_bio_PrivateKey(key_pem, key, nullptr, nullptr, 0, nullptr, nullptr);
+        made.key = ToPem(key_pem);
+        BIO *cert_pem = BIO_new(BIO_s_mem());
+        PEM_write_bio_X509(cert_pem, x509);
+        made.cert = ToPem(cert_pem);
+        X509_free(x509);
+        EVP_PKEY_free(key);
+        return made;
+    }();
+    return certificate;
+}
+
+// TestService over TLS on 127.0.0.1, with a BearerTokenProcessor over
+// |validator| unless it is null.
+class TlsServer
+{
+  public:
+    explicit TlsServer(auth::TokenValidator *validator)
+    {
+        grpc::SslServerCredentialsOptions tls;
+        tls.pem_key_cert_pairs.push_back({GetCertificate().key, GetCertificate().cert});
+        std::shared_ptr<grpc::ServerCredentials> credentials = grpc::SslServerCredentials(tls);
+        if (validator != nullptr)
+            credentials->SetAuthMetadataProcessor(std::make_shared<auth::BearerTokenProcessor>(validator));
+        grpc::ServerBuilder builder;
+        builder.AddListeningPort("127.0.0.1:0", credentials, &port_);
+        builder.RegisterService(&service_);
+        server_ = builder.BuildAndStart();
+    }
+
+    ~TlsServer()
+    {
+        server_->Shutdown();
+    }
+
+    // A new channel of its own, with a resumption cache of |sessions| if
+    // not null.
+    std::shared_ptr<grpc::Channel> NewChannel(grpc_ssl_session_cache *sessions = nullptr)
+    {
+        grpc::SslCredentialsOptions tls;
+        tls.pem_root_certs = GetCertificate().cert;
+        grpc::ChannelArguments args;
+        args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+        if (sessions != nullptr)
+        {
+            grpc_arg arg = grpc_ssl_session_cache_create_channel_arg(sessions);
+            args.SetPointerWithVtable(arg.key, arg.value.pointer.p, arg.value.pointer.vtable);
+        }
+        return grpc::CreateCustomChannel("localhost:" + std::to_string(port_), grpc::SslCredentials(tls), args);
+    }
+
+  private:
+    auth::TestServiceImpl service_;
+    std::unique_ptr<grpc::Server> server_;
+    int port_ = 0;
+};
+
+// UnaryCall with a bearer token of its own per call. range(0) is the mode:
+// 0 sends the token to a server that doesn't check it, the baseline, and 1
+// and 2 to one that does, with the cache cold and warm; range(1) is the
+// simulated remote validation in ms.
+void BM_EndToEndUnaryCall(benchmark::State &state)
+{
+    int mode = static_cast<int>(state.range(0));
+    Validators validators(static_cast<int>(state.range(1)));
+    TlsServer server(mode == 0 ? nullptr : validators.get());
+    std::unique_ptr<grpc::testing::TestService::Stub> stub = grpc::testing::TestService::NewStub(server.NewChannel());
+    std::vector<std::shared_ptr<grpc::CallCredentials>> credentials;
+    for (const std::string &token : Tokens())
+        credentials.push_back(grpc::AccessTokenCredentials(token));
+    grpc::testing::Request request;
+    request.set_fill_username(true);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        grpc::ClientContext context;
+        context.set_credentials(credentials[mode == 2 ? 0 : i++ % kColdTokens]);
+        grpc::testing::Response response;
+        grpc::Status status = stub->UnaryCall(&context, request, &response);
+        if (!status.ok())
+        {
+            state.SkipWithError(status.error_message().c_str());
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EndToEndUnaryCall)
+    ->ArgNames({"mode", "delay_ms"})
+    ->ArgsProduct({{0, 1, 2}, {0, 1}})
+    ->UseRealTime();
+
+// A new connection and its first call, range(0) 1 resuming the TLS session
+// of the connection before it, 0 negotiating every session in full.
+void BM_EndToEndNewConnection(benchmark::State &state)
+{
+    Validators validators(0);
+    TlsServer server(validators.get());
+    grpc_ssl_session_cache *sessions = state.range(0) != 0 ? grpc_ssl_session_cache_create_lru(16) : nullptr;
+    std::shared_ptr<grpc::CallCredentials> credentials = grpc::AccessTokenCredentials(Tokens()[0]);
+    grpc::testing::Request request;
+    bool first = true;
+    for (auto _ : state)
+    {
+        std::unique_ptr<grpc::testing::TestService::Stub> stub =
+            grpc::testing::TestService::NewStub(server.NewChannel(sessions));
+        grpc::ClientContext context;
+        context.set_credentials(credentials);
+        grpc::testing::Response response;
+        grpc::Status status = stub->UnaryCall(&context, request, &response);
+        if (!status.ok())
+        {
+            state.SkipWithError(status.error_message().c_str());
+            break;
+        }
+        if (state.range(0) != 0 && !std::exchange(first, false))
+        {
+            auto reused = context.GetServerTrailingMetadata().find(auth::kSessionReusedKey);
+            if (reused == context.GetServerTrailingMetadata().end() || reused->second != "true")
+            {
+                state.SkipWithError("TLS session not resumed");
+                break;
+            }
+        }
+    }
+    if (sessions != nullptr)
+        grpc_ssl_session_cache_destroy(sessions);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EndToEndNewConnection)->ArgName("resume")->Arg(0)->Arg(1)->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
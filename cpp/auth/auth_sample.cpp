@@ -0,0 +1,277 @@
+/*
+ *
+ * Copyright 2021 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "common/channel_pool.h"
+#include "common/load_generator.h"
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/server_options.h"
+#include "common/shutdown.h"
+#include "common/utils.h"
+#include "auth_sample.grpc.pb.h"
+#include "auth_service.h"
+#include "bearer_processor.h"
+#include "token_cache.h"
+#include "token_validator.h"
+
+// The whole of the file at |path| into |contents|; false, after saying why,
+// if it can't be read.
+bool ReadFile(const std::string &path, std::string *contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Cannot read " << path << std::endl;
+        return false;
+    }
+    std::ostringstream oss;
+    oss << file.rdbuf();
+    *contents = oss.str();
+    return true;
+}
+
+// For Server
+
+// Serves TestService over TLS, every call authenticated by its bearer token.
+// Calls without a valid token never reach the service, health checks
+// included, so the server runs no health service.
+bool RunServer(const CliParams &cli_params)
+{
+    if (cli_params.tls_cert_file.empty() || cli_params.tls_key_file.empty() || cli_params.auth_secret.empty())
+    {
+        std::cout << "The server needs --tls_cert_file, --tls_key_file and --auth_secret." << std::endl;
+        return false;
+    }
+    grpc::SslServerCredentialsOptions::PemKeyCertPair key_cert;
+    if (!ReadFile(cli_params.tls_key_file, &key_cert.private_key) ||
+        !ReadFile(cli_params.tls_cert_file, &key_cert.cert_chain))
+        return false;
+
+    // signed tokens <- optional delay <- optional cache <- processor
+    auth::SignedTokenValidator signed_tokens(cli_params.auth_secret);
+    auth::TokenValidator *validator = &signed_tokens;
+    std::unique_ptr<auth::DelayedValidator> delayed;
+    if (cli_params.auth_validation_delay_ms > 0)
+    {
+        delayed = std::make_unique<auth::DelayedValidator>(
+            validator, std::chrono::milliseconds(cli_params.auth_validation_delay_ms));
+        validator = delayed.get();
+    }
+    std::unique_ptr<auth::CachingValidator> cache;
+    if (cli_params.auth_cache_entries > 0)
+    {
+        auth::CachingValidator::Options options;
+        options.max_entries = static_cast<size_t>(cli_params.auth_cache_entries);
+        options.ttl = std::chrono::milliseconds(cli_params.auth_cache_ttl_ms);
+        cache = std::make_unique<auth::CachingValidator>(validator, options);
+        validator = cache.get();
+    }
+
+    // Clients that keep a session cache resume their TLS sessions on
+    // reconnect; the server side of that needs nothing beyond the TLS
+    // library's defaults.
+    grpc::SslServerCredentialsOptions tls;
+    tls.pem_key_cert_pairs.push_back(key_cert);
+    std::shared_ptr<grpc::ServerCredentials> credentials = grpc::SslServerCredentials(tls);
+    credentials->SetAuthMetadataProcessor(std::make_shared<auth::BearerTokenProcessor>(validator));
+
+    auth::TestServiceImpl service;
+    ServerMetrics metrics;
+    ServerOptions server_options = GetServerOptions(cli_params);
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(cli_params.server_address, credentials);
+    builder.RegisterService(&service);
+    server_options.Apply(&builder);
+    metrics.Install(&builder);
+    // From here on SIGTERM drains the server rather than killing it.
+    ShutdownSignal::Install();
+    std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+    if (server == nullptr)
+        return false;
+    std::cout << "Server listening on " << cli_params.server_address << std::endl;
+    MetricsHttpServer metrics_server(cli_params.maintenance_address, &metrics, server_options.reuse_port);
+    DrainOnSignal(server.get(), server_options);
+    return true;
+}
+
+// For Client
+
+// TLS to the server with the client's bearer token on every call: the one
+// given, or one minted with the shared secret. Null, after saying why, if
+// there is neither or the roots can't be read.
+std::shared_ptr<grpc::ChannelCredentials> GetClientCredentials(const CliParams &cli_params)
+{
+    std::string token = cli_params.auth_token;
+    if (token.empty() && cli_params.auth_secret.empty())
+    {
+        std::cout << "The client needs --auth_token or --auth_secret." << std::endl;
+        return nullptr;
+    }
+    if (token.empty())
+    {
+        auth::Identity identity;
+        identity.username = cli_params.auth_user;
+        identity.oauth_scope = cli_params.auth_scope;
+        identity.expires = std::chrono::system_clock::now() + std::chrono::seconds(cli_params.auth_token_ttl_s);
+        token = auth::SignedTokenValidator(cli_params.auth_secret).Sign(identity);
+    }
+    grpc::SslCredentialsOptions tls;
+    if (!cli_params.tls_ca_file.empty() && !ReadFile(cli_params.tls_ca_file, &tls.pem_root_certs))
+        return nullptr;
+    return grpc::CompositeChannelCredentials(grpc::SslCredentials(tls), grpc::AccessTokenCredentials(token));
+}
+
+ChannelPoolOptions GetPoolOptions(const CliParams &cli_params, std::shared_ptr<grpc::ChannelCredentials> credentials)
+{
+    ChannelPoolOptions options;
+    options.channels = (std::max)(cli_params.channels, 1);
+    options.credentials = std::move(credentials);
+    options.ssl_session_cache_size = (std::max)(cli_params.tls_session_cache, 0);
+    options.ssl_target_name = cli_params.tls_server_name;
+    return options;
+}
+
+class AuthClient
+{
+  public:
+    AuthClient(std::shared_ptr<grpc::Channel> channel, const CallDeadlines &deadlines)
+        : stub_(grpc::testing::TestService::NewStub(channel)), deadlines_(deadlines)
+    {
+    }
+
+    // Asks who the server takes us for, and prints it along with whether the
+    // call's connection resumed an earlier TLS session.
+    bool UnaryCall()
+    {
+        grpc::testing::Request request;
+        request.set_fill_username(true);
+        request.set_fill_oauth_scope(true);
+        grpc::testing::Response response;
+        grpc::ClientContext context;
+        deadlines_.Apply("UnaryCall", &context);
+
+        grpc::Status status = stub_->UnaryCall(&context, request, &response);
+        if (!status.ok())
+        {
+            LOG(ERROR) << status.error_code() << ": " << status.error_message();
+            return false;
+        }
+        const std::multimap<grpc::string_ref, grpc::string_ref> &trailers = context.GetServerTrailingMetadata();
+        auto reused = trailers.find(auth::kSessionReusedKey);
+        std::cout << "username: \"" << response.username() << "\", oauth_scope: \"" << response.oauth_scope()
+                  << "\", TLS session reused: "
+                  << (reused != trailers.end() ? std::string(reused->second.data(), reused->second.size()) : "unknown")
+                  << std::endl;
+        return true;
+    }
+
+  private:
+    std::unique_ptr<grpc::testing::TestService::Stub> stub_;
+    CallDeadlines deadlines_;
+};
+
+// One call on each channel of the pool, one after the other, so that with
+// --channels above 1 every connection but the first can resume the first
+// one's TLS session.
+bool RunClient(const CliParams &cli_params, const CallDeadlines &deadlines,
+               std::shared_ptr<grpc::ChannelCredentials> credentials)
+{
+    ChannelPool pool(cli_params.server_address, GetPoolOptions(cli_params, std::move(credentials)));
+    bool ok = true;
+    for (const std::shared_ptr<grpc::Channel> &channel : pool.channels())
+        ok = AuthClient(channel, deadlines).UnaryCall() && ok;
+    return ok;
+}
+
+// Load mode: UnaryCall through the callback API, the one token of the client
+// on every call, so after the first call the server's cache answers for it.
+bool RunLoad(const CliParams &cli_params, const CallDeadlines &deadlines,
+             std::shared_ptr<grpc::ChannelCredentials> credentials)
+{
+    LoadOptions options;
+    options.qps = cli_params.qps;
+    options.concurrency = cli_params.concurrency;
+    options.duration = std::chrono::seconds(cli_params.duration_s);
+    options.rpc_mix = cli_params.rpc_mix;
+    options.channels = (std::max)(cli_params.channels, 1);
+
+    ChannelPool pool(cli_params.server_address, GetPoolOptions(cli_params, std::move(credentials)));
+    std::vector<std::unique_ptr<grpc::testing::TestService::Stub>> stubs;
+    for (const std::shared_ptr<grpc::Channel> &channel : pool.channels())
+        stubs.push_back(grpc::testing::TestService::NewStub(channel));
+
+    struct Call
+    {
+        grpc::ClientContext context;
+        grpc::testing::Request request;
+        grpc::testing::Response response;
+    };
+    LoadGenerator load;
+    load.AddRpc("UnaryCall", [&stubs, &deadlines](int channel, LoadGenerator::Done done) {
+        Call *call = new Call;
+        call->request.set_fill_username(true);
+        deadlines.Apply("UnaryCall", &call->context);
+        stubs[channel]->async()->UnaryCall(&call->context, &call->request, &call->response,
+                                           [call, done = std::move(done)](grpc::Status status) {
+                                               delete call;
+                                               done(status.ok());
+                                           });
+    });
+    return load.Run(options, std::cout);
+}
+
+int main(int argc, char **argv)
+{
+    CliParams cli_params;
+    ParseCLIState cliState = ParseCommandLine(argc, argv, &cli_params);
+    if (cliState == ParseCLIState::SUCCESS)
+    {
+        if (cli_params.mode == Mode::CLIENT)
+        {
+            CallDeadlines deadlines;
+            if (!GetCallDeadlines(cli_params, &deadlines))
+                return 1;
+            std::shared_ptr<grpc::ChannelCredentials> credentials = GetClientCredentials(cli_params);
+            if (credentials == nullptr)
+                return 1;
+            if (cli_params.load)
+                return RunLoad(cli_params, deadlines, std::move(credentials)) ? 0 : 1;
+            return RunClient(cli_params, deadlines, std::move(credentials)) ? 0 : 1;
+        }
+        else // SERVER
+        {
+            return RunServer(cli_params) ? 0 : 1;
+        }
+    }
+    else if (cliState == ParseCLIState::SHOW_HELP)
+        return 0;
+    else
+        return 1;
+}
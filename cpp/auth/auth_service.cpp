@@ -0,0 +1,39 @@
+#include "auth_service.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <grpc/grpc_security_constants.h>
+
+#include "bearer_processor.h"
+
+namespace auth
+{
+
+namespace
+{
+
+// The first value of |property|, empty if the call has none.
+std::string Property(const grpc::AuthContext &context, const char *property)
+{
+    std::vector<grpc::string_ref> values = context.FindPropertyValues(property);
+    return values.empty() ? std::string() : std::string(values[0].data(), values[0].size());
+}
+
+} // namespace
+
+grpc::Status TestServiceImpl::UnaryCall(grpc::ServerContext *context, const grpc::testing::Request *request,
+                                        grpc::testing::Response *response)
+{
+    std::shared_ptr<const grpc::AuthContext> auth_context = context->auth_context();
+    if (request->fill_username())
+        response->set_username(Property(*auth_context, kUsernameProperty));
+    if (request->fill_oauth_scope())
+        response->set_oauth_scope(Property(*auth_context, kOauthScopeProperty));
+    context->AddTrailingMetadata(kSessionReusedKey,
+                                 Property(*auth_context, GRPC_SSL_SESSION_REUSED_PROPERTY) == "true" ? "true" : "false");
+    return grpc::Status::OK;
+}
+
+} // namespace auth
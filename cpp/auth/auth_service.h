@@ -0,0 +1,27 @@
+#ifndef GRPC_COMMON_CPP_AUTH_AUTH_SERVICE_H_
+#define GRPC_COMMON_CPP_AUTH_AUTH_SERVICE_H_
+
+#include <grpcpp/grpcpp.h>
+
+#include "auth_sample.grpc.pb.h"
+
+namespace auth
+{
+
+// Trailing metadata of every UnaryCall, "true" if the TLS session of the
+// call's connection was resumed rather than negotiated in full.
+constexpr char kSessionReusedKey[] = "tls-session-reused";
+
+// TestService as served by auth_sample and auth_bench. UnaryCall answers with
+// the user and scope that a BearerTokenProcessor found in the call's token,
+// as far as the request asks for them.
+class TestServiceImpl final : public grpc::testing::TestService::Service
+{
+  public:
+    grpc::Status UnaryCall(grpc::ServerContext *context, const grpc::testing::Request *request,
+                           grpc::testing::Response *response) override;
+};
+
+} // namespace auth
+
+#endif // GRPC_COMMON_CPP_AUTH_AUTH_SERVICE_H_
@@ -0,0 +1,41 @@
+#include "bearer_processor.h"
+
+#include <string>
+#include <strings.h>
+
+namespace auth
+{
+
+namespace
+{
+
+constexpr char kAuthorizationKey[] = "authorization";
+// The scheme is case-insensitive, as in HTTP.
+constexpr char kBearerPrefix[] = "bearer ";
+constexpr size_t kBearerPrefixSize = sizeof(kBearerPrefix) - 1;
+
+} // namespace
+
+grpc::Status BearerTokenProcessor::Process(const InputMetadata &auth_metadata, grpc::AuthContext *context,
+                                           OutputMetadata *consumed_auth_metadata, OutputMetadata *)
+{
+    auto header = auth_metadata.find(kAuthorizationKey);
+    if (header == auth_metadata.end())
+        return grpc::Status(grpc::StatusCode::UNAUTHENTICATED, "Missing bearer token");
+    const grpc::string_ref &value = header->second;
+    if (value.size() <= kBearerPrefixSize || strncasecmp(value.data(), kBearerPrefix, kBearerPrefixSize) != 0)
+        return grpc::Status(grpc::StatusCode::UNAUTHENTICATED, "Authorization is not a bearer token");
+
+    Identity identity;
+    if (!validator_->Validate(std::string(value.data() + kBearerPrefixSize, value.size() - kBearerPrefixSize),
+                              &identity))
+        return grpc::Status(grpc::StatusCode::UNAUTHENTICATED, "Invalid or expired bearer token");
+
+    consumed_auth_metadata->emplace(kAuthorizationKey, std::string(value.data(), value.size()));
+    context->AddProperty(kUsernameProperty, identity.username);
+    context->AddProperty(kOauthScopeProperty, identity.oauth_scope);
+    context->SetPeerIdentityPropertyName(kUsernameProperty);
+    return grpc::Status::OK;
+}
+
+} // namespace auth
@@ -0,0 +1,44 @@
+#ifndef GRPC_COMMON_CPP_AUTH_BEARER_PROCESSOR_H_
+#define GRPC_COMMON_CPP_AUTH_BEARER_PROCESSOR_H_
+
+#include <grpcpp/security/auth_context.h>
+#include <grpcpp/security/auth_metadata_processor.h>
+#include <grpcpp/support/status.h>
+
+#include "token_validator.h"
+
+namespace auth
+{
+
+// Auth context properties of a call whose token was accepted.
+constexpr char kUsernameProperty[] = "username";
+constexpr char kOauthScopeProperty[] = "oauth_scope";
+
+// Accepts calls carrying "authorization: Bearer <token>" with a token that
+// |validator| accepts, and fails every other call with UNAUTHENTICATED before
+// it reaches a handler. The user and scope of the token become properties of
+// the call's auth context, the user its peer identity, and the header itself
+// is removed from the metadata the handler sees.
+class BearerTokenProcessor : public grpc::AuthMetadataProcessor
+{
+  public:
+    explicit BearerTokenProcessor(TokenValidator *validator) : validator_(validator)
+    {
+    }
+
+    // Validation may block, so gRPC runs Process() off its polling threads.
+    bool IsBlocking() const override
+    {
+        return true;
+    }
+
+    grpc::Status Process(const InputMetadata &auth_metadata, grpc::AuthContext *context,
+                         OutputMetadata *consumed_auth_metadata, OutputMetadata *response_metadata) override;
+
+  private:
+    TokenValidator *validator_;
+};
+
+} // namespace auth
+
+#endif // GRPC_COMMON_CPP_AUTH_BEARER_PROCESSOR_H_
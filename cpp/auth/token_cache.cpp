@@ -0,0 +1,79 @@
+#include "token_cache.h"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <iterator>
+
+namespace auth
+{
+
+CachingValidator::CachingValidator(TokenValidator *validator, const Options &options)
+    : validator_(validator), ttl_(options.ttl),
+      shard_mask_(std::bit_ceil((std::max)(options.shards, size_t{1})) - 1)
+{
+    shards_.reset(new Shard[shard_mask_ + 1]);
+    shard_entries_ = (std::max)(options.max_entries / (shard_mask_ + 1), size_t{1});
+}
+
+CachingValidator::Shard &CachingValidator::ShardOf(const std::string &token)
+{
+    size_t h = std::hash<std::string>()(token);
+    return shards_[(h >> (sizeof(size_t) * 4)) & shard_mask_];
+}
+
+bool CachingValidator::Validate(const std::string &token, Identity *identity)
+{
+    Shard &shard = ShardOf(token);
+    {
+        std::lock_guard<std::mutex> lock(shard.mu);
+        auto cached = shard.index.find(token);
+        if (cached != shard.index.end())
+        {
+            Lru::iterator it = cached->second;
+            if (it->expires > std::chrono::steady_clock::now())
+            {
+                *identity = it->identity;
+                shard.lru.splice(shard.lru.begin(), shard.lru, it);
+                return true;
+            }
+            shard.index.erase(cached);
+            shard.lru.erase(it);
+        }
+    }
+
+    // Validation may be slow; no lock is held meanwhile.
+    if (!validator_->Validate(token, identity))
+        return false;
+    std::lock_guard<std::mutex> lock(shard.mu);
+    Insert(shard, token, *identity);
+    return true;
+}
+
+void CachingValidator::Insert(Shard &shard, const std::string &token, const Identity &identity)
+{
+    // Token expiry is wall-clock time, cache expiry steady time.
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point expires =
+        now + (std::min)(ttl_, std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   identity.expires - std::chrono::system_clock::now()));
+    if (expires <= now)
+        return;
+    auto existing = shard.index.find(token);
+    if (existing != shard.index.end())
+    {
+        // Validated by a concurrent miss as well.
+        shard.lru.erase(existing->second);
+        shard.index.erase(existing);
+    }
+    shard.lru.push_front(Entry{token, identity, expires});
+    shard.index.emplace(token, shard.lru.begin());
+    while (shard.lru.size() > shard_entries_)
+    {
+        Lru::iterator coldest = std::prev(shard.lru.end());
+        shard.index.erase(coldest->token);
+        shard.lru.erase(coldest);
+    }
+}
+
+} // namespace auth
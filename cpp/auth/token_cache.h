@@ -0,0 +1,68 @@
+#ifndef GRPC_COMMON_CPP_AUTH_TOKEN_CACHE_H_
+#define GRPC_COMMON_CPP_AUTH_TOKEN_CACHE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "token_validator.h"
+
+namespace auth
+{
+
+// Remembers the tokens another validator accepted, so that a client sending
+// the same token on every call pays for its validation once per |ttl|.
+//
+// Each shard is an LRU bounded by entry count. An entry lives |ttl| after the
+// token was validated, and never past the token's own expiry. Rejected tokens
+// are not cached, so a token fixed on the issuer's side works on the next
+// call; concurrent misses on one token each validate it.
+class CachingValidator : public TokenValidator
+{
+  public:
+    struct Options
+    {
+        // Tokens kept, split evenly over the shards.
+        size_t max_entries = 100000;
+        std::chrono::steady_clock::duration ttl = std::chrono::minutes(1);
+        size_t shards = 16;
+    };
+
+    CachingValidator(TokenValidator *validator, const Options &options);
+
+    bool Validate(const std::string &token, Identity *identity) override;
+
+  private:
+    struct Entry
+    {
+        std::string token;
+        Identity identity;
+        std::chrono::steady_clock::time_point expires;
+    };
+    using Lru = std::list<Entry>;
+
+    struct alignas(64) Shard
+    {
+        std::mutex mu;
+        // Most recently used first.
+        Lru lru;
+        std::unordered_map<std::string, Lru::iterator> index;
+    };
+
+    Shard &ShardOf(const std::string &token);
+    void Insert(Shard &shard, const std::string &token, const Identity &identity);
+
+    TokenValidator *validator_;
+    size_t shard_entries_;
+    std::chrono::steady_clock::duration ttl_;
+    std::unique_ptr<Shard[]> shards_;
+    size_t shard_mask_;
+};
+
+} // namespace auth
+
+#endif // GRPC_COMMON_CPP_AUTH_TOKEN_CACHE_H_
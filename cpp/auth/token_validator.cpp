@@ -0,0 +1,115 @@
+#include "token_validator.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+namespace auth
+{
+
+namespace
+{
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+std::string HexEncode(const unsigned char *data, size_t size)
+{
+    std::string hex(2 * size, '0');
+    for (size_t i = 0; i < size; i++)
+    {
+        hex[2 * i] = kHexDigits[data[i] >> 4];
+        hex[2 * i + 1] = kHexDigits[data[i] & 0xf];
+    }
+    return hex;
+}
+
+int HexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// False for anything that isn't lower-case hex of whole bytes.
+bool HexDecode(const std::string &hex, std::string *out)
+{
+    if (hex.size() % 2 != 0)
+        return false;
+    out->resize(hex.size() / 2);
+    for (size_t i = 0; i < out->size(); i++)
+    {
+        int high = HexDigit(hex[2 * i]);
+        int low = HexDigit(hex[2 * i + 1]);
+        if (high < 0 || low < 0)
+            return false;
+        (*out)[i] = static_cast<char>(high << 4 | low);
+    }
+    return true;
+}
+
+} // namespace
+
+std::string SignedTokenValidator::Mac(const std::string &payload) const
+{
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    HMAC(EVP_sha256(), secret_.data(), static_cast<int>(secret_.size()),
+         reinterpret_cast<const unsigned char *>(payload.data()), payload.size(), mac, &size);
+    return HexEncode(mac, size);
+}
+
+std::string SignedTokenValidator::Sign(const Identity &identity) const
+{
+    int64_t expiry =
+        std::chrono::duration_cast<std::chrono::seconds>(identity.expires.time_since_epoch()).count();
+    std::string payload =
+        HexEncode(reinterpret_cast<const unsigned char *>(identity.username.data()), identity.username.size()) + "." +
+        HexEncode(reinterpret_cast<const unsigned char *>(identity.oauth_scope.data()), identity.oauth_scope.size()) +
+        "." + std::to_string(expiry);
+    return payload + "." + Mac(payload);
+}
+
+bool SignedTokenValidator::Validate(const std::string &token, Identity *identity)
+{
+    size_t mac_start = token.rfind('.');
+    if (mac_start == std::string::npos)
+        return false;
+    std::string payload = token.substr(0, mac_start);
+    std::string expected = Mac(payload);
+    // In constant time, so that timing doesn't tell how much of a forged mac
+    // was right.
+    if (token.size() - mac_start - 1 != expected.size() ||
+        CRYPTO_memcmp(token.data() + mac_start + 1, expected.data(), expected.size()) != 0)
+        return false;
+
+    size_t user_end = payload.find('.');
+    size_t scope_end = user_end == std::string::npos ? user_end : payload.find('.', user_end + 1);
+    if (scope_end == std::string::npos)
+        return false;
+    char *end = nullptr;
+    long long expiry = std::strtoll(payload.c_str() + scope_end + 1, &end, 10);
+    if (end == payload.c_str() + scope_end + 1 || *end != '\0')
+        return false;
+    Identity parsed;
+    parsed.expires = std::chrono::system_clock::time_point(std::chrono::seconds(expiry));
+    if (parsed.expires <= std::chrono::system_clock::now() ||
+        !HexDecode(payload.substr(0, user_end), &parsed.username) ||
+        !HexDecode(payload.substr(user_end + 1, scope_end - user_end - 1), &parsed.oauth_scope))
+        return false;
+    *identity = std::move(parsed);
+    return true;
+}
+
+bool DelayedValidator::Validate(const std::string &token, Identity *identity)
+{
+    std::this_thread::sleep_for(delay_);
+    return validator_->Validate(token, identity);
+}
+
+} // namespace auth
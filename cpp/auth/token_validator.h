@@ -0,0 +1,75 @@
+#ifndef GRPC_COMMON_CPP_AUTH_TOKEN_VALIDATOR_H_
+#define GRPC_COMMON_CPP_AUTH_TOKEN_VALIDATOR_H_
+
+#include <chrono>
+#include <string>
+#include <utility>
+
+namespace auth
+{
+
+// Who a bearer token speaks for.
+struct Identity
+{
+    std::string username;
+    // Space-separated, as in OAuth.
+    std::string oauth_scope;
+    // The token is not accepted from then on.
+    std::chrono::system_clock::time_point expires;
+};
+
+// Checks bearer tokens. Validate() may block, and is called from many gRPC
+// threads at once.
+class TokenValidator
+{
+  public:
+    virtual ~TokenValidator() = default;
+
+    // Fills |identity| and returns true if |token| is genuine and has not
+    // expired.
+    virtual bool Validate(const std::string &token, Identity *identity) = 0;
+};
+
+// Self-contained tokens signed with a secret shared by the issuer and the
+// servers: "<user>.<scope>.<expiry>.<mac>", the user and scope hex-encoded
+// so that the token only has characters a bearer token may have, the expiry
+// in seconds since the epoch, and the mac the hex HMAC-SHA256 of everything
+// before it.
+class SignedTokenValidator : public TokenValidator
+{
+  public:
+    explicit SignedTokenValidator(std::string secret) : secret_(std::move(secret))
+    {
+    }
+
+    // A token for |identity| that Validate() accepts until it expires.
+    std::string Sign(const Identity &identity) const;
+
+    bool Validate(const std::string &token, Identity *identity) override;
+
+  private:
+    std::string Mac(const std::string &payload) const;
+
+    std::string secret_;
+};
+
+// Delays every answer of another validator by a fixed time, standing in for
+// a remote token service or a slow signature check in tests and load runs.
+class DelayedValidator : public TokenValidator
+{
+  public:
+    DelayedValidator(TokenValidator *validator, std::chrono::milliseconds delay)
+        : validator_(validator), delay_(delay)
+    {
+    }
+
+    bool Validate(const std::string &token, Identity *identity) override;
+
+  private:
+    TokenValidator *validator_;
+    std::chrono::milliseconds delay_;
+};
+
+} // namespace auth
+
+#endif // GRPC_COMMON_CPP_AUTH_TOKEN_VALIDATOR_H_
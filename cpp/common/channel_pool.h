@@ -0,0 +1,249 @@
+#ifndef __COMMON_CHANNEL_POOL_H__
+#define __COMMON_CHANNEL_POOL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <grpc/grpc_security.h>
+#include <grpcpp/grpcpp.h>
+
+struct ChannelPoolOptions
+{
+    enum class Pick
+    {
+        // Channels take calls in turn.
+        kRoundRobin,
+        // Each call goes to the channel with the fewest calls outstanding,
+        // so a slow connection stops getting new calls until it catches up.
+        kLeastOutstanding,
+    };
+
+    // Channels opened, each with a connection (or, with |lb_policy|, a set of
+    // connections) of its own.
+    int channels = 1;
+    Pick pick = Pick::kRoundRobin;
+    // Load balancing policy inside each channel. "round_robin" spreads the
+    // channel's calls over every address the target resolves to; empty keeps
+    // gRPC's pick_first, one connection to the first address.
+    std::string lb_policy;
+    // Compression algorithms the client accepts on responses, one bit per
+    // grpc_compression_algorithm; 0 accepts all that gRPC supports.
+    uint32_t compression_algorithms = 0;
+    // Null for insecure channels. Creating credentials starts gRPC, which a
+    // server must not have done before its supervisor forks workers.
+    std::shared_ptr<grpc::ChannelCredentials> credentials;
+    // TLS only. Sessions kept for resumption, in a cache the pool's channels
+    // share: every connection after the first, reconnects included, resumes
+    // a session instead of negotiating one in full. 0 for none.
+    int ssl_session_cache_size = 0;
+    // TLS only. Name the server certificate is checked against, if not the
+    // host of the target.
+    std::string ssl_target_name;
+};
+
+// "round_robin" or "least_outstanding"; false for anything else.
+inline bool ParseChannelPick(const std::string &name, ChannelPoolOptions::Pick *pick)
+{
+    if (name == "round_robin")
+        *pick = ChannelPoolOptions::Pick::kRoundRobin;
+    else if (name == "least_outstanding")
+        *pick = ChannelPoolOptions::Pick::kLeastOutstanding;
+    else
+        return false;
+    return true;
+}
+
+// Several channels to one target, so that a client isn't held to the
+// stream limit and the bandwidth of a single HTTP/2 connection. Every channel
+// gets its own subchannel pool and distinct channel args, which keeps gRPC
+// from folding them back onto one connection.
+class ChannelPool
+{
+  public:
+    ChannelPool(const std::string &target, const ChannelPoolOptions &options)
+        : pick_(options.pick), outstanding_(std::make_unique<Slot[]>((std::max)(options.channels, 1)))
+    {
+        grpc_ssl_session_cache *sessions = options.ssl_session_cache_size > 0
+                                               ? grpc_ssl_session_cache_create_lru(options.ssl_session_cache_size)
+                                               : nullptr;
+        for (int i = 0; i < (std::max)(options.channels, 1); i++)
+        {
+            grpc::ChannelArguments args;
+            args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+            args.SetInt("grpc.channel_pool.index", i);
+            if (!options.lb_policy.empty())
+                args.SetLoadBalancingPolicyName(options.lb_policy);
+            if (options.compression_algorithms != 0)
+                args.SetInt(GRPC_COMPRESSION_CHANNEL_ENABLED_ALGORITHMS_BITSET, options.compression_algorithms);
+            if (sessions != nullptr)
+            {
+                grpc_arg arg = grpc_ssl_session_cache_create_channel_arg(sessions);
+                args.SetPointerWithVtable(arg.key, arg.value.pointer.p, arg.value.pointer.vtable);
+            }
+            if (!options.ssl_target_name.empty())
+                args.SetSslTargetNameOverride(options.ssl_target_name);
+            channels_.push_back(grpc::CreateCustomChannel(
+                target, options.credentials ? options.credentials : grpc::InsecureChannelCredentials(), args));
+        }
+        // Each channel holds a reference of its own.
+        if (sessions != nullptr)
+            grpc_ssl_session_cache_destroy(sessions);
+    }
+
+    ChannelPool(const ChannelPool &) = delete;
+    ChannelPool &operator=(const ChannelPool &) = delete;
+
+    size_t size() const
+    {
+        return channels_.size();
+    }
+
+    const std::shared_ptr<grpc::Channel> &channel(size_t index) const
+    {
+        return channels_[index];
+    }
+
+    const std::vector<std::shared_ptr<grpc::Channel>> &channels() const
+    {
+        return channels_;
+    }
+
+    // Index of the channel the next call should go to. The call counts as
+    // outstanding on it until Release().
+    size_t Acquire()
+    {
+        size_t n = channels_.size();
+        size_t index = static_cast<size_t>(next_.fetch_add(1, std::memory_order_relaxed) % n);
+        if (pick_ == ChannelPoolOptions::Pick::kLeastOutstanding)
+        {
+            // The scan starts where round robin would pick, so ties rotate.
+            size_t start = index;
+            int least = outstanding_[start].calls.load(std::memory_order_relaxed);
+            for (size_t i = 1; i < n && least > 0; i++)
+            {
+                size_t candidate = (start + i) % n;
+                int calls = outstanding_[candidate].calls.load(std::memory_order_relaxed);
+                if (calls < least)
+                {
+                    least = calls;
+                    index = candidate;
+                }
+            }
+        }
+        outstanding_[index].calls.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    void Release(size_t index)
+    {
+        outstanding_[index].calls.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    int outstanding(size_t index) const
+    {
+        return outstanding_[index].calls.load(std::memory_order_relaxed);
+    }
+
+  private:
+    // Counters of different channels live on different cache lines.
+    struct alignas(64) Slot
+    {
+        std::atomic<int> calls{0};
+    };
+
+    ChannelPoolOptions::Pick pick_;
+    std::vector<std::shared_ptr<grpc::Channel>> channels_;
+    std::unique_ptr<Slot[]> outstanding_;
+    std::atomic<uint64_t> next_{0};
+};
+
+// One stub of |Service| per channel of a pool. Pick() chooses the channel of
+// one call and holds it as outstanding for as long as the lease lives.
+template <typename Service>
+class StubPool
+{
+  public:
+    using Stub = typename Service::Stub;
+
+    class Lease
+    {
+      public:
+        Lease(Lease &&other) noexcept
+            : pool_(std::exchange(other.pool_, nullptr)), index_(other.index_), stub_(other.stub_)
+        {
+        }
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+        ~Lease()
+        {
+            if (pool_ != nullptr)
+                pool_->Release(index_);
+        }
+
+        Stub *operator->() const
+        {
+            return stub_;
+        }
+        Stub *get() const
+        {
+            return stub_;
+        }
+        size_t index() const
+        {
+            return index_;
+        }
+
+      private:
+        friend class StubPool;
+        Lease(ChannelPool *pool, size_t index, Stub *stub) : pool_(pool), index_(index), stub_(stub)
+        {
+        }
+
+        ChannelPool *pool_;
+        size_t index_;
+        Stub *stub_;
+    };
+
+    explicit StubPool(std::shared_ptr<ChannelPool> channels) : channels_(std::move(channels))
+    {
+        for (const std::shared_ptr<grpc::Channel> &channel : channels_->channels())
+            stubs_.push_back(Service::NewStub(channel));
+    }
+
+    Lease Pick()
+    {
+        size_t index = channels_->Acquire();
+        return Lease(channels_.get(), index, stubs_[index].get());
+    }
+
+    // For calls that outlive a scope: Acquire() a channel, call on stub(),
+    // and Release() it once the call is over.
+    size_t Acquire()
+    {
+        return channels_->Acquire();
+    }
+    void Release(size_t index)
+    {
+        channels_->Release(index);
+    }
+    Stub *stub(size_t index) const
+    {
+        return stubs_[index].get();
+    }
+
+    size_t size() const
+    {
+        return stubs_.size();
+    }
+
+  private:
+    std::shared_ptr<ChannelPool> channels_;
+    std::vector<std::unique_ptr<Stub>> stubs_;
+};
+
+#endif // __COMMON_CHANNEL_POOL_H__
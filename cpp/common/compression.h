@@ -0,0 +1,99 @@
+#ifndef __COMMON_COMPRESSION_H__
+#define __COMMON_COMPRESSION_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include <grpc/compression.h>
+#include <grpcpp/grpcpp.h>
+
+// "gzip", "deflate" or "identity" (also "none"); false for anything else.
+inline bool ParseCompressionAlgorithm(const std::string &name, grpc_compression_algorithm *algorithm)
+{
+    if (name == "none")
+    {
+        *algorithm = GRPC_COMPRESS_NONE;
+        return true;
+    }
+    for (int i = 0; i < GRPC_COMPRESS_ALGORITHMS_COUNT; i++)
+    {
+        const char *known = nullptr;
+        if (grpc_compression_algorithm_name(static_cast<grpc_compression_algorithm>(i), &known) && name == known)
+        {
+            *algorithm = static_cast<grpc_compression_algorithm>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// A comma-separated list such as "gzip,deflate" as a bitset with one bit per
+// algorithm, the form of GRPC_COMPRESSION_CHANNEL_ENABLED_ALGORITHMS_BITSET.
+// Identity is always in; an empty list means every algorithm.
+inline bool ParseCompressionAlgorithms(const std::string &names, uint32_t *bitset)
+{
+    if (names.empty())
+    {
+        *bitset = (1u << GRPC_COMPRESS_ALGORITHMS_COUNT) - 1;
+        return true;
+    }
+    uint32_t bits = 1u << GRPC_COMPRESS_NONE;
+    std::istringstream list(names);
+    std::string name;
+    while (std::getline(list, name, ','))
+    {
+        grpc_compression_algorithm algorithm;
+        if (!ParseCompressionAlgorithm(name, &algorithm))
+            return false;
+        bits |= 1u << algorithm;
+    }
+    *bitset = bits;
+    return true;
+}
+
+// When a server compresses its responses. Only messages of at least
+// |min_bytes| are compressed: a small message like a GetFeature reply comes
+// out of deflate about as big as it went in, and costs CPU on both ends for
+// nothing.
+//
+// A server can't see which algorithms a client accepts (gRPC keeps
+// grpc-accept-encoding to itself), so the call asks for a compression level
+// and gRPC picks among the algorithms the client offered: with both on offer,
+// low picks gzip and high deflate. A client that accepts only one of them gets
+// that one, and a client that accepts neither gets uncompressed responses
+// rather than ones it can't read.
+struct CompressionPolicy
+{
+    grpc_compression_algorithm algorithm = GRPC_COMPRESS_NONE;
+    size_t min_bytes = 1024;
+
+    // Turns on compression for the responses of the call. Must run before
+    // the call's first write. False if the call stays uncompressed.
+    bool Start(grpc::ServerContextBase *context) const
+    {
+        if (algorithm == GRPC_COMPRESS_NONE)
+            return false;
+        context->set_compression_level(algorithm == GRPC_COMPRESS_GZIP ? GRPC_COMPRESS_LEVEL_LOW
+                                                                       : GRPC_COMPRESS_LEVEL_HIGH);
+        return true;
+    }
+
+    // For a unary call, whose single response is already known.
+    bool StartUnary(grpc::ServerContextBase *context, size_t response_bytes) const
+    {
+        return response_bytes >= min_bytes && Start(context);
+    }
+
+    // Options of one write of |bytes| on a call Start() compressed.
+    grpc::WriteOptions WriteOptionsFor(size_t bytes) const
+    {
+        grpc::WriteOptions options;
+        if (bytes < min_bytes)
+            options.set_no_compression();
+        return options;
+    }
+};
+
+#endif // __COMMON_COMPRESSION_H__
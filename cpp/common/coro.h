@@ -0,0 +1,455 @@
+#ifndef __COMMON_CORO_H__
+#define __COMMON_CORO_H__
+
+#include <algorithm>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <grpcpp/alarm.h>
+#include <grpcpp/grpcpp.h>
+
+// C++20 coroutines over a grpc::CompletionQueue, so that a call written
+// against the async API reads top to bottom:
+//
+//     CoTask Serve(grpc::ServerCompletionQueue *cq)
+//     {
+//         grpc::ServerContext context;
+//         grpc::ServerAsyncWriter<Feature> writer(&context);
+//         if (!co_await CoCall([&](void *tag) { service->RequestListFeatures(&context, &rect, &writer, cq, cq, tag); }))
+//             co_return;
+//         CoStream out(&writer);
+//         while (...)
+//             if (!co_await out.Write(feature))
+//                 break;
+//         co_await out.Finish(grpc::Status::OK);
+//     }
+//
+// Each co_await starts one operation, tagged with a CoTag in the coroutine's
+// frame, and suspends; CoDrain() resumes the coroutine with the operation's
+// ok when the tag comes out of the queue. A coroutine therefore runs on the
+// threads draining its queue, one step at a time, and its locals need no lock.
+// Every tag on a queue drained by CoDrain() must be a CoTag.
+
+// Coroutine frames, recycled through per-thread free lists of a few size
+// classes. A coroutine is often started on one thread and finishes on the
+// queue's, so lists that grow past a batch hand it to a shared depot, where
+// the starting thread picks frames back up; once warm, a call allocates no
+// frame from the heap.
+class CoFramePool
+{
+  public:
+    static void *Allocate(size_t size)
+    {
+        size_t index = ClassOf(size);
+        if (index >= kClasses)
+            return ::operator new(size);
+        Local &local = ThreadLocal();
+        if (local.lists[index].empty())
+            Shared().Take(index, &local.lists[index]);
+        if (local.lists[index].empty())
+            return ::operator new((index + 1) * kGranule);
+        void *frame = local.lists[index].back();
+        local.lists[index].pop_back();
+        return frame;
+    }
+
+    static void Free(void *frame, size_t size)
+    {
+        size_t index = ClassOf(size);
+        if (index >= kClasses)
+        {
+            ::operator delete(frame);
+            return;
+        }
+        std::vector<void *> &list = ThreadLocal().lists[index];
+        list.push_back(frame);
+        if (list.size() >= 2 * kBatch)
+            Shared().Give(index, &list);
+    }
+
+  private:
+    // Classes of 256 bytes up to 8 KiB; a server handler's frame, with its
+    // ServerContext, stream and messages, is two to seven KiB.
+    static constexpr size_t kGranule = 256;
+    static constexpr size_t kClasses = 32;
+    // Frames moved between a thread and the depot at a time.
+    static constexpr size_t kBatch = 64;
+
+    static size_t ClassOf(size_t size)
+    {
+        return (size + kGranule - 1) / kGranule - 1;
+    }
+
+    struct Local
+    {
+        std::vector<void *> lists[kClasses];
+
+        ~Local()
+        {
+            for (std::vector<void *> &list : lists)
+                for (void *frame : list)
+                    ::operator delete(frame);
+        }
+    };
+
+    // Frames no thread holds. They live as long as the process.
+    class Depot
+    {
+      public:
+        void Give(size_t index, std::vector<void *> *list)
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            std::vector<void *> &frames = frames_[index];
+            frames.insert(frames.end(), list->end() - kBatch, list->end());
+            list->resize(list->size() - kBatch);
+        }
+
+        void Take(size_t index, std::vector<void *> *list)
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            std::vector<void *> &frames = frames_[index];
+            size_t count = (std::min)(frames.size(), kBatch);
+            list->insert(list->end(), frames.end() - count, frames.end());
+            frames.resize(frames.size() - count);
+        }
+
+      private:
+        std::mutex mu_;
+        std::vector<void *> frames_[kClasses];
+    };
+
+    static Local &ThreadLocal()
+    {
+        thread_local Local local;
+        return local;
+    }
+
+    static Depot &Shared()
+    {
+        static Depot *depot = new Depot;
+        return *depot;
+    }
+};
+
+// A coroutine that starts right away and frees itself when it returns.
+// Nothing waits on it; a coroutine that must know when another is done
+// shares a CoEvent with it.
+class CoTask
+{
+  public:
+    struct promise_type
+    {
+        CoTask get_return_object()
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void()
+        {
+        }
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+
+        static void *operator new(size_t size)
+        {
+            return CoFramePool::Allocate(size);
+        }
+        static void operator delete(void *frame, size_t size)
+        {
+            CoFramePool::Free(frame, size);
+        }
+    };
+};
+
+// A coroutine that another one co_awaits, such as one step of a longer
+// sequence of calls. It starts when awaited and resumes its caller when it
+// returns.
+class [[nodiscard]] CoStep
+{
+  public:
+    struct promise_type
+    {
+        std::coroutine_handle<> caller;
+
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+            {
+                return handle.promise().caller;
+            }
+            void await_resume() const noexcept
+            {
+            }
+        };
+
+        CoStep get_return_object()
+        {
+            return CoStep(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+        FinalAwaiter final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void()
+        {
+        }
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+
+        static void *operator new(size_t size)
+        {
+            return CoFramePool::Allocate(size);
+        }
+        static void operator delete(void *frame, size_t size)
+        {
+            CoFramePool::Free(frame, size);
+        }
+    };
+
+    CoStep(CoStep &&other) noexcept : handle_(std::exchange(other.handle_, nullptr))
+    {
+    }
+    CoStep(const CoStep &) = delete;
+    CoStep &operator=(const CoStep &) = delete;
+    ~CoStep()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller)
+    {
+        handle_.promise().caller = caller;
+        return handle_;
+    }
+    void await_resume() const noexcept
+    {
+    }
+
+  private:
+    explicit CoStep(std::coroutine_handle<promise_type> handle) : handle_(handle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// The tag of the operation a coroutine waits on.
+struct CoTag
+{
+    std::coroutine_handle<> handle;
+    bool ok = false;
+
+    void Resume(bool result)
+    {
+        ok = result;
+        handle.resume();
+    }
+};
+
+// Awaits the operation |start| begins with the tag it is given, and yields
+// the operation's ok.
+template <typename Start> class CoOp
+{
+  public:
+    explicit CoOp(Start start) : start_(std::move(start))
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        // The operation may complete, and resume the coroutine on another
+        // thread, before |start_| returns; nothing here is touched after it.
+        tag_.handle = handle;
+        start_(static_cast<void *>(&tag_));
+    }
+    bool await_resume() const noexcept
+    {
+        return tag_.ok;
+    }
+
+  private:
+    Start start_;
+    CoTag tag_;
+};
+
+template <typename Start> CoOp<Start> CoCall(Start start)
+{
+    return CoOp<Start>(std::move(start));
+}
+
+// co_await CoSleep(&alarm, cq, deadline) suspends until |deadline| without
+// holding a thread.
+template <typename Deadline> auto CoSleep(grpc::Alarm *alarm, grpc::CompletionQueue *cq, const Deadline &deadline)
+{
+    return CoCall([alarm, cq, deadline](void *tag) { alarm->Set(cq, deadline, tag); });
+}
+
+// The operations of one of gRPC's async streams or unary responders, each
+// returning something to co_await. Only the ones |Stream| has compile.
+template <typename Stream> class CoStream
+{
+  public:
+    explicit CoStream(Stream *stream) : stream_(stream)
+    {
+    }
+
+    // Client streams.
+    auto StartCall()
+    {
+        return CoCall([stream = stream_](void *tag) { stream->StartCall(tag); });
+    }
+    auto WritesDone()
+    {
+        return CoCall([stream = stream_](void *tag) { stream->WritesDone(tag); });
+    }
+    auto Finish(grpc::Status *status)
+    {
+        return CoCall([stream = stream_, status](void *tag) { stream->Finish(status, tag); });
+    }
+    // Client unary calls.
+    template <typename M> auto Finish(M *response, grpc::Status *status)
+    {
+        return CoCall([stream = stream_, response, status](void *tag) { stream->Finish(response, status, tag); });
+    }
+
+    // Server streams.
+    auto Finish(const grpc::Status &status)
+    {
+        return CoCall([stream = stream_, status](void *tag) { stream->Finish(status, tag); });
+    }
+    // Server unary and client-streaming calls. A response of a call that
+    // fails is not sent.
+    template <typename M> auto Finish(const M &response, const grpc::Status &status)
+    {
+        return CoCall([stream = stream_, &response, status](void *tag) { stream->Finish(response, status, tag); });
+    }
+
+    // Both sides. |message| must outlive the write, as with the async API.
+    template <typename M> auto Read(M *message)
+    {
+        return CoCall([stream = stream_, message](void *tag) { stream->Read(message, tag); });
+    }
+    template <typename M> auto Write(const M &message, grpc::WriteOptions options = grpc::WriteOptions())
+    {
+        return CoCall([stream = stream_, &message, options](void *tag) { stream->Write(message, options, tag); });
+    }
+
+  private:
+    Stream *stream_;
+};
+
+// Wakes a coroutine from any thread. Notify() before Wait() makes the next
+// Wait() return at once, and notifications coalesce. The waiter resumes on
+// its own queue, through an alarm that Notify() cancels. Only one coroutine
+// may wait at a time, and the event must outlive both the wait and any
+// Notify() in progress on another thread.
+class CoEvent
+{
+  public:
+    explicit CoEvent(grpc::CompletionQueue *cq) : cq_(cq)
+    {
+    }
+
+    void Notify()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (waiting_)
+        {
+            waiting_ = false;
+            alarm_.Cancel();
+        }
+        else
+        {
+            notified_ = true;
+        }
+    }
+
+    class Awaiter
+    {
+      public:
+        explicit Awaiter(CoEvent *event) : event_(event)
+        {
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            std::lock_guard<std::mutex> lock(event_->mu_);
+            if (event_->notified_)
+            {
+                event_->notified_ = false;
+                return false;
+            }
+            event_->waiting_ = true;
+            tag_.handle = handle;
+            event_->alarm_.Set(event_->cq_, gpr_inf_future(GPR_CLOCK_MONOTONIC), &tag_);
+            return true;
+        }
+        void await_resume() const noexcept
+        {
+        }
+
+      private:
+        CoEvent *event_;
+        CoTag tag_;
+    };
+
+    Awaiter Wait()
+    {
+        return Awaiter(this);
+    }
+
+  private:
+    grpc::CompletionQueue *cq_;
+    std::mutex mu_;
+    grpc::Alarm alarm_;
+    bool waiting_ = false;
+    bool notified_ = false;
+};
+
+// Resumes the coroutines waiting on |cq| until it is shut down and drained.
+inline void CoDrain(grpc::CompletionQueue *cq)
+{
+    void *tag;
+    bool ok;
+    while (cq->Next(&tag, &ok))
+        static_cast<CoTag *>(tag)->Resume(ok);
+}
+
+#endif // __COMMON_CORO_H__
@@ -0,0 +1,61 @@
+#ifndef __COMMON_DEADLINES_H__
+#define __COMMON_DEADLINES_H__
+
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <grpcpp/grpcpp.h>
+
+// Deadlines of a client's calls, by method. gRPC sends a call's deadline
+// along as grpc-timeout: the handler sees it as its context's deadline, and
+// the call is cancelled on both ends once it passes, which is what lets a
+// server drop work for callers that gave up.
+struct CallDeadlines
+{
+    // For every method of the service, in milliseconds; 0 for none.
+    int default_ms = 0;
+    // Overrides by method name, such as "ListFeatures"; 0 for none.
+    std::map<std::string, int> method_ms;
+
+    // The deadline of calls to |method|, in milliseconds; 0 for none.
+    int For(const std::string &method) const
+    {
+        auto it = method_ms.find(method);
+        return it != method_ms.end() ? it->second : default_ms;
+    }
+
+    // Gives the call to |method| on |context| its deadline, counted from now.
+    // Must come before the call starts.
+    void Apply(const std::string &method, grpc::ClientContext *context) const
+    {
+        int ms = For(method);
+        if (ms > 0)
+            context->set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(ms));
+    }
+};
+
+// "ListFeatures:5000,RouteChat:0" into |deadlines->method_ms|, on top of what
+// is there. False for an entry that isn't a method name and a count of
+// milliseconds.
+inline bool ParseMethodDeadlines(const std::string &list, CallDeadlines *deadlines)
+{
+    std::istringstream entries(list);
+    std::string entry;
+    while (std::getline(entries, entry, ','))
+    {
+        size_t colon = entry.find(':');
+        if (colon == 0 || colon == std::string::npos || colon + 1 == entry.size())
+            return false;
+        char *end = nullptr;
+        long ms = std::strtol(entry.c_str() + colon + 1, &end, 10);
+        if (*end != '\0' || ms < 0)
+            return false;
+        deadlines->method_ms[entry.substr(0, colon)] = static_cast<int>(ms);
+    }
+    return true;
+}
+
+#endif // __COMMON_DEADLINES_H__
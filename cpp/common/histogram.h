@@ -0,0 +1,102 @@
+#ifndef __COMMON_HISTOGRAM_H__
+#define __COMMON_HISTOGRAM_H__
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Latency histogram in the style of HdrHistogram: values below 128 get a bucket
+// each, and every power of two above that is split into 64 linear buckets, so
+// any recorded value is known to within 1/64 (about 1.6%) over the whole
+// 64-bit range. Record() is lock-free and may be called from any thread.
+class LatencyHistogram
+{
+  public:
+    void Record(uint64_t value)
+    {
+        buckets_[IndexOf(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+            ;
+    }
+
+    void Merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < kBuckets; i++)
+        {
+            uint64_t n = other.buckets_[i].load(std::memory_order_relaxed);
+            if (n != 0)
+                buckets_[i].fetch_add(n, std::memory_order_relaxed);
+        }
+        count_.fetch_add(other.count(), std::memory_order_relaxed);
+        uint64_t other_max = other.max();
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (other_max > max && !max_.compare_exchange_weak(max, other_max, std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const
+    {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    // Smallest value v such that at least |percentile| percent of the
+    // recorded values are <= v, reported as the top of its bucket (capped at
+    // the largest value seen). 0 when nothing was recorded.
+    uint64_t Percentile(double percentile) const
+    {
+        uint64_t total = count();
+        if (total == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(total) + 0.5);
+        if (rank < 1)
+            rank = 1;
+        if (rank > total)
+            rank = total;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; i++)
+        {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+            {
+                uint64_t top = i + 1 < kBuckets ? LowestValueOf(i + 1) - 1 : UINT64_MAX;
+                return top < max() ? top : max();
+            }
+        }
+        return max();
+    }
+
+  private:
+    static constexpr int kLinearBits = 7;
+    static constexpr uint64_t kLinear = uint64_t{1} << kLinearBits;
+    static constexpr uint64_t kHalf = kLinear / 2;
+    static constexpr size_t kBuckets = (64 - kLinearBits + 1) * kHalf + kHalf;
+
+    static size_t IndexOf(uint64_t value)
+    {
+        if (value < kLinear)
+            return static_cast<size_t>(value);
+        int shift = (63 - __builtin_clzll(value)) - (kLinearBits - 1);
+        return static_cast<size_t>(shift * kHalf + (value >> shift));
+    }
+
+    static uint64_t LowestValueOf(size_t index)
+    {
+        if (index < kLinear)
+            return index;
+        int shift = static_cast<int>(index / kHalf) - 1;
+        return static_cast<uint64_t>(index - shift * kHalf) << shift;
+    }
+
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+#endif // __COMMON_HISTOGRAM_H__
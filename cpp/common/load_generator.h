@@ -0,0 +1,271 @@
+#ifndef __COMMON_LOAD_GENERATOR_H__
+#define __COMMON_LOAD_GENERATOR_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "common/channel_pool.h"
+#include "common/histogram.h"
+
+struct LoadOptions
+{
+    // Calls started per second across all channels, on a fixed schedule
+    // whatever the server does (open loop). 0 runs a closed loop instead.
+    double qps = 0;
+    // Closed loop: calls kept outstanding, each started when the previous
+    // one in its slot completes.
+    int concurrency = 1;
+    std::chrono::seconds duration{10};
+    // "Name:weight,Name:weight,...". A name without a weight counts 1, and
+    // an empty mix gives every RPC the same weight.
+    std::string rpc_mix;
+    int channels = 1;
+};
+
+// Opens |count| channels to |target| that each get their own connection, so
+// that load spreads over several HTTP/2 connections.
+inline std::vector<std::shared_ptr<grpc::Channel>> CreateLoadChannels(const std::string &target, int count)
+{
+    ChannelPoolOptions options;
+    options.channels = count;
+    return ChannelPool(target, options).channels();
+}
+
+// Drives a client at a configured rate or concurrency for a while and reports
+// throughput and latency percentiles per RPC. Each RPC is a function that
+// starts one call on the given channel and runs |done| once it completes.
+// Latency is measured from the time a call was due to start, so in open loop
+// a server that stalls the client is charged for the calls it delayed.
+class LoadGenerator
+{
+  public:
+    using Done = std::function<void(bool ok)>;
+    using Rpc = std::function<void(int channel, Done done)>;
+
+    void AddRpc(const std::string &name, Rpc rpc)
+    {
+        rpcs_.push_back(std::make_unique<Entry>());
+        rpcs_.back()->name = name;
+        rpcs_.back()->rpc = std::move(rpc);
+    }
+
+    // Runs the load and writes the report to |out|. Returns false, without
+    // sending anything, if the options don't make sense.
+    bool Run(const LoadOptions &options, std::ostream &out)
+    {
+        if (!ParseMix(options.rpc_mix, out))
+            return false;
+        if (options.channels < 1 || (options.qps <= 0 && options.concurrency < 1))
+        {
+            out << "Load needs at least one channel and either --qps or --concurrency." << std::endl;
+            return false;
+        }
+        channels_ = options.channels;
+
+        start_ = std::chrono::steady_clock::now();
+        deadline_ = start_ + options.duration;
+        if (options.qps > 0)
+        {
+            std::chrono::duration<double> interval(1.0 / options.qps);
+            for (uint64_t k = 0;; k++)
+            {
+                std::chrono::steady_clock::time_point due =
+                    start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval * k);
+                if (due >= deadline_)
+                    break;
+                std::this_thread::sleep_until(due);
+                Issue(static_cast<int>(k % channels_), due, nullptr);
+            }
+        }
+        else
+        {
+            for (int slot = 0; slot < options.concurrency; slot++)
+                StartSlot(slot);
+        }
+
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [this] { return outstanding_ == 0; });
+        Report(options, std::chrono::steady_clock::now() - start_, out);
+        return true;
+    }
+
+  private:
+    struct Entry
+    {
+        std::string name;
+        Rpc rpc;
+        double weight = 0;
+        LatencyHistogram latency;
+        std::atomic<uint64_t> errors{0};
+    };
+
+    bool ParseMix(const std::string &mix, std::ostream &out)
+    {
+        for (std::unique_ptr<Entry> &entry : rpcs_)
+            entry->weight = mix.empty() ? 1 : 0;
+        std::istringstream items(mix);
+        std::string item;
+        while (std::getline(items, item, ','))
+        {
+            size_t colon = item.find(':');
+            std::string name = item.substr(0, colon);
+            double weight = colon == std::string::npos ? 1 : std::atof(item.c_str() + colon + 1);
+            Entry *entry = Find(name);
+            if (entry == nullptr || weight < 0)
+            {
+                out << "Bad --rpc_mix entry \"" << item << "\". RPCs:";
+                for (std::unique_ptr<Entry> &e : rpcs_)
+                    out << " " << e->name;
+                out << std::endl;
+                return false;
+            }
+            entry->weight += weight;
+        }
+        cumulative_.clear();
+        double total = 0;
+        for (std::unique_ptr<Entry> &entry : rpcs_)
+            cumulative_.push_back(total += entry->weight);
+        if (total <= 0)
+        {
+            out << "--rpc_mix gives no RPC a weight." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    Entry *Find(const std::string &name)
+    {
+        for (std::unique_ptr<Entry> &entry : rpcs_)
+            if (entry->name == name)
+                return entry.get();
+        return nullptr;
+    }
+
+    Entry *Pick()
+    {
+        thread_local std::mt19937_64 generator(std::random_device{}());
+        std::uniform_real_distribution<double> distribution(0, cumulative_.back());
+        double x = distribution(generator);
+        for (size_t i = 0; i < cumulative_.size(); i++)
+            if (x < cumulative_[i])
+                return rpcs_[i].get();
+        return rpcs_.back().get();
+    }
+
+    // Closed loop: keeps one call outstanding in |slot| until the deadline.
+    // A call may complete before its rpc function returns, e.g. on a stream
+    // that has failed; this loop then starts the next one, rather than the
+    // completion, so that a run of such calls doesn't nest.
+    void StartSlot(int slot)
+    {
+        // Counted as outstanding itself while it may start another call.
+        Acquire();
+        for (std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now(); now < deadline_;
+             now = std::chrono::steady_clock::now())
+        {
+            // Set by whichever of the completion and this loop gets past the
+            // call first; the other one carries on the slot.
+            auto handoff = std::make_shared<std::atomic<bool>>(false);
+            Issue(slot % channels_, now, [this, slot, handoff] {
+                if (handoff->exchange(true))
+                    StartSlot(slot);
+            });
+            if (!handoff->exchange(true))
+                break;
+        }
+        Release();
+    }
+
+    void Acquire()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        outstanding_++;
+    }
+
+    void Release()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (--outstanding_ == 0)
+            cv_.notify_all();
+    }
+
+    void Issue(int channel, std::chrono::steady_clock::time_point due, std::function<void()> then)
+    {
+        Entry *entry = Pick();
+        Acquire();
+        entry->rpc(channel, [this, entry, due, then = std::move(then)](bool ok) {
+            entry->latency.Record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - due).count());
+            if (!ok)
+                entry->errors.fetch_add(1, std::memory_order_relaxed);
+            // Start the follow-up call first, so that the count only reaches
+            // zero once the last slot has stopped.
+            if (then)
+                then();
+            Release();
+        });
+    }
+
+    void Report(const LoadOptions &options, std::chrono::steady_clock::duration elapsed, std::ostream &out)
+    {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        LatencyHistogram all;
+        uint64_t errors = 0;
+        for (std::unique_ptr<Entry> &entry : rpcs_)
+        {
+            all.Merge(entry->latency);
+            errors += entry->errors.load();
+        }
+        out << std::fixed << std::setprecision(3);
+        if (options.qps > 0)
+            out << "Open loop at " << options.qps << " qps";
+        else
+            out << "Closed loop with " << options.concurrency << " outstanding";
+        out << " over " << options.channels << " channel(s) for " << seconds << " s" << std::endl;
+        out << "Calls: " << all.count() << ", errors: " << errors << ", throughput: " << all.count() / seconds
+            << " calls/s" << std::endl;
+        out << std::left << std::setw(16) << "rpc" << std::right << std::setw(10) << "calls" << std::setw(8)
+            << "errors" << std::setw(11) << "p50 ms" << std::setw(11) << "p90 ms" << std::setw(11) << "p99 ms"
+            << std::setw(11) << "p99.9 ms" << std::setw(11) << "max ms" << std::endl;
+        for (std::unique_ptr<Entry> &entry : rpcs_)
+            if (entry->latency.count() != 0)
+                ReportLine(entry->name, entry->latency, entry->errors.load(), out);
+        if (rpcs_.size() > 1)
+            ReportLine("all", all, errors, out);
+    }
+
+    static void ReportLine(const std::string &name, const LatencyHistogram &latency, uint64_t errors,
+                           std::ostream &out)
+    {
+        auto ms = [](uint64_t ns) { return static_cast<double>(ns) / 1e6; };
+        out << std::left << std::setw(16) << name << std::right << std::setw(10) << latency.count() << std::setw(8)
+            << errors << std::setw(11) << ms(latency.Percentile(50)) << std::setw(11) << ms(latency.Percentile(90))
+            << std::setw(11) << ms(latency.Percentile(99)) << std::setw(11) << ms(latency.Percentile(99.9))
+            << std::setw(11) << ms(latency.max()) << std::endl;
+    }
+
+    std::vector<std::unique_ptr<Entry>> rpcs_;
+    std::vector<double> cumulative_;
+    int channels_ = 1;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point deadline_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    uint64_t outstanding_ = 0;
+};
+
+#endif // __COMMON_LOAD_GENERATOR_H__
@@ -0,0 +1,425 @@
+#ifndef __COMMON_LOGGING_H__
+#define __COMMON_LOGGING_H__
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Asynchronous logging for request paths.
+//
+//     LOG(INFO) << "Found feature called " << name;
+//     LOG_EVERY_MS(WARNING, 1000) << "Reload failed";
+//
+// A line is formatted on the calling thread and pushed into that thread's
+// own ring, without taking a lock or flushing anything. One background
+// thread drains every ring: DEBUG and INFO go to stdout, WARNING and ERROR to
+// stderr, and lines of one thread keep their order. When a thread's ring is
+// full the line is dropped and counted rather than stalling the caller. The
+// ring of a thread that exited is freed once its lines are written out.
+//
+// LOG(DEBUG) compiles to nothing unless COMMON_LOG_DEBUG is defined, so debug
+// prints may stay in hot paths. LOG_EVERY_MS logs at most once per |ms| per
+// call site and says how many lines it skipped in between.
+
+enum class LogLevel
+{
+    kDebug = 0,
+    kInfo = 1,
+    kWarning = 2,
+    kError = 3,
+};
+
+constexpr LogLevel kLog_DEBUG = LogLevel::kDebug;
+constexpr LogLevel kLog_INFO = LogLevel::kInfo;
+constexpr LogLevel kLog_WARNING = LogLevel::kWarning;
+constexpr LogLevel kLog_ERROR = LogLevel::kError;
+
+#ifdef COMMON_LOG_DEBUG
+constexpr LogLevel kLogCompiledMin = LogLevel::kDebug;
+#else
+constexpr LogLevel kLogCompiledMin = LogLevel::kInfo;
+#endif
+
+// Single-producer, single-consumer ring of fixed-size slots. A line longer
+// than one slot takes several consecutive ones.
+class LogRing
+{
+  public:
+    static constexpr size_t kSlots = 1024;
+    static constexpr size_t kSlotText = 120;
+    // Longer lines are cut.
+    static constexpr size_t kMaxSlotsPerLine = 32;
+
+    // Producer side. False when the line did not fit; it is counted as
+    // dropped if |last_try|.
+    bool Push(LogLevel level, std::string_view text, bool last_try)
+    {
+        size_t needed = (std::max)(size_t{1}, (text.size() + kSlotText - 1) / kSlotText);
+        if (needed > kMaxSlotsPerLine)
+        {
+            needed = kMaxSlotsPerLine;
+            text = text.substr(0, needed * kSlotText);
+        }
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head + needed - tail_.load(std::memory_order_acquire) > kSlots)
+        {
+            if (last_try)
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        for (size_t i = 0; i < needed; i++)
+        {
+            Slot &slot = slots_[(head + i) % kSlots];
+            std::string_view part = text.substr(i * kSlotText, kSlotText);
+            slot.level = level;
+            slot.more = i + 1 < needed;
+            slot.size = static_cast<uint8_t>(part.size());
+            std::memcpy(slot.text, part.data(), part.size());
+        }
+        head_.store(head + needed, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Appends every complete line to |out| or |err| by level.
+    size_t Drain(std::string *out, std::string *err)
+    {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t head = head_.load(std::memory_order_acquire);
+        size_t lines = 0;
+        for (; tail != head; tail++)
+        {
+            const Slot &slot = slots_[tail % kSlots];
+            std::string *to = slot.level >= LogLevel::kWarning ? err : out;
+            to->append(slot.text, slot.size);
+            if (!slot.more)
+            {
+                to->push_back('\n');
+                lines++;
+            }
+        }
+        tail_.store(tail, std::memory_order_release);
+        return lines;
+    }
+
+    bool empty() const
+    {
+        return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+    }
+
+    uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    // Producer side, once its thread exits: nothing is pushed from then on.
+    void Retire()
+    {
+        retired_.store(true, std::memory_order_release);
+    }
+
+    // Consumer side. True once Retire() was called; every line pushed before
+    // it is visible to the next Drain().
+    bool retired() const
+    {
+        return retired_.load(std::memory_order_acquire);
+    }
+
+  private:
+    struct Slot
+    {
+        LogLevel level;
+        bool more;
+        uint8_t size;
+        char text[kSlotText];
+    };
+
+    std::array<Slot, kSlots> slots_;
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<bool> retired_{false};
+};
+
+class Logger
+{
+  public:
+    static Logger &Get()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    // Lines below |level| are skipped at run time; DEBUG lines also need
+    // COMMON_LOG_DEBUG at compile time.
+    static void SetMinLevel(LogLevel level)
+    {
+        min_level_.store(level, std::memory_order_relaxed);
+    }
+
+    static bool Enabled(LogLevel level)
+    {
+        return level >= min_level_.load(std::memory_order_relaxed);
+    }
+
+    void Write(LogLevel level, std::string_view text)
+    {
+        LogRing *ring = LocalRing();
+        // A full ring gets the drainer a few chances to catch up before the
+        // line is dropped, so a burst isn't lost just because the drainer
+        // was not scheduled.
+        for (int attempt = 0; !ring->Push(level, text, attempt == kFullRetries); attempt++)
+        {
+            if (attempt == kFullRetries)
+                return;
+            Wake();
+            std::this_thread::yield();
+        }
+        Wake();
+    }
+
+    // Blocks until every line logged so far has been written out. For use
+    // before printing around the logger, e.g. to std::cout.
+    void Flush()
+    {
+        while (!Drained())
+        {
+            if (!awake_.exchange(true))
+                awake_.notify_one();
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+  private:
+    static constexpr int kFullRetries = 16;
+
+    Logger() : thread_([this] { Loop(); })
+    {
+    }
+
+    ~Logger()
+    {
+        stop_.store(true);
+        awake_.store(true);
+        awake_.notify_one();
+        thread_.join();
+    }
+
+    // Retires the ring of its thread when the thread exits, so that threads
+    // that come and go don't leave their rings behind.
+    struct RingOwner
+    {
+        LogRing *ring = nullptr;
+        ~RingOwner()
+        {
+            if (ring != nullptr)
+                ring->Retire();
+        }
+    };
+
+    LogRing *LocalRing()
+    {
+        thread_local RingOwner owner;
+        if (owner.ring == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            rings_.push_back(std::make_unique<LogRing>());
+            owner.ring = rings_.back().get();
+        }
+        return owner.ring;
+    }
+
+    void Wake()
+    {
+        // Pairs with the fence in Loop(): either the drainer sees the line
+        // just pushed before it sleeps, or this thread sees it asleep.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!awake_.load(std::memory_order_relaxed) && !awake_.exchange(true))
+            awake_.notify_one();
+    }
+
+    bool Drained()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        for (const std::unique_ptr<LogRing> &ring : rings_)
+        {
+            if (!ring->empty())
+                return false;
+        }
+        return !writing_.load();
+    }
+
+    size_t DrainOnce(std::string *out, std::string *err)
+    {
+        writing_.store(true);
+        size_t lines = 0;
+        uint64_t dropped = 0;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            dropped = retired_dropped_;
+            for (auto it = rings_.begin(); it != rings_.end();)
+            {
+                // Read before draining, so that a retired ring is empty after.
+                bool retired = (*it)->retired();
+                lines += (*it)->Drain(out, err);
+                dropped += (*it)->dropped();
+                if (retired)
+                {
+                    retired_dropped_ += (*it)->dropped();
+                    it = rings_.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+        if (dropped > dropped_reported_)
+        {
+            *err += "[log] " + std::to_string(dropped - dropped_reported_) + " lines dropped\n";
+            dropped_reported_ = dropped;
+        }
+        if (!out->empty())
+        {
+            std::fwrite(out->data(), 1, out->size(), stdout);
+            std::fflush(stdout);
+            out->clear();
+        }
+        if (!err->empty())
+        {
+            std::fwrite(err->data(), 1, err->size(), stderr);
+            std::fflush(stderr);
+            err->clear();
+        }
+        writing_.store(false);
+        return lines;
+    }
+
+    void Loop()
+    {
+        std::string out;
+        std::string err;
+        while (true)
+        {
+            bool stopping = stop_.load();
+            if (DrainOnce(&out, &err) != 0)
+                continue;
+            if (stopping)
+                break;
+            awake_.store(false);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (stop_.load() || DrainOnce(&out, &err) != 0)
+                continue;
+            awake_.wait(false);
+        }
+    }
+
+    static inline std::atomic<LogLevel> min_level_{LogLevel::kDebug};
+
+    std::mutex mu_;
+    std::vector<std::unique_ptr<LogRing>> rings_;
+    // Lines dropped by rings freed since.
+    uint64_t retired_dropped_ = 0;
+    std::atomic<bool> awake_{true};
+    std::atomic<bool> writing_{false};
+    std::atomic<bool> stop_{false};
+    // Only touched by the drain thread.
+    uint64_t dropped_reported_ = 0;
+    std::thread thread_;
+};
+
+// Collects one line and hands it to the logger when destroyed.
+class LogLine
+{
+  public:
+    explicit LogLine(LogLevel level, int64_t skipped = 0) : level_(level), skipped_(skipped)
+    {
+        Buffer().str(std::string());
+    }
+
+    ~LogLine()
+    {
+        std::ostringstream &buffer = Buffer();
+        if (skipped_ > 0)
+            buffer << " (" << skipped_ << " similar lines skipped)";
+        Logger::Get().Write(level_, buffer.view());
+    }
+
+    std::ostream &stream()
+    {
+        return Buffer();
+    }
+
+  private:
+    // Reused by every line of the thread, so logging doesn't allocate once
+    // the buffer has grown.
+    static std::ostringstream &Buffer()
+    {
+        thread_local std::ostringstream buffer;
+        return buffer;
+    }
+
+    LogLevel level_;
+    int64_t skipped_;
+};
+
+// Lets LOG() be an expression of type void on both sides of ?:.
+struct LogVoidify
+{
+    void operator&(std::ostream &)
+    {
+    }
+};
+
+// Lets through one line per interval and counts the rest.
+class LogRateLimiter
+{
+  public:
+    // Lines skipped since the last one let through, or -1 to skip this one.
+    int64_t Take(int64_t interval_ms)
+    {
+        int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+        int64_t next = next_ms_.load(std::memory_order_relaxed);
+        if (now < next || !next_ms_.compare_exchange_strong(next, now + interval_ms, std::memory_order_relaxed))
+        {
+            skipped_.fetch_add(1, std::memory_order_relaxed);
+            return -1;
+        }
+        return skipped_.exchange(0, std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<int64_t> next_ms_{0};
+    std::atomic<int64_t> skipped_{0};
+};
+
+#define LOG_IS_ON(level) (kLog_##level >= kLogCompiledMin && Logger::Enabled(kLog_##level))
+
+#define LOG(level) !LOG_IS_ON(level) ? (void)0 : LogVoidify() & LogLine(kLog_##level).stream()
+
+// One limiter per call site: every expansion is a lambda of its own, with a
+// static of its own.
+#define LOG_RATE_LIMITER()                                                                                             \
+    []() -> LogRateLimiter & {                                                                                         \
+        static LogRateLimiter limiter;                                                                                 \
+        return limiter;                                                                                                \
+    }()
+
+#define LOG_EVERY_MS(level, ms)                                                                                        \
+    for (int64_t log_skipped_ = LOG_IS_ON(level) ? LOG_RATE_LIMITER().Take(ms) : -1; log_skipped_ >= 0;               \
+         log_skipped_ = -1)                                                                                            \
+    LogLine(kLog_##level, log_skipped_).stream()
+
+#endif // __COMMON_LOGGING_H__
@@ -0,0 +1,519 @@
+#ifndef __COMMON_METRICS_H__
+#define __COMMON_METRICS_H__
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <netdb.h>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/server_posix.h>
+#include <grpcpp/support/server_interceptor.h>
+
+#include "common/histogram.h"
+
+// Per-method server metrics collected by a gRPC server interceptor: calls
+// started, handled (by status code) and in flight, call and stream durations,
+// and the messages and bytes moved. Each thread counts into its own shard, so
+// the hot path never shares a cache line with another thread; Render() merges
+// the shards when the metrics are scraped.
+class ServerMetrics
+{
+  public:
+    ServerMetrics() : id_(NextId())
+    {
+    }
+    ServerMetrics(const ServerMetrics &) = delete;
+    ServerMetrics &operator=(const ServerMetrics &) = delete;
+
+    // Counts every call served by |builder|'s server into this object, which
+    // must outlive that server. Replaces any interceptors set before.
+    void Install(grpc::ServerBuilder *builder)
+    {
+        std::vector<std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>> creators;
+        creators.push_back(std::make_unique<Factory>(this));
+        builder->experimental().SetInterceptorCreators(std::move(creators));
+    }
+
+    // The merged metrics in the Prometheus text exposition format.
+    std::string Render() const
+    {
+        std::vector<Method> methods;
+        std::vector<std::unique_ptr<Counters>> merged;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            methods = methods_;
+            for (size_t i = 0; i < methods.size(); i++)
+                merged.push_back(std::make_unique<Counters>());
+            for (const std::unique_ptr<Shard> &shard : shards_)
+            {
+                std::lock_guard<std::mutex> shard_lock(shard->mu);
+                for (const std::pair<size_t, std::unique_ptr<Counters>> &entry : shard->counters)
+                    merged[entry.first]->Add(*entry.second);
+            }
+        }
+
+        std::ostringstream out;
+        Family(out, "grpc_server_started_total", "counter", "RPCs started on the server.");
+        for (size_t i = 0; i < methods.size(); i++)
+            Sample(out, "grpc_server_started_total", methods[i], "", Load(merged[i]->started));
+        Family(out, "grpc_server_handled_total", "counter", "RPCs completed on the server, by status code.");
+        for (size_t i = 0; i < methods.size(); i++)
+        {
+            for (size_t code = 0; code < kCodes; code++)
+            {
+                uint64_t handled = Load(merged[i]->handled[code]);
+                if (handled != 0)
+                    Sample(out, "grpc_server_handled_total", methods[i],
+                           std::string(",grpc_code=\"") + kCodeNames[code] + "\"", handled);
+            }
+        }
+        Family(out, "grpc_server_in_flight", "gauge", "RPCs started and not yet completed.");
+        for (size_t i = 0; i < methods.size(); i++)
+        {
+            uint64_t handled = 0;
+            for (const std::atomic<uint64_t> &count : merged[i]->handled)
+                handled += Load(count);
+            // Shards are read one after the other, so a call may be seen
+            // ending without being seen starting.
+            uint64_t started = Load(merged[i]->started);
+            Sample(out, "grpc_server_in_flight", methods[i], "", started > handled ? started - handled : 0);
+        }
+        Family(out, "grpc_server_msg_received_total", "counter", "Messages received from clients.");
+        for (size_t i = 0; i < methods.size(); i++)
+            Sample(out, "grpc_server_msg_received_total", methods[i], "", Load(merged[i]->messages_received));
+        Family(out, "grpc_server_msg_sent_total", "counter", "Messages sent to clients.");
+        for (size_t i = 0; i < methods.size(); i++)
+            Sample(out, "grpc_server_msg_sent_total", methods[i], "", Load(merged[i]->messages_sent));
+        Family(out, "grpc_server_sent_message_bytes", "summary", "Serialized size of the messages sent.");
+        for (size_t i = 0; i < methods.size(); i++)
+            Summary(out, "grpc_server_sent_message_bytes", methods[i], merged[i]->sent_message_bytes,
+                    static_cast<double>(Load(merged[i]->bytes_sent)), 1.0);
+        Family(out, "grpc_server_handling_seconds", "summary", "Duration of unary RPCs.");
+        for (size_t i = 0; i < methods.size(); i++)
+            if (!methods[i].streaming)
+                Summary(out, "grpc_server_handling_seconds", methods[i], merged[i]->duration_us,
+                        Load(merged[i]->duration_us_sum) / 1e6, 1e-6);
+        Family(out, "grpc_server_stream_duration_seconds", "summary", "Duration of streaming RPCs.");
+        for (size_t i = 0; i < methods.size(); i++)
+            if (methods[i].streaming)
+                Summary(out, "grpc_server_stream_duration_seconds", methods[i], merged[i]->duration_us,
+                        Load(merged[i]->duration_us_sum) / 1e6, 1e-6);
+        return out.str();
+    }
+
+  private:
+    static constexpr size_t kCodes = 17;
+    static constexpr const char *kCodeNames[kCodes] = {
+        "OK",           "CANCELLED",         "UNKNOWN",          "INVALID_ARGUMENT", "DEADLINE_EXCEEDED",
+        "NOT_FOUND",    "ALREADY_EXISTS",    "PERMISSION_DENIED", "RESOURCE_EXHAUSTED", "FAILED_PRECONDITION",
+        "ABORTED",      "OUT_OF_RANGE",      "UNIMPLEMENTED",    "INTERNAL",         "UNAVAILABLE",
+        "DATA_LOSS",    "UNAUTHENTICATED"};
+
+    struct Method
+    {
+        std::string service;
+        std::string name;
+        const char *type;
+        bool streaming;
+    };
+
+    // One method's counts on one thread. Atomic so that Render() can read
+    // them while they grow; a call that moves between threads keeps counting
+    // into the shard of the thread it started on.
+    struct Counters
+    {
+        std::atomic<uint64_t> started{0};
+        std::array<std::atomic<uint64_t>, kCodes> handled{};
+        std::atomic<uint64_t> messages_received{0};
+        std::atomic<uint64_t> messages_sent{0};
+        std::atomic<uint64_t> bytes_sent{0};
+        std::atomic<uint64_t> duration_us_sum{0};
+        LatencyHistogram duration_us;
+        LatencyHistogram sent_message_bytes;
+
+        void Add(const Counters &other)
+        {
+            started.fetch_add(Load(other.started), std::memory_order_relaxed);
+            for (size_t code = 0; code < kCodes; code++)
+                handled[code].fetch_add(Load(other.handled[code]), std::memory_order_relaxed);
+            messages_received.fetch_add(Load(other.messages_received), std::memory_order_relaxed);
+            messages_sent.fetch_add(Load(other.messages_sent), std::memory_order_relaxed);
+            bytes_sent.fetch_add(Load(other.bytes_sent), std::memory_order_relaxed);
+            duration_us_sum.fetch_add(Load(other.duration_us_sum), std::memory_order_relaxed);
+            duration_us.Merge(other.duration_us);
+            sent_message_bytes.Merge(other.sent_message_bytes);
+        }
+    };
+
+    struct Shard
+    {
+        // Held while |counters| grows and while Render() reads it.
+        std::mutex mu;
+        std::vector<std::pair<size_t, std::unique_ptr<Counters>>> counters;
+        // Only touched by the shard's own thread. Keyed by the method name
+        // pointer, which gRPC keeps stable for a registered method.
+        std::unordered_map<const char *, Counters *> by_method;
+    };
+
+    class Interceptor : public grpc::experimental::Interceptor
+    {
+      public:
+        explicit Interceptor(Counters *counters) : counters_(counters), start_(std::chrono::steady_clock::now())
+        {
+            counters_->started.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ~Interceptor() override
+        {
+            uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                                 start_)
+                              .count();
+            counters_->duration_us.Record(us);
+            counters_->duration_us_sum.fetch_add(us, std::memory_order_relaxed);
+            counters_->handled[code_].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void Intercept(grpc::experimental::InterceptorBatchMethods *methods) override
+        {
+            using grpc::experimental::InterceptionHookPoints;
+            if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::PRE_SEND_MESSAGE))
+            {
+                const grpc::ByteBuffer *message = methods->GetSerializedSendMessage();
+                size_t bytes = message != nullptr ? message->Length() : 0;
+                counters_->messages_sent.fetch_add(1, std::memory_order_relaxed);
+                counters_->bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+                counters_->sent_message_bytes.Record(bytes);
+            }
+            if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::PRE_SEND_STATUS))
+            {
+                size_t code = static_cast<size_t>(methods->GetSendStatus().error_code());
+                code_ = code < kCodes ? code : static_cast<size_t>(grpc::StatusCode::UNKNOWN);
+            }
+            // A null message marks the end of the client's stream.
+            if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::POST_RECV_MESSAGE) &&
+                methods->GetRecvMessage() != nullptr)
+            {
+                counters_->messages_received.fetch_add(1, std::memory_order_relaxed);
+            }
+            methods->Proceed();
+        }
+
+      private:
+        Counters *counters_;
+        std::chrono::steady_clock::time_point start_;
+        // Calls that end without sending a status were cancelled.
+        size_t code_ = static_cast<size_t>(grpc::StatusCode::CANCELLED);
+    };
+
+    class Factory : public grpc::experimental::ServerInterceptorFactoryInterface
+    {
+      public:
+        explicit Factory(ServerMetrics *metrics) : metrics_(metrics)
+        {
+        }
+
+        grpc::experimental::Interceptor *CreateServerInterceptor(grpc::experimental::ServerRpcInfo *info) override
+        {
+            return new Interceptor(metrics_->CountersFor(info->method(), info->type()));
+        }
+
+      private:
+        ServerMetrics *metrics_;
+    };
+
+    static uint64_t NextId()
+    {
+        static std::atomic<uint64_t> next{0};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static uint64_t Load(const std::atomic<uint64_t> &value)
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+
+    Counters *CountersFor(const char *method, grpc::experimental::ServerRpcInfo::Type type)
+    {
+        if (method == nullptr)
+            method = "";
+        Shard *shard = LocalShard();
+        auto found = shard->by_method.find(method);
+        if (found != shard->by_method.end())
+            return found->second;
+        size_t index = MethodIndex(method, type);
+        std::lock_guard<std::mutex> lock(shard->mu);
+        shard->counters.emplace_back(index, std::make_unique<Counters>());
+        Counters *counters = shard->counters.back().second.get();
+        shard->by_method.emplace(method, counters);
+        return counters;
+    }
+
+    // This thread's shard, created on first use. Shards outlive their
+    // threads so that nothing counted is lost.
+    Shard *LocalShard()
+    {
+        thread_local std::vector<std::pair<uint64_t, Shard *>> local;
+        for (const std::pair<uint64_t, Shard *> &entry : local)
+        {
+            if (entry.first == id_)
+                return entry.second;
+        }
+        std::lock_guard<std::mutex> lock(mu_);
+        shards_.push_back(std::make_unique<Shard>());
+        local.emplace_back(id_, shards_.back().get());
+        return shards_.back().get();
+    }
+
+    size_t MethodIndex(const std::string &method, grpc::experimental::ServerRpcInfo::Type type)
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto found = method_index_.find(method);
+        if (found != method_index_.end())
+            return found->second;
+        // gRPC names methods "/package.Service/Method".
+        size_t slash = method.rfind('/');
+        size_t start = !method.empty() && method[0] == '/' ? 1 : 0;
+        Method entry;
+        entry.service = slash == std::string::npos || slash < start ? "" : method.substr(start, slash - start);
+        entry.name = slash == std::string::npos ? method : method.substr(slash + 1);
+        switch (type)
+        {
+        case grpc::experimental::ServerRpcInfo::Type::UNARY:
+            entry.type = "unary";
+            break;
+        case grpc::experimental::ServerRpcInfo::Type::CLIENT_STREAMING:
+            entry.type = "client_stream";
+            break;
+        case grpc::experimental::ServerRpcInfo::Type::SERVER_STREAMING:
+            entry.type = "server_stream";
+            break;
+        default:
+            entry.type = "bidi_stream";
+            break;
+        }
+        entry.streaming = type != grpc::experimental::ServerRpcInfo::Type::UNARY;
+        methods_.push_back(std::move(entry));
+        method_index_.emplace(method, methods_.size() - 1);
+        return methods_.size() - 1;
+    }
+
+    static void Family(std::ostream &out, const char *name, const char *type, const char *help)
+    {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+    }
+
+    static void Labels(std::ostream &out, const Method &method, const std::string &extra)
+    {
+        out << "{grpc_service=\"" << method.service << "\",grpc_method=\"" << method.name << "\",grpc_type=\""
+            << method.type << "\"" << extra << "}";
+    }
+
+    template <typename T>
+    static void Sample(std::ostream &out, const char *name, const Method &method, const std::string &extra, T value)
+    {
+        out << name;
+        Labels(out, method, extra);
+        out << " " << value << "\n";
+    }
+
+    // Quantiles of |histogram| scaled by |unit|, with |sum| already scaled.
+    static void Summary(std::ostream &out, const char *name, const Method &method, const LatencyHistogram &histogram,
+                        double sum, double unit)
+    {
+        static constexpr std::pair<const char *, double> kQuantiles[] = {
+            {"0.5", 50}, {"0.9", 90}, {"0.99", 99}, {"0.999", 99.9}};
+        for (const std::pair<const char *, double> &quantile : kQuantiles)
+            Sample(out, name, method, std::string(",quantile=\"") + quantile.first + "\"",
+                   static_cast<double>(histogram.Percentile(quantile.second)) * unit);
+        Sample(out, (std::string(name) + "_sum").c_str(), method, "", sum);
+        Sample(out, (std::string(name) + "_count").c_str(), method, "", histogram.count());
+    }
+
+    const uint64_t id_;
+    mutable std::mutex mu_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::vector<Method> methods_;
+    std::unordered_map<std::string, size_t> method_index_;
+};
+
+// Answers "GET /metrics" on |address| ("host:port") with |metrics| rendered
+// for Prometheus, on a thread of its own and one request per connection.
+// Other paths get a 404. Connections that open with the HTTP/2 preface, from
+// gRPC clients, are handed to |grpc_server| if there is one: a server started
+// without ports of its own, for the services that belong on the maintenance
+// port rather than the public one. With |reuse_port|, as ServerOptions::reuse_port
+// sets it for the workers of a supervisor, a worker restarted by the
+// supervisor can listen before the one it replaces has gone; without it
+// another process on the address is an error. The server keeps running
+// without /metrics, after saying why, when the address cannot be bound.
+class MetricsHttpServer
+{
+  public:
+    MetricsHttpServer(const std::string &address, const ServerMetrics *metrics, bool reuse_port = false,
+                      grpc::Server *grpc_server = nullptr)
+        : metrics_(metrics), grpc_server_(grpc_server)
+    {
+        std::string error;
+        fd_ = Listen(address, reuse_port, &error);
+        if (fd_ < 0)
+        {
+            std::cerr << "Metrics not served: cannot listen on " << address << ": " << error << std::endl;
+            return;
+        }
+        std::cout << "Metrics served on http://" << address << "/metrics" << std::endl;
+        thread_ = std::thread([this] { Loop(); });
+    }
+
+    ~MetricsHttpServer()
+    {
+        stop_.store(true, std::memory_order_relaxed);
+        if (thread_.joinable())
+            thread_.join();
+        if (fd_ >= 0)
+            close(fd_);
+    }
+
+    MetricsHttpServer(const MetricsHttpServer &) = delete;
+    MetricsHttpServer &operator=(const MetricsHttpServer &) = delete;
+
+  private:
+    // The listening socket, or -1 with |error| saying why.
+    static int Listen(const std::string &address, bool reuse_port, std::string *error)
+    {
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos)
+        {
+            *error = "no port";
+            return -1;
+        }
+        std::string host = address.substr(0, colon);
+        std::string port = address.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo *results = nullptr;
+        int resolved = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &results);
+        if (resolved != 0)
+        {
+            *error = gai_strerror(resolved);
+            return -1;
+        }
+        int fd = -1;
+        for (addrinfo *ai = results; ai != nullptr && fd < 0; ai = ai->ai_next)
+        {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0)
+            {
+                *error = strerror(errno);
+                continue;
+            }
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (reuse_port)
+                setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 16) != 0)
+            {
+                *error = strerror(errno);
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(results);
+        return fd;
+    }
+
+    void Loop()
+    {
+        while (!stop_.load(std::memory_order_relaxed))
+        {
+            // Wakes up now and then to notice |stop_|.
+            pollfd pfd{fd_, POLLIN, 0};
+            if (poll(&pfd, 1, 200) <= 0)
+                continue;
+            int client = accept(fd_, nullptr, nullptr);
+            if (client < 0)
+                continue;
+            timeval timeout{1, 0};
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            if (grpc_server_ != nullptr && IsHttp2(client))
+            {
+                // gRPC takes the socket over, non-blocking, and closes it.
+                fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+                grpc::AddInsecureChannelFromFd(grpc_server_, client);
+                continue;
+            }
+            Serve(client);
+            close(client);
+        }
+    }
+
+    // Whether |client| starts with the HTTP/2 preface; peeks, so that
+    // whoever serves it still reads the request from the start.
+    static bool IsHttp2(int client)
+    {
+        constexpr char kPreface[] = "PRI * HTTP/2.0";
+        char start[sizeof(kPreface) - 1];
+        ssize_t n = recv(client, start, sizeof(start), MSG_PEEK | MSG_WAITALL);
+        return n == static_cast<ssize_t>(sizeof(start)) && memcmp(start, kPreface, sizeof(start)) == 0;
+    }
+
+    void Serve(int client)
+    {
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+        {
+            ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+            if (n <= 0)
+                return;
+            request.append(buffer, static_cast<size_t>(n));
+        }
+        std::string status = "200 OK";
+        std::string body;
+        if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET /metrics?", 0) == 0)
+            body = metrics_->Render();
+        else
+        {
+            status = "404 Not Found";
+            body = "Only /metrics is served here.\n";
+        }
+        std::string response = "HTTP/1.1 " + status +
+                               "\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\nContent-Length: " +
+                               std::to_string(body.size()) + "\r\n\r\n" + body;
+        for (size_t sent = 0; sent < response.size();)
+        {
+            ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                return;
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    const ServerMetrics *metrics_;
+    grpc::Server *const grpc_server_;
+    int fd_ = -1;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+#endif // __COMMON_METRICS_H__
@@ -0,0 +1,124 @@
+#ifndef __COMMON_SERVER_OPTIONS_H__
+#define __COMMON_SERVER_OPTIONS_H__
+
+#include <cstddef>
+#include <cstdint>
+
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/resource_quota.h>
+
+// Resource and transport settings of a server, applied to its ServerBuilder
+// before BuildAndStart(). Fields left at zero (or -1 where noted) keep gRPC's
+// defaults, so a server only changes what a deployment asks for.
+struct ServerOptions
+{
+    // Threads the server may use for synchronous handlers and pollers, and
+    // memory it may use for buffers, in MiB. Both go into one ResourceQuota.
+    int max_threads = 0;
+    int memory_quota_mb = 0;
+
+    // Synchronous servers only: completion queues, and the pollers kept
+    // on each. Callback and async servers ignore them.
+    int sync_cqs = 0;
+    int min_pollers = 0;
+    int max_pollers = 0;
+
+    // Streams a single client connection may have open at once.
+    int max_concurrent_streams = 0;
+
+    // Limits on one message, in bytes; -1 lifts the limit. gRPC's defaults
+    // are 4 MiB received and no limit sent.
+    int max_recv_message_bytes = 0;
+    int max_send_message_bytes = 0;
+
+    // Initial HTTP/2 stream window the server advertises, in bytes. With the
+    // BDP probe on (-1 keeps gRPC's default, which is on) windows then grow
+    // with the measured bandwidth-delay product; 0 keeps them where they are.
+    int stream_window_bytes = 0;
+    int bdp_probe = -1;
+
+    // Server keepalive pings, and how often clients may ping it.
+    int keepalive_time_ms = 0;
+    int keepalive_timeout_ms = 0;
+    bool keepalive_permit_without_calls = false;
+    int min_ping_interval_ms = 0;
+
+    // Connections idle or older than this are closed with a GOAWAY. An age
+    // limit makes long-lived clients reconnect, and so rebalance, after
+    // servers are added.
+    int max_connection_idle_ms = 0;
+    int max_connection_age_ms = 0;
+
+    // Compression algorithms the server takes on requests and advertises,
+    // one bit per grpc_compression_algorithm; 0 keeps them all. What the
+    // server compresses its responses with is up to each call.
+    uint32_t compression_algorithms = 0;
+
+    // Lets other processes listen on the same port, as the workers of a
+    // supervisor do; the kernel spreads new connections across them.
+    bool reuse_port = false;
+
+    // Graceful shutdown (see common/shutdown.h), not builder settings: how
+    // long the server reports NOT_SERVING before it stops taking calls, and
+    // how long the calls in flight then get to finish.
+    int drain_grace_ms = 0;
+    int drain_timeout_ms = 10000;
+
+    void Apply(grpc::ServerBuilder *builder) const
+    {
+        if (max_threads > 0 || memory_quota_mb > 0)
+        {
+            grpc::ResourceQuota quota("server");
+            if (max_threads > 0)
+                quota.SetMaxThreads(max_threads);
+            if (memory_quota_mb > 0)
+                quota.Resize(static_cast<size_t>(memory_quota_mb) << 20);
+            builder->SetResourceQuota(quota);
+        }
+
+        if (sync_cqs > 0)
+            builder->SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::NUM_CQS, sync_cqs);
+        if (min_pollers > 0)
+            builder->SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MIN_POLLERS, min_pollers);
+        if (max_pollers > 0)
+            builder->SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MAX_POLLERS, max_pollers);
+
+        if (max_concurrent_streams > 0)
+            builder->AddChannelArgument(GRPC_ARG_MAX_CONCURRENT_STREAMS, max_concurrent_streams);
+        if (max_recv_message_bytes != 0)
+            builder->SetMaxReceiveMessageSize(max_recv_message_bytes < 0 ? -1 : max_recv_message_bytes);
+        if (max_send_message_bytes != 0)
+            builder->SetMaxSendMessageSize(max_send_message_bytes < 0 ? -1 : max_send_message_bytes);
+
+        if (stream_window_bytes > 0)
+            builder->AddChannelArgument(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, stream_window_bytes);
+        if (bdp_probe >= 0)
+            builder->AddChannelArgument(GRPC_ARG_HTTP2_BDP_PROBE, bdp_probe > 0 ? 1 : 0);
+
+        if (keepalive_time_ms > 0)
+            builder->AddChannelArgument(GRPC_ARG_KEEPALIVE_TIME_MS, keepalive_time_ms);
+        if (keepalive_timeout_ms > 0)
+            builder->AddChannelArgument(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, keepalive_timeout_ms);
+        if (keepalive_permit_without_calls)
+            builder->AddChannelArgument(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+        if (min_ping_interval_ms > 0)
+            builder->AddChannelArgument(GRPC_ARG_HTTP2_MIN_RECV_PING_INTERVAL_WITHOUT_DATA_MS, min_ping_interval_ms);
+
+        if (max_connection_idle_ms > 0)
+            builder->AddChannelArgument(GRPC_ARG_MAX_CONNECTION_IDLE_MS, max_connection_idle_ms);
+        if (max_connection_age_ms > 0)
+            builder->AddChannelArgument(GRPC_ARG_MAX_CONNECTION_AGE_MS, max_connection_age_ms);
+
+        if (reuse_port)
+            builder->AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT, 1);
+
+        if (compression_algorithms != 0)
+        {
+            for (int i = GRPC_COMPRESS_NONE + 1; i < GRPC_COMPRESS_ALGORITHMS_COUNT; i++)
+                builder->SetCompressionAlgorithmSupportStatus(static_cast<grpc_compression_algorithm>(i),
+                                                              (compression_algorithms >> i) & 1);
+        }
+    }
+};
+
+#endif // __COMMON_SERVER_OPTIONS_H__
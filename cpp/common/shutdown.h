@@ -0,0 +1,159 @@
+#ifndef __COMMON_SHUTDOWN_H__
+#define __COMMON_SHUTDOWN_H__
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/health_check_service_interface.h>
+
+#include "common/server_options.h"
+
+// Graceful shutdown of a server on SIGTERM or SIGINT, so that a rolling
+// deploy doesn't cut calls off halfway:
+//
+// 1. The health service reports NOT_SERVING for |drain_grace_ms|, long enough
+//    for load balancers and clients that watch it to move new calls away.
+// 2. Server::Shutdown() stops taking calls and gives the ones in flight
+//    |drain_timeout_ms| to finish; those still running then are cancelled.
+// 3. The caller shuts down and drains its completion queues, if it has any.
+//
+// A second signal during the drain exits at once.
+class ShutdownSignal
+{
+  public:
+    // Catches SIGTERM and SIGINT from here on. Safe to call more than once.
+    static void Install()
+    {
+        int *fds = Pipe();
+        if (fds[0] >= 0 || pipe2(fds, O_CLOEXEC) != 0)
+            return;
+        struct sigaction action = {};
+        action.sa_handler = &OnSignal;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGTERM, &action, nullptr);
+        sigaction(SIGINT, &action, nullptr);
+    }
+
+    // Waits up to |timeout_ms|, or for as long as it takes if negative, for
+    // one of the signals. True once one has arrived, including before the
+    // call, so every later call returns true at once.
+    static bool Wait(int timeout_ms = -1)
+    {
+        Install();
+        pollfd pfd{Pipe()[0], POLLIN, 0};
+        int ready;
+        while ((ready = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+        {
+        }
+        return ready > 0;
+    }
+
+    // The signal that arrived, 0 before one has.
+    static int Received()
+    {
+        return Signal();
+    }
+
+  private:
+    static int *Pipe()
+    {
+        static int fds[2] = {-1, -1};
+        return fds;
+    }
+
+    static volatile sig_atomic_t &Signal()
+    {
+        static volatile sig_atomic_t signal = 0;
+        return signal;
+    }
+
+    // Only async-signal-safe calls in here. The byte stays in the pipe, so
+    // that every Wait() from then on sees it.
+    static void OnSignal(int signal)
+    {
+        if (Signal() != 0)
+            _exit(128 + signal);
+        Signal() = signal;
+        int saved = errno;
+        char byte = 1;
+        [[maybe_unused]] ssize_t written = write(Pipe()[1], &byte, 1);
+        errno = saved;
+    }
+};
+
+// Steps 1 and 2 on |server| once a signal arrives. When it returns no call is
+// left running and the server's completion queues may be shut down.
+inline void DrainOnSignal(grpc::Server *server, const ServerOptions &options)
+{
+    ShutdownSignal::Wait();
+    std::cout << "Draining on signal " << ShutdownSignal::Received() << std::endl;
+    if (grpc::HealthCheckServiceInterface *health = server->GetHealthCheckService())
+        health->SetServingStatus(false);
+    if (options.drain_grace_ms > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.drain_grace_ms));
+    server->Shutdown(std::chrono::system_clock::now() + std::chrono::milliseconds(options.drain_timeout_ms));
+    std::cout << "Server stopped" << std::endl;
+}
+
+// Calls an async server has taken and not finished yet, for step 3. Calls
+// Shutdown() cancelled can still have an operation to start, and nothing may
+// start one on a queue that is shutting down, so such a server waits for
+// none to be left before it shuts its queues down.
+class InFlightCalls
+{
+  public:
+    // Counts a call for as long as it lives.
+    class Scope
+    {
+      public:
+        explicit Scope(InFlightCalls *calls) : calls_(calls)
+        {
+            std::lock_guard<std::mutex> lock(calls_->mu_);
+            calls_->count_++;
+        }
+        ~Scope()
+        {
+            std::lock_guard<std::mutex> lock(calls_->mu_);
+            if (--calls_->count_ == 0)
+                calls_->idle_.notify_all();
+        }
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+      private:
+        InFlightCalls *calls_;
+    };
+
+    // Call once Server::Shutdown() has returned.
+    void WaitForNone()
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+        stopped_ = true;
+        idle_.wait(lock, [this] { return count_ == 0; });
+    }
+
+    // True once the server is shut down. Every call still counted then has
+    // been cancelled, so a handler that has yet to do its work can skip it.
+    bool stopped()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        return stopped_;
+    }
+
+  private:
+    std::mutex mu_;
+    std::condition_variable idle_;
+    int count_ = 0;
+    bool stopped_ = false;
+};
+
+#endif // __COMMON_SHUTDOWN_H__
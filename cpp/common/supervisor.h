@@ -0,0 +1,360 @@
+#ifndef __COMMON_SUPERVISOR_H__
+#define __COMMON_SUPERVISOR_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <poll.h>
+#include <sched.h>
+#include <set>
+#include <signal.h>
+#include <string>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Supervisor mode of a server: worker processes that all listen on the same
+// port through SO_REUSEPORT, so the kernel spreads connections across them,
+// and a parent that keeps them running.
+//
+// - A worker that dies is restarted after |restart_delay_ms|.
+// - SIGHUP restarts the workers one at a time: each replacement starts and
+//   reports ready before the worker it replaces gets SIGTERM, so the port
+//   never loses a listener.
+// - SIGTERM or SIGINT passes SIGTERM on to the workers and waits for them; a
+//   second one kills them.
+//
+// The workers are forked before the server builds anything, gRPC included,
+// so each starts from a clean process.
+struct SupervisorOptions
+{
+    int processes = 1;
+
+    // Pins worker i to the CPUs of NUMA node i % nodes, so that its threads
+    // and the memory they first touch stay on one node.
+    bool numa = false;
+
+    int restart_delay_ms = 1000;
+
+    // How long a restart waits for a new worker to report ready before it
+    // gives up and keeps the old one.
+    int ready_timeout_ms = 10000;
+};
+
+// "0-3,8-11" as {0, 1, 2, 3, 8, 9, 10, 11}, the format of the node and CPU
+// lists in sysfs.
+inline std::vector<int> ParseCpuList(const std::string &list)
+{
+    std::vector<int> ids;
+    size_t start = 0;
+    while (start < list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        int first = 0;
+        int last = 0;
+        int fields = std::sscanf(list.substr(start, end - start).c_str(), "%d-%d", &first, &last);
+        if (fields == 1)
+            last = first;
+        for (int id = first; fields >= 1 && id <= last; id++)
+            ids.push_back(id);
+        start = end + 1;
+    }
+    return ids;
+}
+
+// The CPUs of each online NUMA node that has any. Empty where sysfs doesn't
+// say.
+inline std::vector<cpu_set_t> NumaNodeCpus()
+{
+    std::vector<cpu_set_t> nodes;
+    std::string online;
+    std::ifstream online_file("/sys/devices/system/node/online");
+    if (!std::getline(online_file, online))
+        return nodes;
+    for (int node : ParseCpuList(online))
+    {
+        std::string cpus;
+        std::ifstream cpus_file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!std::getline(cpus_file, cpus))
+            continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : ParseCpuList(cpus))
+        {
+            if (cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        }
+        if (CPU_COUNT(&set) > 0)
+            nodes.push_back(set);
+    }
+    return nodes;
+}
+
+// |address| with its port moved up by |offset|, so that each worker serves
+// its own maintenance port. Addresses without a port, or with port 0, are
+// left alone.
+inline std::string WorkerAddress(const std::string &address, int offset)
+{
+    size_t colon = address.rfind(':');
+    if (offset == 0 || colon == std::string::npos)
+        return address;
+    int port = std::atoi(address.c_str() + colon + 1);
+    if (port <= 0)
+        return address;
+    return address.substr(0, colon + 1) + std::to_string(port + offset);
+}
+
+// The socket a worker reports ready on; -1 outside a supervisor.
+inline int &WorkerReadyFd()
+{
+    static int fd = -1;
+    return fd;
+}
+
+// Tells the supervisor, if any, that this worker is serving. Servers call it
+// once their port is open.
+inline void NotifyWorkerReady()
+{
+    int &fd = WorkerReadyFd();
+    if (fd < 0)
+        return;
+    char ready = 1;
+    send(fd, &ready, 1, MSG_NOSIGNAL);
+    close(fd);
+    fd = -1;
+}
+
+class Supervisor
+{
+  public:
+    // |worker| serves with the given worker index, 0 to processes - 1.
+    Supervisor(const SupervisorOptions &options, std::function<void(int)> worker)
+        : options_(options), worker_(std::move(worker)), workers_((std::max)(options.processes, 1))
+    {
+        if (options_.numa)
+            nodes_ = NumaNodeCpus();
+    }
+
+    // Runs until stopped and returns the supervisor's exit code. Never
+    // returns in a worker.
+    int Run()
+    {
+        sigemptyset(&signals_);
+        sigaddset(&signals_, SIGCHLD);
+        sigaddset(&signals_, SIGHUP);
+        sigaddset(&signals_, SIGINT);
+        sigaddset(&signals_, SIGTERM);
+        sigprocmask(SIG_BLOCK, &signals_, &old_mask_);
+
+        for (size_t i = 0; i < workers_.size(); i++)
+            workers_[i].pid = Spawn(static_cast<int>(i), nullptr);
+        std::cout << "Supervisor " << getpid() << " running " << workers_.size() << " workers" << std::endl;
+
+        while (true)
+        {
+            siginfo_t info;
+            int signal = NextRestart() ? WaitFor(*NextRestart(), &info) : sigwaitinfo(&signals_, &info);
+            if (signal == SIGCHLD)
+            {
+                Reap();
+            }
+            else if (signal == SIGHUP)
+            {
+                RestartAll();
+            }
+            else if (signal == SIGINT || signal == SIGTERM)
+            {
+                Stop();
+                return 0;
+            }
+            RestartDue();
+        }
+    }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Worker
+    {
+        pid_t pid = -1;
+        // When a dead worker is due to be started again.
+        Clock::time_point restart_at;
+    };
+
+    // Forks worker |index|. With |ready| set, it gets the supervisor's end of
+    // the socket the worker reports ready on.
+    pid_t Spawn(int index, int *ready)
+    {
+        int fds[2] = {-1, -1};
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+            return -1;
+        // Or the worker writes out what is still buffered a second time.
+        std::cout.flush();
+        std::cerr.flush();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            sigprocmask(SIG_SETMASK, &old_mask_, nullptr);
+            // A worker must not outlive its supervisor.
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            if (!nodes_.empty())
+            {
+                const cpu_set_t &node = nodes_[index % nodes_.size()];
+                sched_setaffinity(0, sizeof(node), &node);
+            }
+            WorkerReadyFd() = fds[1];
+            worker_(index);
+            _exit(0);
+        }
+        close(fds[1]);
+        if (pid < 0)
+        {
+            std::cerr << "Cannot fork worker " << index << std::endl;
+            close(fds[0]);
+            return -1;
+        }
+        if (ready)
+            *ready = fds[0];
+        else
+            close(fds[0]);
+        return pid;
+    }
+
+    // True once the worker on the other end of |fd| reports ready, false if
+    // it dies or takes longer than the ready timeout.
+    bool WaitReady(int fd)
+    {
+        pollfd pfd{fd, POLLIN, 0};
+        char ready = 0;
+        bool ok = poll(&pfd, 1, options_.ready_timeout_ms) == 1 && recv(fd, &ready, 1, 0) == 1;
+        close(fd);
+        return ok;
+    }
+
+    int WaitFor(Clock::time_point deadline, siginfo_t *info)
+    {
+        auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - Clock::now());
+        if (wait.count() <= 0)
+            return 0;
+        timespec timeout{static_cast<time_t>(wait.count() / 1000000000), static_cast<long>(wait.count() % 1000000000)};
+        return sigtimedwait(&signals_, info, &timeout);
+    }
+
+    const Clock::time_point *NextRestart() const
+    {
+        const Clock::time_point *next = nullptr;
+        for (const Worker &w : workers_)
+        {
+            if (w.pid < 0 && (next == nullptr || w.restart_at < *next))
+                next = &w.restart_at;
+        }
+        return next;
+    }
+
+    void Reap()
+    {
+        int status = 0;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            if (retiring_.erase(pid) != 0)
+                continue;
+            for (size_t i = 0; i < workers_.size(); i++)
+            {
+                if (workers_[i].pid != pid)
+                    continue;
+                if (WIFSIGNALED(status))
+                    std::cerr << "Worker " << i << " (" << pid << ") killed by signal " << WTERMSIG(status);
+                else
+                    std::cerr << "Worker " << i << " (" << pid << ") exited with " << WEXITSTATUS(status);
+                std::cerr << ", restarting in " << options_.restart_delay_ms << " ms" << std::endl;
+                workers_[i].pid = -1;
+                workers_[i].restart_at = Clock::now() + std::chrono::milliseconds(options_.restart_delay_ms);
+            }
+        }
+    }
+
+    void RestartDue()
+    {
+        for (size_t i = 0; i < workers_.size(); i++)
+        {
+            if (workers_[i].pid < 0 && workers_[i].restart_at <= Clock::now())
+            {
+                workers_[i].pid = Spawn(static_cast<int>(i), nullptr);
+                if (workers_[i].pid < 0)
+                    workers_[i].restart_at = Clock::now() + std::chrono::milliseconds(options_.restart_delay_ms);
+            }
+        }
+    }
+
+    // Replaces each worker in turn. The old one is only told to stop once its
+    // replacement serves, and is reaped whenever it exits.
+    void RestartAll()
+    {
+        for (size_t i = 0; i < workers_.size(); i++)
+        {
+            int ready = -1;
+            pid_t pid = Spawn(static_cast<int>(i), &ready);
+            if (pid < 0)
+                return;
+            if (!WaitReady(ready))
+            {
+                std::cerr << "Worker " << i << " (" << pid << ") did not start, keeping the old one" << std::endl;
+                kill(pid, SIGKILL);
+                retiring_.insert(pid);
+                return;
+            }
+            if (workers_[i].pid > 0)
+            {
+                kill(workers_[i].pid, SIGTERM);
+                retiring_.insert(workers_[i].pid);
+            }
+            workers_[i].pid = pid;
+        }
+        std::cout << "Restarted " << workers_.size() << " workers" << std::endl;
+    }
+
+    void Stop()
+    {
+        for (Worker &w : workers_)
+        {
+            if (w.pid > 0)
+                retiring_.insert(w.pid);
+        }
+        for (pid_t pid : retiring_)
+            kill(pid, SIGTERM);
+        while (!retiring_.empty())
+        {
+            siginfo_t info;
+            int signal = sigwaitinfo(&signals_, &info);
+            if (signal == SIGINT || signal == SIGTERM)
+            {
+                for (pid_t pid : retiring_)
+                    kill(pid, SIGKILL);
+            }
+            pid_t pid;
+            while ((pid = waitpid(-1, nullptr, WNOHANG)) > 0)
+                retiring_.erase(pid);
+        }
+    }
+
+    SupervisorOptions options_;
+    std::function<void(int)> worker_;
+    std::vector<Worker> workers_;
+    std::vector<cpu_set_t> nodes_;
+    // Workers told to stop, or that failed to start, not yet reaped.
+    std::set<pid_t> retiring_;
+    sigset_t signals_;
+    sigset_t old_mask_;
+};
+
+#endif // __COMMON_SUPERVISOR_H__
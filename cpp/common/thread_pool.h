@@ -0,0 +1,159 @@
+#ifndef __COMMON_THREAD_POOL_H__
+#define __COMMON_THREAD_POOL_H__
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <vector>
+
+// Pins |thread| to the |index|-th CPU this process may run on (wrapping
+// around), so that per-core threads don't migrate. Returns false when the
+// affinity could not be set; the thread then keeps running unpinned.
+inline bool PinThreadToCpu(std::thread &thread, int index)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+        return false;
+    int target = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed) || target-- != 0)
+            continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+    }
+    return false;
+}
+
+// Somewhere to run work that must not run on gRPC's own threads, such as the
+// body of a callback reactor that would otherwise block.
+class Executor
+{
+  public:
+    virtual ~Executor() = default;
+
+    // Runs |task| as soon as a thread is free.
+    virtual void Submit(std::function<void()> task) = 0;
+
+    // Runs |task| once |delay| has passed, without holding a thread while it
+    // waits.
+    virtual void SubmitAfter(std::chrono::steady_clock::duration delay, std::function<void()> task) = 0;
+};
+
+// Fixed set of worker threads running submitted tasks in FIFO order, and
+// delayed tasks in deadline order once they are due.
+class ThreadPool : public Executor
+{
+  public:
+    explicit ThreadPool(int num_threads)
+    {
+        for (int i = 0; i < num_threads; i++)
+            threads_.emplace_back([this] { Loop(); });
+    }
+
+    // Runs the tasks already queued, then joins the workers. Delayed tasks
+    // that are not due yet run right away rather than being dropped.
+    ~ThreadPool() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (std::thread &t : threads_)
+            t.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void Submit(std::function<void()> task) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            tasks_.push_back(std::move(task));
+        }
+        cv_.notify_one();
+    }
+
+    void SubmitAfter(std::chrono::steady_clock::duration delay, std::function<void()> task) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            timers_.push_back(Timer{std::chrono::steady_clock::now() + delay, next_timer_++, std::move(task)});
+            std::push_heap(timers_.begin(), timers_.end(), LaterTimer);
+        }
+        // Whoever wakes up re-reads the earliest deadline.
+        cv_.notify_one();
+    }
+
+    size_t size() const
+    {
+        return threads_.size();
+    }
+
+  private:
+    struct Timer
+    {
+        std::chrono::steady_clock::time_point deadline;
+        // Keeps timers with equal deadlines in submission order.
+        uint64_t sequence;
+        std::function<void()> task;
+    };
+
+    // Heap order: the earliest deadline ends up at the front.
+    static bool LaterTimer(const Timer &a, const Timer &b)
+    {
+        return a.deadline != b.deadline ? a.deadline > b.deadline : a.sequence > b.sequence;
+    }
+
+    void Loop()
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+        while (true)
+        {
+            // Move the timers that are due onto the run queue.
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            while (!timers_.empty() && (stopping_ || timers_.front().deadline <= now))
+            {
+                std::pop_heap(timers_.begin(), timers_.end(), LaterTimer);
+                tasks_.push_back(std::move(timers_.back().task));
+                timers_.pop_back();
+            }
+            if (!tasks_.empty())
+            {
+                std::function<void()> task = std::move(tasks_.front());
+                tasks_.pop_front();
+                lock.unlock();
+                task();
+                lock.lock();
+                continue;
+            }
+            if (stopping_)
+                return;
+            if (timers_.empty())
+                cv_.wait(lock);
+            else
+                cv_.wait_until(lock, timers_.front().deadline);
+        }
+    }
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<Timer> timers_;
+    uint64_t next_timer_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+
+#endif // __COMMON_THREAD_POOL_H__
@@ -1,9 +1,18 @@
 #ifndef __HELLO_WORLD_UTILS_H__
 #define __HELLO_WORLD_UTILS_H__
 
+#include <algorithm>
 #include <cassert>
+#include <fstream>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/compression.h"
+#include "common/deadlines.h"
+#include "common/server_options.h"
+#include "common/supervisor.h"
 
 void ShowHelpAndExit(const char *szBadOption = NULL)
 {
@@ -18,12 +27,101 @@ void ShowHelpAndExit(const char *szBadOption = NULL)
         << "    -t / --server_address / --target: (default: '0.0.0.0:50051') server address." << std::endl
         << "    --server_ip: (default: '0.0.0.0') server IP." << std::endl
         << "    --server_port: (default: 50051) server port." << std::endl
-        << "    --maintenance_address: (default: '0.0.0.0:50052') maintenance address." << std::endl
+        << "    --maintenance_address: (default: '0.0.0.0:50052') maintenance address, where servers serve"
+        << " /metrics and route_guide servers RouteGuideAdmin." << std::endl
         << "    --maintenance_ip: (default: '0.0.0.0') maintenance IP." << std::endl
         << "    --maintenance_port: (default: 50052) maintenance port." << std::endl
         << "    --secure: (default: false) secure mode." << std::endl
         << "    -s / -c / --mode [\"client\"/\"server\"] : select client/server mode." << std::endl
-        << "    -db / --database : path to Database." << std::endl;
+        << "    -db / --database : path to Database (JSON or binary snapshot)." << std::endl
+        << "    --reload_interval_ms: (default: 0, off) how often the server checks the database for changes."
+        << std::endl
+        << "    --chat_max_notes: (default: 1000) RouteChat notes kept per location, 0 for no limit." << std::endl
+        << "    --chat_ttl_ms: (default: 0, off) age after which RouteChat notes expire." << std::endl
+        << "    --chat_max_bytes: (default: 67108864) memory budget of the RouteChat history, 0 for no limit."
+        << std::endl
+        << "    --chat_subscribe: (default: false) client asks for RouteChat notes to be pushed as they arrive."
+        << std::endl
+        << "    --chat_queue_size: (default: 64) pushed RouteChat notes queued per subscribed stream." << std::endl
+        << "    --chat_disconnect_slow: (default: false) end a subscribed stream whose queue is full instead of"
+        << " dropping its oldest note." << std::endl
+        << "    --num_cqs: (default: 1) completion queues of the async servers and of route_guide_coro's load"
+        << " client, one pinned thread each, or of a sync server." << std::endl
+        << "    --calls_per_cq: (default: 1) calls kept posted on each completion queue." << std::endl
+        << "    --workers: (default: 0) threads that run request handlers off gRPC's threads; 0 runs them inline"
+        << " in greeter_async and uses one per core in greeter_callback." << std::endl
+        << "    --load: (default: false) client runs the load generator instead of the demo calls." << std::endl
+        << "    --qps: (default: 0, closed loop) load: calls started per second on a fixed schedule." << std::endl
+        << "    --concurrency: (default: 1) load: calls kept outstanding in closed loop." << std::endl
+        << "    --duration_s: (default: 10) load: how long to run, in seconds." << std::endl
+        << "    --rpc_mix: (default: all equal) load: RPC weights, e.g. \"GetFeature:8,ListFeatures:2\"." << std::endl
+        << "    --channels: (default: 1) client: channels in the pool, each with its own connection." << std::endl
+        << "    --page_size: (default: server default) client: features per ListFeaturePages page." << std::endl
+        << "    --max_results: (default: no limit) client: features per ListFeaturePages call." << std::endl
+        << "    --window: (default: 16) client: GetFeature calls in flight for batch lookups." << std::endl
+        << "    --kv_keys: (default: 10000) keyvaluestore: keys the server loads and the load client asks for." << std::endl
+        << "    --kv_value_size: (default: 100) keyvaluestore: bytes per value." << std::endl
+        << "    --kv_shards: (default: 64) keyvaluestore: lock shards of the server's map." << std::endl
+        << "    --kv_cache_mb: (default: 0, no cache) keyvaluestore: size of the LRU/TTL cache in front of the backend, in MiB." << std::endl
+        << "    --kv_ttl_ms: (default: 60000) keyvaluestore: how long cached values live." << std::endl
+        << "    --kv_backend_delay_ms: (default: 0) keyvaluestore: added latency of every backend fetch." << std::endl
+        << "    --num_greetings: (default: 10) multi_greeter: replies per sayHello stream." << std::endl
+        << "    --streams: (default: 1) multi_greeter: client streams opened at once." << std::endl
+        << "    --channel_pick: (default: round_robin) client: how calls pick a pooled channel, round_robin or least_outstanding." << std::endl
+        << "    --lb_policy: (default: pick_first) client: gRPC load balancing policy inside each channel, e.g. round_robin." << std::endl
+        << "    --config: (default: none) file of further options, one \"name value\" per line without the dashes; later flags override it." << std::endl
+        << "    --max_threads: (default: gRPC's) server: resource quota on the threads gRPC may use." << std::endl
+        << "    --memory_quota_mb: (default: no quota) server: resource quota on gRPC's buffer memory, in MiB." << std::endl
+        << "    --min_pollers: (default: gRPC's) sync server: pollers kept on each completion queue." << std::endl
+        << "    --max_pollers: (default: gRPC's) sync server: most pollers on each completion queue." << std::endl
+        << "    --max_concurrent_streams: (default: no limit) server: streams one connection may have open." << std::endl
+        << "    --max_recv_message_bytes: (default: 4194304) server: largest message received, -1 for no limit." << std::endl
+        << "    --max_send_message_bytes: (default: no limit) server: largest message sent." << std::endl
+        << "    --stream_window_bytes: (default: gRPC's) server: initial HTTP/2 stream window." << std::endl
+        << "    --bdp_probe: (default: 1) server: 0 keeps HTTP/2 windows fixed instead of growing them to the bandwidth-delay product." << std::endl
+        << "    --keepalive_time_ms: (default: 7200000) server: idle time before the server pings a connection." << std::endl
+        << "    --keepalive_timeout_ms: (default: 20000) server: how long a keepalive ping may go unanswered." << std::endl
+        << "    --keepalive_permit_without_calls: (default: false) server: keep pinging connections with no calls." << std::endl
+        << "    --min_ping_interval_ms: (default: 300000) server: shortest interval between client pings without data." << std::endl
+        << "    --max_connection_idle_ms: (default: off) server: close connections idle this long." << std::endl
+        << "    --max_connection_age_ms: (default: off) server: close connections this old, so clients reconnect and rebalance." << std::endl
+        << "    --compression: (default: none) server: algorithm for large responses, none, deflate or gzip." << std::endl
+        << "    --compression_min_bytes: (default: 1024) server: responses smaller than this go out uncompressed." << std::endl
+        << "    --accept_encodings: (default: all) compression algorithms accepted, e.g. \"gzip,deflate\": on responses by clients, on requests by servers." << std::endl
+        << "    --processes: (default: 1) server: worker processes sharing the port through SO_REUSEPORT, kept"
+        << " running by a supervisor that restarts them one at a time on SIGHUP. Worker i serves /metrics on the"
+        << " maintenance port + i." << std::endl
+        << "    --numa: (default: false) server: pin each worker process to the CPUs of one NUMA node, in turn."
+        << std::endl
+        << "    --drain_grace_ms: (default: 0) server: on SIGTERM, how long to report NOT_SERVING before refusing"
+        << " new calls." << std::endl
+        << "    --drain_timeout_ms: (default: 10000) server: on SIGTERM, how long calls in flight get to finish"
+        << " before being cancelled." << std::endl
+        << "    --deadline_ms: (default: 30000) client: deadline of every call, in milliseconds; 0 for none." << std::endl
+        << "    --method_deadlines: (default: none) client: per-method deadlines overriding --deadline_ms, e.g."
+        << " \"ListFeatures:5000,RouteChat:0\"." << std::endl
+        << "    --tls_cert_file: (default: none) auth_sample server: PEM certificate chain it presents." << std::endl
+        << "    --tls_key_file: (default: none) auth_sample server: PEM private key of --tls_cert_file." << std::endl
+        << "    --tls_ca_file: (default: system roots) auth_sample client: PEM roots the server certificate is checked"
+        << " against." << std::endl
+        << "    --tls_server_name: (default: target host) auth_sample client: name the server certificate is checked"
+        << " against." << std::endl
+        << "    --tls_session_cache: (default: 64) auth_sample client: TLS sessions kept for resumption across"
+        << " connections, 0 for none." << std::endl
+        << "    --auth_secret: (default: none) auth_sample: key tokens are signed with; the server checks tokens with"
+        << " it, the client mints its own with it unless given --auth_token." << std::endl
+        << "    --auth_token: (default: none) auth_sample client: bearer token to send." << std::endl
+        << "    --auth_user: (default: world) auth_sample client: user of the minted token." << std::endl
+        << "    --auth_scope: (default: test.read) auth_sample client: space-separated OAuth scope of the minted"
+        << " token." << std::endl
+        << "    --auth_token_ttl_s: (default: 3600) auth_sample client: lifetime of the minted token, in"
+        << " seconds." << std::endl
+        << "    --auth_cache_entries: (default: 100000) auth_sample server: validated tokens cached, 0 to validate"
+        << " every call." << std::endl
+        << "    --auth_cache_ttl_ms: (default: 60000) auth_sample server: how long a validated token is trusted before"
+        << " it is checked again." << std::endl
+        << "    --auth_validation_delay_ms: (default: 0) auth_sample server: added latency of every token"
+        << " validation." << std::endl;
 
     oss << std::endl;
 
@@ -69,8 +167,139 @@ typedef struct CliParams_
     bool secure = false;
     std::string database;
     bool database_enabled = false;
+    int reload_interval_ms = 0;
+    bool reload_interval_ms_enabled = false;
+    int chat_max_notes = 1000;
+    bool chat_max_notes_enabled = false;
+    int chat_ttl_ms = 0;
+    bool chat_ttl_ms_enabled = false;
+    long long chat_max_bytes = 64 << 20;
+    bool chat_max_bytes_enabled = false;
+    bool chat_subscribe = false;
+    int chat_queue_size = 64;
+    bool chat_queue_size_enabled = false;
+    bool chat_disconnect_slow = false;
+    int num_cqs = 1;
+    bool num_cqs_enabled = false;
+    int calls_per_cq = 1;
+    bool calls_per_cq_enabled = false;
+    int workers = 0;
+    bool workers_enabled = false;
+    bool load = false;
+    double qps = 0;
+    bool qps_enabled = false;
+    int concurrency = 1;
+    bool concurrency_enabled = false;
+    int duration_s = 10;
+    bool duration_s_enabled = false;
+    std::string rpc_mix;
+    bool rpc_mix_enabled = false;
+    int channels = 1;
+    bool channels_enabled = false;
+    int page_size = 0;
+    bool page_size_enabled = false;
+    int max_results = 0;
+    bool max_results_enabled = false;
+    int window = 16;
+    bool window_enabled = false;
+    int kv_keys = 10000;
+    bool kv_keys_enabled = false;
+    int kv_value_size = 100;
+    bool kv_value_size_enabled = false;
+    int kv_shards = 64;
+    bool kv_shards_enabled = false;
+    int kv_cache_mb = 0;
+    bool kv_cache_mb_enabled = false;
+    int kv_ttl_ms = 60000;
+    bool kv_ttl_ms_enabled = false;
+    int kv_backend_delay_ms = 0;
+    bool kv_backend_delay_ms_enabled = false;
+    int num_greetings = 10;
+    bool num_greetings_enabled = false;
+    int streams = 1;
+    bool streams_enabled = false;
+    std::string channel_pick = "round_robin";
+    bool channel_pick_enabled = false;
+    std::string lb_policy = "";
+    bool lb_policy_enabled = false;
+    std::string config = "";
+    bool config_enabled = false;
+    int max_threads = 0;
+    bool max_threads_enabled = false;
+    int memory_quota_mb = 0;
+    bool memory_quota_mb_enabled = false;
+    int min_pollers = 0;
+    bool min_pollers_enabled = false;
+    int max_pollers = 0;
+    bool max_pollers_enabled = false;
+    int max_concurrent_streams = 0;
+    bool max_concurrent_streams_enabled = false;
+    int max_recv_message_bytes = 0;
+    bool max_recv_message_bytes_enabled = false;
+    int max_send_message_bytes = 0;
+    bool max_send_message_bytes_enabled = false;
+    int stream_window_bytes = 0;
+    bool stream_window_bytes_enabled = false;
+    int bdp_probe = -1;
+    bool bdp_probe_enabled = false;
+    int keepalive_time_ms = 0;
+    bool keepalive_time_ms_enabled = false;
+    int keepalive_timeout_ms = 0;
+    bool keepalive_timeout_ms_enabled = false;
+    bool keepalive_permit_without_calls = false;
+    int min_ping_interval_ms = 0;
+    bool min_ping_interval_ms_enabled = false;
+    int max_connection_idle_ms = 0;
+    bool max_connection_idle_ms_enabled = false;
+    int max_connection_age_ms = 0;
+    bool max_connection_age_ms_enabled = false;
+    std::string compression = "none";
+    bool compression_enabled = false;
+    int compression_min_bytes = 1024;
+    bool compression_min_bytes_enabled = false;
+    std::string accept_encodings = "";
+    bool accept_encodings_enabled = false;
+    int processes = 1;
+    bool processes_enabled = false;
+    bool numa = false;
+    int drain_grace_ms = 0;
+    bool drain_grace_ms_enabled = false;
+    int drain_timeout_ms = 10000;
+    bool drain_timeout_ms_enabled = false;
+    int deadline_ms = 30000;
+    bool deadline_ms_enabled = false;
+    std::string method_deadlines = "";
+    bool method_deadlines_enabled = false;
+    std::string tls_cert_file = "";
+    bool tls_cert_file_enabled = false;
+    std::string tls_key_file = "";
+    bool tls_key_file_enabled = false;
+    std::string tls_ca_file = "";
+    bool tls_ca_file_enabled = false;
+    std::string tls_server_name = "";
+    bool tls_server_name_enabled = false;
+    int tls_session_cache = 64;
+    bool tls_session_cache_enabled = false;
+    std::string auth_secret = "";
+    bool auth_secret_enabled = false;
+    std::string auth_token = "";
+    bool auth_token_enabled = false;
+    std::string auth_user = "world";
+    bool auth_user_enabled = false;
+    std::string auth_scope = "test.read";
+    bool auth_scope_enabled = false;
+    int auth_token_ttl_s = 3600;
+    bool auth_token_ttl_s_enabled = false;
+    int auth_cache_entries = 100000;
+    bool auth_cache_entries_enabled = false;
+    int auth_cache_ttl_ms = 60000;
+    bool auth_cache_ttl_ms_enabled = false;
+    int auth_validation_delay_ms = 0;
+    bool auth_validation_delay_ms_enabled = false;
 } CliParams;
 
+ParseCLIState ParseConfigFile(const std::string &path, CliParams *cliParams);
+
 ParseCLIState ParseCommandLine(int argc, char *argv[], CliParams *cliParams)
 {
     for (int i = 1; i < argc; i++)
@@ -91,7 +320,7 @@ ParseCLIState ParseCommandLine(int argc, char *argv[], CliParams *cliParams)
             else
             {
                 cliParams->server_address = std::string(argv[i]);
-                cliParams->server_address = true;
+                cliParams->server_address_enabled = true;
             }
             continue;
         }
@@ -213,26 +442,1033 @@ ParseCLIState ParseCommandLine(int argc, char *argv[], CliParams *cliParams)
             }
             continue;
         }
-        else
+        else if (std::string(argv[i]) == std::string("--reload_interval_ms"))
         {
+            if (++i == argc)
             {
-                ShowHelpAndExit((std::string("input not include ") + std::string(argv[i])).c_str());
+                ShowHelpAndExit("--reload_interval_ms");
                 return ParseCLIState::ERROR;
             }
+            else
+            {
+                cliParams->reload_interval_ms = std::atoi(argv[i]);
+                cliParams->reload_interval_ms_enabled = true;
+            }
+            continue;
         }
-    }
-
-    if (cliParams->maintenance_address_enabled)
-        ;
-    else if (cliParams->maintenance_port_enabled || cliParams->maintenance_ip_enabled)
-        cliParams->maintenance_address =
-            cliParams->maintenance_ip + std::string(":") + std::to_string(cliParams->maintenance_port);
-
-    if (cliParams->server_address_enabled)
-        ;
-    else if (cliParams->server_port_enabled || cliParams->server_ip_enabled)
-        cliParams->server_address = cliParams->server_ip + std::string(":") + std::to_string(cliParams->server_port);
-    return ParseCLIState::SUCCESS;
+        else if (std::string(argv[i]) == std::string("--chat_max_notes"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--chat_max_notes");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->chat_max_notes = std::atoi(argv[i]);
+                cliParams->chat_max_notes_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--chat_ttl_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--chat_ttl_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->chat_ttl_ms = std::atoi(argv[i]);
+                cliParams->chat_ttl_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--chat_max_bytes"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--chat_max_bytes");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->chat_max_bytes = std::atoll(argv[i]);
+                cliParams->chat_max_bytes_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--chat_subscribe"))
+        {
+            cliParams->chat_subscribe = true;
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--chat_queue_size"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--chat_queue_size");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->chat_queue_size = std::atoi(argv[i]);
+                cliParams->chat_queue_size_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--chat_disconnect_slow"))
+        {
+            cliParams->chat_disconnect_slow = true;
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--num_cqs"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--num_cqs");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->num_cqs = std::atoi(argv[i]);
+                cliParams->num_cqs_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--calls_per_cq"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--calls_per_cq");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->calls_per_cq = std::atoi(argv[i]);
+                cliParams->calls_per_cq_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--workers"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--workers");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->workers = std::atoi(argv[i]);
+                cliParams->workers_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--load"))
+        {
+            cliParams->load = true;
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--qps"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--qps");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->qps = std::atof(argv[i]);
+                cliParams->qps_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--concurrency"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--concurrency");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->concurrency = std::atoi(argv[i]);
+                cliParams->concurrency_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--duration_s"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--duration_s");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->duration_s = std::atoi(argv[i]);
+                cliParams->duration_s_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--rpc_mix"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--rpc_mix");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->rpc_mix = std::string(argv[i]);
+                cliParams->rpc_mix_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--channels"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--channels");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->channels = std::atoi(argv[i]);
+                cliParams->channels_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--page_size"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--page_size");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->page_size = std::atoi(argv[i]);
+                cliParams->page_size_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--max_results"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--max_results");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->max_results = std::atoi(argv[i]);
+                cliParams->max_results_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--window"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--window");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->window = std::atoi(argv[i]);
+                cliParams->window_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--kv_keys"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--kv_keys");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->kv_keys = std::atoi(argv[i]);
+                cliParams->kv_keys_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--kv_value_size"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--kv_value_size");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->kv_value_size = std::atoi(argv[i]);
+                cliParams->kv_value_size_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--kv_shards"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--kv_shards");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->kv_shards = std::atoi(argv[i]);
+                cliParams->kv_shards_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--kv_cache_mb"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--kv_cache_mb");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->kv_cache_mb = std::atoi(argv[i]);
+                cliParams->kv_cache_mb_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--kv_ttl_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--kv_ttl_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->kv_ttl_ms = std::atoi(argv[i]);
+                cliParams->kv_ttl_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--kv_backend_delay_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--kv_backend_delay_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->kv_backend_delay_ms = std::atoi(argv[i]);
+                cliParams->kv_backend_delay_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--num_greetings"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--num_greetings");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->num_greetings = std::atoi(argv[i]);
+                cliParams->num_greetings_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--streams"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--streams");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->streams = std::atoi(argv[i]);
+                cliParams->streams_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--channel_pick"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--channel_pick");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->channel_pick = std::string(argv[i]);
+                cliParams->channel_pick_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--lb_policy"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--lb_policy");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->lb_policy = std::string(argv[i]);
+                cliParams->lb_policy_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--config"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--config");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->config = std::string(argv[i]);
+                cliParams->config_enabled = true;
+                ParseCLIState state = ParseConfigFile(cliParams->config, cliParams);
+                if (state != ParseCLIState::SUCCESS)
+                    return state;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--max_threads"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--max_threads");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->max_threads = std::atoi(argv[i]);
+                cliParams->max_threads_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--memory_quota_mb"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--memory_quota_mb");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->memory_quota_mb = std::atoi(argv[i]);
+                cliParams->memory_quota_mb_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--min_pollers"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--min_pollers");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->min_pollers = std::atoi(argv[i]);
+                cliParams->min_pollers_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--max_pollers"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--max_pollers");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->max_pollers = std::atoi(argv[i]);
+                cliParams->max_pollers_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--max_concurrent_streams"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--max_concurrent_streams");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->max_concurrent_streams = std::atoi(argv[i]);
+                cliParams->max_concurrent_streams_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--max_recv_message_bytes"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--max_recv_message_bytes");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->max_recv_message_bytes = std::atoi(argv[i]);
+                cliParams->max_recv_message_bytes_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--max_send_message_bytes"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--max_send_message_bytes");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->max_send_message_bytes = std::atoi(argv[i]);
+                cliParams->max_send_message_bytes_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--stream_window_bytes"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--stream_window_bytes");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->stream_window_bytes = std::atoi(argv[i]);
+                cliParams->stream_window_bytes_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--bdp_probe"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--bdp_probe");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->bdp_probe = std::atoi(argv[i]);
+                cliParams->bdp_probe_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--keepalive_time_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--keepalive_time_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->keepalive_time_ms = std::atoi(argv[i]);
+                cliParams->keepalive_time_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--keepalive_timeout_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--keepalive_timeout_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->keepalive_timeout_ms = std::atoi(argv[i]);
+                cliParams->keepalive_timeout_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--keepalive_permit_without_calls"))
+        {
+            cliParams->keepalive_permit_without_calls = true;
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--min_ping_interval_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--min_ping_interval_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->min_ping_interval_ms = std::atoi(argv[i]);
+                cliParams->min_ping_interval_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--max_connection_idle_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--max_connection_idle_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->max_connection_idle_ms = std::atoi(argv[i]);
+                cliParams->max_connection_idle_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--max_connection_age_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--max_connection_age_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->max_connection_age_ms = std::atoi(argv[i]);
+                cliParams->max_connection_age_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--compression"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--compression");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->compression = std::string(argv[i]);
+                cliParams->compression_enabled = true;
+                grpc_compression_algorithm algorithm;
+                if (!ParseCompressionAlgorithm(cliParams->compression, &algorithm))
+                {
+                    ShowHelpAndExit("--compression");
+                    return ParseCLIState::ERROR;
+                }
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--compression_min_bytes"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--compression_min_bytes");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->compression_min_bytes = std::atoi(argv[i]);
+                cliParams->compression_min_bytes_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--accept_encodings"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--accept_encodings");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->accept_encodings = std::string(argv[i]);
+                cliParams->accept_encodings_enabled = true;
+                uint32_t algorithms;
+                if (!ParseCompressionAlgorithms(cliParams->accept_encodings, &algorithms))
+                {
+                    ShowHelpAndExit("--accept_encodings");
+                    return ParseCLIState::ERROR;
+                }
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--processes"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--processes");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->processes = std::atoi(argv[i]);
+                cliParams->processes_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--numa"))
+        {
+            cliParams->numa = true;
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--drain_grace_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--drain_grace_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->drain_grace_ms = std::atoi(argv[i]);
+                cliParams->drain_grace_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--drain_timeout_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--drain_timeout_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->drain_timeout_ms = std::atoi(argv[i]);
+                cliParams->drain_timeout_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--deadline_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--deadline_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->deadline_ms = std::atoi(argv[i]);
+                cliParams->deadline_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--method_deadlines"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--method_deadlines");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->method_deadlines = std::string(argv[i]);
+                cliParams->method_deadlines_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--tls_cert_file"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--tls_cert_file");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->tls_cert_file = std::string(argv[i]);
+                cliParams->tls_cert_file_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--tls_key_file"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--tls_key_file");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->tls_key_file = std::string(argv[i]);
+                cliParams->tls_key_file_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--tls_ca_file"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--tls_ca_file");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->tls_ca_file = std::string(argv[i]);
+                cliParams->tls_ca_file_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--tls_server_name"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--tls_server_name");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->tls_server_name = std::string(argv[i]);
+                cliParams->tls_server_name_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--tls_session_cache"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--tls_session_cache");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->tls_session_cache = std::atoi(argv[i]);
+                cliParams->tls_session_cache_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--auth_secret"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--auth_secret");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->auth_secret = std::string(argv[i]);
+                cliParams->auth_secret_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--auth_token"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--auth_token");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->auth_token = std::string(argv[i]);
+                cliParams->auth_token_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--auth_user"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--auth_user");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->auth_user = std::string(argv[i]);
+                cliParams->auth_user_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--auth_scope"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--auth_scope");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->auth_scope = std::string(argv[i]);
+                cliParams->auth_scope_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--auth_token_ttl_s"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--auth_token_ttl_s");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->auth_token_ttl_s = std::atoi(argv[i]);
+                cliParams->auth_token_ttl_s_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--auth_cache_entries"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--auth_cache_entries");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->auth_cache_entries = std::atoi(argv[i]);
+                cliParams->auth_cache_entries_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--auth_cache_ttl_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--auth_cache_ttl_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->auth_cache_ttl_ms = std::atoi(argv[i]);
+                cliParams->auth_cache_ttl_ms_enabled = true;
+            }
+            continue;
+        }
+        else if (std::string(argv[i]) == std::string("--auth_validation_delay_ms"))
+        {
+            if (++i == argc)
+            {
+                ShowHelpAndExit("--auth_validation_delay_ms");
+                return ParseCLIState::ERROR;
+            }
+            else
+            {
+                cliParams->auth_validation_delay_ms = std::atoi(argv[i]);
+                cliParams->auth_validation_delay_ms_enabled = true;
+            }
+            continue;
+        }
+        else
+        {
+            {
+                ShowHelpAndExit((std::string("input not include ") + std::string(argv[i])).c_str());
+                return ParseCLIState::ERROR;
+            }
+        }
+    }
+
+    if (cliParams->maintenance_address_enabled)
+        ;
+    else if (cliParams->maintenance_port_enabled || cliParams->maintenance_ip_enabled)
+        cliParams->maintenance_address =
+            cliParams->maintenance_ip + std::string(":") + std::to_string(cliParams->maintenance_port);
+
+    if (cliParams->server_address_enabled)
+        ;
+    else if (cliParams->server_port_enabled || cliParams->server_ip_enabled)
+        cliParams->server_address = cliParams->server_ip + std::string(":") + std::to_string(cliParams->server_port);
+    return ParseCLIState::SUCCESS;
+}
+
+// Reads options from |path|, one per line as "name value" or "name = value",
+// with names as on the command line but without the dashes. A flag without a
+// value, like "secure", takes the line alone. Blank lines and everything
+// after a '#' are skipped.
+ParseCLIState ParseConfigFile(const std::string &path, CliParams *cliParams)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "Cannot read config file " << path << std::endl;
+        return ParseCLIState::ERROR;
+    }
+    std::vector<std::string> args{path};
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos)
+            continue;
+        line = line.substr(start, line.find_last_not_of(" \t\r") - start + 1);
+        size_t split = line.find_first_of(" \t=");
+        std::string name = line.substr(0, split);
+        std::string value;
+        if (split != std::string::npos)
+        {
+            value = line.substr(split);
+            value.erase(0, value.find_first_not_of(" \t="));
+        }
+        args.push_back(name.rfind("-", 0) == 0 ? name : "--" + name);
+        if (!value.empty())
+            args.push_back(value);
+    }
+    std::vector<char *> argv;
+    for (std::string &arg : args)
+        argv.push_back(arg.data());
+    return ParseCommandLine(static_cast<int>(argv.size()), argv.data(), cliParams);
+}
+
+// Server tuning flags as ServerOptions, for ServerOptions::Apply().
+ServerOptions GetServerOptions(const CliParams &cliParams)
+{
+    ServerOptions options;
+    options.max_threads = cliParams.max_threads;
+    options.memory_quota_mb = cliParams.memory_quota_mb;
+    if (cliParams.num_cqs_enabled)
+        options.sync_cqs = cliParams.num_cqs;
+    options.min_pollers = cliParams.min_pollers;
+    options.max_pollers = cliParams.max_pollers;
+    options.max_concurrent_streams = cliParams.max_concurrent_streams;
+    options.max_recv_message_bytes = cliParams.max_recv_message_bytes;
+    options.max_send_message_bytes = cliParams.max_send_message_bytes;
+    options.stream_window_bytes = cliParams.stream_window_bytes;
+    options.bdp_probe = cliParams.bdp_probe;
+    options.keepalive_time_ms = cliParams.keepalive_time_ms;
+    options.keepalive_timeout_ms = cliParams.keepalive_timeout_ms;
+    options.keepalive_permit_without_calls = cliParams.keepalive_permit_without_calls;
+    options.min_ping_interval_ms = cliParams.min_ping_interval_ms;
+    options.max_connection_idle_ms = cliParams.max_connection_idle_ms;
+    options.max_connection_age_ms = cliParams.max_connection_age_ms;
+    ParseCompressionAlgorithms(cliParams.accept_encodings, &options.compression_algorithms);
+    options.reuse_port = cliParams.processes > 1;
+    options.drain_grace_ms = (std::max)(cliParams.drain_grace_ms, 0);
+    options.drain_timeout_ms = (std::max)(cliParams.drain_timeout_ms, 0);
+    return options;
+}
+
+// Response compression flags as a CompressionPolicy.
+CompressionPolicy GetCompressionPolicy(const CliParams &cliParams)
+{
+    CompressionPolicy policy;
+    ParseCompressionAlgorithm(cliParams.compression, &policy.algorithm);
+    policy.min_bytes = static_cast<size_t>((std::max)(cliParams.compression_min_bytes, 0));
+    return policy;
+}
+
+// --processes and --numa as SupervisorOptions, for servers run with more than
+// one process.
+SupervisorOptions GetSupervisorOptions(const CliParams &cliParams)
+{
+    SupervisorOptions options;
+    options.processes = cliParams.processes;
+    options.numa = cliParams.numa;
+    return options;
+}
+
+// --deadline_ms and --method_deadlines as CallDeadlines, on top of what
+// |deadlines| already has; false, after saying why, for a malformed list.
+bool GetCallDeadlines(const CliParams &cliParams, CallDeadlines *deadlines)
+{
+    deadlines->default_ms = (std::max)(cliParams.deadline_ms, 0);
+    if (!ParseMethodDeadlines(cliParams.method_deadlines, deadlines))
+    {
+        std::cout << "--method_deadlines must be a list like ListFeatures:5000,RouteChat:0." << std::endl;
+        return false;
+    }
+    return true;
 }
 
 #endif // __HELLO_WORLD_UTILS_H__
\ No newline at end of file
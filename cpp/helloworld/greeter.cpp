@@ -16,6 +16,7 @@
  *
  */
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <memory>
@@ -29,6 +30,10 @@
 // For client
 #include <grpcpp/grpcpp.h>
 // For both
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/server_options.h"
+#include "common/shutdown.h"
 #include "common/utils.h"
 #include "helloworld.grpc.pb.h"
 
@@ -37,22 +42,37 @@
 class GreeterServiceImpl final : public helloworld::Greeter::Service
 {
   private:
+    // How often a handler looks for its call being cancelled.
+    static constexpr std::chrono::milliseconds kWorkSlice{20};
+
     int i = 0;
     grpc::Status SayHello(grpc::ServerContext *context, const helloworld::HelloRequest *request,
                           helloworld::HelloReply *reply) override
     {
-        std::cout << "--" << std::endl;
+        // The actual processing, given up as soon as the caller goes away or
+        // its deadline passes, so that it doesn't hold a sync thread for
+        // nobody.
+        LOG(DEBUG) << "--";
+        std::chrono::steady_clock::time_point until =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(2806);
+        while (std::chrono::steady_clock::now() < until)
+        {
+            if (context->IsCancelled())
+                return grpc::Status::CANCELLED;
+            std::this_thread::sleep_for((std::min)(std::chrono::steady_clock::duration(kWorkSlice),
+                                                   until - std::chrono::steady_clock::now()));
+        }
         std::string prefix("Hello ");
-        std::this_thread::sleep_for(std::chrono::milliseconds(2806));
         reply->set_message(prefix + request->name());
         reply->set_order(++i);
         return grpc::Status::OK;
     }
 };
 
-void RunServer(std::string &server_address)
+void RunServer(std::string &server_address, std::string &maintenance_address, const ServerOptions &server_options)
 {
     GreeterServiceImpl service;
+    ServerMetrics metrics;
 
     grpc::EnableDefaultHealthCheckService(true);
     grpc::reflection::InitProtoReflectionServerBuilderPlugin();
@@ -62,20 +82,27 @@ void RunServer(std::string &server_address)
     // Register "service" as the instance through which we'll communicate with
     // clients. In this case it corresponds to an *synchronous* service.
     builder.RegisterService(&service);
+    // Thread, queue and transport settings of this deployment.
+    server_options.Apply(&builder);
+    // Count every call for the maintenance port.
+    metrics.Install(&builder);
+    // From here on SIGTERM drains the server rather than killing it.
+    ShutdownSignal::Install();
     // Finally assemble the server.
     std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
     std::cout << "Server listening on " << server_address << std::endl;
+    MetricsHttpServer metrics_server(maintenance_address, &metrics, server_options.reuse_port);
 
-    // Wait for the server to shutdown. Note that some other thread must be
-    // responsible for shutting down the server for this call to ever return.
-    server->Wait();
+    // Serve until SIGTERM, then drain the calls in flight.
+    DrainOnSignal(server.get(), server_options);
 }
 
 // For client
 class GreeterClient
 {
   public:
-    GreeterClient(std::shared_ptr<grpc::Channel> channel) : stub_(helloworld::Greeter::NewStub(channel))
+    GreeterClient(std::shared_ptr<grpc::Channel> channel, const CallDeadlines &deadlines)
+        : stub_(helloworld::Greeter::NewStub(channel)), deadlines_(deadlines)
     {
     }
 
@@ -93,6 +120,7 @@ class GreeterClient
         // Context for the client. It could be used to convey extra information to
         // the server and/or tweak certain RPC behaviors.
         grpc::ClientContext context;
+        deadlines_.Apply("SayHello", &context);
 
         // The actual RPC.
         grpc::Status status = stub_->SayHello(&context, request, &reply);
@@ -106,13 +134,14 @@ class GreeterClient
         }
         else
         {
-            std::cout << status.error_code() << ": " << status.error_message() << std::endl;
+            LOG(ERROR) << status.error_code() << ": " << status.error_message();
             return "RPC failed";
         }
     }
 
   private:
     std::unique_ptr<helloworld::Greeter::Stub> stub_;
+    CallDeadlines deadlines_;
 };
 
 int main(int argc, char **argv)
@@ -124,14 +153,18 @@ int main(int argc, char **argv)
 
         if (cli_params.mode == Mode::CLIENT)
         {
-            GreeterClient greeter(grpc::CreateChannel(cli_params.server_address, grpc::InsecureChannelCredentials()));
+            CallDeadlines deadlines;
+            if (!GetCallDeadlines(cli_params, &deadlines))
+                return 1;
+            GreeterClient greeter(grpc::CreateChannel(cli_params.server_address, grpc::InsecureChannelCredentials()),
+                                  deadlines);
             std::string user("world");
             std::string reply = greeter.SayHello(user);
             std::cout << "Greeter received: " << reply << std::endl;
         }
         else // SERVER
         {
-            RunServer(cli_params.server_address);
+            RunServer(cli_params.server_address, cli_params.maintenance_address, GetServerOptions(cli_params));
         }
 
         return 0;
@@ -16,129 +16,298 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
+#include <vector>
 
 // For both
 #include <grpc/support/log.h>
 #include <grpcpp/grpcpp.h>
 
+#include "common/channel_pool.h"
+#include "common/load_generator.h"
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/server_options.h"
+#include "common/shutdown.h"
+#include "common/thread_pool.h"
 #include "common/utils.h"
 #include "helloworld.grpc.pb.h"
 
 #define CLIENT_V2
 
+// Arena options that make |block| the first block of the arena. Arena::Reset()
+// keeps that block, so an object that owns both reuses it call after call.
+static google::protobuf::ArenaOptions ArenaOptionsFor(char *block, size_t size)
+{
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = size;
+    return options;
+}
+
 // For Server
 class ServerImpl final
 {
   public:
-    ~ServerImpl()
+    struct Options
     {
-        server_->Shutdown();
-        // Always shutdown the completion queue after the server.
-        cq_->Shutdown();
-    }
+        // Completion queues, each drained by its own thread pinned to a core.
+        int num_cqs = 1;
+        // Calls kept posted on each queue, so bursts of new calls don't wait
+        // for a CallData to be re-armed.
+        int calls_per_cq = 1;
+        // If set, request handlers run on a pool of this many threads and the
+        // queue threads only move events.
+        int workers = 0;
+        // Where per-method metrics are served for Prometheus.
+        std::string metrics_address;
+        // Resource quota, stream limits and transport settings.
+        ServerOptions server;
+    };
 
-    // There is no shutdown handling in this code.
-    void Run(std::string &server_address)
+    // Serves until SIGTERM, then drains the calls in flight and shuts down.
+    void Run(std::string &server_address, const Options &options)
     {
+        grpc::EnableDefaultHealthCheckService(true);
         grpc::ServerBuilder builder;
         // Listen on the given address without any authentication mechanism.
         builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
         // Register "service_" as the instance through which we'll communicate with
         // clients. In this case it corresponds to an *asynchronous* service.
         builder.RegisterService(&service_);
-        // Get hold of the completion queue used for the asynchronous communication
+        // Get hold of the completion queues used for the asynchronous communication
         // with the gRPC runtime.
-        cq_ = builder.AddCompletionQueue();
-        // Finally assemble the server.
+        for (int i = 0; i < (std::max)(options.num_cqs, 1); i++)
+            cqs_.push_back(builder.AddCompletionQueue());
+        options.server.Apply(&builder);
+        metrics_.Install(&builder);
+        // Finally assemble the server. From here on SIGTERM drains it rather
+        // than killing it.
+        ShutdownSignal::Install();
         server_ = builder.BuildAndStart();
         std::cout << "Server listening on " << server_address << std::endl;
+        MetricsHttpServer metrics_server(options.metrics_address, &metrics_, options.server.reuse_port);
+        if (options.workers > 0)
+            workers_ = std::make_unique<ThreadPool>(options.workers);
+
+        // Proceed to the server's main loop, one thread per queue.
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < cqs_.size(); i++)
+        {
+            threads.emplace_back(&ServerImpl::HandleRpcs, this, cqs_[i].get(), (std::max)(options.calls_per_cq, 1));
+            if (cqs_.size() > 1)
+                PinThreadToCpu(threads.back(), static_cast<int>(i));
+        }
 
-        // Proceed to the server's main loop.
-        HandleRpcs();
+        DrainOnSignal(server_.get(), options.server);
+        // A call the server cancelled may still be in its handler, which
+        // then puts its Finish() on a queue.
+        in_flight_.WaitForNone();
+        // Always shutdown the completion queue after the server.
+        for (std::unique_ptr<grpc::ServerCompletionQueue> &cq : cqs_)
+            cq->Shutdown();
+        for (std::thread &t : threads)
+            t.join();
     }
 
   private:
+    class CallDataPool;
+
+    // Sized for a HelloRequest and a HelloReply with short names plus the
+    // arena's own bookkeeping.
+    static constexpr size_t kArenaBlockSize = 1024;
+
+    // How often a handler looks for its call being cancelled.
+    static constexpr std::chrono::milliseconds kWorkSlice{20};
+
+    // What the completion queues hand back: a CallData, or the tag telling one
+    // that its call is over.
+    class Tag
+    {
+      public:
+        virtual void Proceed(bool ok) = 0;
+    };
+
     // Class encompasing the state and logic needed to serve a request.
-    class CallData
+    // Instances are owned by the CallDataPool of their completion queue and
+    // are re-armed for the next call instead of being freed after each one.
+    class CallData : public Tag
     {
       public:
-        ~CallData()
-        {
-        }
         // Take in the "service" instance (in this case representing an asynchronous
         // server) and the completion queue "cq" used for asynchronous communication
-        // with the gRPC runtime.
-        CallData(helloworld::Greeter::AsyncService *service, grpc::ServerCompletionQueue *cq)
-            : service_(service), cq_(cq), responder_(&ctx_), status_(CREATE)
+        // with the gRPC runtime. Handlers run on "workers" when it is set.
+        CallData(helloworld::Greeter::AsyncService *service, grpc::ServerCompletionQueue *cq, ThreadPool *workers,
+                 CallDataPool *pool)
+            : service_(service), cq_(cq), workers_(workers), pool_(pool),
+              arena_(ArenaOptionsFor(arena_block_, sizeof(arena_block_))), done_tag_(this), status_(CREATE)
         {
-            // Invoke the serving logic right away.
-            Proceed();
         }
 
-        void Proceed()
+        // |ok| is false for a call the server shut down before it arrived, or
+        // whose reply could not be sent.
+        void Proceed(bool ok) override
         {
             if (status_ == CREATE)
             {
                 // Make this instance progress to the PROCESS state.
                 status_ = PROCESS;
 
+                // The context and the responder are single-use, so they are
+                // rebuilt in place for every call. The messages live on the
+                // arena, whose first block is part of this object.
+                ctx_.emplace();
+                responder_.emplace(&*ctx_);
+                request_ = google::protobuf::Arena::CreateMessage<helloworld::HelloRequest>(&arena_);
+                reply_ = google::protobuf::Arena::CreateMessage<helloworld::HelloReply>(&arena_);
+                // Tells the handler when the caller gives up or its deadline
+                // passes. Only a call that arrives gets this tag back.
+                ctx_->AsyncNotifyWhenDone(&done_tag_);
+
                 // As part of the initial CREATE state, we *request* that the system
                 // start processing SayHello requests. In this request, "this" acts are
                 // the tag uniquely identifying the request (so that different CallData
                 // instances can serve different requests concurrently), in this case
                 // the memory address of this CallData instance.
-                service_->RequestSayHello(&ctx_, &request_, &responder_, cq_, cq_, this);
+                service_->RequestSayHello(&*ctx_, request_, &*responder_, cq_, cq_, static_cast<Tag *>(this));
+            }
+            else if (status_ == PROCESS && !ok)
+            {
+                // The server is shutting down; there is no call to serve and
+                // none to wait for.
+                Recycle();
             }
             else if (status_ == PROCESS)
             {
-                // Spawn a new CallData instance to serve new clients while we process
-                // the one for this CallData. The instance will deallocate itself as
-                // part of its FINISH state.
-                new CallData(service_, cq_);
-
-                // The actual processing.
-                std::cout << "--" << std::endl;
-                std::string prefix("Hello ");
-                std::this_thread::sleep_for(std::chrono::milliseconds(2806));
-                reply_.set_message(prefix + request_.name());
-
-                // And we are done! Let the gRPC runtime know we've finished, using the
-                // memory address of this instance as the uniquely identifying tag for
-                // the event.
+                // Post another CallData to serve new clients while we process
+                // the one for this CallData. It comes from the pool unless
+                // every instance is busy.
+                pool_->Acquire()->Proceed(true);
+
+                in_flight_.emplace(pool_->in_flight());
                 status_ = FINISH;
-                responder_.Finish(reply_, grpc::Status::OK, this);
+                events_ = 2;
+                if (workers_ != nullptr)
+                    workers_->Submit([this] { Handle(); });
+                else
+                    Handle();
             }
             else
             {
                 GPR_ASSERT(status_ == FINISH);
-                // Once in the FINISH state, deallocate ourselves (CallData).
-                delete this;
+                // Once in the FINISH state, drop the per-call state and go back
+                // to the pool.
+                Event();
             }
         }
 
       private:
+        class DoneTag : public Tag
+        {
+          public:
+            explicit DoneTag(CallData *call) : call_(call)
+            {
+            }
+            void Proceed(bool /*ok*/) override
+            {
+                // Only valid once this tag is back.
+                call_->cancelled_ = call_->ctx_->IsCancelled();
+                call_->Event();
+            }
+
+          private:
+            CallData *call_;
+        };
+
+        // The per-call state goes once both the reply and the done tag are
+        // back, in whichever order they come. Both arrive on this queue's
+        // thread.
+        void Event()
+        {
+            if (--events_ == 0)
+                Recycle();
+        }
+
+        void Recycle()
+        {
+            cancelled_ = false;
+            in_flight_.reset();
+            responder_.reset();
+            ctx_.reset();
+            request_ = nullptr;
+            reply_ = nullptr;
+            arena_.Reset();
+            status_ = CREATE;
+            pool_->Release(this);
+        }
+
+        void Handle()
+        {
+            // The actual processing, given up as soon as nobody waits for it:
+            // the caller went away, or the server shut down while the call
+            // waited for a worker. The deadline is checked here as well, since
+            // without workers the done tag waits behind this handler.
+            LOG(DEBUG) << "--";
+            std::chrono::steady_clock::time_point until =
+                std::chrono::steady_clock::now() + std::chrono::milliseconds(2806);
+            while (std::chrono::steady_clock::now() < until)
+            {
+                if (cancelled_ || pool_->in_flight()->stopped() ||
+                    ctx_->deadline() <= std::chrono::system_clock::now())
+                {
+                    responder_->FinishWithError(grpc::Status::CANCELLED, static_cast<Tag *>(this));
+                    return;
+                }
+                std::this_thread::sleep_for((std::min)(std::chrono::steady_clock::duration(kWorkSlice),
+                                                       until - std::chrono::steady_clock::now()));
+            }
+            std::string *message = reply_->mutable_message();
+            message->reserve(6 + request_->name().size());
+            message->append("Hello ").append(request_->name());
+
+            // And we are done! Let the gRPC runtime know we've finished, using the
+            // memory address of this instance as the uniquely identifying tag for
+            // the event. Finish() may be called from any thread.
+            responder_->Finish(*reply_, grpc::Status::OK, static_cast<Tag *>(this));
+        }
+
         // The means of communication with the gRPC runtime for an asynchronous
         // server.
         helloworld::Greeter::AsyncService *service_;
         // The producer-consumer queue where for asynchronous server notifications.
         grpc::ServerCompletionQueue *cq_;
+        ThreadPool *workers_;
+        CallDataPool *pool_;
         // Context for the rpc, allowing to tweak aspects of it such as the use
         // of compression, authentication, as well as to send metadata back to the
         // client.
-        grpc::ServerContext ctx_;
+        std::optional<grpc::ServerContext> ctx_;
 
+        // Backs the messages of the current call. Reset() keeps the first
+        // block, so a recycled CallData parses into memory it already owns.
+        alignas(8) char arena_block_[kArenaBlockSize];
+        google::protobuf::Arena arena_;
         // What we get from the client.
-        helloworld::HelloRequest request_;
+        helloworld::HelloRequest *request_ = nullptr;
         // What we send back to the client.
-        helloworld::HelloReply reply_;
+        helloworld::HelloReply *reply_ = nullptr;
 
         // The means to get back to the client.
-        grpc::ServerAsyncResponseWriter<helloworld::HelloReply> responder_;
+        std::optional<grpc::ServerAsyncResponseWriter<helloworld::HelloReply>> responder_;
+        DoneTag done_tag_;
+        // Set from the done tag on the queue thread, read by the handler.
+        std::atomic<bool> cancelled_{false};
+        // Reply and done tag still to come back.
+        int events_ = 0;
 
         // Let's implement a tiny state machine with the following states.
         enum CallStatus
@@ -148,38 +317,87 @@ class ServerImpl final
             FINISH
         };
         CallStatus status_; // The current serving state.
+        // Held from PROCESS until the reply is sent.
+        std::optional<InFlightCalls::Scope> in_flight_;
     };
 
-    // This can be run in multiple threads if needed.
-    void HandleRpcs()
+    // Free list of the CallData instances of one completion queue. It is only
+    // touched from the thread draining that queue, so it takes no lock, and
+    // it grows to the peak number of calls in flight on the queue.
+    class CallDataPool
     {
-        // Spawn a new CallData instance to serve new clients.
-        new CallData(&service_, cq_.get());
-        void *tag; // uniquely identifies a request.
-        bool ok;
-        while (true)
+      public:
+        CallDataPool(helloworld::Greeter::AsyncService *service, grpc::ServerCompletionQueue *cq, ThreadPool *workers,
+                     InFlightCalls *in_flight)
+            : service_(service), cq_(cq), workers_(workers), in_flight_(in_flight)
         {
-            // Block waiting to read the next event from the completion queue. The
-            // event is uniquely identified by its tag, which in this case is the
-            // memory address of a CallData instance.
-            // The return value of Next should always be checked. This return value
-            // tells us whether there is any kind of event or cq_ is shutting down.
-            GPR_ASSERT(cq_->Next(&tag, &ok));
-            GPR_ASSERT(ok);
-            static_cast<CallData *>(tag)->Proceed();
         }
+
+        // Returns an idle CallData in its CREATE state.
+        CallData *Acquire()
+        {
+            if (free_.empty())
+            {
+                all_.push_back(std::make_unique<CallData>(service_, cq_, workers_, this));
+                return all_.back().get();
+            }
+            CallData *call = free_.back();
+            free_.pop_back();
+            return call;
+        }
+
+        void Release(CallData *call)
+        {
+            free_.push_back(call);
+        }
+
+        InFlightCalls *in_flight() const
+        {
+            return in_flight_;
+        }
+
+      private:
+        helloworld::Greeter::AsyncService *service_;
+        grpc::ServerCompletionQueue *cq_;
+        ThreadPool *workers_;
+        InFlightCalls *in_flight_;
+        std::vector<std::unique_ptr<CallData>> all_;
+        std::vector<CallData *> free_;
+    };
+
+    // Runs on its own thread for each completion queue.
+    void HandleRpcs(grpc::ServerCompletionQueue *cq, int calls_per_cq)
+    {
+        CallDataPool pool(&service_, cq, workers_.get(), &in_flight_);
+        // Post CallData instances to serve new clients.
+        for (int i = 0; i < calls_per_cq; i++)
+            pool.Acquire()->Proceed(true);
+        void *tag; // uniquely identifies a request.
+        bool ok;
+        // Block waiting to read the next event from the completion queue. The
+        // event is uniquely identified by its tag, which in this case is the
+        // memory address of a CallData instance or of its done tag.
+        // The return value of Next should always be checked. This return value
+        // tells us whether there is any kind of event or cq_ is shutting down;
+        // once it is false the queue is drained and no CallData is in use.
+        while (cq->Next(&tag, &ok))
+            static_cast<Tag *>(tag)->Proceed(ok);
     }
 
-    std::unique_ptr<grpc::ServerCompletionQueue> cq_;
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
     helloworld::Greeter::AsyncService service_;
+    ServerMetrics metrics_;
     std::unique_ptr<grpc::Server> server_;
+    std::unique_ptr<ThreadPool> workers_;
+    InFlightCalls in_flight_;
 };
 
 // For Client
 class GreeterClient
 {
   public:
-    explicit GreeterClient(std::shared_ptr<grpc::Channel> channel) : stub_(helloworld::Greeter::NewStub(channel))
+    GreeterClient(std::shared_ptr<ChannelPool> channels, const CallDeadlines &deadlines)
+        : stubs_(std::move(channels)), deadlines_(deadlines)
     {
     }
 
@@ -197,6 +415,7 @@ class GreeterClient
         // Context for the client. It could be used to convey extra information to
         // the server and/or tweak certain RPC behaviors.
         grpc::ClientContext context;
+        deadlines_.Apply("SayHello", &context);
 
         // The producer-consumer queue we use to communicate asynchronously with the
         // gRPC runtime.
@@ -205,8 +424,9 @@ class GreeterClient
         // Storage for the status of the RPC upon completion.
         grpc::Status status;
 
+        StubPool<helloworld::Greeter>::Lease stub = stubs_.Pick();
         std::unique_ptr<grpc::ClientAsyncResponseReader<helloworld::HelloReply>> rpc(
-            stub_->AsyncSayHello(&context, request, &cq));
+            stub->AsyncSayHello(&context, request, &cq));
 
         // Request that, upon completion of the RPC, "reply" be updated with the
         // server's response; "status" with the indication of whether the operation
@@ -238,33 +458,38 @@ class GreeterClient
     }
 
   private:
-    // Out of the passed in Channel comes the stub, stored here, our view of the
+    // Out of the pooled channels come the stubs, stored here, our view of the
     // server's exposed services.
-    std::unique_ptr<helloworld::Greeter::Stub> stub_;
+    StubPool<helloworld::Greeter> stubs_;
+    CallDeadlines deadlines_;
 };
 
 class GreeterClient2
 {
   public:
-    explicit GreeterClient2(std::shared_ptr<grpc::Channel> channel) : stub_(helloworld::Greeter::NewStub(channel))
+    GreeterClient2(std::shared_ptr<ChannelPool> channels, const CallDeadlines &deadlines)
+        : stubs_(std::move(channels)), deadlines_(deadlines)
     {
     }
 
-    // Assembles the client's payload and sends it to the server.
-    void SayHello(const std::string &user)
+    // Assembles the client's payload and sends it to the server. If "done"
+    // is set, it is run with the outcome instead of the reply being printed.
+    void SayHello(const std::string &user, std::function<void(bool ok)> done = nullptr)
     {
-        // Data we are sending to the server.
-        helloworld::HelloRequest request;
-        request.set_name(user);
+        // Call object to store rpc data, recycled from an earlier call when
+        // one is idle.
+        AsyncClientCall *call = AcquireCall();
+        call->done = std::move(done);
 
-        // Call object to store rpc data
-        AsyncClientCall *call = new AsyncClientCall;
+        // Data we are sending to the server.
+        call->request->set_name(user);
 
         // stub_->PrepareAsyncSayHello() creates an RPC object, returning
         // an instance to store in "call" but does not actually start the RPC
         // Because we are using the asynchronous API, we need to hold on to
         // the "call" instance in order to get updates on the ongoing RPC.
-        call->response_reader = stub_->PrepareAsyncSayHello(&call->context, request, &cq_);
+        call->channel = stubs_.Acquire();
+        call->response_reader = stubs_.stub(call->channel)->PrepareAsyncSayHello(&*call->context, *call->request, &cq_);
 
         // StartCall initiates the RPC call
         call->response_reader->StartCall();
@@ -273,11 +498,12 @@ class GreeterClient2
         // server's response; "status" with the indication of whether the operation
         // was successful. Tag the request with the memory address of the call
         // object.
-        call->response_reader->Finish(&call->reply, &call->status, (void *)call);
+        call->response_reader->Finish(call->reply, &call->status, (void *)call);
     }
 
     // Loop while listening for completed responses.
-    // Prints out the response from the server.
+    // Prints out the response from the server. Several threads may run it
+    // at once.
     void AsyncCompleteRpc()
     {
         void *got_tag;
@@ -293,40 +519,111 @@ class GreeterClient2
             // corresponds solely to the request for updates introduced by Finish().
             GPR_ASSERT(ok);
 
-            if (call->status.ok())
-                std::cout << "Greeter received: " << call->reply.message() << std::endl;
-            else
-                std::cout << "RPC failed" << std::endl;
-
-            // Once we're complete, deallocate the call object.
-            delete call;
+            std::function<void(bool ok)> done = std::move(call->done);
+            bool succeeded = call->status.ok();
+            if (!done && succeeded)
+                LOG(INFO) << "Greeter received: " << call->reply->message();
+            else if (!done)
+                LOG(ERROR) << "RPC failed";
+
+            // Once we're complete, hand the call object back for reuse.
+            ReleaseCall(call);
+            if (done)
+                done(succeeded);
         }
     }
 
+    // Makes AsyncCompleteRpc return once the calls in flight have completed.
+    void Shutdown()
+    {
+        cq_.Shutdown();
+    }
+
   private:
     // struct for keeping state and data information
     struct AsyncClientCall
     {
+        AsyncClientCall() : arena(ArenaOptionsFor(arena_block, sizeof(arena_block)))
+        {
+        }
+
+        // First block of "arena", so a recycled call allocates nothing.
+        alignas(8) char arena_block[1024];
+        google::protobuf::Arena arena;
+
+        // Data we are sending to the server.
+        helloworld::HelloRequest *request = nullptr;
+
         // Container for the data we expect from the server.
-        helloworld::HelloReply reply;
+        helloworld::HelloReply *reply = nullptr;
 
         // Context for the client. It could be used to convey extra information to
-        // the server and/or tweak certain RPC behaviors.
-        grpc::ClientContext context;
+        // the server and/or tweak certain RPC behaviors. A context serves a
+        // single call, so it is rebuilt in place each time.
+        std::optional<grpc::ClientContext> context;
 
         // Storage for the status of the RPC upon completion.
         grpc::Status status;
 
         std::unique_ptr<grpc::ClientAsyncResponseReader<helloworld::HelloReply>> response_reader;
+
+        // Completion callback of a load generator call.
+        std::function<void(bool ok)> done;
+
+        // Pooled channel the call went out on.
+        size_t channel = 0;
     };
 
-    // Out of the passed in Channel comes the stub, stored here, our view of the
+    // Calls are started on the caller's thread and completed on the
+    // AsyncCompleteRpc thread, so the free list is shared under a lock.
+    AsyncClientCall *AcquireCall()
+    {
+        AsyncClientCall *call;
+        {
+            std::lock_guard<std::mutex> lock(calls_mu_);
+            if (free_calls_.empty())
+            {
+                all_calls_.push_back(std::make_unique<AsyncClientCall>());
+                call = all_calls_.back().get();
+            }
+            else
+            {
+                call = free_calls_.back();
+                free_calls_.pop_back();
+            }
+        }
+        call->context.emplace();
+        deadlines_.Apply("SayHello", &*call->context);
+        call->request = google::protobuf::Arena::CreateMessage<helloworld::HelloRequest>(&call->arena);
+        call->reply = google::protobuf::Arena::CreateMessage<helloworld::HelloReply>(&call->arena);
+        return call;
+    }
+
+    void ReleaseCall(AsyncClientCall *call)
+    {
+        stubs_.Release(call->channel);
+        call->response_reader.reset();
+        call->context.reset();
+        call->request = nullptr;
+        call->reply = nullptr;
+        call->arena.Reset();
+        call->status = grpc::Status();
+        std::lock_guard<std::mutex> lock(calls_mu_);
+        free_calls_.push_back(call);
+    }
+
+    // Out of the pooled channels come the stubs, stored here, our view of the
     // server's exposed services.
-    std::unique_ptr<helloworld::Greeter::Stub> stub_;
+    StubPool<helloworld::Greeter> stubs_;
+    CallDeadlines deadlines_;
 
     // The producer-consumer queue we use to communicate asynchronously with the
     // gRPC runtime.
     grpc::CompletionQueue cq_;
+
+    std::mutex calls_mu_;
+    std::vector<std::unique_ptr<AsyncClientCall>> all_calls_;
+    std::vector<AsyncClientCall *> free_calls_;
 };
 
 // For both
@@ -336,27 +633,66 @@ int main(int argc, char **argv)
     ParseCLIState cliState = ParseCommandLine(argc, argv, &cli_params);
     if (cliState == ParseCLIState::SUCCESS)
     {
+        ChannelPoolOptions pool_options;
+        pool_options.channels = cli_params.channels;
+        pool_options.lb_policy = cli_params.lb_policy;
+        ParseCompressionAlgorithms(cli_params.accept_encodings, &pool_options.compression_algorithms);
+        if (!ParseChannelPick(cli_params.channel_pick, &pool_options.pick))
+        {
+            std::cout << "--channel_pick must be round_robin or least_outstanding." << std::endl;
+            return 1;
+        }
+        CallDeadlines deadlines;
+        if (!GetCallDeadlines(cli_params, &deadlines))
+        {
+            return 1;
+        }
 #ifdef CLIENT_V1
         if (cli_params.mode == Mode::CLIENT)
         {
-            // Instantiate the client. It requires a channel, out of which the actual RPCs
-            // are created. This channel models a connection to an endpoint (in this case,
-            // localhost at port 50051). We indicate that the channel isn't authenticated
+            // Instantiate the client. It requires channels, out of which the actual RPCs
+            // are created. Each channel models a connection to an endpoint (in this case,
+            // localhost at port 50051). By default the channels aren't authenticated
             // (use of InsecureChannelCredentials()).
-            GreeterClient greeter(grpc::CreateChannel(cli_params.server_address, grpc::InsecureChannelCredentials()));
+            GreeterClient greeter(std::make_shared<ChannelPool>(cli_params.server_address, pool_options), deadlines);
             std::string user("world");
             std::string reply = greeter.SayHello(user); // The actual RPC call!
             std::cout << "Greeter received: " << reply << std::endl;
         }
 #endif // CLIENT_V1
 #ifdef CLIENT_V2
-        if (cli_params.mode == Mode::CLIENT)
+        if (cli_params.mode == Mode::CLIENT && cli_params.load)
+        {
+            // One client over the channel pool, with a completion thread per
+            // channel. Calls pick their channel from the pool.
+            GreeterClient2 client(std::make_shared<ChannelPool>(cli_params.server_address, pool_options), deadlines);
+            std::vector<std::thread> threads;
+            for (int i = 0; i < (std::max)(pool_options.channels, 1); i++)
+                threads.emplace_back(&GreeterClient2::AsyncCompleteRpc, &client);
+
+            LoadGenerator load;
+            load.AddRpc("SayHello", [&client](int /*channel*/, LoadGenerator::Done done) {
+                client.SayHello("world", std::move(done));
+            });
+            LoadOptions options;
+            options.qps = cli_params.qps;
+            options.concurrency = cli_params.concurrency;
+            options.duration = std::chrono::seconds(cli_params.duration_s);
+            options.rpc_mix = cli_params.rpc_mix;
+            bool ran = load.Run(options, std::cout);
+
+            client.Shutdown();
+            for (std::thread &thread : threads)
+                thread.join();
+            return ran ? 0 : 1;
+        }
+        else if (cli_params.mode == Mode::CLIENT)
         {
-            // Instantiate the client. It requires a channel, out of which the actual RPCs
-            // are created. This channel models a connection to an endpoint (in this case,
-            // localhost at port 50051). We indicate that the channel isn't authenticated
+            // Instantiate the client. It requires channels, out of which the actual RPCs
+            // are created. Each channel models a connection to an endpoint (in this case,
+            // localhost at port 50051). By default the channels aren't authenticated
             // (use of InsecureChannelCredentials()).
-            GreeterClient2 greeter2(grpc::CreateChannel(cli_params.server_address, grpc::InsecureChannelCredentials()));
+            GreeterClient2 greeter2(std::make_shared<ChannelPool>(cli_params.server_address, pool_options), deadlines);
 
             // Spawn reader thread that loops indefinitely
             std::thread thread_ = std::thread(&GreeterClient2::AsyncCompleteRpc, &greeter2);
@@ -373,8 +709,14 @@ int main(int argc, char **argv)
 #endif       // CLIENT_V2
         else // SERVER
         {
+            ServerImpl::Options options;
+            options.num_cqs = cli_params.num_cqs;
+            options.calls_per_cq = cli_params.calls_per_cq;
+            options.workers = cli_params.workers;
+            options.metrics_address = cli_params.maintenance_address;
+            options.server = GetServerOptions(cli_params);
             ServerImpl server;
-            server.Run(cli_params.server_address);
+            server.Run(cli_params.server_address, options);
         }
 
         return 0;
@@ -16,6 +16,8 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <iostream>
@@ -31,32 +33,95 @@
 // For Client
 #include <grpcpp/grpcpp.h>
 // For both
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/server_options.h"
+#include "common/shutdown.h"
+#include "common/thread_pool.h"
 #include "common/utils.h"
 #include "helloworld.grpc.pb.h"
 
 // For Server
-// Logic and data behind the server's behavior.
+// Logic and data behind the server's behavior. Reactor methods run on gRPC's
+// callback threads and must not block them, so the slow part of SayHello is
+// handed to |executor| and the reactor is finished from there.
 class GreeterServiceImpl final : public helloworld::Greeter::CallbackService
 {
+  public:
+    explicit GreeterServiceImpl(Executor *executor) : executor_(executor)
+    {
+    }
+
   private:
-    int i = 0;
     grpc::ServerUnaryReactor *SayHello(grpc::CallbackServerContext *context, const helloworld::HelloRequest *request,
                                        helloworld::HelloReply *reply) override
     {
-        std::cout << "--" << std::endl;
-        std::string prefix("Hello ");
-        std::this_thread::sleep_for(std::chrono::milliseconds(2806));
-        reply->set_message(prefix + request->name());
-        reply->set_order(++i);
-        grpc::ServerUnaryReactor *reactor = context->DefaultReactor();
-        reactor->Finish(grpc::Status::OK);
+        LOG(DEBUG) << "--";
+        reply->set_order(order_.fetch_add(1, std::memory_order_relaxed) + 1);
+        Greeting *reactor = new Greeting(request, reply);
+        // The handler's latency is simulated with a timer rather than a
+        // sleeping thread, so calls in flight are not bounded by the number
+        // of workers. Work that really blocks would go through Submit().
+        executor_->SubmitAfter(std::chrono::milliseconds(2806), [reactor] { reactor->Reply(); });
         return reactor;
     }
+
+    // Finishes a SayHello once: from the timer, or at once from OnCancel()
+    // when the caller gives up or its deadline passes. It is freed once both
+    // OnDone() and the timer are through with it.
+    class Greeting : public grpc::ServerUnaryReactor
+    {
+      public:
+        Greeting(const helloworld::HelloRequest *request, helloworld::HelloReply *reply)
+            : request_(request), reply_(reply)
+        {
+        }
+        void Reply()
+        {
+            // |request_| and |reply_| are only valid until Finish().
+            if (!finished_.exchange(true))
+            {
+                std::string prefix("Hello ");
+                reply_->set_message(prefix + request_->name());
+                Finish(grpc::Status::OK);
+            }
+            Release();
+        }
+        void OnCancel() override
+        {
+            if (!finished_.exchange(true))
+                Finish(grpc::Status::CANCELLED);
+        }
+        void OnDone() override
+        {
+            Release();
+        }
+
+      private:
+        void Release()
+        {
+            if (refs_.fetch_sub(1) == 1)
+                delete this;
+        }
+        const helloworld::HelloRequest *request_;
+        helloworld::HelloReply *reply_;
+        std::atomic<bool> finished_{false};
+        std::atomic<int> refs_{2};
+    };
+
+    Executor *executor_;
+    std::atomic<int> order_{0};
 };
 
-void RunServer(std::string &server_address)
+void RunServer(std::string &server_address, std::string &maintenance_address, int workers,
+               const ServerOptions &server_options)
 {
-    GreeterServiceImpl service;
+    // Defaults to one worker per core.
+    if (workers <= 0)
+        workers = (std::max)(1u, std::thread::hardware_concurrency());
+    ThreadPool executor(workers);
+    GreeterServiceImpl service(&executor);
+    ServerMetrics metrics;
 
     grpc::EnableDefaultHealthCheckService(true);
     grpc::reflection::InitProtoReflectionServerBuilderPlugin();
@@ -66,20 +131,27 @@ void RunServer(std::string &server_address)
     // Register "service" as the instance through which we'll communicate with
     // clients. In this case it corresponds to an *synchronous* service.
     builder.RegisterService(&service);
+    // Thread, queue and transport settings of this deployment.
+    server_options.Apply(&builder);
+    // Count every call for the maintenance port.
+    metrics.Install(&builder);
+    // From here on SIGTERM drains the server rather than killing it.
+    ShutdownSignal::Install();
     // Finally assemble the server.
     std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
     std::cout << "Server listening on " << server_address << std::endl;
+    MetricsHttpServer metrics_server(maintenance_address, &metrics, server_options.reuse_port);
 
-    // Wait for the server to shutdown. Note that some other thread must be
-    // responsible for shutting down the server for this call to ever return.
-    server->Wait();
+    // Serve until SIGTERM, then drain the calls in flight.
+    DrainOnSignal(server.get(), server_options);
 }
 
 // For Client
 class GreeterClient
 {
   public:
-    GreeterClient(std::shared_ptr<grpc::Channel> channel) : stub_(helloworld::Greeter::NewStub(channel))
+    GreeterClient(std::shared_ptr<grpc::Channel> channel, const CallDeadlines &deadlines)
+        : stub_(helloworld::Greeter::NewStub(channel)), deadlines_(deadlines)
     {
     }
 
@@ -97,6 +169,7 @@ class GreeterClient
         // Context for the client. It could be used to convey extra information to
         // the server and/or tweak certain RPC behaviors.
         grpc::ClientContext context;
+        deadlines_.Apply("SayHello", &context);
 
         // The actual RPC.
         std::mutex mu;
@@ -125,13 +198,14 @@ class GreeterClient
         }
         else
         {
-            std::cout << status.error_code() << ": " << status.error_message() << std::endl;
+            LOG(ERROR) << status.error_code() << ": " << status.error_message();
             return "RPC failed";
         }
     }
 
   private:
     std::unique_ptr<helloworld::Greeter::Stub> stub_;
+    CallDeadlines deadlines_;
 };
 
 // For both
@@ -144,14 +218,19 @@ int main(int argc, char **argv)
 
         if (cli_params.mode == Mode::CLIENT)
         {
-            GreeterClient greeter(grpc::CreateChannel(cli_params.server_address, grpc::InsecureChannelCredentials()));
+            CallDeadlines deadlines;
+            if (!GetCallDeadlines(cli_params, &deadlines))
+                return 1;
+            GreeterClient greeter(grpc::CreateChannel(cli_params.server_address, grpc::InsecureChannelCredentials()),
+                                  deadlines);
             std::string user("world");
             std::string reply = greeter.SayHello(user);
             std::cout << "Greeter received: " << reply << std::endl;
         }
         else // SERVER
         {
-            RunServer(cli_params.server_address);
+            RunServer(cli_params.server_address, cli_params.maintenance_address, cli_params.workers,
+                      GetServerOptions(cli_params));
         }
 
         return 0;
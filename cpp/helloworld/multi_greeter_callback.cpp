@@ -0,0 +1,304 @@
+/*
+ *
+ * Copyright 2021 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "common/load_generator.h"
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/server_options.h"
+#include "common/shutdown.h"
+#include "common/utils.h"
+#include "hellostreamingworld.grpc.pb.h"
+
+// Resident set size of this process in kB, or 0 where /proc is missing.
+long ResidentKb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.rfind("VmRSS:", 0) == 0)
+            return std::atol(line.c_str() + 6);
+    }
+    return 0;
+}
+
+// For Server
+// Streams |num_greetings| replies per call. Exactly one write is outstanding
+// per stream and the next one starts from OnWriteDone, so a slow reader holds
+// back its own stream through HTTP/2 flow control instead of piling replies up
+// in server memory.
+class MultiGreeterServiceImpl final : public hellostreamingworld::MultiGreeter::CallbackService
+{
+  public:
+    int active_streams() const
+    {
+        return active_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    grpc::ServerWriteReactor<hellostreamingworld::HelloReply> *sayHello(
+        grpc::CallbackServerContext *context, const hellostreamingworld::HelloRequest *request) override
+    {
+        class Greeter : public grpc::ServerWriteReactor<hellostreamingworld::HelloReply>
+        {
+          public:
+            Greeter(MultiGreeterServiceImpl *service, const hellostreamingworld::HelloRequest *request)
+                : service_(service), prefix_("Hello " + request->name() + " #")
+            {
+                service_->active_.fetch_add(1, std::memory_order_relaxed);
+                char *end = nullptr;
+                long count = std::strtol(request->num_greetings().c_str(), &end, 10);
+                if (end == request->num_greetings().c_str() || *end != '\0' || count < 0)
+                {
+                    Finish(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "num_greetings must be a count"));
+                    return;
+                }
+                count_ = count;
+                NextWrite();
+            }
+            void OnWriteDone(bool ok) override
+            {
+                if (!ok)
+                {
+                    // The client went away; nothing more will be delivered.
+                    Finish(grpc::Status(grpc::StatusCode::CANCELLED, "stream broken"));
+                    return;
+                }
+                NextWrite();
+            }
+            void OnDone() override
+            {
+                service_->active_.fetch_sub(1, std::memory_order_relaxed);
+                delete this;
+            }
+
+          private:
+            void NextWrite()
+            {
+                if (sent_ == count_)
+                {
+                    Finish(grpc::Status::OK);
+                    return;
+                }
+                reply_.set_message(prefix_ + std::to_string(sent_));
+                sent_++;
+                StartWrite(&reply_);
+            }
+
+            MultiGreeterServiceImpl *service_;
+            std::string prefix_;
+            long count_ = 0;
+            long sent_ = 0;
+            hellostreamingworld::HelloReply reply_;
+        };
+        return new Greeter(this, request);
+    }
+
+    std::atomic<int> active_{0};
+};
+
+void RunServer(std::string &server_address, std::string &maintenance_address, const ServerOptions &server_options)
+{
+    MultiGreeterServiceImpl service;
+    ServerMetrics metrics;
+    grpc::EnableDefaultHealthCheckService(true);
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.RegisterService(&service);
+    server_options.Apply(&builder);
+    metrics.Install(&builder);
+    // From here on SIGTERM drains the server rather than killing it.
+    ShutdownSignal::Install();
+    std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+    std::cout << "Server listening on " << server_address << std::endl;
+    MetricsHttpServer metrics_server(maintenance_address, &metrics, server_options.reuse_port);
+
+    // Reports the number of open streams and the memory they hold whenever
+    // the count changes, for sizing servers by streams, until SIGTERM.
+    int reported = 0;
+    while (!ShutdownSignal::Wait(2000))
+    {
+        int active = service.active_streams();
+        if (active != reported)
+        {
+            reported = active;
+            std::cout << active << " streams open, VmRSS " << ResidentKb() << " kB" << std::endl;
+        }
+    }
+    DrainOnSignal(server.get(), server_options);
+}
+
+// For Client
+// Opens |streams| sayHello streams at once, spread over |channels|
+// connections, and reads them to the end. Reports messages per second and
+// the client memory per open stream, measured once every stream has
+// delivered its first reply.
+class MultiGreeterClient
+{
+  public:
+    MultiGreeterClient(const std::string &target, int channels, const CallDeadlines &deadlines)
+        : deadlines_(deadlines)
+    {
+        for (const std::shared_ptr<grpc::Channel> &channel : CreateLoadChannels(target, (std::max)(channels, 1)))
+            stubs_.push_back(hellostreamingworld::MultiGreeter::NewStub(channel));
+    }
+
+    bool Run(const std::string &user, int streams, int num_greetings, bool print)
+    {
+        long baseline_kb = ResidentKb();
+        remaining_ = streams;
+        unopened_ = streams;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < streams; i++)
+            new Reader(this, stubs_[i % stubs_.size()].get(), user, num_greetings, print);
+
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [this] { return remaining_ == 0 || unopened_ == 0; });
+        if (unopened_ == 0 && num_greetings > 0)
+        {
+            long open_kb = ResidentKb();
+            LOG(INFO) << streams << " streams open, client VmRSS " << open_kb << " kB ("
+                      << (open_kb - baseline_kb) * 1024 / (std::max)(streams, 1) << " bytes per stream)";
+        }
+        cv_.wait(lock, [this] { return remaining_ == 0; });
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        LOG(INFO) << messages_ << " messages on " << streams << " streams in " << seconds << " s: "
+                  << static_cast<long>(messages_ / seconds) << " messages/s, " << failed_ << " streams failed";
+        return failed_ == 0;
+    }
+
+  private:
+    class Reader : public grpc::ClientReadReactor<hellostreamingworld::HelloReply>
+    {
+      public:
+        Reader(MultiGreeterClient *client, hellostreamingworld::MultiGreeter::Stub *stub, const std::string &user,
+               int num_greetings, bool print)
+            : client_(client), print_(print)
+        {
+            request_.set_name(user);
+            request_.set_num_greetings(std::to_string(num_greetings));
+            client_->deadlines_.Apply("sayHello", &context_);
+            stub->async()->sayHello(&context_, &request_, this);
+            StartRead(&reply_);
+            StartCall();
+        }
+        void OnReadDone(bool ok) override
+        {
+            if (!ok)
+                return;
+            if (print_)
+                LOG(INFO) << "Greeter received: " << reply_.message();
+            if (received_++ == 0)
+                client_->Opened();
+            StartRead(&reply_);
+        }
+        void OnDone(const grpc::Status &s) override
+        {
+            if (!s.ok())
+                LOG(ERROR) << "sayHello rpc failed: " << s.error_message();
+            MultiGreeterClient *client = client_;
+            long received = received_;
+            bool opened = received_ > 0;
+            delete this;
+            client->Finished(received, opened, s.ok());
+        }
+
+      private:
+        MultiGreeterClient *client_;
+        bool print_;
+        grpc::ClientContext context_;
+        hellostreamingworld::HelloRequest request_;
+        hellostreamingworld::HelloReply reply_;
+        long received_ = 0;
+    };
+
+    void Opened()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (--unopened_ == 0)
+            cv_.notify_all();
+    }
+
+    void Finished(long received, bool opened, bool ok)
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        messages_ += received;
+        if (!ok)
+            failed_++;
+        // A stream that ends before its first reply still counts as opened.
+        if (!opened && --unopened_ == 0)
+            cv_.notify_all();
+        if (--remaining_ == 0)
+            cv_.notify_all();
+    }
+
+    std::vector<std::unique_ptr<hellostreamingworld::MultiGreeter::Stub>> stubs_;
+    CallDeadlines deadlines_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    int remaining_ = 0;
+    int unopened_ = 0;
+    long messages_ = 0;
+    int failed_ = 0;
+};
+
+// For both
+int main(int argc, char **argv)
+{
+    CliParams cli_params;
+    ParseCLIState cliState = ParseCommandLine(argc, argv, &cli_params);
+    if (cliState == ParseCLIState::SUCCESS)
+    {
+        if (cli_params.mode == Mode::CLIENT)
+        {
+            CallDeadlines deadlines;
+            if (!GetCallDeadlines(cli_params, &deadlines))
+                return 1;
+            MultiGreeterClient greeter(cli_params.server_address, cli_params.channels, deadlines);
+            int streams = (std::max)(cli_params.streams, 1);
+            // Replies are only printed for a single small stream.
+            bool print = streams == 1 && cli_params.num_greetings <= 100;
+            return greeter.Run("world", streams, cli_params.num_greetings, print) ? 0 : 1;
+        }
+        else // SERVER
+        {
+            RunServer(cli_params.server_address, cli_params.maintenance_address, GetServerOptions(cli_params));
+        }
+
+        return 0;
+    }
+    else if (cliState == ParseCLIState::SHOW_HELP)
+        return 0;
+    else
+        return 1;
+}
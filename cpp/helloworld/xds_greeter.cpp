@@ -31,6 +31,8 @@
 // For Client
 
 // For both
+#include "common/server_options.h"
+#include "common/shutdown.h"
 #include "common/utils.h"
 #include "helloworld.grpc.pb.h"
 #include <grpcpp/grpcpp.h>
@@ -48,10 +50,12 @@ class GreeterServiceImpl final : public helloworld::Greeter::Service
     }
 };
 
-void RunServer(std::string &server_address, std::string &maintenance_address, bool FLAGS_secure = true)
+void RunServer(std::string &server_address, std::string &maintenance_address, const ServerOptions &server_options,
+               bool FLAGS_secure = true)
 {
     grpc::EnableDefaultHealthCheckService(true);
     grpc::reflection::InitProtoReflectionServerBuilderPlugin();
+    ShutdownSignal::Install();
     grpc::XdsServerBuilder xds_builder;
     grpc::ServerBuilder builder;
     std::unique_ptr<grpc::Server> xds_enabled_server;
@@ -60,6 +64,8 @@ void RunServer(std::string &server_address, std::string &maintenance_address, bo
     // Register "service" as the instance through which we'll communicate with
     // clients. In this case it corresponds to an *synchronous* service.
     xds_builder.RegisterService(&service);
+    // Thread, queue and transport settings of this deployment.
+    server_options.Apply(&xds_builder);
     if (FLAGS_secure)
     {
         // Listen on the given address with XdsServerCredentials and a fallback of
@@ -82,16 +88,19 @@ void RunServer(std::string &server_address, std::string &maintenance_address, bo
         gpr_log(GPR_INFO, (std::string("Server listening on ") + server_address).c_str());
     }
 
-    // Wait for the server to shutdown. Note that some other thread must be
-    // responsible for shutting down the server for this call to ever return.
-    server->Wait();
+    // Serve until SIGTERM, then drain the calls in flight. The maintenance
+    // server, if separate, stays up until they are done.
+    DrainOnSignal(FLAGS_secure ? xds_enabled_server.get() : server.get(), server_options);
+    if (FLAGS_secure)
+        server->Shutdown();
 }
 
 // For Client
 class GreeterClient
 {
   public:
-    GreeterClient(std::shared_ptr<grpc::Channel> channel) : stub_(helloworld::Greeter::NewStub(channel))
+    GreeterClient(std::shared_ptr<grpc::Channel> channel, const CallDeadlines &deadlines)
+        : stub_(helloworld::Greeter::NewStub(channel)), deadlines_(deadlines)
     {
     }
 
@@ -109,6 +118,7 @@ class GreeterClient
         // Context for the client. It could be used to convey extra information to
         // the server and/or tweak certain RPC behaviors.
         grpc::ClientContext context;
+        deadlines_.Apply("SayHello", &context);
 
         // The actual RPC.
         grpc::Status status = stub_->SayHello(&context, request, &reply);
@@ -127,6 +137,7 @@ class GreeterClient
 
   private:
     std::unique_ptr<helloworld::Greeter::Stub> stub_;
+    CallDeadlines deadlines_;
 };
 
 // For both
@@ -138,14 +149,20 @@ int main(int argc, char **argv)
     {
         if (cli_params.mode == Mode::SERVER)
         {
-            RunServer(cli_params.server_address, cli_params.maintenance_address, cli_params.secure);
+            RunServer(cli_params.server_address, cli_params.maintenance_address, GetServerOptions(cli_params),
+                      cli_params.secure);
         }
         else
         {
             assert(cli_params.mode == Mode::CLIENT);
-            GreeterClient greeter(grpc::CreateChannel(
-                cli_params.server_address, cli_params.secure ? grpc::XdsCredentials(grpc::InsecureChannelCredentials())
-                                                             : grpc::InsecureChannelCredentials()));
+            CallDeadlines deadlines;
+            if (!GetCallDeadlines(cli_params, &deadlines))
+                return 1;
+            GreeterClient greeter(grpc::CreateChannel(cli_params.server_address,
+                                                      cli_params.secure
+                                                          ? grpc::XdsCredentials(grpc::InsecureChannelCredentials())
+                                                          : grpc::InsecureChannelCredentials()),
+                                  deadlines);
             std::string user("world");
             std::string reply = greeter.SayHello(user);
             std::cout << "Greeter received: " << reply << std::endl;
@@ -0,0 +1,22 @@
+#include "backend.h"
+
+#include <utility>
+
+namespace keyvaluestore
+{
+
+void StoreBackend::Fetch(const std::string &key, Callback done)
+{
+    std::string value;
+    bool found = store_->Get(key, &value);
+    done(found, value);
+}
+
+void DelayedBackend::Fetch(const std::string &key, Callback done)
+{
+    executor_->SubmitAfter(delay_, [this, key, done = std::move(done)]() mutable {
+        backend_->Fetch(key, std::move(done));
+    });
+}
+
+} // namespace keyvaluestore
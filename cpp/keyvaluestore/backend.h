@@ -0,0 +1,65 @@
+#ifndef GRPC_COMMON_CPP_KEYVALUESTORE_BACKEND_H_
+#define GRPC_COMMON_CPP_KEYVALUESTORE_BACKEND_H_
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "common/thread_pool.h"
+#include "sharded_store.h"
+
+namespace keyvaluestore
+{
+
+// Where GetValues gets its values from. Fetches are asynchronous so that a
+// slow source ties up no gRPC thread while it works.
+class Backend
+{
+  public:
+    // |found| is false for an unknown key, in which case |value| is empty.
+    using Callback = std::function<void(bool found, const std::string &value)>;
+
+    virtual ~Backend() = default;
+
+    // Looks |key| up and runs |done| exactly once, possibly before Fetch()
+    // returns and on any thread. Callers must not hold locks that |done|
+    // takes.
+    virtual void Fetch(const std::string &key, Callback done) = 0;
+};
+
+// Answers from an in-memory ShardedStore, inline.
+class StoreBackend : public Backend
+{
+  public:
+    explicit StoreBackend(const ShardedStore *store) : store_(store)
+    {
+    }
+
+    void Fetch(const std::string &key, Callback done) override;
+
+  private:
+    const ShardedStore *store_;
+};
+
+// Delays every answer of another backend by a fixed time, standing in for a
+// remote data source in tests and load runs.
+class DelayedBackend : public Backend
+{
+  public:
+    DelayedBackend(Backend *backend, std::chrono::milliseconds delay, Executor *executor)
+        : backend_(backend), delay_(delay), executor_(executor)
+    {
+    }
+
+    void Fetch(const std::string &key, Callback done) override;
+
+  private:
+    Backend *backend_;
+    std::chrono::milliseconds delay_;
+    Executor *executor_;
+};
+
+} // namespace keyvaluestore
+
+#endif // GRPC_COMMON_CPP_KEYVALUESTORE_BACKEND_H_
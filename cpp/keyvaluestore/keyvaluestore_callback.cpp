@@ -0,0 +1,475 @@
+/*
+ *
+ * Copyright 2021 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "common/load_generator.h"
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/server_options.h"
+#include "common/shutdown.h"
+#include "common/utils.h"
+#include "backend.h"
+#include "common/thread_pool.h"
+#include "keyvaluestore.grpc.pb.h"
+#include "sharded_store.h"
+#include "value_cache.h"
+
+// The synthetic data set: "key<i>" for i < |keys|.
+std::string KeyName(int i)
+{
+    return "key" + std::to_string(i);
+}
+
+// For Server
+
+// Answers a GetValues stream holds before it stops reading requests.
+constexpr size_t kMaxQueued = 1024;
+
+class KeyValueStoreServiceImpl final : public keyvaluestore::KeyValueStore::CallbackService
+{
+  public:
+    explicit KeyValueStoreServiceImpl(keyvaluestore::Backend *backend) : backend_(backend)
+    {
+    }
+
+    grpc::ServerBidiReactor<keyvaluestore::Request, keyvaluestore::Response> *GetValues(
+        grpc::CallbackServerContext *context) override
+    {
+        // Reads run ahead of writes: every request is sent to the backend as
+        // soon as it arrives, and its answer takes a place in line behind the
+        // one being written, so a client can keep many lookups in flight on
+        // one stream. Answers go out in request order as they become ready.
+        // Reading pauses while kMaxQueued answers are waiting.
+        class Reactor : public grpc::ServerBidiReactor<keyvaluestore::Request, keyvaluestore::Response>
+        {
+          public:
+            explicit Reactor(keyvaluestore::Backend *backend) : backend_(backend)
+            {
+                StartRead(&request_);
+            }
+            void OnDone() override
+            {
+                std::unique_lock<std::mutex> lock(mu_);
+                done_ = true;
+                if (fetching_ == 0)
+                {
+                    lock.unlock();
+                    delete this;
+                }
+            }
+            void OnReadDone(bool ok) override
+            {
+                std::unique_lock<std::mutex> lock(mu_);
+                if (!ok)
+                {
+                    reads_done_ = true;
+                    MaybeFinish();
+                    return;
+                }
+                // Taken before the next read, which fills request_ again,
+                // possibly on another thread.
+                std::string key = std::move(*request_.mutable_key());
+                answers_.emplace_back();
+                Answer *answer = &answers_.back();
+                fetching_++;
+                if (answers_.size() < kMaxQueued)
+                {
+                    StartRead(&request_);
+                }
+                else
+                {
+                    read_paused_ = true;
+                }
+                // The backend may answer inline, and the answer takes mu_.
+                lock.unlock();
+                // A missing key is answered with an empty value.
+                backend_->Fetch(key, [this, answer](bool, const std::string &value) {
+                    std::unique_lock<std::mutex> lock(mu_);
+                    answer->response.set_value(value);
+                    answer->ready = true;
+                    if (--fetching_ == 0 && done_)
+                    {
+                        lock.unlock();
+                        delete this;
+                        return;
+                    }
+                    MaybeWrite();
+                });
+            }
+            void OnWriteDone(bool ok) override
+            {
+                std::lock_guard<std::mutex> lock(mu_);
+                writing_ = false;
+                answers_.pop_front();
+                if (!ok)
+                {
+                    // The client is gone; the pending read fails on its own.
+                    if (!finished_)
+                    {
+                        finished_ = true;
+                        Finish(grpc::Status(grpc::StatusCode::UNAVAILABLE, "stream broken"));
+                    }
+                    return;
+                }
+                if (read_paused_)
+                {
+                    read_paused_ = false;
+                    StartRead(&request_);
+                }
+                MaybeWrite();
+                MaybeFinish();
+            }
+            // The caller gave up or ran out of time: answers still to come
+            // are dropped. A write in flight fails and finishes the call.
+            void OnCancel() override
+            {
+                std::lock_guard<std::mutex> lock(mu_);
+                if (!finished_ && !writing_)
+                {
+                    finished_ = true;
+                    Finish(grpc::Status::CANCELLED);
+                }
+            }
+
+          private:
+            struct Answer
+            {
+                keyvaluestore::Response response;
+                bool ready = false;
+            };
+
+            void MaybeWrite()
+            {
+                if (writing_ || finished_ || answers_.empty() || !answers_.front().ready)
+                {
+                    return;
+                }
+                writing_ = true;
+                StartWrite(&answers_.front().response);
+            }
+            void MaybeFinish()
+            {
+                if (reads_done_ && !writing_ && answers_.empty() && !finished_)
+                {
+                    finished_ = true;
+                    Finish(grpc::Status::OK);
+                }
+            }
+
+            keyvaluestore::Backend *backend_;
+            keyvaluestore::Request request_;
+            std::mutex mu_;
+            // Front is being written or is next; deque keeps answers in place
+            // as more are queued.
+            std::deque<Answer> answers_;
+            // Backend fetches not yet answered; the reactor outlives them.
+            int fetching_ = 0;
+            bool writing_ = false;
+            bool read_paused_ = false;
+            bool reads_done_ = false;
+            bool finished_ = false;
+            bool done_ = false;
+        };
+        return new Reactor(backend_);
+    }
+
+  private:
+    keyvaluestore::Backend *backend_;
+};
+
+void RunServer(std::string &server_address, const CliParams &cli_params)
+{
+    keyvaluestore::ShardedStore store(cli_params.kv_shards);
+    for (int i = 0; i < cli_params.kv_keys; i++)
+    {
+        std::string value = "value" + std::to_string(i);
+        value.resize((std::max)(value.size(), static_cast<size_t>(cli_params.kv_value_size)), '.');
+        store.Put(KeyName(i), std::move(value));
+    }
+    std::cout << "Loaded " << store.size() << " keys." << std::endl;
+
+    // store <- optional delay <- optional cache <- service
+    keyvaluestore::StoreBackend store_backend(&store);
+    keyvaluestore::Backend *backend = &store_backend;
+    std::unique_ptr<ThreadPool> delay_pool;
+    std::unique_ptr<keyvaluestore::DelayedBackend> delayed;
+    if (cli_params.kv_backend_delay_ms > 0)
+    {
+        delay_pool = std::make_unique<ThreadPool>(1);
+        delayed = std::make_unique<keyvaluestore::DelayedBackend>(
+            backend, std::chrono::milliseconds(cli_params.kv_backend_delay_ms), delay_pool.get());
+        backend = delayed.get();
+    }
+    std::unique_ptr<keyvaluestore::CachingBackend> cache;
+    if (cli_params.kv_cache_mb > 0)
+    {
+        keyvaluestore::CachingBackend::Options options;
+        options.max_bytes = static_cast<size_t>(cli_params.kv_cache_mb) << 20;
+        options.ttl = std::chrono::milliseconds(cli_params.kv_ttl_ms);
+        cache = std::make_unique<keyvaluestore::CachingBackend>(backend, options);
+        backend = cache.get();
+    }
+
+    KeyValueStoreServiceImpl service(backend);
+    ServerMetrics metrics;
+    ServerOptions server_options = GetServerOptions(cli_params);
+    grpc::EnableDefaultHealthCheckService(true);
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.RegisterService(&service);
+    server_options.Apply(&builder);
+    metrics.Install(&builder);
+    // From here on SIGTERM drains the server rather than killing it.
+    ShutdownSignal::Install();
+    std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+    std::cout << "Server listening on " << server_address << std::endl;
+    MetricsHttpServer metrics_server(cli_params.maintenance_address, &metrics, server_options.reuse_port);
+    DrainOnSignal(server.get(), server_options);
+}
+
+// For Client
+
+// One GetValues stream carrying any number of lookups. Requests are written
+// back to back without waiting for answers; the server answers in order, so
+// each response completes the oldest lookup still waiting.
+class ValueStream : public grpc::ClientBidiReactor<keyvaluestore::Request, keyvaluestore::Response>
+{
+  public:
+    using Done = std::function<void(bool ok, const std::string &value)>;
+
+    ValueStream(keyvaluestore::KeyValueStore::Stub *stub, const CallDeadlines &deadlines)
+    {
+        deadlines.Apply("GetValues", &context_);
+        stub->async()->GetValues(&context_, this);
+        StartRead(&response_);
+        StartCall();
+    }
+
+    // Looks |key| up; |done| runs on a gRPC thread once the answer is in, or
+    // with ok false if the stream fails first.
+    void Lookup(std::string key, Done done)
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+        if (stream_done_ || closing_)
+        {
+            lock.unlock();
+            done(false, std::string());
+            return;
+        }
+        to_write_.emplace_back();
+        to_write_.back().set_key(std::move(key));
+        waiting_.push_back(std::move(done));
+        if (!writing_)
+        {
+            writing_ = true;
+            StartWrite(&to_write_.front());
+        }
+    }
+
+    // Closes the stream once the queued lookups are written and waits for the
+    // server to finish it. Returns the final status.
+    grpc::Status Shutdown()
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+        if (!closing_)
+        {
+            closing_ = true;
+            // A stream that has already ended has nothing left to close.
+            if (!writing_ && !stream_done_)
+            {
+                StartWritesDone();
+            }
+        }
+        done_cv_.wait(lock, [this] { return finished_; });
+        return status_;
+    }
+
+    void OnWriteDone(bool ok) override
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        to_write_.pop_front();
+        if (ok && !to_write_.empty())
+        {
+            StartWrite(&to_write_.front());
+            return;
+        }
+        writing_ = false;
+        if (ok && closing_)
+        {
+            StartWritesDone();
+        }
+    }
+
+    void OnReadDone(bool ok) override
+    {
+        if (!ok)
+        {
+            return;
+        }
+        Done done;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            if (waiting_.empty())
+            {
+                // More answers than questions; nothing to hand this one to.
+                context_.TryCancel();
+                return;
+            }
+            done = std::move(waiting_.front());
+            waiting_.pop_front();
+        }
+        done(true, response_.value());
+        StartRead(&response_);
+    }
+
+    void OnDone(const grpc::Status &status) override
+    {
+        // Ended before the failed lookups run, so that lookups their
+        // callbacks start fail at once rather than touch the stream.
+        std::deque<Done> failed;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            status_ = status;
+            stream_done_ = true;
+            failed.swap(waiting_);
+        }
+        for (Done &done : failed)
+        {
+            done(false, std::string());
+        }
+        std::lock_guard<std::mutex> lock(mu_);
+        finished_ = true;
+        done_cv_.notify_all();
+    }
+
+  private:
+    grpc::ClientContext context_;
+    keyvaluestore::Response response_;
+    std::mutex mu_;
+    std::condition_variable done_cv_;
+    // Front is being written.
+    std::deque<keyvaluestore::Request> to_write_;
+    // Lookups written or queued, oldest first.
+    std::deque<Done> waiting_;
+    bool writing_ = false;
+    bool closing_ = false;
+    bool stream_done_ = false;
+    // OnDone() has run the failed lookups; Shutdown() may return.
+    bool finished_ = false;
+    grpc::Status status_;
+};
+
+// Looks a few keys up on one stream, one of them unknown, and prints them.
+void RunClient(const std::string &server_address, const CallDeadlines &deadlines)
+{
+    std::unique_ptr<keyvaluestore::KeyValueStore::Stub> stub =
+        keyvaluestore::KeyValueStore::NewStub(grpc::CreateChannel(server_address, grpc::InsecureChannelCredentials()));
+    ValueStream stream(stub.get(), deadlines);
+    for (const std::string &key : {KeyName(0), KeyName(1), KeyName(2), std::string("no-such-key")})
+    {
+        stream.Lookup(key, [key](bool ok, const std::string &value) {
+            if (ok)
+                LOG(INFO) << key << " : \"" << value << "\"";
+            else
+                LOG(INFO) << key << " : lookup failed";
+        });
+    }
+    grpc::Status status = stream.Shutdown();
+    LOG(INFO) << "GetValues rpc " << (status.ok() ? "succeeded." : "failed: " + status.error_message());
+}
+
+// Load mode: one stream per channel, one load generator call per key, so the
+// report is the latency of single lookups on the shared streams.
+bool RunLoad(const CliParams &cli_params, const CallDeadlines &deadlines)
+{
+    LoadOptions options;
+    options.qps = cli_params.qps;
+    options.concurrency = cli_params.concurrency;
+    options.duration = std::chrono::seconds(cli_params.duration_s);
+    options.rpc_mix = cli_params.rpc_mix;
+    options.channels = (std::max)(cli_params.channels, 1);
+
+    std::vector<std::unique_ptr<keyvaluestore::KeyValueStore::Stub>> stubs;
+    std::vector<std::unique_ptr<ValueStream>> streams;
+    for (const std::shared_ptr<grpc::Channel> &channel :
+         CreateLoadChannels(cli_params.server_address, options.channels))
+    {
+        stubs.push_back(keyvaluestore::KeyValueStore::NewStub(channel));
+        streams.push_back(std::make_unique<ValueStream>(stubs.back().get(), deadlines));
+    }
+
+    int keys = (std::max)(cli_params.kv_keys, 1);
+    LoadGenerator load;
+    load.AddRpc("GetValues", [&streams, keys](int channel, LoadGenerator::Done done) {
+        thread_local std::mt19937 generator(std::random_device{}());
+        std::uniform_int_distribution<int> key(0, keys - 1);
+        streams[channel]->Lookup(KeyName(key(generator)),
+                                 [done = std::move(done)](bool ok, const std::string &) { done(ok); });
+    });
+    bool ran = load.Run(options, std::cout);
+    for (const std::unique_ptr<ValueStream> &stream : streams)
+        stream->Shutdown();
+    return ran;
+}
+
+int main(int argc, char **argv)
+{
+    CliParams cli_params;
+    ParseCLIState cliState = ParseCommandLine(argc, argv, &cli_params);
+    if (cliState == ParseCLIState::SUCCESS)
+    {
+        // One GetValues stream carries every lookup of a run, so it has no
+        // deadline unless --method_deadlines gives it one.
+        CallDeadlines deadlines;
+        deadlines.method_ms.emplace("GetValues", 0);
+        if (cli_params.mode == Mode::CLIENT && !GetCallDeadlines(cli_params, &deadlines))
+        {
+            return 1;
+        }
+        else if (cli_params.mode == Mode::CLIENT && cli_params.load)
+        {
+            return RunLoad(cli_params, deadlines) ? 0 : 1;
+        }
+        else if (cli_params.mode == Mode::CLIENT)
+        {
+            RunClient(cli_params.server_address, deadlines);
+        }
+        else // SERVER
+        {
+            RunServer(cli_params.server_address, cli_params);
+        }
+        return 0;
+    }
+    else if (cliState == ParseCLIState::SHOW_HELP)
+        return 0;
+    else
+        return 1;
+}
@@ -0,0 +1,68 @@
+#include "sharded_store.h"
+
+#include <algorithm>
+#include <bit>
+#include <mutex>
+#include <utility>
+
+namespace keyvaluestore
+{
+
+ShardedStore::ShardedStore(size_t shards) : shard_mask_(std::bit_ceil((std::max)(shards, size_t{1})) - 1)
+{
+    shards_.reset(new Shard[shard_mask_ + 1]);
+}
+
+ShardedStore::Shard &ShardedStore::ShardOf(std::string_view key) const
+{
+    // The maps bucket on the low bits of the same hash; shard on the high
+    // ones so that a shard's keys still spread over all of its buckets.
+    size_t h = Hash()(key);
+    return shards_[(h >> (sizeof(size_t) * 4)) & shard_mask_];
+}
+
+bool ShardedStore::Get(std::string_view key, std::string *value) const
+{
+    Shard &shard = ShardOf(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mu);
+    auto it = shard.map.find(key);
+    if (it == shard.map.end())
+    {
+        return false;
+    }
+    *value = it->second;
+    return true;
+}
+
+void ShardedStore::Put(std::string key, std::string value)
+{
+    Shard &shard = ShardOf(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mu);
+    shard.map.insert_or_assign(std::move(key), std::move(value));
+}
+
+bool ShardedStore::Erase(std::string_view key)
+{
+    Shard &shard = ShardOf(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mu);
+    auto it = shard.map.find(key);
+    if (it == shard.map.end())
+    {
+        return false;
+    }
+    shard.map.erase(it);
+    return true;
+}
+
+size_t ShardedStore::size() const
+{
+    size_t n = 0;
+    for (size_t i = 0; i <= shard_mask_; i++)
+    {
+        std::shared_lock<std::shared_mutex> lock(shards_[i].mu);
+        n += shards_[i].map.size();
+    }
+    return n;
+}
+
+} // namespace keyvaluestore
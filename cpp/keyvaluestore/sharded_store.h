@@ -0,0 +1,60 @@
+#ifndef GRPC_COMMON_CPP_KEYVALUESTORE_SHARDED_STORE_H_
+#define GRPC_COMMON_CPP_KEYVALUESTORE_SHARDED_STORE_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace keyvaluestore
+{
+
+// Concurrent string map split into independently locked shards. Readers of a
+// shard share its lock, so lookups only contend with writes to the same
+// shard, and each shard sits on its own cache line to keep the locks of
+// neighbouring shards from false sharing.
+class ShardedStore
+{
+  public:
+    // |shards| is rounded up to a power of two.
+    explicit ShardedStore(size_t shards = 64);
+
+    // Copies the value stored under |key| to |value|; false if there is none.
+    bool Get(std::string_view key, std::string *value) const;
+
+    void Put(std::string key, std::string value);
+
+    // Returns true if |key| was present.
+    bool Erase(std::string_view key);
+
+    size_t size() const;
+
+  private:
+    // Transparent, so lookups by string_view don't build a std::string.
+    struct Hash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view key) const
+        {
+            return std::hash<std::string_view>()(key);
+        }
+    };
+
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex mu;
+        std::unordered_map<std::string, std::string, Hash, std::equal_to<>> map;
+    };
+
+    Shard &ShardOf(std::string_view key) const;
+
+    std::unique_ptr<Shard[]> shards_;
+    size_t shard_mask_;
+};
+
+} // namespace keyvaluestore
+
+#endif // GRPC_COMMON_CPP_KEYVALUESTORE_SHARDED_STORE_H_
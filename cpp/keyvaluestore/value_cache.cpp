@@ -0,0 +1,148 @@
+#include "value_cache.h"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+namespace keyvaluestore
+{
+
+namespace
+{
+
+// Rough heap cost of an entry beyond its strings: list node, index node and
+// bucket, and the string headers.
+constexpr size_t kEntryOverhead = 128;
+
+} // namespace
+
+CachingBackend::CachingBackend(Backend *backend, const Options &options)
+    : backend_(backend), ttl_(options.ttl), shard_mask_(std::bit_ceil((std::max)(options.shards, size_t{1})) - 1)
+{
+    shards_.reset(new Shard[shard_mask_ + 1]);
+    shard_bytes_ = options.max_bytes / (shard_mask_ + 1);
+    protected_bytes_ = static_cast<size_t>(shard_bytes_ * (std::clamp)(options.protected_ratio, 0.0, 1.0));
+}
+
+size_t CachingBackend::Cost(const Entry &entry)
+{
+    // The key is held twice, by the entry and by the index.
+    return 2 * entry.key.size() + entry.value.size() + kEntryOverhead;
+}
+
+CachingBackend::Shard &CachingBackend::ShardOf(const std::string &key)
+{
+    size_t h = std::hash<std::string>()(key);
+    return shards_[(h >> (sizeof(size_t) * 4)) & shard_mask_];
+}
+
+void CachingBackend::Fetch(const std::string &key, Callback done)
+{
+    Shard &shard = ShardOf(key);
+    std::unique_lock<std::mutex> lock(shard.mu);
+    auto cached = shard.index.find(key);
+    if (cached != shard.index.end())
+    {
+        Lru::iterator it = cached->second;
+        if (it->expires > std::chrono::steady_clock::now())
+        {
+            bool found = it->found;
+            std::string value = it->value;
+            Touch(shard, it);
+            lock.unlock();
+            done(found, value);
+            return;
+        }
+        Erase(shard, it);
+    }
+    auto [waiters, first] = shard.fetching.try_emplace(key);
+    waiters->second.push_back(std::move(done));
+    if (!first)
+    {
+        // A fetch for this key is already out; it answers us too.
+        return;
+    }
+    lock.unlock();
+
+    backend_->Fetch(key, [this, key](bool found, const std::string &value) {
+        Shard &shard = ShardOf(key);
+        std::vector<Callback> waiters;
+        {
+            std::lock_guard<std::mutex> lock(shard.mu);
+            Insert(shard, key, found, value);
+            auto it = shard.fetching.find(key);
+            waiters.swap(it->second);
+            shard.fetching.erase(it);
+        }
+        for (Callback &waiter : waiters)
+        {
+            waiter(found, value);
+        }
+    });
+}
+
+void CachingBackend::Touch(Shard &shard, Lru::iterator it)
+{
+    if (it->in_protected)
+    {
+        shard.protected_lru.splice(shard.protected_lru.begin(), shard.protected_lru, it);
+        return;
+    }
+    // Second hit: promote, demoting the coldest protected entries to the
+    // head of probation if that overfills the protected segment.
+    size_t cost = Cost(*it);
+    shard.protected_lru.splice(shard.protected_lru.begin(), shard.probation_lru, it);
+    it->in_protected = true;
+    shard.probation_bytes -= cost;
+    shard.protected_bytes += cost;
+    while (shard.protected_bytes > protected_bytes_ && shard.protected_lru.size() > 1)
+    {
+        Lru::iterator coldest = std::prev(shard.protected_lru.end());
+        size_t coldest_cost = Cost(*coldest);
+        shard.probation_lru.splice(shard.probation_lru.begin(), shard.protected_lru, coldest);
+        coldest->in_protected = false;
+        shard.protected_bytes -= coldest_cost;
+        shard.probation_bytes += coldest_cost;
+    }
+}
+
+void CachingBackend::Insert(Shard &shard, const std::string &key, bool found, const std::string &value)
+{
+    auto existing = shard.index.find(key);
+    if (existing != shard.index.end())
+    {
+        Erase(shard, existing->second);
+    }
+    Entry entry{key, found ? value : std::string(), found, false, std::chrono::steady_clock::now() + ttl_};
+    size_t cost = Cost(entry);
+    if (cost > shard_bytes_)
+    {
+        // Would evict everything else and still not fit.
+        return;
+    }
+    shard.probation_lru.push_front(std::move(entry));
+    shard.index.emplace(key, shard.probation_lru.begin());
+    shard.probation_bytes += cost;
+    EvictOverflow(shard);
+}
+
+void CachingBackend::Erase(Shard &shard, Lru::iterator it)
+{
+    size_t cost = Cost(*it);
+    (it->in_protected ? shard.protected_bytes : shard.probation_bytes) -= cost;
+    shard.index.erase(it->key);
+    (it->in_protected ? shard.protected_lru : shard.probation_lru).erase(it);
+}
+
+void CachingBackend::EvictOverflow(Shard &shard)
+{
+    while (shard.probation_bytes + shard.protected_bytes > shard_bytes_)
+    {
+        Lru &victims = shard.probation_lru.empty() ? shard.protected_lru : shard.probation_lru;
+        Erase(shard, std::prev(victims.end()));
+    }
+}
+
+} // namespace keyvaluestore
@@ -0,0 +1,87 @@
+#ifndef GRPC_COMMON_CPP_KEYVALUESTORE_VALUE_CACHE_H_
+#define GRPC_COMMON_CPP_KEYVALUESTORE_VALUE_CACHE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "backend.h"
+
+namespace keyvaluestore
+{
+
+// Memory-bounded cache in front of another backend, itself usable as one.
+//
+// Each shard is a segmented LRU: new entries start on probation and move to
+// the protected segment on their second hit, so a scan over many cold keys
+// only churns probation and leaves the hot set alone. Entries expire |ttl|
+// after they were fetched, and answers for unknown keys are cached too.
+// Concurrent misses on a key share one backend fetch: later callers queue up
+// behind the first and are all answered when it returns.
+class CachingBackend : public Backend
+{
+  public:
+    struct Options
+    {
+        // Budget for keys, values and per-entry bookkeeping, split evenly
+        // over the shards.
+        size_t max_bytes = 64 << 20;
+        // Share of a shard's budget that protected entries may hold.
+        double protected_ratio = 0.8;
+        std::chrono::steady_clock::duration ttl = std::chrono::minutes(1);
+        size_t shards = 16;
+    };
+
+    CachingBackend(Backend *backend, const Options &options);
+
+    void Fetch(const std::string &key, Callback done) override;
+
+  private:
+    struct Entry
+    {
+        std::string key;
+        std::string value;
+        bool found;
+        bool in_protected;
+        std::chrono::steady_clock::time_point expires;
+    };
+    using Lru = std::list<Entry>;
+
+    struct alignas(64) Shard
+    {
+        std::mutex mu;
+        // Most recently used first.
+        Lru probation_lru;
+        Lru protected_lru;
+        size_t probation_bytes = 0;
+        size_t protected_bytes = 0;
+        std::unordered_map<std::string, Lru::iterator> index;
+        // Callers waiting for the fetch in flight for a key.
+        std::unordered_map<std::string, std::vector<Callback>> fetching;
+    };
+
+    static size_t Cost(const Entry &entry);
+    Shard &ShardOf(const std::string &key);
+    // Hit path: moves |it| towards the protected head.
+    void Touch(Shard &shard, Lru::iterator it);
+    void Insert(Shard &shard, const std::string &key, bool found, const std::string &value);
+    void Erase(Shard &shard, Lru::iterator it);
+    void EvictOverflow(Shard &shard);
+
+    Backend *backend_;
+    size_t shard_bytes_;
+    size_t protected_bytes_;
+    std::chrono::steady_clock::duration ttl_;
+    std::unique_ptr<Shard[]> shards_;
+    size_t shard_mask_;
+};
+
+} // namespace keyvaluestore
+
+#endif // GRPC_COMMON_CPP_KEYVALUESTORE_VALUE_CACHE_H_
@@ -0,0 +1,16 @@
+#include "feature_cache.h"
+
+#include <utility>
+
+namespace routeguide
+{
+
+FeatureCache::FeatureCache(std::shared_ptr<const FeatureStore> store) : store_(std::move(store))
+{
+    std::string_view encoded = store_->encoded_features();
+    blob_ = grpc::Slice(const_cast<char *>(encoded.data()), encoded.size(),
+                        [](void *store) { delete static_cast<std::shared_ptr<const FeatureStore> *>(store); },
+                        new std::shared_ptr<const FeatureStore>(store_));
+}
+
+} // namespace routeguide
@@ -0,0 +1,46 @@
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_CACHE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include <grpcpp/support/slice.h>
+
+#include "feature_store.h"
+
+namespace routeguide
+{
+
+// Hands out the wire encoding of the Features of a store, which the store
+// serialized as it was built, so that GetFeature and ListFeatures can answer
+// with raw bytes. It copies nothing: one refcounted slice covers the store's
+// encoded section, mapped pages included, and holds a reference to the store.
+// Serialized() hands out sub-slices of it, which keep the bytes alive for as
+// long as the transport holds them, even after the cache itself is dropped.
+class FeatureCache
+{
+  public:
+    explicit FeatureCache(std::shared_ptr<const FeatureStore> store);
+
+    const std::shared_ptr<const FeatureStore> &store() const
+    {
+        return store_;
+    }
+
+    // The serialized Feature at |index| of store().
+    grpc::Slice Serialized(uint32_t index) const
+    {
+        std::string_view encoded = store_->encoded(index);
+        size_t start = encoded.data() - reinterpret_cast<const char *>(blob_.begin());
+        return blob_.sub(start, start + encoded.size());
+    }
+
+  private:
+    std::shared_ptr<const FeatureStore> store_;
+    grpc::Slice blob_;
+};
+
+} // namespace routeguide
+
+#endif // GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_CACHE_H_
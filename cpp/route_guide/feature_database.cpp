@@ -0,0 +1,137 @@
+#include "feature_database.h"
+
+#include <sys/stat.h>
+#include <vector>
+
+#include "common/logging.h"
+
+namespace routeguide
+{
+
+FeatureDatabase::FeatureDatabase(std::string db_path) : db_path_(std::move(db_path))
+{
+    if (!Reload())
+    {
+        current_.store(std::make_shared<const FeatureStore>(std::vector<Feature>()));
+    }
+}
+
+FeatureDatabase::~FeatureDatabase()
+{
+    {
+        std::lock_guard<std::mutex> lock(watch_mu_);
+        stopping_ = true;
+    }
+    watch_cv_.notify_all();
+    if (watcher_.joinable())
+    {
+        watcher_.join();
+    }
+}
+
+FeatureDatabase::FileVersion FeatureDatabase::StatFile() const
+{
+    FileVersion version;
+    struct stat st;
+    if (stat(db_path_.c_str(), &st) == 0)
+    {
+        version.inode = st.st_ino;
+        version.size = st.st_size;
+        version.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+    return version;
+}
+
+bool FeatureDatabase::Reload()
+{
+    std::lock_guard<std::mutex> lock(reload_mu_);
+    // Stat before loading: a write that lands while the file is being read
+    // leaves a newer version behind and triggers one more reload. A file that
+    // fails to load is not retried until it changes again.
+    seen_version_ = StatFile();
+    std::shared_ptr<const FeatureStore> store = FeatureStore::Open(db_path_);
+    if (!store)
+    {
+        LOG(WARNING) << "Reload of " << db_path_ << " failed, keeping the current features.";
+        return false;
+    }
+    current_.store(std::move(store), std::memory_order_release);
+    return true;
+}
+
+bool FeatureDatabase::ReloadInBackground(std::function<void(bool reloaded)> done)
+{
+    {
+        std::lock_guard<std::mutex> lock(watch_mu_);
+        if (stopping_ || requested_ || reloading_)
+        {
+            return false;
+        }
+        requested_ = std::move(done);
+        if (!watcher_.joinable())
+        {
+            watcher_ = std::thread(&FeatureDatabase::WatchLoop, this);
+        }
+    }
+    watch_cv_.notify_all();
+    return true;
+}
+
+void FeatureDatabase::Watch(std::chrono::milliseconds interval)
+{
+    {
+        std::lock_guard<std::mutex> lock(watch_mu_);
+        watch_interval_ = interval;
+        if (!watcher_.joinable())
+        {
+            watcher_ = std::thread(&FeatureDatabase::WatchLoop, this);
+        }
+    }
+    watch_cv_.notify_all();
+}
+
+void FeatureDatabase::WatchLoop()
+{
+    std::unique_lock<std::mutex> lock(watch_mu_);
+    // A reload that was asked for still runs when stopping, so that whoever
+    // asked hears back.
+    auto woken = [this] { return stopping_ || requested_; };
+    while (true)
+    {
+        bool asked = true;
+        if (watch_interval_.count() > 0)
+        {
+            asked = watch_cv_.wait_for(lock, watch_interval_, woken);
+        }
+        else
+        {
+            watch_cv_.wait(lock, woken);
+        }
+        std::function<void(bool)> done = std::move(requested_);
+        requested_ = nullptr;
+        if (!done && stopping_)
+        {
+            return;
+        }
+        if (!asked)
+        {
+            FileVersion version = StatFile();
+            std::lock_guard<std::mutex> reload_lock(reload_mu_);
+            if (version.inode == 0 || version == seen_version_)
+            {
+                continue;
+            }
+        }
+        reloading_ = true;
+        lock.unlock();
+        bool reloaded = Reload();
+        if (done)
+        {
+            done(reloaded);
+        }
+        lock.lock();
+        reloading_ = false;
+    }
+}
+
+} // namespace routeguide
@@ -0,0 +1,82 @@
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_DATABASE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_DATABASE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "feature_store.h"
+
+namespace routeguide
+{
+
+// The feature database of a running server. Reload() builds a new store off
+// to the side and publishes it with one atomic pointer swap, RCU style: RPCs
+// hold the store they got from Get() for their whole life, so a reload never
+// changes data under a running ListFeatures stream, and the previous store is
+// released when its last reader drops it.
+class FeatureDatabase
+{
+  public:
+    // Loads |db_path|; if that fails the server starts with an empty store and
+    // picks the data up on the next successful reload.
+    explicit FeatureDatabase(std::string db_path);
+    ~FeatureDatabase();
+
+    std::shared_ptr<const FeatureStore> Get() const
+    {
+        return current_.load(std::memory_order_acquire);
+    }
+
+    // Loads the database file again and swaps it in. Keeps serving the current
+    // store and returns false if the file cannot be loaded.
+    bool Reload();
+
+    // Reloads on the watcher thread, starting it if Watch() has not, and
+    // then calls |done| there with what Reload() returned. Returns false,
+    // without calling |done|, while another reload is queued or running.
+    bool ReloadInBackground(std::function<void(bool reloaded)> done);
+
+    // Starts a background thread that checks the file every |interval| and
+    // reloads it when it has been modified or replaced. Snapshots must be
+    // replaced by rename, as route_guide_snapshot does: a mapped snapshot that
+    // is truncated in place faults the RPCs still reading it.
+    void Watch(std::chrono::milliseconds interval);
+
+  private:
+    struct FileVersion
+    {
+        bool operator==(const FileVersion &) const = default;
+        uint64_t inode = 0;
+        int64_t size = 0;
+        int64_t mtime_ns = 0;
+    };
+    FileVersion StatFile() const;
+    void WatchLoop();
+
+    const std::string db_path_;
+    std::atomic<std::shared_ptr<const FeatureStore>> current_;
+
+    std::mutex reload_mu_; // serializes Reload()
+    FileVersion seen_version_;
+
+    std::mutex watch_mu_;
+    std::condition_variable watch_cv_;
+    bool stopping_ = false;
+    // Zero while the file is not watched.
+    std::chrono::milliseconds watch_interval_{0};
+    // The reload asked for by ReloadInBackground(), and whether one is
+    // running; both guarded by |watch_mu_|.
+    std::function<void(bool)> requested_;
+    bool reloading_ = false;
+    std::thread watcher_;
+};
+
+} // namespace routeguide
+
+#endif // GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_DATABASE_H_
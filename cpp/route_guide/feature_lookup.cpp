@@ -0,0 +1,61 @@
+#include "feature_lookup.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace routeguide
+{
+
+FeatureLookup::FeatureLookup(RouteGuide::Stub *stub, int window, int deadline_ms)
+    : stub_(stub), deadline_ms_(deadline_ms)
+{
+    for (int i = 0; i < (std::max)(window, 1); i++)
+    {
+        slots_.push_back(std::make_unique<Slot>());
+    }
+}
+
+void FeatureLookup::Run(const std::vector<Point> &points, Callback on_result)
+{
+    points_ = &points;
+    on_result_ = std::move(on_result);
+    next_.store(0, std::memory_order_relaxed);
+    remaining_ = points.size();
+    for (const std::unique_ptr<Slot> &slot : slots_)
+    {
+        Start(slot.get());
+    }
+    std::unique_lock<std::mutex> lock(mu_);
+    done_cv_.wait(lock, [this] { return remaining_ == 0; });
+    on_result_ = nullptr;
+}
+
+void FeatureLookup::Start(Slot *slot)
+{
+    size_t index = next_.fetch_add(1, std::memory_order_relaxed);
+    if (index >= points_->size())
+    {
+        return;
+    }
+    slot->index = index;
+    slot->context.emplace();
+    if (deadline_ms_ > 0)
+        slot->context->set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(deadline_ms_));
+    stub_->async()->GetFeature(&*slot->context, &(*points_)[index], &slot->feature,
+                               [this, slot](grpc::Status status) { OnDone(slot, status); });
+}
+
+void FeatureLookup::OnDone(Slot *slot, const grpc::Status &status)
+{
+    on_result_(slot->index, status, slot->feature);
+    slot->context.reset();
+    Start(slot);
+    std::lock_guard<std::mutex> lock(mu_);
+    if (--remaining_ == 0)
+    {
+        done_cv_.notify_all();
+    }
+}
+
+} // namespace routeguide
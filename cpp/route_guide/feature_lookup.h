@@ -0,0 +1,64 @@
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_LOOKUP_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_LOOKUP_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "route_guide.grpc.pb.h"
+
+namespace routeguide
+{
+
+// Batch GetFeature client: keeps up to |window| calls in flight on one stub
+// and starts the next lookup from the completion of the previous one, so a
+// batch takes about points / window round trips instead of one per point.
+class FeatureLookup
+{
+  public:
+    // Called once per point, from a gRPC thread and in completion order;
+    // |index| is the position of the point in the batch. Calls for different
+    // points may run concurrently.
+    using Callback = std::function<void(size_t index, const grpc::Status &status, const Feature &feature)>;
+
+    // Each lookup gets |deadline_ms| from its start; none for 0.
+    FeatureLookup(RouteGuide::Stub *stub, int window, int deadline_ms = 0);
+
+    // Looks up every point of |points| and returns once |on_result| has
+    // been called for all of them. |points| must stay unchanged until then.
+    void Run(const std::vector<Point> &points, Callback on_result);
+
+  private:
+    // One in-flight call; reused for the next point once it completes.
+    struct Slot
+    {
+        std::optional<grpc::ClientContext> context;
+        size_t index = 0;
+        Feature feature;
+    };
+
+    void Start(Slot *slot);
+    void OnDone(Slot *slot, const grpc::Status &status);
+
+    RouteGuide::Stub *stub_;
+    int deadline_ms_;
+    std::vector<std::unique_ptr<Slot>> slots_;
+    const std::vector<Point> *points_ = nullptr;
+    Callback on_result_;
+    std::atomic<size_t> next_{0};
+
+    std::mutex mu_;
+    std::condition_variable done_cv_;
+    size_t remaining_ = 0;
+};
+
+} // namespace routeguide
+
+#endif // GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_LOOKUP_H_
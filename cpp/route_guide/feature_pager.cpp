@@ -0,0 +1,108 @@
+#include "feature_pager.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "helper.h"
+
+namespace routeguide
+{
+
+namespace
+{
+
+// Token layout: store checksum, rectangle hash, next index and store size;
+// little endian as the host writes it, since tokens only round-trip through
+// the same servers.
+struct PageToken
+{
+    uint64_t store_checksum;
+    uint64_t rectangle_hash;
+    uint32_t index;
+    uint32_t store_size;
+};
+
+// Hash of the area covered by |rectangle|, whichever corners it names.
+uint64_t HashRectangle(const Rectangle &rectangle)
+{
+    int32_t left = (std::min)(rectangle.lo().longitude(), rectangle.hi().longitude());
+    int32_t right = (std::max)(rectangle.lo().longitude(), rectangle.hi().longitude());
+    int32_t top = (std::max)(rectangle.lo().latitude(), rectangle.hi().latitude());
+    int32_t bottom = (std::min)(rectangle.lo().latitude(), rectangle.hi().latitude());
+    return HashPoint(bottom, left) * 31 + HashPoint(top, right);
+}
+
+} // namespace
+
+FeaturePager::FeaturePager(std::shared_ptr<const FeatureStore> store, const ListFeaturesRequest &request)
+    : store_(std::move(store)), cursor_(store_->Query(request.rectangle())),
+      rectangle_hash_(HashRectangle(request.rectangle()))
+{
+    if (request.page_size() < 0 || request.max_results() < 0)
+    {
+        status_ = grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "page_size and max_results must not be negative");
+        return;
+    }
+    if (request.page_size() > 0)
+    {
+        page_size_ = (std::min)(request.page_size(), kMaxPageSize);
+    }
+    if (request.max_results() > 0)
+    {
+        remaining_ = request.max_results();
+    }
+    const std::string &token = request.page_token();
+    if (!token.empty())
+    {
+        PageToken t;
+        if (token.size() != sizeof(t))
+        {
+            status_ = grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "malformed page_token");
+            return;
+        }
+        std::memcpy(&t, token.data(), sizeof(t));
+        if (t.rectangle_hash != rectangle_hash_)
+        {
+            status_ = grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "page_token was issued for another rectangle");
+            return;
+        }
+        if (t.store_checksum != store_->checksum() || t.store_size != store_->size())
+        {
+            status_ = grpc::Status(grpc::StatusCode::ABORTED, "feature database changed since page_token was issued");
+            return;
+        }
+        cursor_.Seek(t.index);
+    }
+    next_ = cursor_.Next();
+}
+
+bool FeaturePager::Next(FeaturePage *page)
+{
+    if (!status_.ok() || next_ == FeatureStore::kNotFound || remaining_ == 0)
+    {
+        return false;
+    }
+    // Clear() keeps the Feature objects of the previous page for reuse.
+    page->Clear();
+    int64_t n = (std::min)(static_cast<int64_t>(page_size_), remaining_);
+    remaining_ -= n;
+    while (n-- > 0 && next_ != FeatureStore::kNotFound)
+    {
+        store_->GetFeature(next_, page->add_features());
+        next_ = cursor_.Next();
+    }
+    if (next_ != FeatureStore::kNotFound)
+    {
+        page->set_next_page_token(Token(next_));
+    }
+    return true;
+}
+
+std::string FeaturePager::Token(uint32_t index) const
+{
+    PageToken t = {store_->checksum(), rectangle_hash_, index, static_cast<uint32_t>(store_->size())};
+    return std::string(reinterpret_cast<const char *>(&t), sizeof(t));
+}
+
+} // namespace routeguide
@@ -0,0 +1,61 @@
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_PAGER_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_PAGER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <grpcpp/support/status.h>
+
+#include "feature_store.h"
+#include "route_guide.pb.h"
+
+namespace routeguide
+{
+
+// Splits the answer to a ListFeaturesRequest into FeaturePages, shared by the
+// ListFeaturePages handlers of both servers.
+//
+// A page token holds the index of the next feature together with the
+// rectangle and the checksum of the store it was issued for; features are
+// returned in index order, so resuming is a Seek() on a new cursor. A token
+// replayed against a reloaded database with other contents, even of the same
+// size, is refused rather than silently skipping or repeating features. Every
+// server process with the same features accepts it.
+class FeaturePager
+{
+  public:
+    static constexpr int kDefaultPageSize = 100;
+    static constexpr int kMaxPageSize = 10000;
+
+    FeaturePager(std::shared_ptr<const FeatureStore> store, const ListFeaturesRequest &request);
+
+    // INVALID_ARGUMENT for negative sizes or a token issued for another
+    // rectangle, ABORTED for a token issued by another database, else OK.
+    // Next() returns nothing unless this is OK.
+    const grpc::Status &status() const
+    {
+        return status_;
+    }
+
+    // Fills |page| with the next page; false once the listing is over.
+    bool Next(FeaturePage *page);
+
+  private:
+    std::string Token(uint32_t index) const;
+
+    // The listing finishes on the store it started on, even across a reload.
+    std::shared_ptr<const FeatureStore> store_;
+    FeatureStore::Cursor cursor_;
+    uint64_t rectangle_hash_;
+    grpc::Status status_;
+    int page_size_ = kDefaultPageSize;
+    int64_t remaining_ = INT64_MAX;
+    // Index of the next feature to return, read ahead so that the last page
+    // knows whether a token is needed.
+    uint32_t next_ = FeatureStore::kNotFound;
+};
+
+} // namespace routeguide
+
+#endif // GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_PAGER_H_
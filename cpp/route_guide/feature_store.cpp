@@ -0,0 +1,503 @@
+#include "feature_store.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helper.h"
+
+namespace routeguide
+{
+
+// Snapshot layout: this header, then each section below padded to 8 bytes, in
+// this order. Everything is stored in host byte order.
+//   int32_t  latitudes[feature_count]
+//   int32_t  longitudes[feature_count]
+//   uint64_t name_offsets[feature_count + 1]
+//   uint32_t cell_offsets[rows * columns + 1]
+//   uint32_t hash_slots[hash_capacity]
+//   uint64_t encoded_offsets[feature_count + 1]
+//   char     names[names_size]
+//   char     encoded[encoded_size]
+struct FeatureStore::Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t feature_count;
+    int32_t rows;
+    int32_t columns;
+    int32_t min_latitude;
+    int32_t min_longitude;
+    int32_t max_latitude;
+    int32_t max_longitude;
+    uint32_t reserved;
+    int64_t cell_height;
+    int64_t cell_width;
+    uint64_t hash_capacity;
+    uint64_t names_size;
+    uint64_t encoded_size;
+    uint64_t image_size;
+    // Hash of every section, see checksum().
+    uint64_t checksum;
+};
+
+namespace
+{
+constexpr char kSnapshotMagic[8] = {'R', 'G', 'F', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t kSnapshotVersion = 3;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+// Average number of features per grid cell the index is sized for.
+constexpr size_t kFeaturesPerCell = 4;
+
+struct Layout
+{
+    size_t latitudes;
+    size_t longitudes;
+    size_t name_offsets;
+    size_t cell_offsets;
+    size_t hash_slots;
+    size_t encoded_offsets;
+    size_t names;
+    size_t encoded;
+    size_t size;
+};
+
+size_t Align(size_t offset)
+{
+    return (offset + 7) & ~static_cast<size_t>(7);
+}
+
+// FNV-1a over 64-bit words, then a final mix so that the high bits depend on
+// every word too.
+uint64_t HashWords(const uint64_t *words, size_t count)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < count; i++)
+        h = (h ^ words[i]) * 0x100000001b3ull;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+template <typename Header> Layout ComputeLayout(const Header &h)
+{
+    Layout l;
+    l.latitudes = Align(sizeof(Header));
+    l.longitudes = Align(l.latitudes + sizeof(int32_t) * h.feature_count);
+    l.name_offsets = Align(l.longitudes + sizeof(int32_t) * h.feature_count);
+    l.cell_offsets = Align(l.name_offsets + sizeof(uint64_t) * (h.feature_count + 1));
+    l.hash_slots =
+        Align(l.cell_offsets + sizeof(uint32_t) * (static_cast<size_t>(h.rows) * h.columns + 1));
+    l.encoded_offsets = Align(l.hash_slots + sizeof(uint32_t) * h.hash_capacity);
+    l.names = Align(l.encoded_offsets + sizeof(uint64_t) * (h.feature_count + 1));
+    l.encoded = Align(l.names + h.names_size);
+    l.size = Align(l.encoded + h.encoded_size);
+    return l;
+}
+
+// Feature |f| as GetFeature() gives it back, so that its encoding is the one
+// a server would have produced from the store.
+Feature Canonical(const Feature &f)
+{
+    Feature canonical;
+    canonical.set_name(f.name());
+    canonical.mutable_location()->set_latitude(f.location().latitude());
+    canonical.mutable_location()->set_longitude(f.location().longitude());
+    return canonical;
+}
+} // namespace
+
+std::unique_ptr<FeatureStore> FeatureStore::Open(const std::string &db_path)
+{
+    int fd = open(db_path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        std::cout << "Failed to open " << db_path << std::endl;
+        if (fd >= 0)
+            close(fd);
+        return nullptr;
+    }
+    char magic[sizeof(kSnapshotMagic)] = {};
+    bool is_snapshot = pread(fd, magic, sizeof(magic), 0) == static_cast<ssize_t>(sizeof(magic)) &&
+                       memcmp(magic, kSnapshotMagic, sizeof(magic)) == 0;
+    if (!is_snapshot)
+    {
+        close(fd);
+        std::vector<Feature> feature_list;
+        if (!LoadDb(db_path, &feature_list))
+        {
+            return nullptr;
+        }
+        return std::make_unique<FeatureStore>(feature_list);
+    }
+
+    // Shared read-only mapping: pages come straight from the page cache and
+    // are shared by every process that maps the same snapshot.
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        std::cout << "Failed to map " << db_path << std::endl;
+        return nullptr;
+    }
+    std::unique_ptr<FeatureStore> store(new FeatureStore());
+    store->mapping_ = data;
+    store->mapping_size_ = st.st_size;
+    if (!store->Attach(static_cast<const char *>(data), st.st_size) || !store->CheckSections())
+    {
+        std::cout << "Invalid feature snapshot " << db_path << std::endl;
+        return nullptr;
+    }
+    std::cout << "Snapshot mapped, loaded " << store->size() << " features." << std::endl;
+    return store;
+}
+
+FeatureStore::FeatureStore(const std::vector<Feature> &features)
+{
+    Header h = {};
+    memcpy(h.magic, kSnapshotMagic, sizeof(h.magic));
+    h.version = kSnapshotVersion;
+    h.byte_order = kByteOrderMark;
+    h.feature_count = static_cast<uint32_t>(features.size());
+    h.max_latitude = -1;
+    h.max_longitude = -1;
+    h.cell_height = 1;
+    h.cell_width = 1;
+    h.hash_capacity = 1;
+    if (!features.empty())
+    {
+        h.min_latitude = h.max_latitude = features.front().location().latitude();
+        h.min_longitude = h.max_longitude = features.front().location().longitude();
+        for (const Feature &f : features)
+        {
+            h.min_latitude = (std::min)(h.min_latitude, f.location().latitude());
+            h.max_latitude = (std::max)(h.max_latitude, f.location().latitude());
+            h.min_longitude = (std::min)(h.min_longitude, f.location().longitude());
+            h.max_longitude = (std::max)(h.max_longitude, f.location().longitude());
+            h.names_size += f.name().size();
+            h.encoded_size += Canonical(f).ByteSizeLong();
+        }
+        // Square-ish grid with roughly kFeaturesPerCell features per cell on
+        // average; empty cells only cost one offset each.
+        size_t cells = (std::max)(static_cast<size_t>(1), features.size() / kFeaturesPerCell);
+        int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(cells))));
+        int64_t height = static_cast<int64_t>(h.max_latitude) - h.min_latitude + 1;
+        int64_t width = static_cast<int64_t>(h.max_longitude) - h.min_longitude + 1;
+        h.cell_height = (height + side - 1) / side;
+        h.cell_width = (width + side - 1) / side;
+        h.rows = static_cast<int32_t>((height + h.cell_height - 1) / h.cell_height);
+        h.columns = static_cast<int32_t>((width + h.cell_width - 1) / h.cell_width);
+        // Load factor of at most 1/2 keeps the linear probes short.
+        while (h.hash_capacity < 2 * features.size())
+            h.hash_capacity <<= 1;
+    }
+    Layout layout = ComputeLayout(h);
+    h.image_size = layout.size;
+
+    owned_.assign(layout.size / sizeof(uint64_t), 0);
+    char *image = reinterpret_cast<char *>(owned_.data());
+    memcpy(image, &h, sizeof(h));
+    // Attach() only reads the header to place the sections, so the arrays can
+    // be filled in through the (still writable) image below.
+    Attach(image, layout.size);
+    int32_t *latitudes = reinterpret_cast<int32_t *>(image + layout.latitudes);
+    int32_t *longitudes = reinterpret_cast<int32_t *>(image + layout.longitudes);
+    uint64_t *name_offsets = reinterpret_cast<uint64_t *>(image + layout.name_offsets);
+    uint32_t *cell_offsets = reinterpret_cast<uint32_t *>(image + layout.cell_offsets);
+    uint32_t *hash_slots = reinterpret_cast<uint32_t *>(image + layout.hash_slots);
+    uint64_t *encoded_offsets = reinterpret_cast<uint64_t *>(image + layout.encoded_offsets);
+    char *names = image + layout.names;
+    char *encoded = image + layout.encoded;
+
+    // Counting sort of the features by cell, stable within a cell.
+    std::vector<uint32_t> cell_of(features.size());
+    for (size_t i = 0; i < features.size(); i++)
+    {
+        const Point &p = features[i].location();
+        cell_of[i] = RowOf(p.latitude()) * h.columns + ColumnOf(p.longitude());
+        cell_offsets[cell_of[i] + 1]++;
+    }
+    size_t cells = static_cast<size_t>(h.rows) * h.columns;
+    for (size_t c = 0; c < cells; c++)
+        cell_offsets[c + 1] += cell_offsets[c];
+    std::vector<uint32_t> order(features.size());
+    std::vector<uint32_t> fill(cell_offsets, cell_offsets + cells);
+    for (size_t i = 0; i < features.size(); i++)
+        order[fill[cell_of[i]]++] = static_cast<uint32_t>(i);
+
+    uint64_t name_offset = 0;
+    uint64_t encoded_offset = 0;
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        const Feature &f = features[order[i]];
+        latitudes[i] = f.location().latitude();
+        longitudes[i] = f.location().longitude();
+        name_offsets[i] = name_offset;
+        memcpy(names + name_offset, f.name().data(), f.name().size());
+        name_offset += f.name().size();
+        Feature canonical = Canonical(f);
+        size_t encoded_size = canonical.ByteSizeLong();
+        encoded_offsets[i] = encoded_offset;
+        canonical.SerializeToArray(encoded + encoded_offset, static_cast<int>(encoded_size));
+        encoded_offset += encoded_size;
+        // Duplicate points share a cell and keep their relative order, so the
+        // first loaded feature is the one that ends up in the table.
+        if (Find(f.location()) == kNotFound)
+        {
+            uint64_t slot = HashPoint(latitudes[i], longitudes[i]) & hash_mask_;
+            while (hash_slots[slot] != 0)
+                slot = (slot + 1) & hash_mask_;
+            hash_slots[slot] = i + 1;
+        }
+    }
+    name_offsets[order.size()] = name_offset;
+    encoded_offsets[order.size()] = encoded_offset;
+
+    // The sections are 8-byte aligned and their padding is zero, so the same
+    // features always give the same checksum.
+    const uint64_t *sections = owned_.data() + layout.latitudes / sizeof(uint64_t);
+    reinterpret_cast<Header *>(image)->checksum =
+        HashWords(sections, (layout.size - layout.latitudes) / sizeof(uint64_t));
+}
+
+FeatureStore::~FeatureStore()
+{
+    if (mapping_ != nullptr)
+    {
+        munmap(mapping_, mapping_size_);
+    }
+}
+
+bool FeatureStore::Attach(const char *data, size_t size)
+{
+    if (size < sizeof(Header))
+        return false;
+    const Header *h = reinterpret_cast<const Header *>(data);
+    if (memcmp(h->magic, kSnapshotMagic, sizeof(h->magic)) != 0 || h->version != kSnapshotVersion ||
+        h->byte_order != kByteOrderMark || h->image_size != size || h->rows < 0 || h->columns < 0 ||
+        h->cell_height <= 0 || h->cell_width <= 0)
+        return false;
+    // A full table leaves lookups that miss probing forever. The size bounds
+    // keep ComputeLayout() from overflowing.
+    if (h->hash_capacity == 0 || (h->hash_capacity & (h->hash_capacity - 1)) != 0 ||
+        h->hash_capacity <= h->feature_count || h->hash_capacity > size / sizeof(uint32_t) ||
+        static_cast<uint64_t>(h->rows) * h->columns > size / sizeof(uint32_t) || h->names_size > size ||
+        h->encoded_size > size)
+        return false;
+    // Cursors index the grid from the bounding box, which must lie inside it.
+    if (h->feature_count != 0 &&
+        (h->min_latitude > h->max_latitude || h->min_longitude > h->max_longitude ||
+         (static_cast<int64_t>(h->max_latitude) - h->min_latitude) / h->cell_height >= h->rows ||
+         (static_cast<int64_t>(h->max_longitude) - h->min_longitude) / h->cell_width >= h->columns))
+        return false;
+    Layout layout = ComputeLayout(*h);
+    if (layout.size != size)
+        return false;
+
+    header_ = h;
+    count_ = h->feature_count;
+    latitudes_ = reinterpret_cast<const int32_t *>(data + layout.latitudes);
+    longitudes_ = reinterpret_cast<const int32_t *>(data + layout.longitudes);
+    name_offsets_ = reinterpret_cast<const uint64_t *>(data + layout.name_offsets);
+    cell_offsets_ = reinterpret_cast<const uint32_t *>(data + layout.cell_offsets);
+    hash_slots_ = reinterpret_cast<const uint32_t *>(data + layout.hash_slots);
+    encoded_offsets_ = reinterpret_cast<const uint64_t *>(data + layout.encoded_offsets);
+    names_ = data + layout.names;
+    encoded_ = data + layout.encoded;
+    hash_mask_ = h->hash_capacity - 1;
+    return true;
+}
+
+bool FeatureStore::CheckSections() const
+{
+    if (name_offsets_[0] != 0 || name_offsets_[count_] != header_->names_size || encoded_offsets_[0] != 0 ||
+        encoded_offsets_[count_] != header_->encoded_size || cell_offsets_[0] != 0)
+        return false;
+    for (uint32_t i = 0; i < count_; i++)
+    {
+        if (name_offsets_[i + 1] < name_offsets_[i] || encoded_offsets_[i + 1] < encoded_offsets_[i])
+            return false;
+    }
+    size_t cells = static_cast<size_t>(header_->rows) * header_->columns;
+    for (size_t c = 0; c < cells; c++)
+    {
+        if (cell_offsets_[c + 1] < cell_offsets_[c])
+            return false;
+    }
+    if (cell_offsets_[cells] != count_)
+        return false;
+    uint64_t used = 0;
+    for (uint64_t slot = 0; slot <= hash_mask_; slot++)
+    {
+        if (hash_slots_[slot] > count_)
+            return false;
+        used += hash_slots_[slot] != 0;
+    }
+    if (used >= header_->hash_capacity)
+        return false;
+    const char *image = reinterpret_cast<const char *>(header_);
+    const char *sections = reinterpret_cast<const char *>(latitudes_);
+    return HashWords(reinterpret_cast<const uint64_t *>(sections),
+                     (header_->image_size - (sections - image)) / sizeof(uint64_t)) == header_->checksum;
+}
+
+bool FeatureStore::WriteSnapshot(const std::string &path) const
+{
+    // Write next to the target and rename over it: servers that still map the
+    // previous snapshot keep reading the old inode.
+    std::string tmp_path = path + ".tmp";
+    FILE *out = fopen(tmp_path.c_str(), "wb");
+    if (out == nullptr)
+    {
+        std::cout << "Failed to open " << tmp_path << std::endl;
+        return false;
+    }
+    bool ok = fwrite(header_, 1, header_->image_size, out) == header_->image_size;
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        std::cout << "Failed to write " << path << std::endl;
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+uint64_t FeatureStore::checksum() const
+{
+    return header_->checksum;
+}
+
+std::string_view FeatureStore::encoded_features() const
+{
+    return std::string_view(encoded_, header_->encoded_size);
+}
+
+int FeatureStore::ColumnOf(int32_t longitude) const
+{
+    return static_cast<int>((static_cast<int64_t>(longitude) - header_->min_longitude) / header_->cell_width);
+}
+
+int FeatureStore::RowOf(int32_t latitude) const
+{
+    return static_cast<int>((static_cast<int64_t>(latitude) - header_->min_latitude) / header_->cell_height);
+}
+
+uint32_t FeatureStore::Find(int32_t latitude, int32_t longitude) const
+{
+    for (uint64_t slot = HashPoint(latitude, longitude) & hash_mask_;; slot = (slot + 1) & hash_mask_)
+    {
+        uint32_t entry = hash_slots_[slot];
+        if (entry == 0)
+        {
+            return kNotFound;
+        }
+        if (latitudes_[entry - 1] == latitude && longitudes_[entry - 1] == longitude)
+        {
+            return entry - 1;
+        }
+    }
+}
+
+std::string_view FeatureStore::GetFeatureName(const Point &point) const
+{
+    uint32_t index = Find(point);
+    return index == kNotFound ? std::string_view() : name(index);
+}
+
+void FeatureStore::GetFeature(uint32_t index, Feature *feature) const
+{
+    std::string_view n = name(index);
+    feature->set_name(n.data(), n.size());
+    feature->mutable_location()->set_latitude(latitudes_[index]);
+    feature->mutable_location()->set_longitude(longitudes_[index]);
+}
+
+FeatureStore::Cursor FeatureStore::Query(const Rectangle &rectangle) const
+{
+    return Cursor(this, rectangle);
+}
+
+FeatureStore::Cursor::Cursor(const FeatureStore *store, const Rectangle &rectangle)
+    : store_(store), left_((std::min)(rectangle.lo().longitude(), rectangle.hi().longitude())),
+      right_((std::max)(rectangle.lo().longitude(), rectangle.hi().longitude())),
+      top_((std::max)(rectangle.lo().latitude(), rectangle.hi().latitude())),
+      bottom_((std::min)(rectangle.lo().latitude(), rectangle.hi().latitude()))
+{
+    const Header *h = store_->header_;
+    if (store_->count_ == 0 || right_ < h->min_longitude || left_ > h->max_longitude || top_ < h->min_latitude ||
+        bottom_ > h->max_latitude)
+    {
+        return;
+    }
+    first_column_ = store_->ColumnOf((std::max)(left_, h->min_longitude));
+    last_column_ = store_->ColumnOf((std::min)(right_, h->max_longitude));
+    row_ = store_->RowOf((std::max)(bottom_, h->min_latitude)) - 1;
+    last_row_ = store_->RowOf((std::min)(top_, h->max_latitude));
+}
+
+uint32_t FeatureStore::Cursor::Next()
+{
+    while (true)
+    {
+        while (next_ < end_)
+        {
+            uint32_t i = next_++;
+            int32_t latitude = store_->latitudes_[i];
+            int32_t longitude = store_->longitudes_[i];
+            if (longitude >= left_ && longitude <= right_ && latitude >= bottom_ && latitude <= top_)
+            {
+                return i;
+            }
+        }
+        if (row_ >= last_row_)
+        {
+            return kNotFound;
+        }
+        // Cells of one row are contiguous, so a row of the query is one range.
+        row_++;
+        size_t row_start = static_cast<size_t>(row_) * store_->header_->columns;
+        next_ = store_->cell_offsets_[row_start + first_column_];
+        end_ = store_->cell_offsets_[row_start + last_column_ + 1];
+    }
+}
+
+void FeatureStore::Cursor::Seek(uint32_t index)
+{
+    while (end_ <= index)
+    {
+        if (row_ >= last_row_)
+        {
+            next_ = end_;
+            return;
+        }
+        row_++;
+        size_t row_start = static_cast<size_t>(row_) * store_->header_->columns;
+        next_ = store_->cell_offsets_[row_start + first_column_];
+        end_ = store_->cell_offsets_[row_start + last_column_ + 1];
+    }
+    next_ = (std::max)(next_, index);
+}
+
+bool FeatureStore::Cursor::Next(Feature *feature)
+{
+    uint32_t index = Next();
+    if (index == kNotFound)
+    {
+        return false;
+    }
+    store_->GetFeature(index, feature);
+    return true;
+}
+
+} // namespace routeguide
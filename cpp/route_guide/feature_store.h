@@ -0,0 +1,162 @@
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_STORE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_STORE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "route_guide.pb.h"
+
+namespace routeguide
+{
+
+// Read-only, indexed view of the feature database shared by the route_guide
+// servers. Exact point lookups go through a hash table keyed on the packed
+// (latitude, longitude) pair. Rectangle queries walk a uniform grid laid over
+// the bounding box of the data, so their cost follows the size of the answer
+// instead of the size of the database.
+//
+// The store is one flat, position-independent image: columnar latitude and
+// longitude arrays, a blob of names, the grid, the hash table and the wire
+// encoding of every feature, serialized once as the store is built. It is
+// either built in memory from the JSON feature list or mapped read-only from a
+// binary snapshot written by WriteSnapshot(), in which case startup does no
+// parsing and server processes on one host share the pages.
+class FeatureStore
+{
+  public:
+    static constexpr uint32_t kNotFound = UINT32_MAX;
+
+    // Opens the database at |db_path|, either a binary snapshot or the JSON
+    // feature list. Returns nullptr if the file cannot be used.
+    static std::unique_ptr<FeatureStore> Open(const std::string &db_path);
+
+    explicit FeatureStore(const std::vector<Feature> &features);
+    ~FeatureStore();
+    FeatureStore(const FeatureStore &) = delete;
+    FeatureStore &operator=(const FeatureStore &) = delete;
+
+    // Writes the image to |path| so that Open() can map it later.
+    bool WriteSnapshot(const std::string &path) const;
+
+    // Returns the index of the first loaded feature located exactly at the
+    // given coordinates, or kNotFound.
+    uint32_t Find(int32_t latitude, int32_t longitude) const;
+    uint32_t Find(const Point &point) const
+    {
+        return Find(point.latitude(), point.longitude());
+    }
+
+    // Returns the name of the feature at |point|, or an empty string.
+    std::string_view GetFeatureName(const Point &point) const;
+
+    void GetFeature(uint32_t index, Feature *feature) const;
+
+    int32_t latitude(uint32_t index) const
+    {
+        return latitudes_[index];
+    }
+    int32_t longitude(uint32_t index) const
+    {
+        return longitudes_[index];
+    }
+    std::string_view name(uint32_t index) const
+    {
+        return std::string_view(names_ + name_offsets_[index], name_offsets_[index + 1] - name_offsets_[index]);
+    }
+    // The Feature at |index| serialized, exactly the bytes GetFeature() and
+    // SerializeToString() would give.
+    std::string_view encoded(uint32_t index) const
+    {
+        return std::string_view(encoded_ + encoded_offsets_[index],
+                                encoded_offsets_[index + 1] - encoded_offsets_[index]);
+    }
+    // Every encoded(i), back to back in index order.
+    std::string_view encoded_features() const;
+    size_t size() const
+    {
+        return count_;
+    }
+    // Identifies the contents: stores of the same features have the same
+    // checksum, in any process and whether built or mapped.
+    uint64_t checksum() const;
+
+    // Resumable iteration over the features that lie inside a rectangle. The
+    // callback reactors hand out one feature per write, so they keep a cursor
+    // around between writes instead of an iterator over the whole database.
+    class Cursor
+    {
+      public:
+        // Returns the index of the next matching feature, or kNotFound once
+        // exhausted.
+        uint32_t Next();
+        // Fills |feature| with the next matching feature; false once exhausted.
+        bool Next(Feature *feature);
+        // Skips the matching features whose index is below |index|. Matches
+        // come in index order, so seeking to the index another cursor of the
+        // same query would return next resumes that query.
+        void Seek(uint32_t index);
+
+      private:
+        friend class FeatureStore;
+        Cursor(const FeatureStore *store, const Rectangle &rectangle);
+
+        const FeatureStore *store_;
+        int32_t left_;
+        int32_t right_;
+        int32_t top_;
+        int32_t bottom_;
+        int first_column_ = 0;
+        int last_column_ = -1;
+        int row_ = 0;
+        int last_row_ = -1;
+        uint32_t next_ = 0;
+        uint32_t end_ = 0;
+    };
+
+    // Features inside |rectangle| (corners in any order, bounds inclusive).
+    Cursor Query(const Rectangle &rectangle) const;
+
+  private:
+    struct Header;
+
+    FeatureStore() = default;
+    // Points the section pointers into |data|; false if the image is invalid.
+    bool Attach(const char *data, size_t size);
+    // Checks the sections Attach() placed: offsets that ascend and end inside
+    // their sections, a hash table with a free slot and no index past the
+    // end, and the checksum. Reads all of them, so it is for images from
+    // outside the process.
+    bool CheckSections() const;
+    int ColumnOf(int32_t longitude) const;
+    int RowOf(int32_t latitude) const;
+
+    // Exactly one of these backs the image.
+    std::vector<uint64_t> owned_;
+    void *mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+
+    const Header *header_ = nullptr;
+    uint32_t count_ = 0;
+    // Features are ordered by grid cell (row-major), keeping the load order
+    // within a cell.
+    const int32_t *latitudes_ = nullptr;
+    const int32_t *longitudes_ = nullptr;
+    // name(i) is names_[name_offsets_[i], name_offsets_[i + 1]).
+    const uint64_t *name_offsets_ = nullptr;
+    const char *names_ = nullptr;
+    // encoded(i) is encoded_[encoded_offsets_[i], encoded_offsets_[i + 1]).
+    const uint64_t *encoded_offsets_ = nullptr;
+    const char *encoded_ = nullptr;
+    // Features [cell_offsets_[c], cell_offsets_[c + 1]) lie in grid cell c.
+    const uint32_t *cell_offsets_ = nullptr;
+    // Open addressing table of feature index + 1, 0 marks a free slot.
+    const uint32_t *hash_slots_ = nullptr;
+    uint64_t hash_mask_ = 0;
+};
+
+} // namespace routeguide
+
+#endif // GRPC_COMMON_CPP_ROUTE_GUIDE_FEATURE_STORE_H_
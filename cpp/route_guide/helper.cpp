@@ -16,13 +16,22 @@
  *
  */
 
+#include "common/logging.h"
 #include "route_guide.grpc.pb.h"
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
-#include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
 namespace routeguide
@@ -33,7 +42,7 @@ std::string GetDbFileContent(std::string db_path)
     std::ifstream db_file(db_path);
     if (!db_file.is_open())
     {
-        std::cout << "Failed to open " << db_path << std::endl;
+        LOG(ERROR) << "Failed to open " << db_path;
         abort();
     }
     std::stringstream db;
@@ -43,121 +52,215 @@ std::string GetDbFileContent(std::string db_path)
 
 // A simple parser for the json db file. It requires the db file to have the
 // exact form of [{"location": { "latitude": 123, "longitude": 456}, "name":
-// "the name can be empty" }, { ... } ... The spaces will be stripped.
+// "the name can be empty" }, { ... } ... Whitespace between tokens is
+// skipped while parsing, so the input is read once and never copied.
 class Parser
 {
   public:
-    explicit Parser(const std::string &db) : db_(db)
+    explicit Parser(std::string_view db) : db_(db)
+    {
+    }
+
+    bool Parse(std::vector<Feature> *feature_list)
     {
-        // Remove all spaces.
-        db_.erase(std::remove_if(db_.begin(), db_.end(), isspace), db_.end());
         if (!Match("["))
         {
-            SetFailedAndReturnFalse();
+            return false;
+        }
+        if (!MatchOptional("]"))
+        {
+            do
+            {
+                if (!TryParseOne(&feature_list->emplace_back()))
+                {
+                    return false;
+                }
+            } while (MatchOptional(","));
+            if (!Match("]"))
+            {
+                return false;
+            }
+        }
+        SkipSpaces();
+        if (current_ != db_.size())
+        {
+            return SetFailedAndReturnFalse("end of file");
         }
+        return true;
     }
 
-    bool Finished()
+    // Byte offset and description of the first token that did not parse.
+    size_t error_offset() const
     {
-        return current_ >= db_.size();
+        return current_;
+    }
+    const char *expected() const
+    {
+        return expected_;
     }
 
+  private:
     bool TryParseOne(Feature *feature)
     {
-        if (failed_ || Finished() || !Match("{"))
-        {
-            return SetFailedAndReturnFalse();
-        }
-        if (!Match(location_) || !Match("{") || !Match(latitude_))
-        {
-            return SetFailedAndReturnFalse();
-        }
-        long temp = 0;
-        ReadLong(&temp);
-        feature->mutable_location()->set_latitude(temp);
-        if (!Match(",") || !Match(longitude_))
+        int32_t latitude = 0;
+        int32_t longitude = 0;
+        std::string_view name;
+        if (!Match("{") || !Match("\"location\"") || !Match(":") || !Match("{") || !Match("\"latitude\"") ||
+            !Match(":") || !ReadInt(&latitude) || !Match(",") || !Match("\"longitude\"") || !Match(":") ||
+            !ReadInt(&longitude) || !Match("}") || !Match(",") || !Match("\"name\"") || !Match(":") ||
+            !ReadString(&name) || !Match("}"))
         {
-            return SetFailedAndReturnFalse();
+            return false;
         }
-        ReadLong(&temp);
-        feature->mutable_location()->set_longitude(temp);
-        if (!Match("},") || !Match(name_) || !Match("\""))
-        {
-            return SetFailedAndReturnFalse();
-        }
-        size_t name_start = current_;
-        while (current_ != db_.size() && db_[current_++] != '"')
-        {
-        }
-        if (current_ == db_.size())
+        feature->mutable_location()->set_latitude(latitude);
+        feature->mutable_location()->set_longitude(longitude);
+        feature->set_name(name.data(), name.size());
+        return true;
+    }
+
+    bool SetFailedAndReturnFalse(const char *expected)
+    {
+        expected_ = expected;
+        return false;
+    }
+
+    void SkipSpaces()
+    {
+        while (current_ < db_.size() && isspace(static_cast<unsigned char>(db_[current_])))
         {
-            return SetFailedAndReturnFalse();
+            current_++;
         }
-        feature->set_name(db_.substr(name_start, current_ - name_start - 1));
-        if (!Match("},"))
+    }
+
+    bool MatchOptional(std::string_view token)
+    {
+        SkipSpaces();
+        if (db_.compare(current_, token.size(), token) != 0)
         {
-            if (db_[current_ - 1] == ']' && current_ == db_.size())
-            {
-                return true;
-            }
-            return SetFailedAndReturnFalse();
+            return false;
         }
+        current_ += token.size();
         return true;
     }
 
-  private:
-    bool SetFailedAndReturnFalse()
+    bool Match(const char *token)
     {
-        failed_ = true;
-        return false;
+        return MatchOptional(token) || SetFailedAndReturnFalse(token);
     }
 
-    bool Match(const std::string &prefix)
+    bool ReadInt(int32_t *value)
     {
-        bool eq = db_.substr(current_, prefix.size()) == prefix;
-        current_ += prefix.size();
-        return eq;
+        SkipSpaces();
+        const char *end = db_.data() + db_.size();
+        auto [ptr, ec] = std::from_chars(db_.data() + current_, end, *value);
+        if (ec != std::errc())
+        {
+            return SetFailedAndReturnFalse("a 32-bit integer");
+        }
+        current_ = ptr - db_.data();
+        return true;
     }
 
-    void ReadLong(long *l)
+    bool ReadString(std::string_view *value)
     {
-        size_t start = current_;
-        while (current_ != db_.size() && db_[current_] != ',' && db_[current_] != '}')
+        if (!Match("\""))
         {
-            current_++;
+            return false;
+        }
+        size_t end = db_.find('"', current_);
+        if (end == std::string_view::npos)
+        {
+            return SetFailedAndReturnFalse("closing '\"'");
         }
-        // It will throw an exception if fails.
-        *l = std::stol(db_.substr(start, current_ - start));
+        *value = db_.substr(current_, end - current_);
+        current_ = end + 1;
+        return true;
     }
 
-    bool failed_ = false;
-    std::string db_;
+    std::string_view db_;
     size_t current_ = 0;
-    const std::string location_ = "\"location\":";
-    const std::string latitude_ = "\"latitude\":";
-    const std::string longitude_ = "\"longitude\":";
-    const std::string name_ = "\"name\":";
+    const char *expected_ = "";
 };
 
-void ParseDb(const std::string &db, std::vector<Feature> *feature_list)
+bool ParseDb(std::string_view db, std::vector<Feature> *feature_list)
 {
     feature_list->clear();
-    std::string db_content(db);
-    db_content.erase(std::remove_if(db_content.begin(), db_content.end(), isspace), db_content.end());
+    // Every feature opens two objects; names rarely contain braces, so this is
+    // a tight upper bound that saves regrowing the vector on large files.
+    feature_list->reserve(std::count(db.begin(), db.end(), '{') / 2);
 
-    Parser parser(db_content);
-    Feature feature;
-    while (!parser.Finished())
+    Parser parser(db);
+    if (!parser.Parse(feature_list))
     {
-        feature_list->push_back(Feature());
-        if (!parser.TryParseOne(&feature_list->back()))
-        {
-            std::cout << "Error parsing the db file";
-            feature_list->clear();
-            break;
-        }
+        LOG(ERROR) << "Error parsing the db file at byte " << parser.error_offset() << ": expected "
+                  << parser.expected();
+        feature_list->clear();
+        return false;
     }
-    std::cout << "DB parsed, loaded " << feature_list->size() << " features." << std::endl;
+    LOG(INFO) << "DB parsed, loaded " << feature_list->size() << " features.";
+    return true;
+}
+
+bool LoadDb(const std::string &db_path, std::vector<Feature> *feature_list)
+{
+    int fd = open(db_path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        LOG(ERROR) << "Failed to open " << db_path << ": " << std::strerror(errno);
+        if (fd >= 0)
+            close(fd);
+        feature_list->clear();
+        return false;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return ParseDb(std::string_view(), feature_list);
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        LOG(ERROR) << "Failed to map " << db_path << ": " << std::strerror(error);
+        feature_list->clear();
+        return false;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    bool ok = ParseDb(std::string_view(static_cast<const char *>(data), st.st_size), feature_list);
+    munmap(data, st.st_size);
+    return ok;
+}
+
+namespace
+{
+
+float ConvertToRadians(float num)
+{
+    return num * 3.1415926 / 180;
+}
+
+} // namespace
+
+// The formula is based on http://mathforum.org/library/drmath/view/51879.html
+float GetDistance(const Point &start, const Point &end)
+{
+    const float kCoordFactor = 10000000.0;
+    float lat_1 = start.latitude() / kCoordFactor;
+    float lat_2 = end.latitude() / kCoordFactor;
+    float lon_1 = start.longitude() / kCoordFactor;
+    float lon_2 = end.longitude() / kCoordFactor;
+    float lat_rad_1 = ConvertToRadians(lat_1);
+    float lat_rad_2 = ConvertToRadians(lat_2);
+    float delta_lat_rad = ConvertToRadians(lat_2 - lat_1);
+    float delta_lon_rad = ConvertToRadians(lon_2 - lon_1);
+
+    float a = pow(sin(delta_lat_rad / 2), 2) + cos(lat_rad_1) * cos(lat_rad_2) * pow(sin(delta_lon_rad / 2), 2);
+    float c = 2 * atan2(sqrt(a), sqrt(1 - a));
+    int R = 6371000; // metres
+
+    return R * c;
 }
 
 } // namespace routeguide
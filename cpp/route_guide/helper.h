@@ -19,16 +19,41 @@
 #ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_HELPER_H_
 #define GRPC_COMMON_CPP_ROUTE_GUIDE_HELPER_H_
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace routeguide
 {
 class Feature;
+class Point;
 
 std::string GetDbFileContent(std::string db_path = "route_guide_db.json");
 
-void ParseDb(const std::string &db, std::vector<Feature> *feature_list);
+// Parses the JSON feature list in |db|. On failure the byte offset of the
+// offending token is reported and |feature_list| is left empty.
+bool ParseDb(std::string_view db, std::vector<Feature> *feature_list);
+
+// Maps the database file at |db_path| read-only and parses it in place.
+// False, with |feature_list| left empty, if the file can't be read or parsed.
+bool LoadDb(const std::string &db_path, std::vector<Feature> *feature_list);
+
+// Great-circle distance between two points, in metres.
+float GetDistance(const Point &start, const Point &end);
+
+// Hash of a (latitude, longitude) pair: the packed point run through the
+// murmur3 finalizer, so every bit of the result depends on both coordinates.
+inline uint64_t HashPoint(int32_t latitude, int32_t longitude)
+{
+    uint64_t k = (static_cast<uint64_t>(static_cast<uint32_t>(latitude)) << 32) | static_cast<uint32_t>(longitude);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
 
 } // namespace routeguide
 
@@ -0,0 +1,167 @@
+#include "note_store.h"
+
+#include <algorithm>
+
+#include "helper.h"
+
+namespace routeguide
+{
+
+RouteNoteStore::RouteNoteStore(const Options &options)
+    : options_(options), shard_budget_(options.max_bytes == 0 ? 0 : (std::max)(options.max_bytes / kShardCount,
+                                                                                static_cast<size_t>(1)))
+{
+}
+
+void RouteNoteStore::Push(Location *location, Entry entry)
+{
+    if (location->count == location->ring.size())
+    {
+        // Grow and unwrap; only reached while below max_notes_per_location.
+        std::vector<Entry> ring;
+        size_t capacity = (std::max)(location->ring.size() * 2, static_cast<size_t>(4));
+        if (options_.max_notes_per_location != 0)
+        {
+            capacity = (std::min)(capacity, options_.max_notes_per_location);
+        }
+        ring.reserve(capacity);
+        for (size_t i = 0; i < location->count; i++)
+        {
+            ring.push_back(std::move(location->ring[(location->head + i) % location->ring.size()]));
+        }
+        ring.resize(capacity);
+        location->ring = std::move(ring);
+        location->head = 0;
+    }
+    location->ring[(location->head + location->count) % location->ring.size()] = std::move(entry);
+    location->count++;
+}
+
+void RouteNoteStore::PopOldest(Shard *shard, Location *location)
+{
+    Entry &oldest = location->ring[location->head];
+    shard->bytes -= oldest.bytes;
+    oldest.note.reset();
+    location->head = (location->head + 1) % location->ring.size();
+    location->count--;
+}
+
+bool RouteNoteStore::HasSubscribers(const Location &location)
+{
+    return std::any_of(location.subscribers.begin(), location.subscribers.end(),
+                       [](const std::weak_ptr<Subscriber> &s) { return !s.expired(); });
+}
+
+void RouteNoteStore::Post(const RouteNote &note, std::vector<std::shared_ptr<const RouteNote>> *earlier,
+                          const std::shared_ptr<Subscriber> &subscriber)
+{
+    uint64_t hash = HashPoint(note.location().latitude(), note.location().longitude());
+    Shard &shard = shards_[hash & (kShardCount - 1)];
+    uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(note.location().latitude())) << 32) |
+                   static_cast<uint32_t>(note.location().longitude());
+    // Copy and stamp the note before taking the lock.
+    Entry entry;
+    entry.note = std::make_shared<const RouteNote>(note);
+    entry.posted = std::chrono::steady_clock::now();
+    entry.bytes = sizeof(Entry) + sizeof(RouteNote) + note.message().size();
+    std::shared_ptr<const RouteNote> posted = entry.note;
+    std::vector<std::shared_ptr<Subscriber>> fanout;
+
+    std::unique_lock<std::mutex> lock(shard.mu);
+    auto [found, inserted] = shard.locations.try_emplace(key);
+    Location &location = found->second;
+    if (inserted)
+    {
+        location.lru = shard.lru.insert(shard.lru.end(), key);
+    }
+    else
+    {
+        shard.lru.splice(shard.lru.end(), shard.lru, location.lru);
+    }
+
+    // Expiry is lazy: old notes go when their location is posted to again,
+    // or earlier through the byte budget.
+    if (options_.ttl.count() > 0)
+    {
+        while (location.count > 0 && location.ring[location.head].posted + options_.ttl <= entry.posted)
+        {
+            PopOldest(&shard, &location);
+        }
+    }
+    for (size_t i = 0; i < location.count; i++)
+    {
+        earlier->push_back(location.ring[(location.head + i) % location.ring.size()].note);
+    }
+
+    if (options_.max_notes_per_location != 0 && location.count == options_.max_notes_per_location)
+    {
+        PopOldest(&shard, &location);
+    }
+    shard.bytes += entry.bytes;
+    Push(&location, std::move(entry));
+
+    // Collect the live subscribers, pruning the streams that went away.
+    size_t live = 0;
+    for (size_t i = 0; i < location.subscribers.size(); i++)
+    {
+        std::shared_ptr<Subscriber> s = location.subscribers[i].lock();
+        if (!s)
+        {
+            continue;
+        }
+        if (s != subscriber)
+        {
+            fanout.push_back(std::move(s));
+        }
+        if (live != i)
+        {
+            location.subscribers[live] = std::move(location.subscribers[i]);
+        }
+        live++;
+    }
+    location.subscribers.resize(live);
+    if (subscriber && subscriber->locations_.insert(key).second)
+    {
+        location.subscribers.push_back(subscriber);
+    }
+
+    while (shard_budget_ != 0 && shard.bytes > shard_budget_)
+    {
+        uint64_t victim_key = shard.lru.front();
+        Location &victim = shard.locations.find(victim_key)->second;
+        if (victim.count == 0)
+        {
+            // Emptied before and kept for its subscribers: gone once they
+            // are, otherwise out of the way of the locations with notes.
+            if (HasSubscribers(victim))
+            {
+                shard.lru.splice(shard.lru.end(), shard.lru, victim.lru);
+            }
+            else
+            {
+                shard.lru.erase(victim.lru);
+                shard.locations.erase(victim_key);
+            }
+            continue;
+        }
+        if (&victim == &location && location.count == 1)
+        {
+            break; // never drop the note just posted
+        }
+        PopOldest(&shard, &victim);
+        if (victim.count == 0 && !HasSubscribers(victim))
+        {
+            shard.lru.erase(victim.lru);
+            shard.locations.erase(victim_key);
+        }
+    }
+    lock.unlock();
+
+    // Deliver outside the shard lock, a post never waits on another stream.
+    for (const std::shared_ptr<Subscriber> &s : fanout)
+    {
+        s->Deliver(posted);
+    }
+}
+
+} // namespace routeguide
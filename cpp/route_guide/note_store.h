@@ -0,0 +1,183 @@
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_NOTE_STORE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_NOTE_STORE_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "route_guide.pb.h"
+
+namespace routeguide
+{
+
+// Client metadata key whose presence opts a RouteChat stream into pushed notes.
+constexpr char kRouteChatSubscribeKey[] = "route-chat-subscribe";
+
+// Bounded FIFO of the notes pushed to one subscriber, waiting to be written.
+// Not synchronized; the owning stream guards it with its own lock.
+class NoteQueue
+{
+  public:
+    enum class Overflow
+    {
+        // Make room by dropping the oldest queued note.
+        kDropOldest,
+        // Refuse the note; the stream is too slow and should be disconnected.
+        kDisconnect,
+    };
+
+    NoteQueue(size_t capacity, Overflow overflow) : capacity_(capacity), overflow_(overflow)
+    {
+    }
+
+    // Returns false if the note was refused under Overflow::kDisconnect.
+    bool Push(std::shared_ptr<const RouteNote> note)
+    {
+        if (notes_.size() >= capacity_)
+        {
+            if (overflow_ == Overflow::kDisconnect)
+            {
+                return false;
+            }
+            notes_.pop_front();
+            dropped_++;
+        }
+        notes_.push_back(std::move(note));
+        return true;
+    }
+    std::shared_ptr<const RouteNote> Pop()
+    {
+        std::shared_ptr<const RouteNote> note = std::move(notes_.front());
+        notes_.pop_front();
+        return note;
+    }
+    bool empty() const
+    {
+        return notes_.empty();
+    }
+    uint64_t dropped() const
+    {
+        return dropped_;
+    }
+
+  private:
+    const size_t capacity_;
+    const Overflow overflow_;
+    std::deque<std::shared_ptr<const RouteNote>> notes_;
+    uint64_t dropped_ = 0;
+};
+
+// RouteChat history, keyed by location. Locations are spread over a fixed set
+// of shards with a lock each, so a post only scans the notes of its own point
+// and chatters at different locations rarely touch the same lock.
+//
+// Notes are immutable and reference counted: a post hands back pointers to the
+// earlier notes, which stay valid while the caller writes them after the lock
+// is released, even if retention drops them from the store meanwhile.
+//
+// Streams can also subscribe to the locations they post to; every later note
+// at such a location is then pushed to them as it arrives.
+class RouteNoteStore
+{
+  public:
+    // A stream that receives the notes posted at its locations.
+    class Subscriber
+    {
+      public:
+        virtual ~Subscriber() = default;
+
+        // Called from the posting stream with no store lock held. Must not
+        // block: queue the note and return.
+        virtual void Deliver(const std::shared_ptr<const RouteNote> &note) = 0;
+
+      private:
+        friend class RouteNoteStore;
+        // Locations subscribed to so far; only touched by the owner's posts.
+        std::unordered_set<uint64_t> locations_;
+    };
+
+    // Retention limits (0 disables a limit) and subscriber queueing.
+    struct Options
+    {
+        // Newest notes kept per location.
+        size_t max_notes_per_location = 1000;
+        // Notes older than this are no longer sent.
+        std::chrono::milliseconds ttl{0};
+        // Approximate memory held by all notes. Over budget the oldest note of
+        // the least recently posted location goes first.
+        size_t max_bytes = 64 << 20;
+        // Outbound queue of each subscribed stream, and what happens when a
+        // slow reader lets it fill up.
+        size_t subscriber_queue_size = 64;
+        NoteQueue::Overflow subscriber_overflow = NoteQueue::Overflow::kDropOldest;
+    };
+
+    RouteNoteStore() : RouteNoteStore(Options())
+    {
+    }
+    explicit RouteNoteStore(const Options &options);
+
+    const Options &options() const
+    {
+        return options_;
+    }
+
+    // Appends |note| to the history of its location and appends the notes
+    // posted there before it to |earlier|, oldest first. The note is pushed to
+    // the other subscribers of the location. If |subscriber| is set it joins
+    // them; it stays subscribed until its last reference is dropped.
+    void Post(const RouteNote &note, std::vector<std::shared_ptr<const RouteNote>> *earlier,
+              const std::shared_ptr<Subscriber> &subscriber = nullptr);
+
+  private:
+    static constexpr size_t kShardCount = 64;
+
+    struct Entry
+    {
+        std::shared_ptr<const RouteNote> note;
+        std::chrono::steady_clock::time_point posted;
+        size_t bytes;
+    };
+
+    // Ring buffer of the newest notes of one location. It grows on demand up
+    // to max_notes_per_location, then overwrites its oldest entry.
+    struct Location
+    {
+        std::vector<Entry> ring;
+        size_t head = 0; // oldest entry
+        size_t count = 0;
+        // Every location is on the LRU list. One the byte budget has emptied
+        // stays on it while it has subscribers and goes with the last of them.
+        std::list<uint64_t>::iterator lru;
+        std::vector<std::weak_ptr<Subscriber>> subscribers;
+    };
+
+    // Padded to a cache line so neighbouring shard locks don't false-share.
+    struct alignas(64) Shard
+    {
+        std::mutex mu;
+        std::unordered_map<uint64_t, Location> locations;
+        // Least recently posted location first.
+        std::list<uint64_t> lru;
+        size_t bytes = 0;
+    };
+
+    void Push(Location *location, Entry entry);
+    void PopOldest(Shard *shard, Location *location);
+    static bool HasSubscribers(const Location &location);
+
+    const Options options_;
+    const size_t shard_budget_;
+    std::array<Shard, kShardCount> shards_;
+};
+
+} // namespace routeguide
+
+#endif // GRPC_COMMON_CPP_ROUTE_GUIDE_NOTE_STORE_H_
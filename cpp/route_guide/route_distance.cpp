@@ -0,0 +1,165 @@
+#include "route_distance.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "route_distance_kernel.h"
+#include "route_guide.pb.h"
+
+namespace routeguide
+{
+
+using RouteLengthFunction = double (*)(const int32_t *, const int32_t *, size_t);
+
+// Defined in route_distance_avx2.cpp; nullptr when that file was built
+// without AVX2.
+RouteLengthFunction RouteLengthAvx2Function();
+
+namespace
+{
+
+#if defined(__aarch64__)
+
+// NEON is part of the AArch64 baseline, so this needs no runtime check.
+struct NeonOps
+{
+    using T = float64x2_t;
+    using Mask = uint64x2_t;
+    static constexpr size_t kLanes = 2;
+
+    static T Set(double x)
+    {
+        return vdupq_n_f64(x);
+    }
+    static T Load(const double *p)
+    {
+        return vld1q_f64(p);
+    }
+    static void Store(double *p, T v)
+    {
+        vst1q_f64(p, v);
+    }
+    static T Add(T a, T b)
+    {
+        return vaddq_f64(a, b);
+    }
+    static T Sub(T a, T b)
+    {
+        return vsubq_f64(a, b);
+    }
+    static T Mul(T a, T b)
+    {
+        return vmulq_f64(a, b);
+    }
+    static T Fma(T a, T b, T c)
+    {
+        return vfmaq_f64(c, a, b);
+    }
+    static T Sqrt(T a)
+    {
+        return vsqrtq_f64(a);
+    }
+    static T Min(T a, T b)
+    {
+        return vminq_f64(a, b);
+    }
+    static T Round(T a)
+    {
+        return vrndnq_f64(a);
+    }
+    static Mask Greater(T a, T b)
+    {
+        return vcgtq_f64(a, b);
+    }
+    static T Select(Mask m, T a, T b)
+    {
+        return vbslq_f64(m, a, b);
+    }
+    static double Sum(T a)
+    {
+        return vaddvq_f64(a);
+    }
+};
+
+#endif
+
+struct Kernel
+{
+    RouteLengthFunction function;
+    const char *name;
+};
+
+Kernel SelectKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    RouteLengthFunction avx2 = RouteLengthAvx2Function();
+    if (avx2 != nullptr && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return {avx2, "avx2"};
+    }
+#elif defined(__aarch64__)
+    return {[](const int32_t *latitudes, const int32_t *longitudes, size_t count) {
+                return RouteLengthT<NeonOps>(latitudes, longitudes, count);
+            },
+            "neon"};
+#endif
+    return {[](const int32_t *latitudes, const int32_t *longitudes, size_t count) {
+                return RouteLengthT<ScalarOps>(latitudes, longitudes, count);
+            },
+            "scalar"};
+}
+
+const Kernel &GetKernel()
+{
+    static const Kernel kernel = SelectKernel();
+    return kernel;
+}
+
+} // namespace
+
+double RouteLength(const int32_t *latitudes, const int32_t *longitudes, size_t count)
+{
+    return GetKernel().function(latitudes, longitudes, count);
+}
+
+const char *RouteLengthKernel()
+{
+    return GetKernel().name;
+}
+
+void RouteDistance::Add(const Point &point)
+{
+    Add(point.latitude(), point.longitude());
+}
+
+void RouteDistance::Add(int32_t latitude, int32_t longitude)
+{
+    if (count_ == kBatch + 1)
+    {
+        Flush();
+    }
+    latitudes_[count_] = latitude;
+    longitudes_[count_] = longitude;
+    count_++;
+}
+
+double RouteDistance::Total()
+{
+    Flush();
+    return total_;
+}
+
+void RouteDistance::Flush()
+{
+    if (count_ < 2)
+    {
+        return;
+    }
+    total_ += RouteLength(latitudes_, longitudes_, count_);
+    latitudes_[0] = latitudes_[count_ - 1];
+    longitudes_[0] = longitudes_[count_ - 1];
+    count_ = 1;
+}
+
+} // namespace routeguide
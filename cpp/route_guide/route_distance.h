@@ -0,0 +1,47 @@
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_DISTANCE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_DISTANCE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace routeguide
+{
+class Point;
+
+// Length in metres of the route through |count| points given as columns of
+// latitudes and longitudes in 1e-7 degrees: the sum of the great-circle
+// (haversine) distances between consecutive points, accumulated in double.
+// Runs on an AVX2 or NEON kernel when the CPU has one. Latitudes beyond the
+// poles are clamped to them.
+double RouteLength(const int32_t *latitudes, const int32_t *longitudes, size_t count);
+
+// Name of the kernel RouteLength() dispatches to: "avx2", "neon" or "scalar".
+const char *RouteLengthKernel();
+
+// Running length of a route received point by point, as in RecordRoute.
+// Points are buffered in columnar arrays and measured a batch at a time.
+class RouteDistance
+{
+  public:
+    void Add(const Point &point);
+    void Add(int32_t latitude, int32_t longitude);
+
+    // Metres covered by the points added so far.
+    double Total();
+
+  private:
+    static constexpr size_t kBatch = 512;
+
+    void Flush();
+
+    // Slot 0 holds the last point of the previous batch once one was
+    // measured, so the leg across batches is counted.
+    int32_t latitudes_[kBatch + 1];
+    int32_t longitudes_[kBatch + 1];
+    size_t count_ = 0;
+    double total_ = 0;
+};
+
+} // namespace routeguide
+
+#endif // GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_DISTANCE_H_
@@ -0,0 +1,106 @@
+// AVX2 + FMA instantiation of the RouteLength() kernel. CMake builds this file
+// with -mavx2 -mfma on x86-64; elsewhere it compiles to a stub and the
+// dispatcher in route_distance.cpp never selects it.
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+
+#include "route_distance_kernel.h"
+#endif
+
+namespace routeguide
+{
+
+using RouteLengthFunction = double (*)(const int32_t *, const int32_t *, size_t);
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+namespace
+{
+
+struct Avx2Ops
+{
+    using T = __m256d;
+    using Mask = __m256d;
+    static constexpr size_t kLanes = 4;
+
+    static T Set(double x)
+    {
+        return _mm256_set1_pd(x);
+    }
+    static T Load(const double *p)
+    {
+        return _mm256_loadu_pd(p);
+    }
+    static void Store(double *p, T v)
+    {
+        _mm256_storeu_pd(p, v);
+    }
+    static T Add(T a, T b)
+    {
+        return _mm256_add_pd(a, b);
+    }
+    static T Sub(T a, T b)
+    {
+        return _mm256_sub_pd(a, b);
+    }
+    static T Mul(T a, T b)
+    {
+        return _mm256_mul_pd(a, b);
+    }
+    static T Fma(T a, T b, T c)
+    {
+        return _mm256_fmadd_pd(a, b, c);
+    }
+    static T Sqrt(T a)
+    {
+        return _mm256_sqrt_pd(a);
+    }
+    static T Min(T a, T b)
+    {
+        return _mm256_min_pd(a, b);
+    }
+    static T Round(T a)
+    {
+        return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    }
+    static Mask Greater(T a, T b)
+    {
+        return _mm256_cmp_pd(a, b, _CMP_GT_OQ);
+    }
+    static T Select(Mask m, T a, T b)
+    {
+        return _mm256_blendv_pd(b, a, m);
+    }
+    static double Sum(T a)
+    {
+        __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+    }
+};
+
+double RouteLengthAvx2(const int32_t *latitudes, const int32_t *longitudes, size_t count)
+{
+    return RouteLengthT<Avx2Ops>(latitudes, longitudes, count);
+}
+
+} // namespace
+
+RouteLengthFunction RouteLengthAvx2Function()
+{
+    return RouteLengthAvx2;
+}
+
+#else
+
+RouteLengthFunction RouteLengthAvx2Function()
+{
+    return nullptr;
+}
+
+#endif
+
+} // namespace routeguide
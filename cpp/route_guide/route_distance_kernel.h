@@ -0,0 +1,223 @@
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_DISTANCE_KERNEL_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_DISTANCE_KERNEL_H_
+
+// The RouteLength() kernel, written once against a small set of lane
+// operations and instantiated per instruction set. Only route_distance*.cpp
+// include this, each compiled with its own target flags, so everything here
+// has internal linkage: the linker must never pick an AVX2 copy of a helper
+// for the portable build.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace routeguide
+{
+namespace
+{
+
+constexpr double kEarthRadius = 6371000; // metres
+constexpr double kPi = 3.14159265358979323846;
+// kPi rounded to double plus the remainder, for range reduction.
+constexpr double kPiHigh = 3.141592653589793116;
+constexpr double kPiLow = 1.2246467991473532e-16;
+constexpr double kRadiansPerUnit = kPi / 180 / 1e7;
+
+// Taylor coefficients of sin(r) after r, for |r| <= pi/2: the first omitted
+// term is below 1e-13 relative.
+struct SinSeries
+{
+    static constexpr int kTerms = 8;
+    double c[kTerms] = {};
+    constexpr SinSeries()
+    {
+        double f = 1;
+        for (int n = 1; n <= kTerms; n++)
+        {
+            f /= -(2.0 * n) * (2.0 * n + 1);
+            c[n - 1] = f;
+        }
+    }
+};
+
+// Taylor coefficients of asin(t) after t, for 0 <= t <= 0.5: the first
+// omitted term is below 1e-16 relative.
+struct AsinSeries
+{
+    static constexpr int kTerms = 22;
+    double c[kTerms] = {};
+    constexpr AsinSeries()
+    {
+        double b = 1;
+        for (int n = 1; n <= kTerms; n++)
+        {
+            b *= (2.0 * n - 1) / (2.0 * n);
+            c[n - 1] = b / (2 * n + 1);
+        }
+    }
+};
+
+constexpr SinSeries kSin;
+constexpr AsinSeries kAsin;
+
+// One double per lane; the reference for the vector variants and the tail
+// loop of all of them.
+struct ScalarOps
+{
+    using T = double;
+    using Mask = bool;
+    static constexpr size_t kLanes = 1;
+
+    static T Set(double x)
+    {
+        return x;
+    }
+    static T Load(const double *p)
+    {
+        return *p;
+    }
+    static void Store(double *p, T v)
+    {
+        *p = v;
+    }
+    static T Add(T a, T b)
+    {
+        return a + b;
+    }
+    static T Sub(T a, T b)
+    {
+        return a - b;
+    }
+    static T Mul(T a, T b)
+    {
+        return a * b;
+    }
+    // a * b + c
+    static T Fma(T a, T b, T c)
+    {
+        return a * b + c;
+    }
+    static T Sqrt(T a)
+    {
+        return std::sqrt(a);
+    }
+    static T Min(T a, T b)
+    {
+        return a < b ? a : b;
+    }
+    static T Round(T a)
+    {
+        return std::nearbyint(a);
+    }
+    static Mask Greater(T a, T b)
+    {
+        return a > b;
+    }
+    static T Select(Mask m, T a, T b)
+    {
+        return m ? a : b;
+    }
+    static double Sum(T a)
+    {
+        return a;
+    }
+};
+
+template <class V> typename V::T SinReduced(typename V::T r)
+{
+    typename V::T z = V::Mul(r, r);
+    typename V::T p = V::Set(kSin.c[SinSeries::kTerms - 1]);
+    for (int i = SinSeries::kTerms - 2; i >= 0; i--)
+        p = V::Fma(p, z, V::Set(kSin.c[i]));
+    return V::Fma(V::Mul(r, z), p, r);
+}
+
+// sin(x)^2 for any x; the square doesn't care which multiple of pi x is
+// reduced by.
+template <class V> typename V::T SinSquared(typename V::T x)
+{
+    typename V::T k = V::Round(V::Mul(x, V::Set(1 / kPi)));
+    typename V::T r = V::Fma(k, V::Set(-kPiHigh), x);
+    r = V::Fma(k, V::Set(-kPiLow), r);
+    typename V::T s = SinReduced<V>(r);
+    return V::Mul(s, s);
+}
+
+// cos(phi) for |phi| <= pi/2.
+template <class V> typename V::T CosLatitude(typename V::T phi)
+{
+    typename V::T abs = V::Select(V::Greater(V::Set(0), phi), V::Sub(V::Set(0), phi), phi);
+    return SinReduced<V>(V::Sub(V::Set(kPi / 2), abs));
+}
+
+// asin(t) for 0 <= t <= 1, folding t > 0.5 onto the accurate half through
+// asin(t) = pi/2 - 2 asin(sqrt((1 - t) / 2)).
+template <class V> typename V::T Asin(typename V::T t)
+{
+    typename V::Mask big = V::Greater(t, V::Set(0.5));
+    typename V::T u = V::Select(big, V::Sqrt(V::Mul(V::Sub(V::Set(1), t), V::Set(0.5))), t);
+    typename V::T z = V::Mul(u, u);
+    typename V::T p = V::Set(kAsin.c[AsinSeries::kTerms - 1]);
+    for (int i = AsinSeries::kTerms - 2; i >= 0; i--)
+        p = V::Fma(p, z, V::Set(kAsin.c[i]));
+    typename V::T a = V::Fma(V::Mul(u, z), p, u);
+    return V::Select(big, V::Fma(a, V::Set(-2), V::Set(kPi / 2)), a);
+}
+
+// Central angle of the legs starting at |i|. Coordinates are kept in their
+// integer units, which doubles hold exactly, so the differences between
+// nearby points lose nothing before they are scaled to radians.
+template <class V>
+typename V::T CentralAngle(const double *latitudes, const double *longitudes, const double *cos_phi, size_t i)
+{
+    typename V::T half = V::Set(0.5 * kRadiansPerUnit);
+    typename V::T dphi = V::Sub(V::Load(latitudes + i + 1), V::Load(latitudes + i));
+    typename V::T dlambda = V::Sub(V::Load(longitudes + i + 1), V::Load(longitudes + i));
+    typename V::T half_lat = SinSquared<V>(V::Mul(dphi, half));
+    typename V::T half_lon = SinSquared<V>(V::Mul(dlambda, half));
+    typename V::T a = V::Fma(V::Mul(V::Load(cos_phi + i), V::Load(cos_phi + i + 1)), half_lon, half_lat);
+    // Rounding can push a slightly past 1 for antipodal points.
+    a = V::Min(a, V::Set(1));
+    return V::Mul(Asin<V>(V::Sqrt(a)), V::Set(2));
+}
+
+template <class V> double RouteLengthT(const int32_t *latitudes, const int32_t *longitudes, size_t count)
+{
+    // Points are converted a chunk at a time; consecutive chunks share a
+    // point so that the leg between them is counted once.
+    constexpr size_t kChunk = 256;
+    constexpr int32_t kPole = 900000000;
+    alignas(64) double lat[kChunk];
+    alignas(64) double lon[kChunk];
+    alignas(64) double cos_phi[kChunk];
+    double angle = 0;
+    for (size_t start = 0; start + 1 < count; start += kChunk - 1)
+    {
+        size_t n = (std::min)(kChunk, count - start);
+        for (size_t i = 0; i < n; i++)
+        {
+            lat[i] = (std::clamp)(latitudes[start + i], -kPole, kPole);
+            lon[i] = longitudes[start + i];
+        }
+        size_t i = 0;
+        for (; i + V::kLanes <= n; i += V::kLanes)
+            V::Store(cos_phi + i, CosLatitude<V>(V::Mul(V::Load(lat + i), V::Set(kRadiansPerUnit))));
+        for (; i < n; i++)
+            cos_phi[i] = CosLatitude<ScalarOps>(lat[i] * kRadiansPerUnit);
+
+        typename V::T sum = V::Set(0);
+        i = 0;
+        for (; i + V::kLanes < n; i += V::kLanes)
+            sum = V::Add(sum, CentralAngle<V>(lat, lon, cos_phi, i));
+        angle += V::Sum(sum);
+        for (; i + 1 < n; i++)
+            angle += CentralAngle<ScalarOps>(lat, lon, cos_phi, i);
+    }
+    return angle * kEarthRadius;
+}
+
+} // namespace
+} // namespace routeguide
+
+#endif // GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_DISTANCE_KERNEL_H_
@@ -20,8 +20,11 @@
 #include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <string>
 #include <thread>
@@ -41,114 +44,170 @@
 #include <grpcpp/security/credentials.h>
 
 // For both
+#include "common/channel_pool.h"
+#include "common/compression.h"
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/server_options.h"
+#include "common/shutdown.h"
 #include "common/utils.h"
+#include "feature_database.h"
+#include "feature_pager.h"
+#include "feature_store.h"
 #include "helper.h"
+#include "note_store.h"
+#include "route_recorder.h"
 #include "route_guide.grpc.pb.h"
 
 // For Server
-float ConvertToRadians(float num)
+// Pushed notes of one subscribed RouteChat stream. A sync stream can read and
+// write from two threads at once, so a pusher thread drains this queue while
+// the RPC thread keeps reading.
+class ChatSubscriber final : public routeguide::RouteNoteStore::Subscriber
 {
-    return num * 3.1415926 / 180;
-}
+  public:
+    ChatSubscriber(size_t queue_size, routeguide::NoteQueue::Overflow overflow) : queue_(queue_size, overflow)
+    {
+    }
 
-// The formula is based on http://mathforum.org/library/drmath/view/51879.html
-float GetDistance(const routeguide::Point &start, const routeguide::Point &end)
-{
-    const float kCoordFactor = 10000000.0;
-    float lat_1 = start.latitude() / kCoordFactor;
-    float lat_2 = end.latitude() / kCoordFactor;
-    float lon_1 = start.longitude() / kCoordFactor;
-    float lon_2 = end.longitude() / kCoordFactor;
-    float lat_rad_1 = ConvertToRadians(lat_1);
-    float lat_rad_2 = ConvertToRadians(lat_2);
-    float delta_lat_rad = ConvertToRadians(lat_2 - lat_1);
-    float delta_lon_rad = ConvertToRadians(lon_2 - lon_1);
-
-    float a = pow(sin(delta_lat_rad / 2), 2) + cos(lat_rad_1) * cos(lat_rad_2) * pow(sin(delta_lon_rad / 2), 2);
-    float c = 2 * atan2(sqrt(a), sqrt(1 - a));
-    int R = 6371000; // metres
-
-    return R * c;
-}
+    void Deliver(const std::shared_ptr<const routeguide::RouteNote> &note) override
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!closed_ && !queue_.Push(note))
+        {
+            overflowed_ = true;
+        }
+        cv_.notify_one();
+    }
 
-std::string GetFeatureName(const routeguide::Point &point, const std::vector<routeguide::Feature> &feature_list)
-{
-    for (const routeguide::Feature &f : feature_list)
+    // Blocks for the next pushed note; false once closed or overflowed.
+    bool WaitPop(std::shared_ptr<const routeguide::RouteNote> *note)
     {
-        if (f.location().latitude() == point.latitude() && f.location().longitude() == point.longitude())
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [this] { return closed_ || overflowed_ || !queue_.empty(); });
+        if (closed_ || overflowed_)
         {
-            return f.name();
+            return false;
         }
+        *note = queue_.Pop();
+        return true;
     }
-    return "";
-}
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        closed_ = true;
+        cv_.notify_one();
+    }
+
+    bool overflowed()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        return overflowed_;
+    }
+
+  private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    routeguide::NoteQueue queue_;
+    bool closed_ = false;
+    bool overflowed_ = false;
+};
 
 class RouteGuideImpl final : public routeguide::RouteGuide::Service
 {
   public:
-    explicit RouteGuideImpl(const std::string &db)
+    RouteGuideImpl(routeguide::FeatureDatabase *db, const routeguide::RouteNoteStore::Options &note_options,
+                   const CompressionPolicy &compression)
+        : db_(db), notes_(note_options), compression_(compression)
     {
-        routeguide::ParseDb(db, &feature_list_);
     }
 
     grpc::Status GetFeature(grpc::ServerContext *context, const routeguide::Point *point,
                             routeguide::Feature *feature) override
     {
-        feature->set_name(GetFeatureName(*point, feature_list_));
+        std::shared_ptr<const routeguide::FeatureStore> store = db_->Get();
+        std::string_view name = store->GetFeatureName(*point);
+        feature->set_name(name.data(), name.size());
         feature->mutable_location()->CopyFrom(*point);
+        compression_.StartUnary(context, feature->ByteSizeLong());
         return grpc::Status::OK;
     }
 
     grpc::Status ListFeatures(grpc::ServerContext *context, const routeguide::Rectangle *rectangle,
                               grpc::ServerWriter<routeguide::Feature> *writer) override
     {
-        auto lo = rectangle->lo();
-        auto hi = rectangle->hi();
-        long left = (std::min)(lo.longitude(), hi.longitude());
-        long right = (std::max)(lo.longitude(), hi.longitude());
-        long top = (std::max)(lo.latitude(), hi.latitude());
-        long bottom = (std::min)(lo.latitude(), hi.latitude());
-        // for (const Feature &f : feature_list_)
-        for (const routeguide::Feature &f : feature_list_)
+        std::shared_ptr<const routeguide::FeatureStore> store = db_->Get();
+        routeguide::FeatureStore::Cursor cursor = store->Query(*rectangle);
+        routeguide::Feature feature;
+        bool compressing = compression_.Start(context);
+        for (uint32_t index = cursor.Next(); index != routeguide::FeatureStore::kNotFound; index = cursor.Next())
         {
-            if (f.location().longitude() >= left && f.location().longitude() <= right &&
-                f.location().latitude() >= bottom && f.location().latitude() <= top)
+            // Nobody reads the rest once the caller gives up or its deadline
+            // passes.
+            if (context->IsCancelled())
+                return grpc::Status::CANCELLED;
+            store->GetFeature(index, &feature);
+            if (!writer->Write(feature, compressing ? compression_.WriteOptionsFor(feature.ByteSizeLong())
+                                                    : grpc::WriteOptions()))
             {
-                writer->Write(f);
+                break;
             }
         }
         return grpc::Status::OK;
     }
 
+    grpc::Status ListFeaturePages(grpc::ServerContext *context, const routeguide::ListFeaturesRequest *request,
+                                  grpc::ServerWriter<routeguide::FeaturePage> *writer) override
+    {
+        routeguide::FeaturePager pager(db_->Get(), *request);
+        routeguide::FeaturePage page;
+        bool compressing = compression_.Start(context);
+        while (!context->IsCancelled() && pager.Next(&page))
+        {
+            if (!writer->Write(page, compressing ? compression_.WriteOptionsFor(page.ByteSizeLong())
+                                                 : grpc::WriteOptions()))
+            {
+                // Broken stream; the client resumes from its last token.
+                break;
+            }
+        }
+        return context->IsCancelled() ? grpc::Status::CANCELLED : pager.status();
+    }
+
     grpc::Status RecordRoute(grpc::ServerContext *context, grpc::ServerReader<routeguide::Point> *reader,
                              routeguide::RouteSummary *summary) override
     {
         routeguide::Point point;
-        int point_count = 0;
-        int feature_count = 0;
-        float distance = 0.0;
-        routeguide::Point previous;
-
-        std::chrono::system_clock::time_point start_time = std::chrono::system_clock::now();
+        routeguide::RouteRecorder recorder(db_->Get());
         while (reader->Read(&point))
         {
-            point_count++;
-            if (!GetFeatureName(point, feature_list_).empty())
-            {
-                feature_count++;
-            }
-            if (point_count != 1)
+            recorder.Add(point);
+        }
+        // Read() also fails on a cancelled call, whose summary nobody gets.
+        if (context->IsCancelled())
+            return grpc::Status::CANCELLED;
+        recorder.Finish(summary);
+
+        return grpc::Status::OK;
+    }
+
+    grpc::Status RecordRouteBatch(grpc::ServerContext *context, grpc::ServerReader<routeguide::PointBatch> *reader,
+                                  routeguide::RouteSummary *summary) override
+    {
+        routeguide::PointBatch batch;
+        routeguide::RouteRecorder recorder(db_->Get());
+        while (reader->Read(&batch))
+        {
+            if (!recorder.Add(batch))
             {
-                distance += GetDistance(previous, point);
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                    "latitude and longitude deltas differ in length");
             }
-            previous = point;
         }
-        std::chrono::system_clock::time_point end_time = std::chrono::system_clock::now();
-        summary->set_point_count(point_count);
-        summary->set_feature_count(feature_count);
-        summary->set_distance(static_cast<long>(distance));
-        auto secs = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
-        summary->set_elapsed_time(secs.count());
+        if (context->IsCancelled())
+            return grpc::Status::CANCELLED;
+        recorder.Finish(summary);
 
         return grpc::Status::OK;
     }
@@ -156,40 +215,125 @@ class RouteGuideImpl final : public routeguide::RouteGuide::Service
     grpc::Status RouteChat(grpc::ServerContext *context,
                            grpc::ServerReaderWriter<routeguide::RouteNote, routeguide::RouteNote> *stream) override
     {
+        // Replies and pushed notes come from two threads, one write at a time.
+        std::mutex write_mu;
+        bool compressing = compression_.Start(context);
+        auto write = [this, stream, compressing](const routeguide::RouteNote &n) {
+            return stream->Write(n, compressing ? compression_.WriteOptionsFor(n.ByteSizeLong())
+                                                : grpc::WriteOptions());
+        };
+        std::shared_ptr<ChatSubscriber> subscriber;
+        std::thread pusher;
+        if (context->client_metadata().count(routeguide::kRouteChatSubscribeKey) != 0)
+        {
+            const routeguide::RouteNoteStore::Options &options = notes_.options();
+            subscriber = std::make_shared<ChatSubscriber>((std::max)(options.subscriber_queue_size, size_t{1}),
+                                                          options.subscriber_overflow);
+            pusher = std::thread([context, &write, &write_mu, &subscriber] {
+                std::shared_ptr<const routeguide::RouteNote> n;
+                while (subscriber->WaitPop(&n))
+                {
+                    std::lock_guard<std::mutex> lock(write_mu);
+                    // The stream is gone; the reads fail too and end the call.
+                    if (!write(*n))
+                        break;
+                }
+                if (subscriber->overflowed())
+                {
+                    // Too slow to keep up, fail the pending Read to end the call.
+                    context->TryCancel();
+                }
+            });
+        }
+
         routeguide::RouteNote note;
+        std::vector<std::shared_ptr<const routeguide::RouteNote>> earlier;
         while (stream->Read(&note))
         {
-            std::unique_lock<std::mutex> lock(mu_);
-            for (const routeguide::RouteNote &n : received_notes_)
+            earlier.clear();
+            notes_.Post(note, &earlier, subscriber);
+            std::lock_guard<std::mutex> lock(write_mu);
+            for (const std::shared_ptr<const routeguide::RouteNote> &n : earlier)
             {
-                if (n.location().latitude() == note.location().latitude() &&
-                    n.location().longitude() == note.location().longitude())
-                {
-                    stream->Write(n);
-                }
+                if (context->IsCancelled() || !write(*n))
+                    break;
             }
-            received_notes_.push_back(note);
         }
 
+        if (subscriber)
+        {
+            subscriber->Close();
+            pusher.join();
+            if (subscriber->overflowed())
+            {
+                return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "RouteChat subscriber fell behind");
+            }
+        }
         return grpc::Status::OK;
     }
 
   private:
-    std::vector<routeguide::Feature> feature_list_;
-    std::mutex mu_;
-    std::vector<routeguide::RouteNote> received_notes_;
+    routeguide::FeatureDatabase *db_;
+    routeguide::RouteNoteStore notes_;
+    const CompressionPolicy compression_;
+};
+
+class RouteGuideAdminImpl final : public routeguide::RouteGuideAdmin::Service
+{
+  public:
+    explicit RouteGuideAdminImpl(routeguide::FeatureDatabase *db) : db_(db)
+    {
+    }
+
+    grpc::Status ReloadFeatures(grpc::ServerContext *context, const routeguide::ReloadFeaturesRequest *request,
+                                routeguide::ReloadFeaturesReply *reply) override
+    {
+        std::promise<bool> reloaded;
+        if (!db_->ReloadInBackground([&reloaded](bool ok) { reloaded.set_value(ok); }))
+        {
+            return grpc::Status(grpc::StatusCode::ABORTED, "A reload is already running");
+        }
+        reply->set_reloaded(reloaded.get_future().get());
+        reply->set_feature_count(db_->Get()->size());
+        return grpc::Status::OK;
+    }
+
+  private:
+    routeguide::FeatureDatabase *db_;
 };
 
-void RunServer(const std::string &db, std::string &server_address)
+void RunServer(const std::string &db_path, int reload_interval_ms,
+               const routeguide::RouteNoteStore::Options &note_options, std::string &server_address,
+               std::string &maintenance_address, const ServerOptions &server_options,
+               const CompressionPolicy &compression)
 {
-    RouteGuideImpl service(db);
+    routeguide::FeatureDatabase db(db_path);
+    if (reload_interval_ms > 0)
+    {
+        db.Watch(std::chrono::milliseconds(reload_interval_ms));
+    }
+    RouteGuideImpl service(&db, note_options, compression);
+    RouteGuideAdminImpl admin_service(&db);
 
+    ServerMetrics metrics;
+    grpc::EnableDefaultHealthCheckService(true);
     grpc::ServerBuilder builder;
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
     builder.RegisterService(&service);
+    server_options.Apply(&builder);
+    metrics.Install(&builder);
+    // From here on SIGTERM drains the server rather than killing it.
+    ShutdownSignal::Install();
     std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
     std::cout << "Server listening on " << server_address << std::endl;
-    server->Wait();
+    // The admin service has no authentication, so it is served only on the
+    // maintenance port, next to /metrics.
+    grpc::ServerBuilder admin_builder;
+    admin_builder.RegisterService(&admin_service);
+    std::unique_ptr<grpc::Server> admin_server(admin_builder.BuildAndStart());
+    MetricsHttpServer metrics_server(maintenance_address, &metrics, server_options.reuse_port, admin_server.get());
+    NotifyWorkerReady();
+    DrainOnSignal(server.get(), server_options);
 }
 
 // For Client
@@ -220,10 +364,10 @@ routeguide::RouteNote MakeRouteNote(const std::string &message, long latitude, l
 class RouteGuideClient
 {
   public:
-    RouteGuideClient(std::shared_ptr<grpc::Channel> channel, const std::string &db)
-        : stub_(routeguide::RouteGuide::NewStub(channel))
+    RouteGuideClient(std::shared_ptr<ChannelPool> channels, const std::string &db_path, const CallDeadlines &deadlines)
+        : stubs_(std::move(channels)), deadlines_(deadlines)
     {
-        routeguide::ParseDb(db, &feature_list_);
+        routeguide::LoadDb(db_path, &feature_list_);
     }
 
     void GetFeature()
@@ -241,36 +385,80 @@ class RouteGuideClient
         routeguide::Rectangle rect;
         routeguide::Feature feature;
         grpc::ClientContext context;
+        deadlines_.Apply("ListFeatures", &context);
 
         rect.mutable_lo()->set_latitude(400000000);
         rect.mutable_lo()->set_longitude(-750000000);
         rect.mutable_hi()->set_latitude(420000000);
         rect.mutable_hi()->set_longitude(-730000000);
-        std::cout << "Looking for features between 40, -75 and 42, -73" << std::endl;
+        LOG(INFO) << "Looking for features between 40, -75 and 42, -73";
 
-        std::unique_ptr<grpc::ClientReader<routeguide::Feature>> reader(stub_->ListFeatures(&context, rect));
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        std::unique_ptr<grpc::ClientReader<routeguide::Feature>> reader(stub->ListFeatures(&context, rect));
         while (reader->Read(&feature))
         {
-            std::cout << "Found feature called " << feature.name() << " at "
+            LOG(INFO) << "Found feature called " << feature.name() << " at "
                       << feature.location().latitude() / kCoordFactor_ << ", "
-                      << feature.location().longitude() / kCoordFactor_ << std::endl;
+                      << feature.location().longitude() / kCoordFactor_;
         }
         grpc::Status status = reader->Finish();
         if (status.ok())
         {
-            std::cout << "ListFeatures rpc succeeded." << std::endl;
+            LOG(INFO) << "ListFeatures rpc succeeded.";
         }
         else
         {
-            std::cout << "ListFeatures rpc failed." << std::endl;
+            LOG(ERROR) << "ListFeatures rpc failed.";
         }
     }
 
+    // Lists the same rectangle as ListFeatures a page at a time, resuming with
+    // a new call whenever |max_results| cuts a call short.
+    void ListFeaturePages(int page_size, int max_results)
+    {
+        routeguide::ListFeaturesRequest request;
+        routeguide::FeaturePage page;
+        request.mutable_rectangle()->mutable_lo()->set_latitude(400000000);
+        request.mutable_rectangle()->mutable_lo()->set_longitude(-750000000);
+        request.mutable_rectangle()->mutable_hi()->set_latitude(420000000);
+        request.mutable_rectangle()->mutable_hi()->set_longitude(-730000000);
+        request.set_page_size(page_size);
+        request.set_max_results(max_results);
+
+        int calls = 0;
+        int pages = 0;
+        int features = 0;
+        do
+        {
+            grpc::ClientContext context;
+            deadlines_.Apply("ListFeaturePages", &context);
+            StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+            std::unique_ptr<grpc::ClientReader<routeguide::FeaturePage>> reader(
+                stub->ListFeaturePages(&context, request));
+            calls++;
+            request.clear_page_token();
+            while (reader->Read(&page))
+            {
+                pages++;
+                features += page.features_size();
+                request.set_page_token(page.next_page_token());
+            }
+            grpc::Status status = reader->Finish();
+            if (!status.ok())
+            {
+                LOG(ERROR) << "ListFeaturePages rpc failed: " << status.error_message();
+                return;
+            }
+        } while (!request.page_token().empty());
+        LOG(INFO) << "Got " << features << " features in " << pages << " pages over " << calls << " calls";
+    }
+
     void RecordRoute()
     {
         routeguide::Point point;
         routeguide::RouteSummary stats;
         grpc::ClientContext context;
+        deadlines_.Apply("RecordRoute", &context);
         const int kPoints = 10;
         unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
 
@@ -278,12 +466,13 @@ class RouteGuideClient
         std::uniform_int_distribution<int> feature_distribution(0, feature_list_.size() - 1);
         std::uniform_int_distribution<int> delay_distribution(500, 1500);
 
-        std::unique_ptr<grpc::ClientWriter<routeguide::Point>> writer(stub_->RecordRoute(&context, &stats));
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        std::unique_ptr<grpc::ClientWriter<routeguide::Point>> writer(stub->RecordRoute(&context, &stats));
         for (int i = 0; i < kPoints; i++)
         {
             const routeguide::Feature &f = feature_list_[feature_distribution(generator)];
-            std::cout << "Visiting point " << f.location().latitude() / kCoordFactor_ << ", "
-                      << f.location().longitude() / kCoordFactor_ << std::endl;
+            LOG(INFO) << "Visiting point " << f.location().latitude() / kCoordFactor_ << ", "
+                      << f.location().longitude() / kCoordFactor_;
             if (!writer->Write(f.location()))
             {
                 // Broken stream.
@@ -295,23 +484,65 @@ class RouteGuideClient
         grpc::Status status = writer->Finish();
         if (status.ok())
         {
-            std::cout << "Finished trip with " << stats.point_count() << " points\n"
+            LOG(INFO) << "Finished trip with " << stats.point_count() << " points\n"
                       << "Passed " << stats.feature_count() << " features\n"
                       << "Travelled " << stats.distance() << " meters\n"
-                      << "It took " << stats.elapsed_time() << " seconds" << std::endl;
+                      << "It took " << stats.elapsed_time() << " seconds";
         }
         else
         {
-            std::cout << "RecordRoute rpc failed." << std::endl;
+            LOG(ERROR) << "RecordRoute rpc failed.";
         }
     }
 
-    void RouteChat()
+    void RecordRouteBatch()
     {
+        routeguide::RouteSummary stats;
         grpc::ClientContext context;
+        deadlines_.Apply("RecordRouteBatch", &context);
+        const int kPoints = 1000;
+        unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+
+        std::default_random_engine generator(seed);
+        std::uniform_int_distribution<int> feature_distribution(0, feature_list_.size() - 1);
+
+        // The whole route goes in one message.
+        routeguide::PointBatch batch;
+        routeguide::PointBatchEncoder encoder;
+        for (int i = 0; i < kPoints; i++)
+        {
+            encoder.Add(feature_list_[feature_distribution(generator)].location(), &batch);
+        }
+        LOG(INFO) << "Sending " << kPoints << " points in " << batch.ByteSizeLong() << " bytes";
 
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        std::unique_ptr<grpc::ClientWriter<routeguide::PointBatch>> writer(stub->RecordRouteBatch(&context, &stats));
+        writer->WriteLast(batch, grpc::WriteOptions());
+        grpc::Status status = writer->Finish();
+        if (status.ok())
+        {
+            LOG(INFO) << "Finished trip with " << stats.point_count() << " points\n"
+                      << "Passed " << stats.feature_count() << " features\n"
+                      << "Travelled " << stats.distance() << " meters";
+        }
+        else
+        {
+            LOG(ERROR) << "RecordRouteBatch rpc failed.";
+        }
+    }
+
+    void RouteChat(bool subscribe)
+    {
+        grpc::ClientContext context;
+        deadlines_.Apply("RouteChat", &context);
+        if (subscribe)
+        {
+            context.AddMetadata(routeguide::kRouteChatSubscribeKey, "1");
+        }
+
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
         std::shared_ptr<grpc::ClientReaderWriter<routeguide::RouteNote, routeguide::RouteNote>> stream(
-            stub_->RouteChat(&context));
+            stub->RouteChat(&context));
 
         std::thread writer([stream]() {
             std::vector<routeguide::RouteNote> notes{
@@ -319,8 +550,8 @@ class RouteGuideClient
                 MakeRouteNote("Third message", 1, 0), MakeRouteNote("Fourth message", 0, 0)};
             for (const routeguide::RouteNote &note : notes)
             {
-                std::cout << "Sending message " << note.message() << " at " << note.location().latitude() << ", "
-                          << note.location().longitude() << std::endl;
+                LOG(INFO) << "Sending message " << note.message() << " at " << note.location().latitude() << ", "
+                          << note.location().longitude();
                 stream->Write(note);
             }
             stream->WritesDone();
@@ -329,14 +560,14 @@ class RouteGuideClient
         routeguide::RouteNote server_note;
         while (stream->Read(&server_note))
         {
-            std::cout << "Got message " << server_note.message() << " at " << server_note.location().latitude() << ", "
-                      << server_note.location().longitude() << std::endl;
+            LOG(INFO) << "Got message " << server_note.message() << " at " << server_note.location().latitude() << ", "
+                      << server_note.location().longitude();
         }
         writer.join();
         grpc::Status status = stream->Finish();
         if (!status.ok())
         {
-            std::cout << "RouteChat rpc failed." << std::endl;
+            LOG(ERROR) << "RouteChat rpc failed.";
         }
     }
 
@@ -344,33 +575,36 @@ class RouteGuideClient
     bool GetOneFeature(const routeguide::Point &point, routeguide::Feature *feature)
     {
         grpc::ClientContext context;
-        grpc::Status status = stub_->GetFeature(&context, point, feature);
+        deadlines_.Apply("GetFeature", &context);
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        grpc::Status status = stub->GetFeature(&context, point, feature);
         if (!status.ok())
         {
-            std::cout << "GetFeature rpc failed." << std::endl;
+            LOG(ERROR) << "GetFeature rpc failed.";
             return false;
         }
         if (!feature->has_location())
         {
-            std::cout << "Server returns incomplete feature." << std::endl;
+            LOG(ERROR) << "Server returns incomplete feature.";
             return false;
         }
         if (feature->name().empty())
         {
-            std::cout << "Found no feature at " << feature->location().latitude() / kCoordFactor_ << ", "
-                      << feature->location().longitude() / kCoordFactor_ << std::endl;
+            LOG(INFO) << "Found no feature at " << feature->location().latitude() / kCoordFactor_ << ", "
+                      << feature->location().longitude() / kCoordFactor_;
         }
         else
         {
-            std::cout << "Found feature called " << feature->name() << " at "
+            LOG(INFO) << "Found feature called " << feature->name() << " at "
                       << feature->location().latitude() / kCoordFactor_ << ", "
-                      << feature->location().longitude() / kCoordFactor_ << std::endl;
+                      << feature->location().longitude() / kCoordFactor_;
         }
         return true;
     }
 
     const float kCoordFactor_ = 10000000.0;
-    std::unique_ptr<routeguide::RouteGuide::Stub> stub_;
+    StubPool<routeguide::RouteGuide> stubs_;
+    CallDeadlines deadlines_;
     std::vector<routeguide::Feature> feature_list_;
 };
 
@@ -379,27 +613,59 @@ int main(int argc, char **argv)
 {
     CliParams cli_params;
     ParseCLIState cliState = ParseCommandLine(argc, argv, &cli_params);
-    std::string db_content = routeguide::GetDbFileContent(cli_params.database);
 
     if (cliState == ParseCLIState::SUCCESS)
     {
         if (cli_params.mode == Mode::CLIENT)
         {
-            RouteGuideClient route_guide(
-                grpc::CreateChannel(cli_params.server_address, grpc::InsecureChannelCredentials()), db_content);
+            ChannelPoolOptions pool_options;
+            pool_options.channels = cli_params.channels;
+            pool_options.lb_policy = cli_params.lb_policy;
+            ParseCompressionAlgorithms(cli_params.accept_encodings, &pool_options.compression_algorithms);
+            if (!ParseChannelPick(cli_params.channel_pick, &pool_options.pick))
+            {
+                std::cout << "--channel_pick must be round_robin or least_outstanding." << std::endl;
+                return 1;
+            }
+            CallDeadlines deadlines;
+            if (!GetCallDeadlines(cli_params, &deadlines))
+            {
+                return 1;
+            }
+            RouteGuideClient route_guide(std::make_shared<ChannelPool>(cli_params.server_address, pool_options),
+                                         cli_params.database, deadlines);
 
-            std::cout << "-------------- GetFeature --------------" << std::endl;
+            LOG(INFO) << "-------------- GetFeature --------------";
             route_guide.GetFeature();
-            std::cout << "-------------- ListFeatures --------------" << std::endl;
+            LOG(INFO) << "-------------- ListFeatures --------------";
             route_guide.ListFeatures();
-            std::cout << "-------------- RecordRoute --------------" << std::endl;
+            LOG(INFO) << "-------------- ListFeaturePages --------------";
+            route_guide.ListFeaturePages(cli_params.page_size, cli_params.max_results);
+            LOG(INFO) << "-------------- RecordRoute --------------";
             route_guide.RecordRoute();
-            std::cout << "-------------- RouteChat --------------" << std::endl;
-            route_guide.RouteChat();
+            LOG(INFO) << "-------------- RecordRouteBatch --------------";
+            route_guide.RecordRouteBatch();
+            LOG(INFO) << "-------------- RouteChat --------------";
+            route_guide.RouteChat(cli_params.chat_subscribe);
         }
         else // SERVER
         {
-            RunServer(db_content, cli_params.server_address);
+            routeguide::RouteNoteStore::Options note_options;
+            note_options.max_notes_per_location = cli_params.chat_max_notes;
+            note_options.ttl = std::chrono::milliseconds(cli_params.chat_ttl_ms);
+            note_options.max_bytes = cli_params.chat_max_bytes;
+            note_options.subscriber_queue_size = cli_params.chat_queue_size;
+            note_options.subscriber_overflow = cli_params.chat_disconnect_slow
+                                                   ? routeguide::NoteQueue::Overflow::kDisconnect
+                                                   : routeguide::NoteQueue::Overflow::kDropOldest;
+            auto serve = [&](int worker) {
+                std::string maintenance_address = WorkerAddress(cli_params.maintenance_address, worker);
+                RunServer(cli_params.database, cli_params.reload_interval_ms, note_options, cli_params.server_address,
+                          maintenance_address, GetServerOptions(cli_params), GetCompressionPolicy(cli_params));
+            };
+            if (cli_params.processes > 1)
+                return Supervisor(GetSupervisorOptions(cli_params), serve).Run();
+            serve(0);
         }
         return 0;
     }
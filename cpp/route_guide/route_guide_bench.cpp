@@ -0,0 +1,634 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Microbenchmarks for the route_guide server hot paths, plus end-to-end calls
+// into the callback server over an in-process channel. Feature sets are
+// synthetic and seeded, so runs are comparable across changes:
+//
+//   route_guide_bench --benchmark_filter='GetFeatureName/1000000'
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <grpc/compression.h>
+#include <grpcpp/grpcpp.h>
+#include <zlib.h>
+
+#include "common/compression.h"
+#include "feature_database.h"
+#include "feature_lookup.h"
+#include "feature_pager.h"
+#include "feature_store.h"
+#include "helper.h"
+#include "note_store.h"
+#include "route_distance.h"
+#include "route_recorder.h"
+#include "route_guide.grpc.pb.h"
+#include "route_guide_service.h"
+
+namespace
+{
+
+constexpr int64_t kMinFeatures = 100;
+constexpr int64_t kMaxFeatures = 10000000;
+constexpr int64_t kMaxEndToEndFeatures = 1000000;
+// Queries per batch, cycled through so that lookups miss the CPU caches the
+// way they do on a server with a large database.
+constexpr size_t kQueries = 4096;
+// Dataset of the RecordRoute and windowed GetFeature benchmarks, and points
+// per RecordRouteBatch message.
+constexpr int64_t kRouteFeatures = 10000;
+constexpr int kPointsPerBatch = 1000;
+
+// Features spread uniformly over the globe; one in ten has no name, like the
+// sample database.
+std::vector<routeguide::Feature> MakeFeatures(int64_t count)
+{
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int32_t> latitude(-900000000, 900000000);
+    std::uniform_int_distribution<int32_t> longitude(-1800000000, 1800000000);
+    std::vector<routeguide::Feature> features(count);
+    for (int64_t i = 0; i < count; i++)
+    {
+        features[i].mutable_location()->set_latitude(latitude(generator));
+        features[i].mutable_location()->set_longitude(longitude(generator));
+        if (i % 10 != 0)
+        {
+            features[i].set_name("Feature " + std::to_string(i) + ", Somewhere, NJ 07945, USA");
+        }
+    }
+    return features;
+}
+
+// Data for one size at a time: a 10M feature set is several GB once the
+// JSON and the store are built, so switching sizes drops the previous one.
+struct Dataset
+{
+    int64_t count = -1;
+    std::vector<routeguide::Feature> features;
+    std::unique_ptr<routeguide::FeatureStore> store;
+    std::string json;
+};
+
+Dataset &GetDataset(int64_t count)
+{
+    static Dataset dataset;
+    if (dataset.count != count)
+    {
+        dataset = Dataset();
+        dataset.count = count;
+        dataset.features = MakeFeatures(count);
+        dataset.store = std::make_unique<routeguide::FeatureStore>(dataset.features);
+    }
+    return dataset;
+}
+
+const std::string &GetJson(int64_t count)
+{
+    Dataset &dataset = GetDataset(count);
+    if (dataset.json.empty())
+    {
+        dataset.json = "[\n";
+        for (size_t i = 0; i < dataset.features.size(); i++)
+        {
+            const routeguide::Feature &f = dataset.features[i];
+            dataset.json += "    {\n        \"location\": {\n            \"latitude\": " +
+                            std::to_string(f.location().latitude()) + ",\n            \"longitude\": " +
+                            std::to_string(f.location().longitude()) + "\n        },\n        \"name\": \"" +
+                            f.name() + "\"\n    }";
+            dataset.json += i + 1 < dataset.features.size() ? ",\n" : "\n";
+        }
+        dataset.json += "]\n";
+    }
+    return dataset.json;
+}
+
+std::vector<routeguide::Point> SamplePoints(const std::vector<routeguide::Feature> &features)
+{
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<size_t> index(0, features.size() - 1);
+    std::vector<routeguide::Point> points(kQueries);
+    for (routeguide::Point &point : points)
+        point = features[index(generator)].location();
+    return points;
+}
+
+// Squares of |half_side| (in 1e-7 degrees) around sampled features.
+std::vector<routeguide::Rectangle> SampleRectangles(const std::vector<routeguide::Feature> &features,
+                                                    int32_t half_side)
+{
+    std::vector<routeguide::Rectangle> rectangles;
+    for (const routeguide::Point &center : SamplePoints(features))
+    {
+        routeguide::Rectangle rect;
+        rect.mutable_lo()->set_latitude(center.latitude() - half_side);
+        rect.mutable_lo()->set_longitude(center.longitude() - half_side);
+        rect.mutable_hi()->set_latitude(center.latitude() + half_side);
+        rect.mutable_hi()->set_longitude(center.longitude() + half_side);
+        rectangles.push_back(rect);
+    }
+    return rectangles;
+}
+
+void BM_ParseDb(benchmark::State &state)
+{
+    const std::string &json = GetJson(state.range(0));
+    for (auto _ : state)
+    {
+        std::vector<routeguide::Feature> features;
+        benchmark::DoNotOptimize(routeguide::ParseDb(json, &features));
+        benchmark::DoNotOptimize(features.data());
+    }
+    state.SetBytesProcessed(state.iterations() * json.size());
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ParseDb)->RangeMultiplier(10)->Range(kMinFeatures, kMaxFeatures)->Unit(benchmark::kMillisecond);
+
+void BM_BuildStore(benchmark::State &state)
+{
+    const std::vector<routeguide::Feature> &features = GetDataset(state.range(0)).features;
+    for (auto _ : state)
+    {
+        routeguide::FeatureStore store(features);
+        benchmark::DoNotOptimize(store.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BuildStore)->RangeMultiplier(10)->Range(kMinFeatures, kMaxFeatures)->Unit(benchmark::kMillisecond);
+
+void BM_GetFeatureName(benchmark::State &state)
+{
+    Dataset &dataset = GetDataset(state.range(0));
+    std::vector<routeguide::Point> points = SamplePoints(dataset.features);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(dataset.store->GetFeatureName(points[i++ % kQueries]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetFeatureName)->RangeMultiplier(10)->Range(kMinFeatures, kMaxFeatures);
+
+void BM_GetFeatureNameMiss(benchmark::State &state)
+{
+    Dataset &dataset = GetDataset(state.range(0));
+    std::vector<routeguide::Point> points = SamplePoints(dataset.features);
+    for (routeguide::Point &point : points)
+        point.set_latitude(point.latitude() + 1);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(dataset.store->GetFeatureName(points[i++ % kQueries]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetFeatureNameMiss)->RangeMultiplier(10)->Range(kMinFeatures, kMaxFeatures);
+
+// The ListFeatures rectangle filter: squares one degree on a side, so the
+// answer grows with the database, as it would for a real map view.
+void BM_ListFeaturesQuery(benchmark::State &state)
+{
+    Dataset &dataset = GetDataset(state.range(0));
+    std::vector<routeguide::Rectangle> rectangles = SampleRectangles(dataset.features, 5000000);
+    size_t i = 0;
+    int64_t matches = 0;
+    for (auto _ : state)
+    {
+        routeguide::FeatureStore::Cursor cursor = dataset.store->Query(rectangles[i++ % kQueries]);
+        while (cursor.Next() != routeguide::FeatureStore::kNotFound)
+            matches++;
+    }
+    state.counters["matches/query"] = benchmark::Counter(static_cast<double>(matches) / state.iterations());
+    state.SetItemsProcessed(matches);
+}
+BENCHMARK(BM_ListFeaturesQuery)->RangeMultiplier(10)->Range(kMinFeatures, kMaxFeatures);
+
+void BM_GetDistance(benchmark::State &state)
+{
+    std::vector<routeguide::Point> points = SamplePoints(GetDataset(kMinFeatures).features);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(routeguide::GetDistance(points[i % kQueries], points[(i + 1) % kQueries]));
+        i++;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetDistance);
+
+// RecordRoute's distance over a route through the dataset's points, batched
+// the way the servers feed it.
+void BM_RouteDistance(benchmark::State &state)
+{
+    const std::vector<routeguide::Feature> &features = GetDataset(state.range(0)).features;
+    for (auto _ : state)
+    {
+        routeguide::RouteDistance distance;
+        for (const routeguide::Feature &feature : features)
+            distance.Add(feature.location());
+        benchmark::DoNotOptimize(distance.Total());
+    }
+    state.SetItemsProcessed(state.iterations() * (features.size() - 1));
+    state.SetLabel(routeguide::RouteLengthKernel());
+}
+BENCHMARK(BM_RouteDistance)->RangeMultiplier(100)->Range(kMinFeatures, kMaxFeatures);
+
+// One ListFeaturePages page of the RecordRoute dataset, serialized, and
+// zlib with the settings of gRPC's message compression (default level, 32 KiB
+// window; gzip adds its header and trailer), so the bytes and CPU per
+// algorithm are what a compressing server and its clients pay per page.
+
+std::string SerializedPage()
+{
+    const std::vector<routeguide::Feature> &features = GetDataset(kRouteFeatures).features;
+    routeguide::FeaturePage page;
+    for (int i = 0; i < routeguide::FeaturePager::kDefaultPageSize; i++)
+        *page.add_features() = features[i];
+    return page.SerializeAsString();
+}
+
+int WindowBits(grpc_compression_algorithm algorithm)
+{
+    return algorithm == GRPC_COMPRESS_GZIP ? 15 | 16 : 15;
+}
+
+bool Compress(grpc_compression_algorithm algorithm, const std::string &in, std::string *out)
+{
+    if (algorithm == GRPC_COMPRESS_NONE)
+    {
+        *out = in;
+        return true;
+    }
+    z_stream zs{};
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, WindowBits(algorithm), 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out->resize(deflateBound(&zs, in.size()));
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    zs.next_out = reinterpret_cast<Bytef *>(out->data());
+    zs.avail_out = static_cast<uInt>(out->size());
+    bool done = deflate(&zs, Z_FINISH) == Z_STREAM_END;
+    out->resize(zs.total_out);
+    deflateEnd(&zs);
+    return done;
+}
+
+bool Decompress(grpc_compression_algorithm algorithm, const std::string &in, size_t size, std::string *out)
+{
+    if (algorithm == GRPC_COMPRESS_NONE)
+    {
+        *out = in;
+        return true;
+    }
+    z_stream zs{};
+    if (inflateInit2(&zs, WindowBits(algorithm)) != Z_OK)
+        return false;
+    out->resize(size);
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    zs.next_out = reinterpret_cast<Bytef *>(out->data());
+    zs.avail_out = static_cast<uInt>(out->size());
+    bool done = inflate(&zs, Z_FINISH) == Z_STREAM_END;
+    inflateEnd(&zs);
+    return done && zs.total_out == size;
+}
+
+const char *AlgorithmName(int64_t algorithm)
+{
+    const char *name = "unknown";
+    grpc_compression_algorithm_name(static_cast<grpc_compression_algorithm>(algorithm), &name);
+    return name;
+}
+
+// wire_bytes is the size of the compressed page, out of |page_bytes|.
+void BM_CompressFeaturePage(benchmark::State &state)
+{
+    grpc_compression_algorithm algorithm = static_cast<grpc_compression_algorithm>(state.range(0));
+    std::string page = SerializedPage();
+    std::string compressed;
+    for (auto _ : state)
+    {
+        if (!Compress(algorithm, page, &compressed))
+        {
+            state.SkipWithError("compression failed");
+            break;
+        }
+        benchmark::DoNotOptimize(compressed.data());
+    }
+    state.SetLabel(AlgorithmName(algorithm));
+    state.SetBytesProcessed(state.iterations() * page.size());
+    state.counters["page_bytes"] = static_cast<double>(page.size());
+    state.counters["wire_bytes"] = static_cast<double>(compressed.size());
+}
+BENCHMARK(BM_CompressFeaturePage)->DenseRange(GRPC_COMPRESS_NONE, GRPC_COMPRESS_ALGORITHMS_COUNT - 1);
+
+void BM_DecompressFeaturePage(benchmark::State &state)
+{
+    grpc_compression_algorithm algorithm = static_cast<grpc_compression_algorithm>(state.range(0));
+    std::string page = SerializedPage();
+    std::string compressed;
+    std::string decompressed;
+    Compress(algorithm, page, &compressed);
+    for (auto _ : state)
+    {
+        if (!Decompress(algorithm, compressed, page.size(), &decompressed))
+        {
+            state.SkipWithError("decompression failed");
+            break;
+        }
+        benchmark::DoNotOptimize(decompressed.data());
+    }
+    state.SetLabel(AlgorithmName(algorithm));
+    state.SetBytesProcessed(state.iterations() * page.size());
+}
+BENCHMARK(BM_DecompressFeaturePage)->DenseRange(GRPC_COMPRESS_NONE, GRPC_COMPRESS_ALGORITHMS_COUNT - 1);
+
+// The callback server on a snapshot of the current dataset, reached through
+// an in-process channel so that the numbers include (de)serialization and the
+// gRPC stack but no sockets. With |loopback| it is reached over TCP on
+// 127.0.0.1 instead, for what the in-process transport skips: it never
+// compresses messages.
+class InProcessServer
+{
+  public:
+    explicit InProcessServer(int64_t count, const CompressionPolicy &compression = CompressionPolicy(),
+                             bool loopback = false)
+    {
+        Dataset &dataset = GetDataset(count);
+        path_ = "/tmp/route_guide_bench." + std::to_string(getpid()) + ".snapshot";
+        dataset.store->WriteSnapshot(path_);
+        db_ = std::make_unique<routeguide::FeatureDatabase>(path_);
+        service_ =
+            std::make_unique<routeguide::RouteGuideImpl>(db_.get(), routeguide::RouteNoteStore::Options(), compression);
+        grpc::ServerBuilder builder;
+        int port = 0;
+        if (loopback)
+            builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+        builder.RegisterService(service_.get());
+        server_ = builder.BuildAndStart();
+        stub_ = routeguide::RouteGuide::NewStub(
+            loopback ? grpc::CreateChannel("127.0.0.1:" + std::to_string(port), grpc::InsecureChannelCredentials())
+                     : server_->InProcessChannel(grpc::ChannelArguments()));
+    }
+
+    ~InProcessServer()
+    {
+        server_->Shutdown();
+        std::remove(path_.c_str());
+    }
+
+    routeguide::RouteGuide::Stub *stub()
+    {
+        return stub_.get();
+    }
+
+  private:
+    std::string path_;
+    std::unique_ptr<routeguide::FeatureDatabase> db_;
+    std::unique_ptr<routeguide::RouteGuideImpl> service_;
+    std::unique_ptr<grpc::Server> server_;
+    std::unique_ptr<routeguide::RouteGuide::Stub> stub_;
+};
+
+void BM_EndToEndGetFeature(benchmark::State &state)
+{
+    std::vector<routeguide::Point> points = SamplePoints(GetDataset(state.range(0)).features);
+    InProcessServer server(state.range(0));
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        grpc::ClientContext context;
+        routeguide::Feature feature;
+        grpc::Status status = server.stub()->GetFeature(&context, points[i++ % kQueries], &feature);
+        if (!status.ok())
+        {
+            state.SkipWithError(status.error_message().c_str());
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EndToEndGetFeature)->RangeMultiplier(100)->Range(kMinFeatures, kMaxEndToEndFeatures);
+
+// GetFeature over a batch of kQueries points with state.range(0) calls in
+// flight.
+void BM_EndToEndGetFeatureWindow(benchmark::State &state)
+{
+    std::vector<routeguide::Point> points = SamplePoints(GetDataset(kRouteFeatures).features);
+    InProcessServer server(kRouteFeatures);
+    routeguide::FeatureLookup lookup(server.stub(), state.range(0));
+    std::atomic<int64_t> failed{0};
+    for (auto _ : state)
+    {
+        lookup.Run(points, [&failed](size_t, const grpc::Status &status, const routeguide::Feature &) {
+            if (!status.ok())
+                failed++;
+        });
+    }
+    if (failed > 0)
+        state.SkipWithError("GetFeature failed");
+    state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK(BM_EndToEndGetFeatureWindow)->RangeMultiplier(4)->Range(1, 256)->UseRealTime();
+
+void BM_EndToEndListFeatures(benchmark::State &state)
+{
+    std::vector<routeguide::Rectangle> rectangles = SampleRectangles(GetDataset(state.range(0)).features, 5000000);
+    InProcessServer server(state.range(0));
+    size_t i = 0;
+    int64_t features = 0;
+    for (auto _ : state)
+    {
+        grpc::ClientContext context;
+        routeguide::Feature feature;
+        std::unique_ptr<grpc::ClientReader<routeguide::Feature>> reader(
+            server.stub()->ListFeatures(&context, rectangles[i++ % kQueries]));
+        while (reader->Read(&feature))
+            features++;
+        grpc::Status status = reader->Finish();
+        if (!status.ok())
+        {
+            state.SkipWithError(status.error_message().c_str());
+            break;
+        }
+    }
+    state.SetItemsProcessed(features);
+}
+BENCHMARK(BM_EndToEndListFeatures)->RangeMultiplier(100)->Range(kMinFeatures, kMaxEndToEndFeatures);
+
+void BM_EndToEndListFeaturePages(benchmark::State &state)
+{
+    std::vector<routeguide::Rectangle> rectangles = SampleRectangles(GetDataset(state.range(0)).features, 5000000);
+    InProcessServer server(state.range(0));
+    size_t i = 0;
+    int64_t features = 0;
+    routeguide::ListFeaturesRequest request;
+    request.set_page_size(routeguide::FeaturePager::kDefaultPageSize);
+    for (auto _ : state)
+    {
+        grpc::ClientContext context;
+        routeguide::FeaturePage page;
+        *request.mutable_rectangle() = rectangles[i++ % kQueries];
+        std::unique_ptr<grpc::ClientReader<routeguide::FeaturePage>> reader(
+            server.stub()->ListFeaturePages(&context, request));
+        while (reader->Read(&page))
+            features += page.features_size();
+        grpc::Status status = reader->Finish();
+        if (!status.ok())
+        {
+            state.SkipWithError(status.error_message().c_str());
+            break;
+        }
+    }
+    state.SetItemsProcessed(features);
+}
+BENCHMARK(BM_EndToEndListFeaturePages)->RangeMultiplier(100)->Range(kMinFeatures, kMaxEndToEndFeatures);
+
+// Bytes through the loopback interface so far, both directions, or -1 where
+// /proc/net/dev is not available.
+int64_t LoopbackBytes()
+{
+    std::ifstream dev("/proc/net/dev");
+    std::string line;
+    while (std::getline(dev, line))
+    {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || line.substr(0, colon).find("lo") == std::string::npos ||
+            line.find_first_not_of(' ') != line.find("lo"))
+            continue;
+        std::istringstream fields(line.substr(colon + 1));
+        int64_t bytes = -1;
+        fields >> bytes;
+        return bytes;
+    }
+    return -1;
+}
+
+// ListFeaturePages of a few hundred features a call over loopback TCP, with
+// the server compressing its pages with algorithm state.range(0): the CPU
+// both ends spend on it, and wire_bytes per call, headers and framing
+// included.
+void BM_EndToEndListFeaturePagesCompressed(benchmark::State &state)
+{
+    std::vector<routeguide::Rectangle> rectangles = SampleRectangles(GetDataset(kRouteFeatures).features, 150000000);
+    CompressionPolicy compression;
+    compression.algorithm = static_cast<grpc_compression_algorithm>(state.range(0));
+    InProcessServer server(kRouteFeatures, compression, true);
+    int64_t wire_start = LoopbackBytes();
+    size_t i = 0;
+    int64_t features = 0;
+    routeguide::ListFeaturesRequest request;
+    request.set_page_size(routeguide::FeaturePager::kDefaultPageSize);
+    for (auto _ : state)
+    {
+        grpc::ClientContext context;
+        routeguide::FeaturePage page;
+        *request.mutable_rectangle() = rectangles[i++ % kQueries];
+        std::unique_ptr<grpc::ClientReader<routeguide::FeaturePage>> reader(
+            server.stub()->ListFeaturePages(&context, request));
+        while (reader->Read(&page))
+            features += page.features_size();
+        grpc::Status status = reader->Finish();
+        if (!status.ok())
+        {
+            state.SkipWithError(status.error_message().c_str());
+            break;
+        }
+    }
+    int64_t wire_end = LoopbackBytes();
+    state.SetLabel(AlgorithmName(compression.algorithm));
+    state.SetItemsProcessed(features);
+    if (wire_start >= 0 && wire_end >= wire_start && state.iterations() > 0)
+        state.counters["wire_bytes"] = static_cast<double>(wire_end - wire_start) / state.iterations();
+}
+BENCHMARK(BM_EndToEndListFeaturePagesCompressed)
+    ->DenseRange(GRPC_COMPRESS_NONE, GRPC_COMPRESS_ALGORITHMS_COUNT - 1)
+    ->Unit(benchmark::kMicrosecond);
+
+// A route through |state.range(0)| points of the dataset, one Point message
+// each and then packed kPointsPerBatch to a PointBatch.
+void BM_EndToEndRecordRoute(benchmark::State &state)
+{
+    const std::vector<routeguide::Feature> &features = GetDataset(kRouteFeatures).features;
+    InProcessServer server(kRouteFeatures);
+    for (auto _ : state)
+    {
+        grpc::ClientContext context;
+        routeguide::RouteSummary summary;
+        std::unique_ptr<grpc::ClientWriter<routeguide::Point>> writer(server.stub()->RecordRoute(&context, &summary));
+        for (int64_t i = 0; i < state.range(0); i++)
+            writer->Write(features[i % features.size()].location());
+        writer->WritesDone();
+        grpc::Status status = writer->Finish();
+        if (!status.ok())
+        {
+            state.SkipWithError(status.error_message().c_str());
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EndToEndRecordRoute)->RangeMultiplier(10)->Range(10, 100000);
+
+void BM_EndToEndRecordRouteBatch(benchmark::State &state)
+{
+    const std::vector<routeguide::Feature> &features = GetDataset(kRouteFeatures).features;
+    InProcessServer server(kRouteFeatures);
+    for (auto _ : state)
+    {
+        grpc::ClientContext context;
+        routeguide::RouteSummary summary;
+        std::unique_ptr<grpc::ClientWriter<routeguide::PointBatch>> writer(
+            server.stub()->RecordRouteBatch(&context, &summary));
+        routeguide::PointBatchEncoder encoder;
+        routeguide::PointBatch batch;
+        for (int64_t i = 0; i < state.range(0); i++)
+        {
+            encoder.Add(features[i % features.size()].location(), &batch);
+            if (batch.latitude_deltas_size() == kPointsPerBatch)
+            {
+                writer->Write(batch);
+                batch.Clear();
+            }
+        }
+        if (batch.latitude_deltas_size() > 0)
+            writer->Write(batch);
+        writer->WritesDone();
+        grpc::Status status = writer->Finish();
+        if (!status.ok())
+        {
+            state.SkipWithError(status.error_message().c_str());
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EndToEndRecordRouteBatch)->RangeMultiplier(10)->Range(10, 100000);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -18,6 +18,7 @@
 
 // For both
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <condition_variable>
@@ -44,260 +45,56 @@
 #include <grpcpp/security/credentials.h>
 
 // For both
+#include "common/channel_pool.h"
+#include "common/compression.h"
+#include "common/load_generator.h"
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/server_options.h"
+#include "common/shutdown.h"
 #include "common/utils.h"
+#include "feature_database.h"
+#include "feature_lookup.h"
+#include "feature_store.h"
 #include "helper.h"
+#include "note_store.h"
 #include "route_guide.grpc.pb.h"
+#include "route_guide_service.h"
+#include "route_recorder.h"
 
 // For Server
-float ConvertToRadians(float num)
+void RunServer(const std::string &db_path, int reload_interval_ms,
+               const routeguide::RouteNoteStore::Options &note_options, std::string &server_address,
+               std::string &maintenance_address, const ServerOptions &server_options,
+               const CompressionPolicy &compression)
 {
-    return num * 3.1415926 / 180;
-}
-
-// The formula is based on http://mathforum.org/library/drmath/view/51879.html
-float GetDistance(const routeguide::Point &start, const routeguide::Point &end)
-{
-    const float kCoordFactor = 10000000.0;
-    float lat_1 = start.latitude() / kCoordFactor;
-    float lat_2 = end.latitude() / kCoordFactor;
-    float lon_1 = start.longitude() / kCoordFactor;
-    float lon_2 = end.longitude() / kCoordFactor;
-    float lat_rad_1 = ConvertToRadians(lat_1);
-    float lat_rad_2 = ConvertToRadians(lat_2);
-    float delta_lat_rad = ConvertToRadians(lat_2 - lat_1);
-    float delta_lon_rad = ConvertToRadians(lon_2 - lon_1);
-
-    float a = pow(sin(delta_lat_rad / 2), 2) + cos(lat_rad_1) * cos(lat_rad_2) * pow(sin(delta_lon_rad / 2), 2);
-    float c = 2 * atan2(sqrt(a), sqrt(1 - a));
-    int R = 6371000; // metres
-
-    return R * c;
-}
-
-std::string GetFeatureName(const routeguide::Point &point, const std::vector<routeguide::Feature> &feature_list)
-{
-    for (const routeguide::Feature &f : feature_list)
-    {
-        if (f.location().latitude() == point.latitude() && f.location().longitude() == point.longitude())
-        {
-            return f.name();
-        }
-    }
-    return "";
-}
-
-class RouteGuideImpl final : public routeguide::RouteGuide::CallbackService
-{
-  public:
-    explicit RouteGuideImpl(const std::string &db)
-    {
-        routeguide::ParseDb(db, &feature_list_);
-    }
-
-    grpc::ServerUnaryReactor *GetFeature(grpc::CallbackServerContext *context, const routeguide::Point *point,
-                                         routeguide::Feature *feature) override
-    {
-        feature->set_name(GetFeatureName(*point, feature_list_));
-        feature->mutable_location()->CopyFrom(*point);
-        grpc::ServerUnaryReactor *reactor = context->DefaultReactor();
-        reactor->Finish(grpc::Status::OK);
-        return reactor;
-    }
-
-    grpc::ServerWriteReactor<routeguide::Feature> *ListFeatures(grpc::CallbackServerContext *context,
-                                                                const routeguide::Rectangle *rectangle) override
+    routeguide::FeatureDatabase db(db_path);
+    if (reload_interval_ms > 0)
     {
-        class Lister : public grpc::ServerWriteReactor<routeguide::Feature>
-        {
-          public:
-            Lister(const routeguide::Rectangle *rectangle, const std::vector<routeguide::Feature> *feature_list)
-                : left_((std::min)(rectangle->lo().longitude(), rectangle->hi().longitude())),
-                  right_((std::max)(rectangle->lo().longitude(), rectangle->hi().longitude())),
-                  top_((std::max)(rectangle->lo().latitude(), rectangle->hi().latitude())),
-                  bottom_((std::min)(rectangle->lo().latitude(), rectangle->hi().latitude())),
-                  feature_list_(feature_list), next_feature_(feature_list_->begin())
-            {
-                NextWrite();
-            }
-            void OnDone() override
-            {
-                delete this;
-            }
-            void OnWriteDone(bool /*ok*/) override
-            {
-                NextWrite();
-            }
-
-          private:
-            void NextWrite()
-            {
-                while (next_feature_ != feature_list_->end())
-                {
-                    const routeguide::Feature &f = *next_feature_;
-                    next_feature_++;
-                    if (f.location().longitude() >= left_ && f.location().longitude() <= right_ &&
-                        f.location().latitude() >= bottom_ && f.location().latitude() <= top_)
-                    {
-                        StartWrite(&f);
-                        return;
-                    }
-                }
-                // Didn't write anything, all is done.
-                Finish(grpc::Status::OK);
-            }
-            const long left_;
-            const long right_;
-            const long top_;
-            const long bottom_;
-            const std::vector<routeguide::Feature> *feature_list_;
-            std::vector<routeguide::Feature>::const_iterator next_feature_;
-        };
-        return new Lister(rectangle, &feature_list_);
-    }
-
-    grpc::ServerReadReactor<routeguide::Point> *RecordRoute(grpc::CallbackServerContext *context,
-                                                            routeguide::RouteSummary *summary) override
-    {
-        class Recorder : public grpc::ServerReadReactor<routeguide::Point>
-        {
-          public:
-            Recorder(routeguide::RouteSummary *summary, const std::vector<routeguide::Feature> *feature_list)
-                : start_time_(std::chrono::system_clock::now()), summary_(summary), feature_list_(feature_list)
-            {
-                StartRead(&point_);
-            }
-            void OnDone() override
-            {
-                delete this;
-            }
-            void OnReadDone(bool ok) override
-            {
-                if (ok)
-                {
-                    point_count_++;
-                    if (!GetFeatureName(point_, *feature_list_).empty())
-                    {
-                        feature_count_++;
-                    }
-                    if (point_count_ != 1)
-                    {
-                        distance_ += GetDistance(previous_, point_);
-                    }
-                    previous_ = point_;
-                    StartRead(&point_);
-                }
-                else
-                {
-                    summary_->set_point_count(point_count_);
-                    summary_->set_feature_count(feature_count_);
-                    summary_->set_distance(static_cast<long>(distance_));
-                    auto secs = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() -
-                                                                                 start_time_);
-                    summary_->set_elapsed_time(secs.count());
-                    Finish(grpc::Status::OK);
-                }
-            }
-
-          private:
-            std::chrono::system_clock::time_point start_time_;
-            routeguide::RouteSummary *summary_;
-            const std::vector<routeguide::Feature> *feature_list_;
-            routeguide::Point point_;
-            int point_count_ = 0;
-            int feature_count_ = 0;
-            float distance_ = 0.0;
-            routeguide::Point previous_;
-        };
-        return new Recorder(summary, &feature_list_);
-    }
-
-    grpc::ServerBidiReactor<routeguide::RouteNote, routeguide::RouteNote> *RouteChat(
-        grpc::CallbackServerContext *context) override
-    {
-        class Chatter : public grpc::ServerBidiReactor<routeguide::RouteNote, routeguide::RouteNote>
-        {
-          public:
-            Chatter(absl::Mutex *mu, std::vector<routeguide::RouteNote> *received_notes)
-                : mu_(mu), received_notes_(received_notes)
-            {
-                StartRead(&note_);
-            }
-            void OnDone() override
-            {
-                delete this;
-            }
-            void OnReadDone(bool ok) override
-            {
-                if (ok)
-                {
-                    // Unlike the other example in this directory that's not using
-                    // the reactor pattern, we can't grab a local lock to secure the
-                    // access to the notes vector, because the reactor will most likely
-                    // make us jump threads, so we'll have to use a different locking
-                    // strategy. We'll grab the lock locally to build a copy of the
-                    // list of nodes we're going to send, then we'll grab the lock
-                    // again to append the received note to the existing vector.
-                    mu_->Lock();
-                    std::copy_if(received_notes_->begin(), received_notes_->end(), std::back_inserter(to_send_notes_),
-                                 [this](const routeguide::RouteNote &note) {
-                                     return note.location().latitude() == note_.location().latitude() &&
-                                            note.location().longitude() == note_.location().longitude();
-                                 });
-                    mu_->Unlock();
-                    notes_iterator_ = to_send_notes_.begin();
-                    NextWrite();
-                }
-                else
-                {
-                    Finish(grpc::Status::OK);
-                }
-            }
-            void OnWriteDone(bool /*ok*/) override
-            {
-                NextWrite();
-            }
-
-          private:
-            void NextWrite()
-            {
-                if (notes_iterator_ != to_send_notes_.end())
-                {
-                    StartWrite(&*notes_iterator_);
-                    notes_iterator_++;
-                }
-                else
-                {
-                    mu_->Lock();
-                    received_notes_->push_back(note_);
-                    mu_->Unlock();
-                    StartRead(&note_);
-                }
-            }
-            routeguide::RouteNote note_;
-            absl::Mutex *mu_;
-            std::vector<routeguide::RouteNote> *received_notes_;
-            std::vector<routeguide::RouteNote> to_send_notes_;
-            std::vector<routeguide::RouteNote>::iterator notes_iterator_;
-        };
-        return new Chatter(&mu_, &received_notes_);
+        db.Watch(std::chrono::milliseconds(reload_interval_ms));
     }
+    routeguide::RouteGuideImpl service(&db, note_options, compression);
+    routeguide::RouteGuideAdminImpl admin_service(&db);
 
-  private:
-    std::vector<routeguide::Feature> feature_list_;
-    absl::Mutex mu_;
-    std::vector<routeguide::RouteNote> received_notes_ ABSL_GUARDED_BY(mu_);
-};
-
-void RunServer(const std::string &db, std::string &server_address)
-{
-    RouteGuideImpl service(db);
-
+    ServerMetrics metrics;
+    grpc::EnableDefaultHealthCheckService(true);
     grpc::ServerBuilder builder;
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
     builder.RegisterService(&service);
+    server_options.Apply(&builder);
+    metrics.Install(&builder);
+    // From here on SIGTERM drains the server rather than killing it.
+    ShutdownSignal::Install();
     std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
     std::cout << "Server listening on " << server_address << std::endl;
-    server->Wait();
+    // The admin service has no authentication, so it is served only on the
+    // maintenance port, next to /metrics.
+    grpc::ServerBuilder admin_builder;
+    admin_builder.RegisterService(&admin_service);
+    std::unique_ptr<grpc::Server> admin_server(admin_builder.BuildAndStart());
+    MetricsHttpServer metrics_server(maintenance_address, &metrics, server_options.reuse_port, admin_server.get());
+    NotifyWorkerReady();
+    DrainOnSignal(server.get(), server_options);
 }
 
 // For Client
@@ -328,10 +125,11 @@ routeguide::RouteNote MakeRouteNote(const std::string &message, long latitude, l
 class RouteGuideClient
 {
   public:
-    RouteGuideClient(std::shared_ptr<grpc::Channel> channel, const std::string &db)
-        : stub_(routeguide::RouteGuide::NewStub(channel))
+    RouteGuideClient(std::shared_ptr<ChannelPool> channels, const std::string &db_path,
+                     const CallDeadlines &deadlines)
+        : stubs_(std::move(channels)), deadlines_(deadlines)
     {
-        routeguide::ParseDb(db, &feature_list_);
+        routeguide::LoadDb(db_path, &feature_list_);
     }
 
     void GetFeature()
@@ -344,6 +142,28 @@ class RouteGuideClient
         GetOneFeature(point, &feature);
     }
 
+    // Looks up every point of the feature list with |window| calls in flight.
+    void GetFeatures(int window)
+    {
+        std::vector<routeguide::Point> points;
+        for (const routeguide::Feature &f : feature_list_)
+            points.push_back(f.location());
+        std::atomic<int> found{0};
+        std::atomic<int> failed{0};
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        routeguide::FeatureLookup lookup(stub.get(), window, deadlines_.For("GetFeature"));
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        lookup.Run(points, [&](size_t, const grpc::Status &status, const routeguide::Feature &feature) {
+            if (!status.ok())
+                failed++;
+            else if (!feature.name().empty())
+                found++;
+        });
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        LOG(INFO) << "Looked up " << points.size() << " points with " << window << " calls in flight: " << found
+                  << " named, " << failed << " failed, in " << elapsed.count() << " ms";
+    }
+
     void ListFeatures()
     {
         routeguide::Rectangle rect;
@@ -353,14 +173,16 @@ class RouteGuideClient
         rect.mutable_lo()->set_longitude(-750000000);
         rect.mutable_hi()->set_latitude(420000000);
         rect.mutable_hi()->set_longitude(-730000000);
-        std::cout << "Looking for features between 40, -75 and 42, -73" << std::endl;
+        LOG(INFO) << "Looking for features between 40, -75 and 42, -73";
 
         class Reader : public grpc::ClientReadReactor<routeguide::Feature>
         {
           public:
-            Reader(routeguide::RouteGuide::Stub *stub, float coord_factor, const routeguide::Rectangle &rect)
+            Reader(routeguide::RouteGuide::Stub *stub, const CallDeadlines &deadlines, float coord_factor,
+                   const routeguide::Rectangle &rect)
                 : coord_factor_(coord_factor)
             {
+                deadlines.Apply("ListFeatures", &context_);
                 stub->async()->ListFeatures(&context_, &rect, this);
                 StartRead(&feature_);
                 StartCall();
@@ -370,12 +192,12 @@ class RouteGuideClient
                 if (ok)
                 {
                     if (feature_.name().empty())
-                        std::cout << "Found feature at " << feature_.location().latitude() / coord_factor_ << ", "
-                                  << feature_.location().longitude() / coord_factor_ << std::endl;
+                        LOG(INFO) << "Found feature at " << feature_.location().latitude() / coord_factor_ << ", "
+                                  << feature_.location().longitude() / coord_factor_;
                     else
-                        std::cout << "Found feature called " << feature_.name() << " at "
+                        LOG(INFO) << "Found feature called " << feature_.name() << " at "
                                   << feature_.location().latitude() / coord_factor_ << ", "
-                                  << feature_.location().longitude() / coord_factor_ << std::endl;
+                                  << feature_.location().longitude() / coord_factor_;
                     StartRead(&feature_);
                 }
             }
@@ -402,15 +224,16 @@ class RouteGuideClient
             grpc::Status status_;
             bool done_ = false;
         };
-        Reader reader(stub_.get(), kCoordFactor_, rect);
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        Reader reader(stub.get(), deadlines_, kCoordFactor_, rect);
         grpc::Status status = reader.Await();
         if (status.ok())
         {
-            std::cout << "ListFeatures rpc succeeded." << std::endl;
+            LOG(INFO) << "ListFeatures rpc succeeded.";
         }
         else
         {
-            std::cout << "ListFeatures rpc failed." << std::endl;
+            LOG(ERROR) << "ListFeatures rpc failed.";
         }
     }
 
@@ -419,12 +242,13 @@ class RouteGuideClient
         class Recorder : public grpc::ClientWriteReactor<routeguide::Point>
         {
           public:
-            Recorder(routeguide::RouteGuide::Stub *stub, float coord_factor,
+            Recorder(routeguide::RouteGuide::Stub *stub, const CallDeadlines &deadlines, float coord_factor,
                      const std::vector<routeguide::Feature> *feature_list)
                 : coord_factor_(coord_factor), feature_list_(feature_list),
                   generator_(std::chrono::system_clock::now().time_since_epoch().count()),
                   feature_distribution_(0, feature_list->size() - 1), delay_distribution_(500, 1500)
             {
+                deadlines.Apply("RecordRoute", &context_);
                 stub->async()->RecordRoute(&context_, &stats_, this);
                 // Use a hold since some StartWrites are invoked indirectly from a
                 // delayed lambda in OnWriteDone rather than directly from the reaction
@@ -461,8 +285,8 @@ class RouteGuideClient
                 if (points_remaining_ != 0)
                 {
                     const routeguide::Feature &f = (*feature_list_)[feature_distribution_(generator_)];
-                    std::cout << "Visiting point " << f.location().latitude() / coord_factor_ << ", "
-                              << f.location().longitude() / coord_factor_ << std::endl;
+                    LOG(INFO) << "Visiting point " << f.location().latitude() / coord_factor_ << ", "
+                              << f.location().longitude() / coord_factor_;
                     StartWrite(&f.location());
                     points_remaining_--;
                 }
@@ -487,32 +311,38 @@ class RouteGuideClient
             grpc::Status status_;
             bool done_ = false;
         };
-        Recorder recorder(stub_.get(), kCoordFactor_, &feature_list_);
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        Recorder recorder(stub.get(), deadlines_, kCoordFactor_, &feature_list_);
         routeguide::RouteSummary stats;
         grpc::Status status = recorder.Await(&stats);
         if (status.ok())
         {
-            std::cout << "Finished trip with " << stats.point_count() << " points\n"
+            LOG(INFO) << "Finished trip with " << stats.point_count() << " points\n"
                       << "Passed " << stats.feature_count() << " features\n"
                       << "Travelled " << stats.distance() << " meters\n"
-                      << "It took " << stats.elapsed_time() << " seconds" << std::endl;
+                      << "It took " << stats.elapsed_time() << " seconds";
         }
         else
         {
-            std::cout << "RecordRoute rpc failed." << std::endl;
+            LOG(ERROR) << "RecordRoute rpc failed.";
         }
     }
 
-    void RouteChat()
+    void RouteChat(bool subscribe)
     {
         class Chatter : public grpc::ClientBidiReactor<routeguide::RouteNote, routeguide::RouteNote>
         {
           public:
-            explicit Chatter(routeguide::RouteGuide::Stub *stub)
+            Chatter(routeguide::RouteGuide::Stub *stub, const CallDeadlines &deadlines, bool subscribe)
                 : notes_{MakeRouteNote("First message", 0, 0), MakeRouteNote("Second message", 0, 1),
                          MakeRouteNote("Third message", 1, 0), MakeRouteNote("Fourth message", 0, 0)},
                   notes_iterator_(notes_.begin())
             {
+                if (subscribe)
+                {
+                    context_.AddMetadata(routeguide::kRouteChatSubscribeKey, "1");
+                }
+                deadlines.Apply("RouteChat", &context_);
                 stub->async()->RouteChat(&context_, this);
                 NextWrite();
                 StartRead(&server_note_);
@@ -526,9 +356,8 @@ class RouteGuideClient
             {
                 if (ok)
                 {
-                    std::cout << "Got message " << server_note_.message() << " at "
-                              << server_note_.location().latitude() << ", " << server_note_.location().longitude()
-                              << std::endl;
+                    LOG(INFO) << "Got message " << server_note_.message() << " at "
+                              << server_note_.location().latitude() << ", " << server_note_.location().longitude();
                     StartRead(&server_note_);
                 }
             }
@@ -552,8 +381,8 @@ class RouteGuideClient
                 if (notes_iterator_ != notes_.end())
                 {
                     const auto &note = *notes_iterator_;
-                    std::cout << "Sending message " << note.message() << " at " << note.location().latitude() << ", "
-                              << note.location().longitude() << std::endl;
+                    LOG(INFO) << "Sending message " << note.message() << " at " << note.location().latitude() << ", "
+                              << note.location().longitude();
                     StartWrite(&note);
                     notes_iterator_++;
                 }
@@ -572,11 +401,12 @@ class RouteGuideClient
             bool done_ = false;
         };
 
-        Chatter chatter(stub_.get());
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        Chatter chatter(stub.get(), deadlines_, subscribe);
         grpc::Status status = chatter.Await();
         if (!status.ok())
         {
-            std::cout << "RouteChat rpc failed." << std::endl;
+            LOG(ERROR) << "RouteChat rpc failed.";
         }
     }
 
@@ -584,34 +414,36 @@ class RouteGuideClient
     bool GetOneFeature(const routeguide::Point &point, routeguide::Feature *feature)
     {
         grpc::ClientContext context;
+        deadlines_.Apply("GetFeature", &context);
         bool result;
         std::mutex mu;
         std::condition_variable cv;
         bool done = false;
-        stub_->async()->GetFeature(
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        stub->async()->GetFeature(
             &context, &point, feature, [&result, &mu, &cv, &done, feature, this](grpc::Status status) {
                 bool ret;
                 if (!status.ok())
                 {
-                    std::cout << "GetFeature rpc failed." << std::endl;
+                    LOG(ERROR) << "GetFeature rpc failed.";
                     ret = false;
                 }
                 else if (!feature->has_location())
                 {
-                    std::cout << "Server returns incomplete feature." << std::endl;
+                    LOG(ERROR) << "Server returns incomplete feature.";
                     ret = false;
                 }
                 else if (feature->name().empty())
                 {
-                    std::cout << "Found no feature at " << feature->location().latitude() / kCoordFactor_ << ", "
-                              << feature->location().longitude() / kCoordFactor_ << std::endl;
+                    LOG(INFO) << "Found no feature at " << feature->location().latitude() / kCoordFactor_ << ", "
+                              << feature->location().longitude() / kCoordFactor_;
                     ret = true;
                 }
                 else
                 {
-                    std::cout << "Found feature called " << feature->name() << " at "
+                    LOG(INFO) << "Found feature called " << feature->name() << " at "
                               << feature->location().latitude() / kCoordFactor_ << ", "
-                              << feature->location().longitude() / kCoordFactor_ << std::endl;
+                              << feature->location().longitude() / kCoordFactor_;
                     ret = true;
                 }
                 std::lock_guard<std::mutex> lock(mu);
@@ -625,7 +457,249 @@ class RouteGuideClient
     }
 
     const float kCoordFactor_ = 10000000.0;
-    std::unique_ptr<routeguide::RouteGuide::Stub> stub_;
+    StubPool<routeguide::RouteGuide> stubs_;
+    CallDeadlines deadlines_;
+    std::vector<routeguide::Feature> feature_list_;
+};
+
+// Issues RouteGuide calls for the load generator, on one stub per pooled
+// channel; the pool picks the channel of each call. Calls pick their points
+// from the feature list and print nothing; every reactor deletes itself once
+// the call is over.
+class RouteGuideLoad
+{
+  public:
+    RouteGuideLoad(std::shared_ptr<ChannelPool> channels, const std::string &db_path,
+                   const CallDeadlines &deadlines)
+        : stubs_(std::move(channels)), deadlines_(deadlines)
+    {
+        routeguide::LoadDb(db_path, &feature_list_);
+        if (feature_list_.empty())
+            feature_list_.push_back(MakeFeature("", 0, 0));
+    }
+
+    void Register(LoadGenerator *load)
+    {
+        load->AddRpc("GetFeature", [this](int, LoadGenerator::Done done) {
+            size_t channel = stubs_.Acquire();
+            GetFeature(stubs_.stub(channel), Releasing(channel, std::move(done)));
+        });
+        load->AddRpc("ListFeatures", [this](int, LoadGenerator::Done done) {
+            size_t channel = stubs_.Acquire();
+            new Lister(stubs_.stub(channel), this, RandomPoint(), Releasing(channel, std::move(done)));
+        });
+        load->AddRpc("RecordRoute", [this](int, LoadGenerator::Done done) {
+            size_t channel = stubs_.Acquire();
+            new Recorder(stubs_.stub(channel), this, Releasing(channel, std::move(done)));
+        });
+        load->AddRpc("RecordRouteBatch", [this](int, LoadGenerator::Done done) {
+            size_t channel = stubs_.Acquire();
+            new BatchRecorder(stubs_.stub(channel), this, Releasing(channel, std::move(done)));
+        });
+        load->AddRpc("RouteChat", [this](int, LoadGenerator::Done done) {
+            size_t channel = stubs_.Acquire();
+            new Chatter(stubs_.stub(channel), this, Releasing(channel, std::move(done)));
+        });
+    }
+
+  private:
+    // Wraps |done| to give |channel| back to the pool once the call is over.
+    LoadGenerator::Done Releasing(size_t channel, LoadGenerator::Done done)
+    {
+        return [this, channel, done = std::move(done)](bool ok) {
+            stubs_.Release(channel);
+            done(ok);
+        };
+    }
+
+    static std::mt19937 &Generator()
+    {
+        thread_local std::mt19937 generator(std::random_device{}());
+        return generator;
+    }
+
+    const routeguide::Point &RandomPoint()
+    {
+        std::uniform_int_distribution<size_t> index(0, feature_list_.size() - 1);
+        return feature_list_[index(Generator())].location();
+    }
+
+    void GetFeature(routeguide::RouteGuide::Stub *stub, LoadGenerator::Done done)
+    {
+        struct Call
+        {
+            grpc::ClientContext context;
+            routeguide::Point point;
+            routeguide::Feature feature;
+        };
+        Call *call = new Call;
+        call->point = RandomPoint();
+        deadlines_.Apply("GetFeature", &call->context);
+        stub->async()->GetFeature(&call->context, &call->point, &call->feature,
+                                  [call, done = std::move(done)](grpc::Status status) {
+                                      delete call;
+                                      done(status.ok());
+                                  });
+    }
+
+    // Lists the features in a 0.2 degree square around a known point.
+    class Lister : public grpc::ClientReadReactor<routeguide::Feature>
+    {
+      public:
+        Lister(routeguide::RouteGuide::Stub *stub, RouteGuideLoad *load, const routeguide::Point &center,
+               LoadGenerator::Done done)
+            : done_(std::move(done))
+        {
+            rect_.mutable_lo()->set_latitude(center.latitude() - 1000000);
+            rect_.mutable_lo()->set_longitude(center.longitude() - 1000000);
+            rect_.mutable_hi()->set_latitude(center.latitude() + 1000000);
+            rect_.mutable_hi()->set_longitude(center.longitude() + 1000000);
+            load->deadlines_.Apply("ListFeatures", &context_);
+            stub->async()->ListFeatures(&context_, &rect_, this);
+            StartRead(&feature_);
+            StartCall();
+        }
+        void OnReadDone(bool ok) override
+        {
+            if (ok)
+                StartRead(&feature_);
+        }
+        void OnDone(const grpc::Status &s) override
+        {
+            LoadGenerator::Done done = std::move(done_);
+            delete this;
+            done(s.ok());
+        }
+
+      private:
+        grpc::ClientContext context_;
+        routeguide::Rectangle rect_;
+        routeguide::Feature feature_;
+        LoadGenerator::Done done_;
+    };
+
+    // Sends a route of ten known points, back to back.
+    class Recorder : public grpc::ClientWriteReactor<routeguide::Point>
+    {
+      public:
+        Recorder(routeguide::RouteGuide::Stub *stub, RouteGuideLoad *load, LoadGenerator::Done done)
+            : load_(load), done_(std::move(done))
+        {
+            load->deadlines_.Apply("RecordRoute", &context_);
+            stub->async()->RecordRoute(&context_, &summary_, this);
+            NextWrite();
+            StartCall();
+        }
+        void OnWriteDone(bool ok) override
+        {
+            if (ok)
+                NextWrite();
+        }
+        void OnDone(const grpc::Status &s) override
+        {
+            LoadGenerator::Done done = std::move(done_);
+            delete this;
+            done(s.ok());
+        }
+
+      private:
+        void NextWrite()
+        {
+            if (points_remaining_-- > 0)
+                StartWrite(&load_->RandomPoint());
+            else
+                StartWritesDone();
+        }
+
+        RouteGuideLoad *load_;
+        grpc::ClientContext context_;
+        routeguide::RouteSummary summary_;
+        int points_remaining_ = 10;
+        LoadGenerator::Done done_;
+    };
+
+    // Sends a route of a thousand known points packed into a single batch.
+    class BatchRecorder : public grpc::ClientWriteReactor<routeguide::PointBatch>
+    {
+      public:
+        BatchRecorder(routeguide::RouteGuide::Stub *stub, RouteGuideLoad *load, LoadGenerator::Done done)
+            : done_(std::move(done))
+        {
+            routeguide::PointBatchEncoder encoder;
+            for (int i = 0; i < 1000; i++)
+                encoder.Add(load->RandomPoint(), &batch_);
+            load->deadlines_.Apply("RecordRouteBatch", &context_);
+            stub->async()->RecordRouteBatch(&context_, &summary_, this);
+            StartWriteLast(&batch_, grpc::WriteOptions());
+            StartCall();
+        }
+        void OnDone(const grpc::Status &s) override
+        {
+            LoadGenerator::Done done = std::move(done_);
+            delete this;
+            done(s.ok());
+        }
+
+      private:
+        grpc::ClientContext context_;
+        routeguide::PointBatch batch_;
+        routeguide::RouteSummary summary_;
+        LoadGenerator::Done done_;
+    };
+
+    // Posts a few notes at a random location and reads back whatever the
+    // server returns for it. Random locations keep the history per location
+    // short, so the cost of a chat stays about constant as the test runs.
+    class Chatter : public grpc::ClientBidiReactor<routeguide::RouteNote, routeguide::RouteNote>
+    {
+      public:
+        Chatter(routeguide::RouteGuide::Stub *stub, RouteGuideLoad *load, LoadGenerator::Done done)
+            : done_(std::move(done))
+        {
+            std::uniform_int_distribution<int> latitude(-900000000, 900000000);
+            std::uniform_int_distribution<int> longitude(-1800000000, 1800000000);
+            note_ = MakeRouteNote("load", latitude(Generator()), longitude(Generator()));
+            load->deadlines_.Apply("RouteChat", &context_);
+            stub->async()->RouteChat(&context_, this);
+            NextWrite();
+            StartRead(&server_note_);
+            StartCall();
+        }
+        void OnWriteDone(bool ok) override
+        {
+            if (ok)
+                NextWrite();
+        }
+        void OnReadDone(bool ok) override
+        {
+            if (ok)
+                StartRead(&server_note_);
+        }
+        void OnDone(const grpc::Status &s) override
+        {
+            LoadGenerator::Done done = std::move(done_);
+            delete this;
+            done(s.ok());
+        }
+
+      private:
+        void NextWrite()
+        {
+            if (notes_remaining_-- > 0)
+                StartWrite(&note_);
+            else
+                StartWritesDone();
+        }
+
+        grpc::ClientContext context_;
+        routeguide::RouteNote note_;
+        routeguide::RouteNote server_note_;
+        int notes_remaining_ = 4;
+        LoadGenerator::Done done_;
+    };
+
+    StubPool<routeguide::RouteGuide> stubs_;
+    CallDeadlines deadlines_;
     std::vector<routeguide::Feature> feature_list_;
 };
 
@@ -634,27 +708,70 @@ int main(int argc, char **argv)
 {
     CliParams cli_params;
     ParseCLIState cliState = ParseCommandLine(argc, argv, &cli_params);
-    std::string db_content = routeguide::GetDbFileContent(cli_params.database);
 
     if (cliState == ParseCLIState::SUCCESS)
     {
-        if (cli_params.mode == Mode::CLIENT)
+        ChannelPoolOptions pool_options;
+        pool_options.channels = cli_params.channels;
+        pool_options.lb_policy = cli_params.lb_policy;
+        ParseCompressionAlgorithms(cli_params.accept_encodings, &pool_options.compression_algorithms);
+        if (!ParseChannelPick(cli_params.channel_pick, &pool_options.pick))
+        {
+            std::cout << "--channel_pick must be round_robin or least_outstanding." << std::endl;
+            return 1;
+        }
+        CallDeadlines deadlines;
+        if (!GetCallDeadlines(cli_params, &deadlines))
+        {
+            return 1;
+        }
+        if (cli_params.mode == Mode::CLIENT && cli_params.load)
+        {
+            RouteGuideLoad route_guide(std::make_shared<ChannelPool>(cli_params.server_address, pool_options),
+                                       cli_params.database, deadlines);
+            LoadGenerator load;
+            route_guide.Register(&load);
+            LoadOptions options;
+            options.qps = cli_params.qps;
+            options.concurrency = cli_params.concurrency;
+            options.duration = std::chrono::seconds(cli_params.duration_s);
+            options.rpc_mix = cli_params.rpc_mix;
+            return load.Run(options, std::cout) ? 0 : 1;
+        }
+        else if (cli_params.mode == Mode::CLIENT)
         {
-            RouteGuideClient route_guide(
-                grpc::CreateChannel(cli_params.server_address, grpc::InsecureChannelCredentials()), db_content);
+            RouteGuideClient route_guide(std::make_shared<ChannelPool>(cli_params.server_address, pool_options),
+                                         cli_params.database, deadlines);
 
-            std::cout << "-------------- GetFeature --------------" << std::endl;
+            LOG(INFO) << "-------------- GetFeature --------------";
             route_guide.GetFeature();
-            std::cout << "-------------- ListFeatures --------------" << std::endl;
+            LOG(INFO) << "-------------- GetFeatures --------------";
+            route_guide.GetFeatures(cli_params.window);
+            LOG(INFO) << "-------------- ListFeatures --------------";
             route_guide.ListFeatures();
-            std::cout << "-------------- RecordRoute --------------" << std::endl;
+            LOG(INFO) << "-------------- RecordRoute --------------";
             route_guide.RecordRoute();
-            std::cout << "-------------- RouteChat --------------" << std::endl;
-            route_guide.RouteChat();
+            LOG(INFO) << "-------------- RouteChat --------------";
+            route_guide.RouteChat(cli_params.chat_subscribe);
         }
         else // SERVER
         {
-            RunServer(db_content, cli_params.server_address);
+            routeguide::RouteNoteStore::Options note_options;
+            note_options.max_notes_per_location = cli_params.chat_max_notes;
+            note_options.ttl = std::chrono::milliseconds(cli_params.chat_ttl_ms);
+            note_options.max_bytes = cli_params.chat_max_bytes;
+            note_options.subscriber_queue_size = cli_params.chat_queue_size;
+            note_options.subscriber_overflow = cli_params.chat_disconnect_slow
+                                                   ? routeguide::NoteQueue::Overflow::kDisconnect
+                                                   : routeguide::NoteQueue::Overflow::kDropOldest;
+            auto serve = [&](int worker) {
+                std::string maintenance_address = WorkerAddress(cli_params.maintenance_address, worker);
+                RunServer(cli_params.database, cli_params.reload_interval_ms, note_options, cli_params.server_address,
+                          maintenance_address, GetServerOptions(cli_params), GetCompressionPolicy(cli_params));
+            };
+            if (cli_params.processes > 1)
+                return Supervisor(GetSupervisorOptions(cli_params), serve).Run();
+            serve(0);
         }
         return 0;
     }
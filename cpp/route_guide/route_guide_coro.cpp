@@ -0,0 +1,1126 @@
+// RouteGuide on the async completion-queue API, with every handler and client
+// call written as a C++20 coroutine (common/coro.h) instead of a hand-rolled
+// state machine. Takes the same flags as route_guide_callback.
+//   ./route_guide_coro -s --num_cqs 2 --calls_per_cq 4
+//   ./route_guide_coro -c --load --rpc_mix GetFeature:1 --concurrency 64
+
+// For both
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// For Server
+#include <grpc/grpc.h>
+#include <grpcpp/security/server_credentials.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+#include <grpcpp/server_context.h>
+
+// For Client
+#include <grpc/grpc.h>
+#include <grpcpp/alarm.h>
+#include <grpcpp/channel.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+
+// For both
+#include "common/channel_pool.h"
+#include "common/compression.h"
+#include "common/coro.h"
+#include "common/load_generator.h"
+#include "common/logging.h"
+#include "common/metrics.h"
+#include "common/server_options.h"
+#include "common/shutdown.h"
+#include "common/thread_pool.h"
+#include "common/utils.h"
+#include "feature_database.h"
+#include "feature_pager.h"
+#include "feature_store.h"
+#include "helper.h"
+#include "note_store.h"
+#include "route_guide.grpc.pb.h"
+#include "route_guide_service.h"
+#include "route_recorder.h"
+
+// For Server
+// Write side of one RouteChat stream: the replies to the stream's own notes
+// and, when it subscribed, the notes other streams push to it. A stream takes
+// one write at a time, so a single writer coroutine, Drain(), sends both
+// while the handler keeps reading.
+class ChatOutbox final : public routeguide::RouteNoteStore::Subscriber
+{
+  public:
+    ChatOutbox(grpc::CompletionQueue *cq, size_t queue_size, routeguide::NoteQueue::Overflow overflow,
+               const CompressionPolicy *compression)
+        : pushed_(queue_size, overflow), compression_(compression), wake_(cq), replied_(cq), drained_(cq)
+    {
+    }
+
+    void Deliver(const std::shared_ptr<const routeguide::RouteNote> &note) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            if (!closed_ && !pushed_.Push(note))
+            {
+                overflowed_ = true;
+            }
+        }
+        wake_.Notify();
+    }
+
+    // Hands the replies to a note to the writer, leaving |notes| empty. The
+    // result resumes the handler once they are all on their way, so that a
+    // client can't outrun its own replies.
+    CoEvent::Awaiter Reply(std::vector<std::shared_ptr<const routeguide::RouteNote>> *notes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            replies_.swap(*notes);
+            next_reply_ = 0;
+        }
+        wake_.Notify();
+        return replied_.Wait();
+    }
+
+    // Stops the writer after its current write. The result resumes the
+    // handler once the writer is gone.
+    CoEvent::Awaiter Close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            closed_ = true;
+        }
+        wake_.Notify();
+        return drained_.Wait();
+    }
+
+    bool overflowed()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        return overflowed_;
+    }
+
+    // The writer. It ends when closed, when a write fails and when the
+    // subscriber falls behind, which also cancels the call to fail the
+    // handler's pending read.
+    CoTask Drain(grpc::ServerContext *context,
+                 grpc::ServerAsyncReaderWriter<routeguide::RouteNote, routeguide::RouteNote> *stream)
+    {
+        CoStream chat(stream);
+        while (true)
+        {
+            std::shared_ptr<const routeguide::RouteNote> note;
+            bool replied = false;
+            bool done = false;
+            {
+                std::lock_guard<std::mutex> lock(mu_);
+                if (next_reply_ < replies_.size())
+                {
+                    note = std::move(replies_[next_reply_++]);
+                }
+                else
+                {
+                    replied = !replies_.empty();
+                    replies_.clear();
+                    if (closed_ || overflowed_)
+                        done = true;
+                    else if (!pushed_.empty())
+                        note = pushed_.Pop();
+                }
+            }
+            if (replied)
+            {
+                replied_.Notify();
+            }
+            if (note)
+            {
+                grpc::WriteOptions options =
+                    compression_ ? compression_->WriteOptionsFor(note->ByteSizeLong()) : grpc::WriteOptions();
+                if (!co_await chat.Write(*note, options))
+                {
+                    // Broken stream; the handler's reads fail too.
+                    break;
+                }
+            }
+            else if (done)
+            {
+                break;
+            }
+            else
+            {
+                co_await wake_.Wait();
+            }
+        }
+
+        bool overflowed;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            closed_ = true;
+            overflowed = overflowed_;
+            replies_.clear();
+        }
+        if (overflowed)
+        {
+            context->TryCancel();
+        }
+        // A handler waiting for its replies must not wait for a writer that
+        // is gone.
+        replied_.Notify();
+        drained_.Notify();
+    }
+
+  private:
+    std::mutex mu_;
+    routeguide::NoteQueue pushed_;
+    std::vector<std::shared_ptr<const routeguide::RouteNote>> replies_;
+    size_t next_reply_ = 0;
+    bool closed_ = false;
+    bool overflowed_ = false;
+    const CompressionPolicy *compression_;
+    CoEvent wake_;
+    CoEvent replied_;
+    CoEvent drained_;
+};
+
+// Each handler is a coroutine that waits for a call of its method on one
+// queue, posts its replacement for the next call once it has one, and then
+// serves the call to the end. Its context, messages and stream all live in
+// the coroutine frame, which comes from the queue thread's frame pool.
+class RouteGuideImpl
+{
+  public:
+    RouteGuideImpl(routeguide::FeatureDatabase *db, const routeguide::RouteNoteStore::Options &note_options,
+                   const CompressionPolicy &compression)
+        : db_(db), notes_(note_options), compression_(compression)
+    {
+    }
+
+    grpc::Service *service()
+    {
+        return &service_;
+    }
+
+    // Keeps |calls| calls of each method posted on |cq| and resumes them
+    // until the queue is shut down.
+    void Serve(grpc::ServerCompletionQueue *cq, int calls)
+    {
+        for (int i = 0; i < calls; i++)
+        {
+            GetFeature(cq);
+            ListFeatures(cq);
+            ListFeaturePages(cq);
+            RecordRoute(cq);
+            RecordRouteBatch(cq);
+            RouteChat(cq);
+        }
+        CoDrain(cq);
+    }
+
+    // Once the server is shut down, waits for the handlers of the calls it
+    // had to return, so that none starts another operation on a queue.
+    void WaitForCalls()
+    {
+        in_flight_.WaitForNone();
+    }
+
+  private:
+    CoTask GetFeature(grpc::ServerCompletionQueue *cq)
+    {
+        grpc::ServerContext context;
+        routeguide::Point point;
+        grpc::ServerAsyncResponseWriter<routeguide::Feature> responder(&context);
+        if (!co_await CoCall([&](void *tag) { service_.RequestGetFeature(&context, &point, &responder, cq, cq, tag); }))
+            co_return;
+        GetFeature(cq);
+        InFlightCalls::Scope in_flight(&in_flight_);
+
+        routeguide::Feature feature;
+        {
+            std::shared_ptr<const routeguide::FeatureStore> store = db_->Get();
+            std::string_view name = store->GetFeatureName(point);
+            feature.set_name(name.data(), name.size());
+            feature.mutable_location()->CopyFrom(point);
+        }
+        compression_.StartUnary(&context, feature.ByteSizeLong());
+        co_await CoStream(&responder).Finish(feature, grpc::Status::OK);
+    }
+
+    CoTask ListFeatures(grpc::ServerCompletionQueue *cq)
+    {
+        grpc::ServerContext context;
+        routeguide::Rectangle rectangle;
+        grpc::ServerAsyncWriter<routeguide::Feature> writer(&context);
+        if (!co_await CoCall([&](void *tag) { service_.RequestListFeatures(&context, &rectangle, &writer, cq, cq, tag); }))
+            co_return;
+        ListFeatures(cq);
+        InFlightCalls::Scope in_flight(&in_flight_);
+
+        CoStream out(&writer);
+        std::shared_ptr<const routeguide::FeatureStore> store = db_->Get();
+        routeguide::FeatureStore::Cursor cursor = store->Query(rectangle);
+        routeguide::Feature feature;
+        bool compressing = compression_.Start(&context);
+        for (uint32_t index = cursor.Next(); index != routeguide::FeatureStore::kNotFound; index = cursor.Next())
+        {
+            store->GetFeature(index, &feature);
+            if (!co_await out.Write(feature, compressing ? compression_.WriteOptionsFor(feature.ByteSizeLong())
+                                                         : grpc::WriteOptions()))
+            {
+                // Broken stream.
+                break;
+            }
+        }
+        co_await out.Finish(grpc::Status::OK);
+    }
+
+    CoTask ListFeaturePages(grpc::ServerCompletionQueue *cq)
+    {
+        grpc::ServerContext context;
+        routeguide::ListFeaturesRequest request;
+        grpc::ServerAsyncWriter<routeguide::FeaturePage> writer(&context);
+        if (!co_await CoCall(
+                [&](void *tag) { service_.RequestListFeaturePages(&context, &request, &writer, cq, cq, tag); }))
+            co_return;
+        ListFeaturePages(cq);
+        InFlightCalls::Scope in_flight(&in_flight_);
+
+        CoStream out(&writer);
+        routeguide::FeaturePager pager(db_->Get(), request);
+        routeguide::FeaturePage page;
+        bool compressing = compression_.Start(&context);
+        while (pager.Next(&page))
+        {
+            if (!co_await out.Write(page, compressing ? compression_.WriteOptionsFor(page.ByteSizeLong())
+                                                      : grpc::WriteOptions()))
+            {
+                // Broken stream; the client resumes from its last token.
+                break;
+            }
+        }
+        co_await out.Finish(pager.status());
+    }
+
+    CoTask RecordRoute(grpc::ServerCompletionQueue *cq)
+    {
+        grpc::ServerContext context;
+        grpc::ServerAsyncReader<routeguide::RouteSummary, routeguide::Point> reader(&context);
+        if (!co_await CoCall([&](void *tag) { service_.RequestRecordRoute(&context, &reader, cq, cq, tag); }))
+            co_return;
+        RecordRoute(cq);
+        InFlightCalls::Scope in_flight(&in_flight_);
+
+        CoStream in(&reader);
+        routeguide::Point point;
+        routeguide::RouteRecorder recorder(db_->Get());
+        while (co_await in.Read(&point))
+        {
+            recorder.Add(point);
+        }
+        routeguide::RouteSummary summary;
+        recorder.Finish(&summary);
+        co_await in.Finish(summary, grpc::Status::OK);
+    }
+
+    CoTask RecordRouteBatch(grpc::ServerCompletionQueue *cq)
+    {
+        grpc::ServerContext context;
+        grpc::ServerAsyncReader<routeguide::RouteSummary, routeguide::PointBatch> reader(&context);
+        if (!co_await CoCall([&](void *tag) { service_.RequestRecordRouteBatch(&context, &reader, cq, cq, tag); }))
+            co_return;
+        RecordRouteBatch(cq);
+        InFlightCalls::Scope in_flight(&in_flight_);
+
+        CoStream in(&reader);
+        routeguide::PointBatch batch;
+        routeguide::RouteRecorder recorder(db_->Get());
+        grpc::Status status;
+        while (co_await in.Read(&batch))
+        {
+            if (!recorder.Add(batch))
+            {
+                status = grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                                      "latitude and longitude deltas differ in length");
+                break;
+            }
+        }
+        routeguide::RouteSummary summary;
+        recorder.Finish(&summary);
+        co_await in.Finish(summary, status);
+    }
+
+    CoTask RouteChat(grpc::ServerCompletionQueue *cq)
+    {
+        grpc::ServerContext context;
+        grpc::ServerAsyncReaderWriter<routeguide::RouteNote, routeguide::RouteNote> stream(&context);
+        if (!co_await CoCall([&](void *tag) { service_.RequestRouteChat(&context, &stream, cq, cq, tag); }))
+            co_return;
+        RouteChat(cq);
+        InFlightCalls::Scope in_flight(&in_flight_);
+
+        const routeguide::RouteNoteStore::Options &options = notes_.options();
+        std::shared_ptr<ChatOutbox> outbox =
+            std::make_shared<ChatOutbox>(cq, (std::max)(options.subscriber_queue_size, size_t{1}),
+                                         options.subscriber_overflow, compression_.Start(&context) ? &compression_
+                                                                                                   : nullptr);
+        std::shared_ptr<routeguide::RouteNoteStore::Subscriber> subscriber;
+        if (context.client_metadata().count(routeguide::kRouteChatSubscribeKey) != 0)
+        {
+            subscriber = outbox;
+        }
+        outbox->Drain(&context, &stream);
+
+        CoStream chat(&stream);
+        routeguide::RouteNote note;
+        std::vector<std::shared_ptr<const routeguide::RouteNote>> earlier;
+        while (co_await chat.Read(&note))
+        {
+            earlier.clear();
+            notes_.Post(note, &earlier, subscriber);
+            if (!earlier.empty())
+            {
+                co_await outbox->Reply(&earlier);
+            }
+        }
+        co_await outbox->Close();
+
+        if (outbox->overflowed())
+        {
+            co_await chat.Finish(
+                grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "RouteChat subscriber fell behind"));
+        }
+        else
+        {
+            co_await chat.Finish(grpc::Status::OK);
+        }
+    }
+
+    routeguide::RouteGuide::AsyncService service_;
+    routeguide::FeatureDatabase *db_;
+    routeguide::RouteNoteStore notes_;
+    const CompressionPolicy compression_;
+    InFlightCalls in_flight_;
+};
+
+void RunServer(const std::string &db_path, int reload_interval_ms,
+               const routeguide::RouteNoteStore::Options &note_options, std::string &server_address,
+               std::string &maintenance_address, const ServerOptions &server_options,
+               const CompressionPolicy &compression, int num_cqs, int calls_per_cq)
+{
+    routeguide::FeatureDatabase db(db_path);
+    if (reload_interval_ms > 0)
+    {
+        db.Watch(std::chrono::milliseconds(reload_interval_ms));
+    }
+    RouteGuideImpl service(&db, note_options, compression);
+    routeguide::RouteGuideAdminImpl admin_service(&db);
+
+    ServerMetrics metrics;
+    grpc::EnableDefaultHealthCheckService(true);
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.RegisterService(service.service());
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs;
+    for (int i = 0; i < (std::max)(num_cqs, 1); i++)
+    {
+        cqs.push_back(builder.AddCompletionQueue());
+    }
+    server_options.Apply(&builder);
+    metrics.Install(&builder);
+    // From here on SIGTERM drains the server rather than killing it.
+    ShutdownSignal::Install();
+    std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+    std::cout << "Server listening on " << server_address << std::endl;
+    // The admin service has no authentication, so it is served only on the
+    // maintenance port, next to /metrics.
+    grpc::ServerBuilder admin_builder;
+    admin_builder.RegisterService(&admin_service);
+    std::unique_ptr<grpc::Server> admin_server(admin_builder.BuildAndStart());
+    MetricsHttpServer metrics_server(maintenance_address, &metrics, server_options.reuse_port, admin_server.get());
+    NotifyWorkerReady();
+
+    // One thread per queue, resuming the coroutines of its calls.
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < cqs.size(); i++)
+    {
+        threads.emplace_back(&RouteGuideImpl::Serve, &service, cqs[i].get(), (std::max)(calls_per_cq, 1));
+        if (cqs.size() > 1)
+        {
+            PinThreadToCpu(threads.back(), static_cast<int>(i));
+        }
+    }
+
+    DrainOnSignal(server.get(), server_options);
+    service.WaitForCalls();
+    // The handlers still posted get their Request back with ok false.
+    for (std::unique_ptr<grpc::ServerCompletionQueue> &cq : cqs)
+    {
+        cq->Shutdown();
+    }
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+}
+
+// For Client
+routeguide::Point MakePoint(long latitude, long longitude)
+{
+    routeguide::Point p;
+    p.set_latitude(latitude);
+    p.set_longitude(longitude);
+    return p;
+}
+
+routeguide::Feature MakeFeature(const std::string &name, long latitude, long longitude)
+{
+    routeguide::Feature f;
+    f.set_name(name);
+    f.mutable_location()->CopyFrom(MakePoint(latitude, longitude));
+    return f;
+}
+
+routeguide::RouteNote MakeRouteNote(const std::string &message, long latitude, long longitude)
+{
+    routeguide::RouteNote n;
+    n.set_message(message);
+    n.mutable_location()->CopyFrom(MakePoint(latitude, longitude));
+    return n;
+}
+
+// The demo calls, as steps of one coroutine on a queue that the caller
+// drains on its own thread until Run() shuts it down.
+class RouteGuideClient
+{
+  public:
+    RouteGuideClient(std::shared_ptr<ChannelPool> channels, const std::string &db_path,
+                     const CallDeadlines &deadlines, grpc::CompletionQueue *cq)
+        : stubs_(std::move(channels)), deadlines_(deadlines), cq_(cq)
+    {
+        routeguide::LoadDb(db_path, &feature_list_);
+    }
+
+    CoTask Run(int window, int page_size, int max_results, bool subscribe)
+    {
+        LOG(INFO) << "-------------- GetFeature --------------";
+        co_await GetOneFeature(MakePoint(409146138, -746188906));
+        co_await GetOneFeature(MakePoint(0, 0));
+        LOG(INFO) << "-------------- GetFeatures --------------";
+        co_await GetFeatures(window);
+        LOG(INFO) << "-------------- ListFeatures --------------";
+        co_await ListFeatures();
+        LOG(INFO) << "-------------- ListFeaturePages --------------";
+        co_await ListFeaturePages(page_size, max_results);
+        LOG(INFO) << "-------------- RecordRoute --------------";
+        co_await RecordRoute();
+        LOG(INFO) << "-------------- RecordRouteBatch --------------";
+        co_await RecordRouteBatch();
+        LOG(INFO) << "-------------- RouteChat --------------";
+        co_await RouteChat(subscribe);
+        cq_->Shutdown();
+    }
+
+  private:
+    CoStep GetOneFeature(routeguide::Point point)
+    {
+        grpc::ClientContext context;
+        deadlines_.Apply("GetFeature", &context);
+        routeguide::Feature feature;
+        grpc::Status status;
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        std::unique_ptr<grpc::ClientAsyncResponseReader<routeguide::Feature>> call(
+            stub->AsyncGetFeature(&context, point, cq_));
+        co_await CoStream(call.get()).Finish(&feature, &status);
+        if (!status.ok())
+        {
+            LOG(ERROR) << "GetFeature rpc failed.";
+        }
+        else if (!feature.has_location())
+        {
+            LOG(ERROR) << "Server returns incomplete feature.";
+        }
+        else if (feature.name().empty())
+        {
+            LOG(INFO) << "Found no feature at " << feature.location().latitude() / kCoordFactor_ << ", "
+                      << feature.location().longitude() / kCoordFactor_;
+        }
+        else
+        {
+            LOG(INFO) << "Found feature called " << feature.name() << " at "
+                      << feature.location().latitude() / kCoordFactor_ << ", "
+                      << feature.location().longitude() / kCoordFactor_;
+        }
+    }
+
+    // Looks up every point of the feature list with |window| calls in
+    // flight, each kept going by its own coroutine. They all run on this
+    // thread, so the counters take no lock.
+    struct Lookup
+    {
+        explicit Lookup(grpc::CompletionQueue *cq) : done(cq)
+        {
+        }
+
+        std::vector<routeguide::Point> points;
+        size_t next = 0;
+        int found = 0;
+        int failed = 0;
+        int running = 0;
+        CoEvent done;
+    };
+
+    CoStep GetFeatures(int window)
+    {
+        Lookup lookup(cq_);
+        for (const routeguide::Feature &f : feature_list_)
+            lookup.points.push_back(f.location());
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        lookup.running = (std::min)((std::max)(window, 1), static_cast<int>(lookup.points.size()));
+        int workers = lookup.running;
+        for (int i = 0; i < workers; i++)
+            LookUp(stub.get(), &lookup);
+        if (workers > 0)
+            co_await lookup.done.Wait();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        LOG(INFO) << "Looked up " << lookup.points.size() << " points with " << window << " calls in flight: "
+                  << lookup.found << " named, " << lookup.failed << " failed, in " << elapsed.count() << " ms";
+    }
+
+    CoTask LookUp(routeguide::RouteGuide::Stub *stub, Lookup *lookup)
+    {
+        while (lookup->next < lookup->points.size())
+        {
+            grpc::ClientContext context;
+            deadlines_.Apply("GetFeature", &context);
+            routeguide::Feature feature;
+            grpc::Status status;
+            std::unique_ptr<grpc::ClientAsyncResponseReader<routeguide::Feature>> call(
+                stub->AsyncGetFeature(&context, lookup->points[lookup->next++], cq_));
+            co_await CoStream(call.get()).Finish(&feature, &status);
+            if (!status.ok())
+                lookup->failed++;
+            else if (!feature.name().empty())
+                lookup->found++;
+        }
+        if (--lookup->running == 0)
+            lookup->done.Notify();
+    }
+
+    CoStep ListFeatures()
+    {
+        routeguide::Rectangle rect;
+        routeguide::Feature feature;
+        grpc::ClientContext context;
+        deadlines_.Apply("ListFeatures", &context);
+        grpc::Status status;
+
+        rect.mutable_lo()->set_latitude(400000000);
+        rect.mutable_lo()->set_longitude(-750000000);
+        rect.mutable_hi()->set_latitude(420000000);
+        rect.mutable_hi()->set_longitude(-730000000);
+        LOG(INFO) << "Looking for features between 40, -75 and 42, -73";
+
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        std::unique_ptr<grpc::ClientAsyncReader<routeguide::Feature>> reader(
+            stub->PrepareAsyncListFeatures(&context, rect, cq_));
+        CoStream in(reader.get());
+        if (co_await in.StartCall())
+        {
+            while (co_await in.Read(&feature))
+            {
+                LOG(INFO) << "Found feature called " << feature.name() << " at "
+                          << feature.location().latitude() / kCoordFactor_ << ", "
+                          << feature.location().longitude() / kCoordFactor_;
+            }
+        }
+        co_await in.Finish(&status);
+        if (status.ok())
+        {
+            LOG(INFO) << "ListFeatures rpc succeeded.";
+        }
+        else
+        {
+            LOG(ERROR) << "ListFeatures rpc failed.";
+        }
+    }
+
+    // Lists the same rectangle as ListFeatures a page at a time, resuming with
+    // a new call whenever |max_results| cuts a call short.
+    CoStep ListFeaturePages(int page_size, int max_results)
+    {
+        routeguide::ListFeaturesRequest request;
+        routeguide::FeaturePage page;
+        request.mutable_rectangle()->mutable_lo()->set_latitude(400000000);
+        request.mutable_rectangle()->mutable_lo()->set_longitude(-750000000);
+        request.mutable_rectangle()->mutable_hi()->set_latitude(420000000);
+        request.mutable_rectangle()->mutable_hi()->set_longitude(-730000000);
+        request.set_page_size(page_size);
+        request.set_max_results(max_results);
+
+        int calls = 0;
+        int pages = 0;
+        int features = 0;
+        do
+        {
+            grpc::ClientContext context;
+            deadlines_.Apply("ListFeaturePages", &context);
+            grpc::Status status;
+            StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+            std::unique_ptr<grpc::ClientAsyncReader<routeguide::FeaturePage>> reader(
+                stub->PrepareAsyncListFeaturePages(&context, request, cq_));
+            CoStream in(reader.get());
+            calls++;
+            request.clear_page_token();
+            if (co_await in.StartCall())
+            {
+                while (co_await in.Read(&page))
+                {
+                    pages++;
+                    features += page.features_size();
+                    request.set_page_token(page.next_page_token());
+                }
+            }
+            co_await in.Finish(&status);
+            if (!status.ok())
+            {
+                LOG(ERROR) << "ListFeaturePages rpc failed: " << status.error_message();
+                co_return;
+            }
+        } while (!request.page_token().empty());
+        LOG(INFO) << "Got " << features << " features in " << pages << " pages over " << calls << " calls";
+    }
+
+    // Visits ten known points, pausing between them on an alarm rather than
+    // a sleeping thread.
+    CoStep RecordRoute()
+    {
+        routeguide::RouteSummary stats;
+        grpc::ClientContext context;
+        deadlines_.Apply("RecordRoute", &context);
+        grpc::Status status;
+        grpc::Alarm alarm;
+        const int kPoints = 10;
+        unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+
+        std::default_random_engine generator(seed);
+        std::uniform_int_distribution<int> feature_distribution(0, feature_list_.size() - 1);
+        std::uniform_int_distribution<int> delay_distribution(500, 1500);
+
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        std::unique_ptr<grpc::ClientAsyncWriter<routeguide::Point>> writer(
+            stub->PrepareAsyncRecordRoute(&context, &stats, cq_));
+        CoStream out(writer.get());
+        if (co_await out.StartCall())
+        {
+            for (int i = 0; i < kPoints; i++)
+            {
+                const routeguide::Feature &f = feature_list_[feature_distribution(generator)];
+                LOG(INFO) << "Visiting point " << f.location().latitude() / kCoordFactor_ << ", "
+                          << f.location().longitude() / kCoordFactor_;
+                if (!co_await out.Write(f.location()))
+                {
+                    // Broken stream.
+                    break;
+                }
+                co_await CoSleep(&alarm, cq_,
+                                 std::chrono::system_clock::now() +
+                                     std::chrono::milliseconds(delay_distribution(generator)));
+            }
+            co_await out.WritesDone();
+        }
+        co_await out.Finish(&status);
+        if (status.ok())
+        {
+            LOG(INFO) << "Finished trip with " << stats.point_count() << " points\n"
+                      << "Passed " << stats.feature_count() << " features\n"
+                      << "Travelled " << stats.distance() << " meters\n"
+                      << "It took " << stats.elapsed_time() << " seconds";
+        }
+        else
+        {
+            LOG(ERROR) << "RecordRoute rpc failed.";
+        }
+    }
+
+    CoStep RecordRouteBatch()
+    {
+        routeguide::RouteSummary stats;
+        grpc::ClientContext context;
+        deadlines_.Apply("RecordRouteBatch", &context);
+        grpc::Status status;
+        const int kPoints = 1000;
+        unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+
+        std::default_random_engine generator(seed);
+        std::uniform_int_distribution<int> feature_distribution(0, feature_list_.size() - 1);
+
+        // The whole route goes in one message.
+        routeguide::PointBatch batch;
+        routeguide::PointBatchEncoder encoder;
+        for (int i = 0; i < kPoints; i++)
+        {
+            encoder.Add(feature_list_[feature_distribution(generator)].location(), &batch);
+        }
+        LOG(INFO) << "Sending " << kPoints << " points in " << batch.ByteSizeLong() << " bytes";
+
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        std::unique_ptr<grpc::ClientAsyncWriter<routeguide::PointBatch>> writer(
+            stub->PrepareAsyncRecordRouteBatch(&context, &stats, cq_));
+        CoStream out(writer.get());
+        if (co_await out.StartCall())
+        {
+            co_await out.Write(batch, grpc::WriteOptions().set_last_message());
+        }
+        co_await out.Finish(&status);
+        if (status.ok())
+        {
+            LOG(INFO) << "Finished trip with " << stats.point_count() << " points\n"
+                      << "Passed " << stats.feature_count() << " features\n"
+                      << "Travelled " << stats.distance() << " meters";
+        }
+        else
+        {
+            LOG(ERROR) << "RecordRouteBatch rpc failed.";
+        }
+    }
+
+    // Reads the notes of a chat while RouteChat() writes its own.
+    CoTask ReadChat(grpc::ClientAsyncReaderWriter<routeguide::RouteNote, routeguide::RouteNote> *stream,
+                    CoEvent *done)
+    {
+        CoStream in(stream);
+        routeguide::RouteNote server_note;
+        while (co_await in.Read(&server_note))
+        {
+            LOG(INFO) << "Got message " << server_note.message() << " at " << server_note.location().latitude()
+                      << ", " << server_note.location().longitude();
+        }
+        done->Notify();
+    }
+
+    CoStep RouteChat(bool subscribe)
+    {
+        grpc::ClientContext context;
+        deadlines_.Apply("RouteChat", &context);
+        grpc::Status status;
+        if (subscribe)
+        {
+            context.AddMetadata(routeguide::kRouteChatSubscribeKey, "1");
+        }
+
+        StubPool<routeguide::RouteGuide>::Lease stub = stubs_.Pick();
+        std::unique_ptr<grpc::ClientAsyncReaderWriter<routeguide::RouteNote, routeguide::RouteNote>> stream(
+            stub->PrepareAsyncRouteChat(&context, cq_));
+        CoStream chat(stream.get());
+        if (co_await chat.StartCall())
+        {
+            CoEvent read(cq_);
+            ReadChat(stream.get(), &read);
+            std::vector<routeguide::RouteNote> notes{
+                MakeRouteNote("First message", 0, 0), MakeRouteNote("Second message", 0, 1),
+                MakeRouteNote("Third message", 1, 0), MakeRouteNote("Fourth message", 0, 0)};
+            for (const routeguide::RouteNote &note : notes)
+            {
+                LOG(INFO) << "Sending message " << note.message() << " at " << note.location().latitude() << ", "
+                          << note.location().longitude();
+                if (!co_await chat.Write(note))
+                {
+                    break;
+                }
+            }
+            co_await chat.WritesDone();
+            co_await read.Wait();
+        }
+        co_await chat.Finish(&status);
+        if (!status.ok())
+        {
+            LOG(ERROR) << "RouteChat rpc failed.";
+        }
+    }
+
+    const float kCoordFactor_ = 10000000.0;
+    StubPool<routeguide::RouteGuide> stubs_;
+    CallDeadlines deadlines_;
+    grpc::CompletionQueue *cq_;
+    std::vector<routeguide::Feature> feature_list_;
+};
+
+// The load generator's calls, each a coroutine on one of |queues| queues
+// with a thread each.
+class RouteGuideLoad
+{
+  public:
+    RouteGuideLoad(std::shared_ptr<ChannelPool> channels, const std::string &db_path, const CallDeadlines &deadlines,
+                   int queues)
+        : stubs_(std::move(channels)), deadlines_(deadlines)
+    {
+        routeguide::LoadDb(db_path, &feature_list_);
+        if (feature_list_.empty())
+            feature_list_.push_back(MakeFeature("", 0, 0));
+        for (int i = 0; i < (std::max)(queues, 1); i++)
+            cqs_.push_back(std::make_unique<grpc::CompletionQueue>());
+        for (size_t i = 0; i < cqs_.size(); i++)
+        {
+            threads_.emplace_back(CoDrain, cqs_[i].get());
+            if (cqs_.size() > 1)
+                PinThreadToCpu(threads_.back(), static_cast<int>(i));
+        }
+    }
+
+    ~RouteGuideLoad()
+    {
+        for (std::unique_ptr<grpc::CompletionQueue> &cq : cqs_)
+            cq->Shutdown();
+        for (std::thread &t : threads_)
+            t.join();
+    }
+
+    void Register(LoadGenerator *load)
+    {
+        load->AddRpc("GetFeature", [this](int, LoadGenerator::Done done) {
+            size_t channel = stubs_.Acquire();
+            GetFeature(stubs_.stub(channel), NextQueue(), Releasing(channel, std::move(done)));
+        });
+        load->AddRpc("ListFeatures", [this](int, LoadGenerator::Done done) {
+            size_t channel = stubs_.Acquire();
+            ListFeatures(stubs_.stub(channel), NextQueue(), Releasing(channel, std::move(done)));
+        });
+        load->AddRpc("RecordRoute", [this](int, LoadGenerator::Done done) {
+            size_t channel = stubs_.Acquire();
+            RecordRoute(stubs_.stub(channel), NextQueue(), Releasing(channel, std::move(done)));
+        });
+        load->AddRpc("RecordRouteBatch", [this](int, LoadGenerator::Done done) {
+            size_t channel = stubs_.Acquire();
+            RecordRouteBatch(stubs_.stub(channel), NextQueue(), Releasing(channel, std::move(done)));
+        });
+        load->AddRpc("RouteChat", [this](int, LoadGenerator::Done done) {
+            size_t channel = stubs_.Acquire();
+            RouteChat(stubs_.stub(channel), NextQueue(), Releasing(channel, std::move(done)));
+        });
+    }
+
+  private:
+    // Wraps |done| to give |channel| back to the pool once the call is over.
+    LoadGenerator::Done Releasing(size_t channel, LoadGenerator::Done done)
+    {
+        return [this, channel, done = std::move(done)](bool ok) {
+            stubs_.Release(channel);
+            done(ok);
+        };
+    }
+
+    grpc::CompletionQueue *NextQueue()
+    {
+        return cqs_[next_cq_.fetch_add(1, std::memory_order_relaxed) % cqs_.size()].get();
+    }
+
+    static std::mt19937 &Generator()
+    {
+        thread_local std::mt19937 generator(std::random_device{}());
+        return generator;
+    }
+
+    const routeguide::Point &RandomPoint()
+    {
+        std::uniform_int_distribution<size_t> index(0, feature_list_.size() - 1);
+        return feature_list_[index(Generator())].location();
+    }
+
+    CoTask GetFeature(routeguide::RouteGuide::Stub *stub, grpc::CompletionQueue *cq, LoadGenerator::Done done)
+    {
+        grpc::ClientContext context;
+        deadlines_.Apply("GetFeature", &context);
+        routeguide::Feature feature;
+        grpc::Status status;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<routeguide::Feature>> call(
+            stub->AsyncGetFeature(&context, RandomPoint(), cq));
+        co_await CoStream(call.get()).Finish(&feature, &status);
+        done(status.ok());
+    }
+
+    // Lists the features in a 0.2 degree square around a known point.
+    CoTask ListFeatures(routeguide::RouteGuide::Stub *stub, grpc::CompletionQueue *cq, LoadGenerator::Done done)
+    {
+        grpc::ClientContext context;
+        deadlines_.Apply("ListFeatures", &context);
+        routeguide::Rectangle rect;
+        routeguide::Feature feature;
+        grpc::Status status;
+        const routeguide::Point &center = RandomPoint();
+        rect.mutable_lo()->set_latitude(center.latitude() - 1000000);
+        rect.mutable_lo()->set_longitude(center.longitude() - 1000000);
+        rect.mutable_hi()->set_latitude(center.latitude() + 1000000);
+        rect.mutable_hi()->set_longitude(center.longitude() + 1000000);
+        std::unique_ptr<grpc::ClientAsyncReader<routeguide::Feature>> reader(
+            stub->PrepareAsyncListFeatures(&context, rect, cq));
+        CoStream in(reader.get());
+        if (co_await in.StartCall())
+        {
+            while (co_await in.Read(&feature))
+            {
+            }
+        }
+        co_await in.Finish(&status);
+        done(status.ok());
+    }
+
+    // Sends a route of ten known points, back to back.
+    CoTask RecordRoute(routeguide::RouteGuide::Stub *stub, grpc::CompletionQueue *cq, LoadGenerator::Done done)
+    {
+        grpc::ClientContext context;
+        deadlines_.Apply("RecordRoute", &context);
+        routeguide::RouteSummary summary;
+        grpc::Status status;
+        std::unique_ptr<grpc::ClientAsyncWriter<routeguide::Point>> writer(
+            stub->PrepareAsyncRecordRoute(&context, &summary, cq));
+        CoStream out(writer.get());
+        if (co_await out.StartCall())
+        {
+            int points = 10;
+            while (points-- > 0 && co_await out.Write(RandomPoint()))
+            {
+            }
+            co_await out.WritesDone();
+        }
+        co_await out.Finish(&status);
+        done(status.ok());
+    }
+
+    // Sends a route of a thousand known points packed into a single batch.
+    CoTask RecordRouteBatch(routeguide::RouteGuide::Stub *stub, grpc::CompletionQueue *cq, LoadGenerator::Done done)
+    {
+        grpc::ClientContext context;
+        deadlines_.Apply("RecordRouteBatch", &context);
+        routeguide::PointBatch batch;
+        routeguide::RouteSummary summary;
+        grpc::Status status;
+        routeguide::PointBatchEncoder encoder;
+        for (int i = 0; i < 1000; i++)
+            encoder.Add(RandomPoint(), &batch);
+        std::unique_ptr<grpc::ClientAsyncWriter<routeguide::PointBatch>> writer(
+            stub->PrepareAsyncRecordRouteBatch(&context, &summary, cq));
+        CoStream out(writer.get());
+        if (co_await out.StartCall())
+            co_await out.Write(batch, grpc::WriteOptions().set_last_message());
+        co_await out.Finish(&status);
+        done(status.ok());
+    }
+
+    // Posts a few notes at a random location, then reads back whatever the
+    // server returns for it. Random locations keep the history per location
+    // short, so the cost of a chat stays about constant as the test runs.
+    CoTask RouteChat(routeguide::RouteGuide::Stub *stub, grpc::CompletionQueue *cq, LoadGenerator::Done done)
+    {
+        grpc::ClientContext context;
+        deadlines_.Apply("RouteChat", &context);
+        routeguide::RouteNote server_note;
+        grpc::Status status;
+        std::uniform_int_distribution<int> latitude(-900000000, 900000000);
+        std::uniform_int_distribution<int> longitude(-1800000000, 1800000000);
+        routeguide::RouteNote note = MakeRouteNote("load", latitude(Generator()), longitude(Generator()));
+        std::unique_ptr<grpc::ClientAsyncReaderWriter<routeguide::RouteNote, routeguide::RouteNote>> stream(
+            stub->PrepareAsyncRouteChat(&context, cq));
+        CoStream chat(stream.get());
+        if (co_await chat.StartCall())
+        {
+            int notes = 4;
+            while (notes-- > 0 && co_await chat.Write(note))
+            {
+            }
+            co_await chat.WritesDone();
+            while (co_await chat.Read(&server_note))
+            {
+            }
+        }
+        co_await chat.Finish(&status);
+        done(status.ok());
+    }
+
+    StubPool<routeguide::RouteGuide> stubs_;
+    CallDeadlines deadlines_;
+    std::vector<routeguide::Feature> feature_list_;
+    std::vector<std::unique_ptr<grpc::CompletionQueue>> cqs_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_cq_{0};
+};
+
+// For both
+int main(int argc, char **argv)
+{
+    CliParams cli_params;
+    ParseCLIState cliState = ParseCommandLine(argc, argv, &cli_params);
+
+    if (cliState == ParseCLIState::SUCCESS)
+    {
+        ChannelPoolOptions pool_options;
+        pool_options.channels = cli_params.channels;
+        pool_options.lb_policy = cli_params.lb_policy;
+        ParseCompressionAlgorithms(cli_params.accept_encodings, &pool_options.compression_algorithms);
+        if (!ParseChannelPick(cli_params.channel_pick, &pool_options.pick))
+        {
+            std::cout << "--channel_pick must be round_robin or least_outstanding." << std::endl;
+            return 1;
+        }
+        CallDeadlines deadlines;
+        if (!GetCallDeadlines(cli_params, &deadlines))
+        {
+            return 1;
+        }
+        if (cli_params.mode == Mode::CLIENT && cli_params.load)
+        {
+            RouteGuideLoad route_guide(std::make_shared<ChannelPool>(cli_params.server_address, pool_options),
+                                       cli_params.database, deadlines, cli_params.num_cqs);
+            LoadGenerator load;
+            route_guide.Register(&load);
+            LoadOptions options;
+            options.qps = cli_params.qps;
+            options.concurrency = cli_params.concurrency;
+            options.duration = std::chrono::seconds(cli_params.duration_s);
+            options.rpc_mix = cli_params.rpc_mix;
+            return load.Run(options, std::cout) ? 0 : 1;
+        }
+        else if (cli_params.mode == Mode::CLIENT)
+        {
+            grpc::CompletionQueue cq;
+            RouteGuideClient route_guide(std::make_shared<ChannelPool>(cli_params.server_address, pool_options),
+                                         cli_params.database, deadlines, &cq);
+            route_guide.Run(cli_params.window, cli_params.page_size, cli_params.max_results,
+                            cli_params.chat_subscribe);
+            CoDrain(&cq);
+        }
+        else // SERVER
+        {
+            routeguide::RouteNoteStore::Options note_options;
+            note_options.max_notes_per_location = cli_params.chat_max_notes;
+            note_options.ttl = std::chrono::milliseconds(cli_params.chat_ttl_ms);
+            note_options.max_bytes = cli_params.chat_max_bytes;
+            note_options.subscriber_queue_size = cli_params.chat_queue_size;
+            note_options.subscriber_overflow = cli_params.chat_disconnect_slow
+                                                   ? routeguide::NoteQueue::Overflow::kDisconnect
+                                                   : routeguide::NoteQueue::Overflow::kDropOldest;
+            auto serve = [&](int worker) {
+                std::string maintenance_address = WorkerAddress(cli_params.maintenance_address, worker);
+                RunServer(cli_params.database, cli_params.reload_interval_ms, note_options, cli_params.server_address,
+                          maintenance_address, GetServerOptions(cli_params), GetCompressionPolicy(cli_params),
+                          cli_params.num_cqs, cli_params.calls_per_cq);
+            };
+            if (cli_params.processes > 1)
+                return Supervisor(GetSupervisorOptions(cli_params), serve).Run();
+            serve(0);
+        }
+        return 0;
+    }
+    else if (cliState == ParseCLIState::SHOW_HELP)
+        return 0;
+    else
+        return 1;
+}
@@ -0,0 +1,516 @@
+/*
+ *
+ * Copyright 2021 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "route_guide_service.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "feature_cache.h"
+#include "feature_pager.h"
+#include "feature_store.h"
+#include "helper.h"
+#include "route_recorder.h"
+
+namespace routeguide
+{
+
+namespace
+{
+
+// Parses a request of one of the raw methods.
+template <class Message> bool ParseMessage(const grpc::ByteBuffer &buffer, Message *message)
+{
+    // Deserialize() consumes its buffer; the copy only takes a reference.
+    grpc::ByteBuffer copy(buffer);
+    return grpc::SerializationTraits<Message>::Deserialize(&copy, message).ok();
+}
+
+// Write side of a RouteChat reactor: the replies to its own posts and, when
+// subscribed, the notes other streams push to it. It outlives the reactor
+// while posters still hold it. Reactor operations are started under mu_,
+// which is safe because gRPC never runs a reaction inline from a Start call.
+class ChatOutbox final : public RouteNoteStore::Subscriber
+{
+  public:
+    using Reactor = grpc::ServerBidiReactor<RouteNote, RouteNote>;
+
+    // |compression| is null on an uncompressed call.
+    ChatOutbox(Reactor *reactor, RouteNote *read_buffer, size_t queue_size, NoteQueue::Overflow overflow,
+               const CompressionPolicy *compression)
+        : reactor_(reactor), read_buffer_(read_buffer), pushed_(queue_size, overflow), compression_(compression)
+    {
+    }
+
+    void Deliver(const std::shared_ptr<const RouteNote> &note) override
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (reactor_ != nullptr && !finished_ && !pushed_.Push(note))
+        {
+            overflowed_ = true;
+        }
+        Step();
+    }
+
+    void Start()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        want_read_ = true;
+        Step();
+    }
+
+    // Sends the reply to one posted note; the next read starts once all of
+    // it is on its way, so a client can't outrun its own replies.
+    void Reply(std::vector<std::shared_ptr<const RouteNote>> notes)
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        replies_ = std::move(notes);
+        next_reply_ = 0;
+        want_read_ = true;
+        Step();
+    }
+
+    void ReadsDone()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        reads_done_ = true;
+        Step();
+    }
+
+    void WriteDone(bool ok)
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        writing_ = false;
+        current_.reset();
+        if (!ok)
+        {
+            // The stream is broken, stop as soon as possible.
+            reads_done_ = true;
+            replies_.clear();
+            next_reply_ = 0;
+        }
+        Step();
+    }
+
+    // Called from OnDone(); later deliveries are dropped.
+    void Detach()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        reactor_ = nullptr;
+    }
+
+  private:
+    // Starts whatever the current state allows. Requires mu_.
+    void Step()
+    {
+        if (reactor_ == nullptr || finished_)
+        {
+            return;
+        }
+        if (!writing_ && !overflowed_)
+        {
+            if (next_reply_ < replies_.size())
+            {
+                current_ = std::move(replies_[next_reply_++]);
+            }
+            else if (!pushed_.empty())
+            {
+                current_ = pushed_.Pop();
+            }
+            if (current_)
+            {
+                writing_ = true;
+                reactor_->StartWrite(current_.get(), compression_ != nullptr
+                                                         ? compression_->WriteOptionsFor(current_->ByteSizeLong())
+                                                         : grpc::WriteOptions());
+            }
+        }
+        bool replies_sent = next_reply_ == replies_.size();
+        if (want_read_ && replies_sent && !reads_done_)
+        {
+            want_read_ = false;
+            reactor_->StartRead(read_buffer_);
+        }
+        if (!writing_ && (overflowed_ || (reads_done_ && replies_sent)))
+        {
+            finished_ = true;
+            reactor_->Finish(overflowed_
+                                 ? grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "RouteChat subscriber fell behind")
+                                 : grpc::Status::OK);
+        }
+    }
+
+    std::mutex mu_;
+    Reactor *reactor_;
+    RouteNote *read_buffer_;
+    std::vector<std::shared_ptr<const RouteNote>> replies_;
+    size_t next_reply_ = 0;
+    NoteQueue pushed_;
+    const CompressionPolicy *compression_;
+    // The note being written, kept alive until OnWriteDone.
+    std::shared_ptr<const RouteNote> current_;
+    bool writing_ = false;
+    bool want_read_ = false;
+    bool reads_done_ = false;
+    bool overflowed_ = false;
+    bool finished_ = false;
+};
+
+} // namespace
+
+RouteGuideImpl::RouteGuideImpl(FeatureDatabase *db, const RouteNoteStore::Options &note_options,
+                               const CompressionPolicy &compression)
+    : db_(db), notes_(note_options), compression_(compression)
+{
+}
+
+std::shared_ptr<const FeatureCache> RouteGuideImpl::Cache()
+{
+    std::shared_ptr<const FeatureStore> store = db_->Get();
+    std::shared_ptr<const FeatureCache> cache = cache_.load(std::memory_order_acquire);
+    if (cache && cache->store() == store)
+    {
+        return cache;
+    }
+    // First call after a reload. The store came serialized, so this only
+    // wraps it; callers that race here each wrap it, and one of them stays.
+    cache = std::make_shared<const FeatureCache>(std::move(store));
+    cache_.store(cache, std::memory_order_release);
+    return cache;
+}
+
+grpc::ServerUnaryReactor *RouteGuideImpl::GetFeature(grpc::CallbackServerContext *context,
+                                                     const grpc::ByteBuffer *request, grpc::ByteBuffer *response)
+{
+    grpc::ServerUnaryReactor *reactor = context->DefaultReactor();
+    Point point;
+    if (!ParseMessage(*request, &point))
+    {
+        reactor->Finish(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "malformed Point"));
+        return reactor;
+    }
+    std::shared_ptr<const FeatureCache> cache = Cache();
+    uint32_t index = cache->store()->Find(point);
+    if (index != FeatureStore::kNotFound)
+    {
+        grpc::Slice slice = cache->Serialized(index);
+        *response = grpc::ByteBuffer(&slice, 1);
+    }
+    else
+    {
+        // Misses echo the point back with an empty name.
+        Feature feature;
+        *feature.mutable_location() = point;
+        bool own_buffer;
+        grpc::SerializationTraits<Feature>::Serialize(feature, response, &own_buffer);
+    }
+    compression_.StartUnary(context, response->Length());
+    reactor->Finish(grpc::Status::OK);
+    return reactor;
+}
+
+grpc::ServerWriteReactor<grpc::ByteBuffer> *RouteGuideImpl::ListFeatures(grpc::CallbackServerContext *context,
+                                                                         const grpc::ByteBuffer *request)
+{
+    class Lister : public grpc::ServerWriteReactor<grpc::ByteBuffer>
+    {
+      public:
+        Lister(const Rectangle &rectangle, std::shared_ptr<const FeatureCache> cache,
+               const CompressionPolicy *compression)
+            : cache_(std::move(cache)), cursor_(cache_->store()->Query(rectangle)), next_(cursor_.Next()),
+              compression_(compression)
+        {
+            NextWrite();
+        }
+        void OnDone() override
+        {
+            delete this;
+        }
+        // With the caller gone, or past its deadline, the rest of the cursor
+        // is left unread.
+        void OnCancel() override
+        {
+            cancelled_ = true;
+        }
+        void OnWriteDone(bool ok) override
+        {
+            if (!ok || cancelled_)
+            {
+                Finish(grpc::Status::CANCELLED);
+                return;
+            }
+            NextWrite();
+        }
+
+      private:
+        void NextWrite()
+        {
+            if (next_ == FeatureStore::kNotFound)
+            {
+                // Didn't write anything, all is done.
+                Finish(grpc::Status::OK);
+                return;
+            }
+            grpc::Slice slice = cache_->Serialized(next_);
+            feature_ = grpc::ByteBuffer(&slice, 1);
+            next_ = cursor_.Next();
+            grpc::WriteOptions options =
+                compression_ != nullptr ? compression_->WriteOptionsFor(feature_.Length()) : grpc::WriteOptions();
+            if (next_ == FeatureStore::kNotFound)
+            {
+                StartWriteAndFinish(&feature_, options, grpc::Status::OK);
+                return;
+            }
+            StartWrite(&feature_, options);
+        }
+        // The stream finishes on the store it started on, even across a reload.
+        std::shared_ptr<const FeatureCache> cache_;
+        FeatureStore::Cursor cursor_;
+        // Index of the feature after feature_, read ahead so that the last
+        // write can carry the status.
+        uint32_t next_;
+        // Null on an uncompressed call.
+        const CompressionPolicy *compression_;
+        grpc::ByteBuffer feature_;
+        // Set on a callback thread of its own, read on the one writing.
+        std::atomic<bool> cancelled_{false};
+    };
+    Rectangle rectangle;
+    if (!ParseMessage(*request, &rectangle))
+    {
+        class Rejecter : public grpc::ServerWriteReactor<grpc::ByteBuffer>
+        {
+          public:
+            Rejecter()
+            {
+                Finish(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "malformed Rectangle"));
+            }
+            void OnDone() override
+            {
+                delete this;
+            }
+        };
+        return new Rejecter;
+    }
+    return new Lister(rectangle, Cache(), compression_.Start(context) ? &compression_ : nullptr);
+}
+
+grpc::ServerWriteReactor<FeaturePage> *RouteGuideImpl::ListFeaturePages(grpc::CallbackServerContext *context,
+                                                                        const ListFeaturesRequest *request)
+{
+    class Pager : public grpc::ServerWriteReactor<FeaturePage>
+    {
+      public:
+        Pager(const ListFeaturesRequest *request, std::shared_ptr<const FeatureStore> store,
+              const CompressionPolicy *compression)
+            : pager_(std::move(store), *request), compression_(compression)
+        {
+            NextWrite();
+        }
+        void OnDone() override
+        {
+            delete this;
+        }
+        void OnCancel() override
+        {
+            cancelled_ = true;
+        }
+        void OnWriteDone(bool ok) override
+        {
+            if (ok && !cancelled_)
+            {
+                NextWrite();
+            }
+            else
+            {
+                // Broken or abandoned stream; no page is built for it. The
+                // client resumes from its last token.
+                Finish(grpc::Status::OK);
+            }
+        }
+
+      private:
+        void NextWrite()
+        {
+            if (pager_.Next(&page_))
+            {
+                StartWrite(&page_, compression_ != nullptr ? compression_->WriteOptionsFor(page_.ByteSizeLong())
+                                                           : grpc::WriteOptions());
+                return;
+            }
+            Finish(pager_.status());
+        }
+        FeaturePager pager_;
+        // Null on an uncompressed call.
+        const CompressionPolicy *compression_;
+        FeaturePage page_;
+        std::atomic<bool> cancelled_{false};
+    };
+    return new Pager(request, db_->Get(), compression_.Start(context) ? &compression_ : nullptr);
+}
+
+grpc::ServerReadReactor<Point> *RouteGuideImpl::RecordRoute(grpc::CallbackServerContext *context, RouteSummary *summary)
+{
+    class Recorder : public grpc::ServerReadReactor<Point>
+    {
+      public:
+        Recorder(RouteSummary *summary, std::shared_ptr<const FeatureStore> store)
+            : summary_(summary), recorder_(std::move(store))
+        {
+            StartRead(&point_);
+        }
+        void OnDone() override
+        {
+            delete this;
+        }
+        void OnReadDone(bool ok) override
+        {
+            if (ok)
+            {
+                recorder_.Add(point_);
+                StartRead(&point_);
+            }
+            else
+            {
+                recorder_.Finish(summary_);
+                Finish(grpc::Status::OK);
+            }
+        }
+
+      private:
+        RouteSummary *summary_;
+        RouteRecorder recorder_;
+        Point point_;
+    };
+    return new Recorder(summary, db_->Get());
+}
+
+grpc::ServerReadReactor<PointBatch> *RouteGuideImpl::RecordRouteBatch(grpc::CallbackServerContext *context,
+                                                                      RouteSummary *summary)
+{
+    class Recorder : public grpc::ServerReadReactor<PointBatch>
+    {
+      public:
+        Recorder(RouteSummary *summary, std::shared_ptr<const FeatureStore> store)
+            : summary_(summary), recorder_(std::move(store))
+        {
+            StartRead(&batch_);
+        }
+        void OnDone() override
+        {
+            delete this;
+        }
+        void OnReadDone(bool ok) override
+        {
+            if (!ok)
+            {
+                recorder_.Finish(summary_);
+                Finish(grpc::Status::OK);
+            }
+            else if (!recorder_.Add(batch_))
+            {
+                Finish(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "latitude and longitude deltas differ in length"));
+            }
+            else
+            {
+                StartRead(&batch_);
+            }
+        }
+
+      private:
+        RouteSummary *summary_;
+        RouteRecorder recorder_;
+        PointBatch batch_;
+    };
+    return new Recorder(summary, db_->Get());
+}
+
+grpc::ServerBidiReactor<RouteNote, RouteNote> *RouteGuideImpl::RouteChat(grpc::CallbackServerContext *context)
+{
+    class Chatter : public grpc::ServerBidiReactor<RouteNote, RouteNote>
+    {
+      public:
+        Chatter(RouteNoteStore *notes, bool subscribe, const CompressionPolicy *compression)
+            : notes_(notes), subscribe_(subscribe),
+              outbox_(std::make_shared<ChatOutbox>(this, &note_,
+                                                   (std::max)(notes->options().subscriber_queue_size, size_t{1}),
+                                                   notes->options().subscriber_overflow, compression))
+        {
+            outbox_->Start();
+        }
+        void OnDone() override
+        {
+            outbox_->Detach();
+            delete this;
+        }
+        void OnReadDone(bool ok) override
+        {
+            if (!ok)
+            {
+                outbox_->ReadsDone();
+                return;
+            }
+            // Post() hands out references to the earlier notes at this
+            // location, so nothing is locked or copied while the outbox
+            // writes them.
+            std::vector<std::shared_ptr<const RouteNote>> earlier;
+            notes_->Post(note_, &earlier, subscribe_ ? outbox_ : nullptr);
+            outbox_->Reply(std::move(earlier));
+        }
+        void OnWriteDone(bool ok) override
+        {
+            outbox_->WriteDone(ok);
+        }
+
+      private:
+        RouteNoteStore *notes_;
+        const bool subscribe_;
+        RouteNote note_;
+        std::shared_ptr<ChatOutbox> outbox_;
+    };
+    return new Chatter(&notes_, context->client_metadata().count(kRouteChatSubscribeKey) != 0,
+                       compression_.Start(context) ? &compression_ : nullptr);
+}
+
+RouteGuideAdminImpl::RouteGuideAdminImpl(FeatureDatabase *db) : db_(db)
+{
+}
+
+grpc::ServerUnaryReactor *RouteGuideAdminImpl::ReloadFeatures(grpc::CallbackServerContext *context,
+                                                              const ReloadFeaturesRequest *request,
+                                                              ReloadFeaturesReply *reply)
+{
+    // The reload parses the whole file, keep it off the callback threads.
+    grpc::ServerUnaryReactor *reactor = context->DefaultReactor();
+    if (!db_->ReloadInBackground([this, reactor, reply](bool reloaded) {
+            reply->set_reloaded(reloaded);
+            reply->set_feature_count(db_->Get()->size());
+            reactor->Finish(grpc::Status::OK);
+        }))
+    {
+        reactor->Finish(grpc::Status(grpc::StatusCode::ABORTED, "A reload is already running"));
+    }
+    return reactor;
+}
+
+} // namespace routeguide
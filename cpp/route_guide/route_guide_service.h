@@ -0,0 +1,84 @@
+/*
+ *
+ * Copyright 2021 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_GUIDE_SERVICE_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_GUIDE_SERVICE_H_
+
+#include <atomic>
+#include <memory>
+
+#include <grpcpp/grpcpp.h>
+
+#include "common/compression.h"
+#include "feature_cache.h"
+#include "feature_database.h"
+#include "note_store.h"
+#include "route_guide.grpc.pb.h"
+
+namespace routeguide
+{
+
+// Callback implementation of RouteGuide, served by route_guide_callback and
+// driven in-process by route_guide_bench. GetFeature and ListFeatures are raw
+// methods: they answer with the bytes the FeatureStore serialized as it was
+// built, through a FeatureCache, so features are never serialized per call.
+class RouteGuideImpl final
+    : public RouteGuide::WithRawCallbackMethod_GetFeature<
+          RouteGuide::WithRawCallbackMethod_ListFeatures<RouteGuide::CallbackService>>
+{
+  public:
+    RouteGuideImpl(FeatureDatabase *db, const RouteNoteStore::Options &note_options,
+                   const CompressionPolicy &compression = CompressionPolicy());
+
+    grpc::ServerUnaryReactor *GetFeature(grpc::CallbackServerContext *context, const grpc::ByteBuffer *request,
+                                         grpc::ByteBuffer *response) override;
+    grpc::ServerWriteReactor<grpc::ByteBuffer> *ListFeatures(grpc::CallbackServerContext *context,
+                                                             const grpc::ByteBuffer *request) override;
+    grpc::ServerWriteReactor<FeaturePage> *ListFeaturePages(grpc::CallbackServerContext *context,
+                                                            const ListFeaturesRequest *request) override;
+    grpc::ServerReadReactor<Point> *RecordRoute(grpc::CallbackServerContext *context, RouteSummary *summary) override;
+    grpc::ServerReadReactor<PointBatch> *RecordRouteBatch(grpc::CallbackServerContext *context,
+                                                          RouteSummary *summary) override;
+    grpc::ServerBidiReactor<RouteNote, RouteNote> *RouteChat(grpc::CallbackServerContext *context) override;
+
+  private:
+    // The cache of the current store, made on first use after a reload.
+    std::shared_ptr<const FeatureCache> Cache();
+
+    FeatureDatabase *db_;
+    RouteNoteStore notes_;
+    const CompressionPolicy compression_;
+    std::atomic<std::shared_ptr<const FeatureCache>> cache_;
+};
+
+class RouteGuideAdminImpl final : public RouteGuideAdmin::CallbackService
+{
+  public:
+    explicit RouteGuideAdminImpl(FeatureDatabase *db);
+
+    grpc::ServerUnaryReactor *ReloadFeatures(grpc::CallbackServerContext *context,
+                                             const ReloadFeaturesRequest *request,
+                                             ReloadFeaturesReply *reply) override;
+
+  private:
+    FeatureDatabase *db_;
+};
+
+} // namespace routeguide
+
+#endif // GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_GUIDE_SERVICE_H_
@@ -0,0 +1,24 @@
+// Converts the JSON feature database into the binary snapshot that the
+// route_guide servers map at startup when it is passed as --database.
+//   ./route_guide_snapshot route_guide_db.json route_guide_db.snapshot
+
+#include <iostream>
+#include <memory>
+
+#include "feature_store.h"
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "Usage: " << argv[0] << " <db.json> <output.snapshot>" << std::endl;
+        return 1;
+    }
+    std::unique_ptr<routeguide::FeatureStore> store = routeguide::FeatureStore::Open(argv[1]);
+    if (!store || !store->WriteSnapshot(argv[2]))
+    {
+        return 1;
+    }
+    std::cout << "Wrote " << store->size() << " features to " << argv[2] << std::endl;
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "route_recorder.h"
+
+#include <utility>
+
+namespace routeguide
+{
+
+RouteRecorder::RouteRecorder(std::shared_ptr<const FeatureStore> store)
+    : store_(std::move(store)), start_time_(std::chrono::system_clock::now())
+{
+}
+
+void RouteRecorder::Add(int32_t latitude, int32_t longitude)
+{
+    point_count_++;
+    // Only named features count, as unnamed entries are just known points.
+    uint32_t index = store_->Find(latitude, longitude);
+    if (index != FeatureStore::kNotFound && !store_->name(index).empty())
+    {
+        feature_count_++;
+    }
+    distance_.Add(latitude, longitude);
+}
+
+bool RouteRecorder::Add(const PointBatch &batch)
+{
+    int n = batch.latitude_deltas_size();
+    if (batch.longitude_deltas_size() != n)
+    {
+        return false;
+    }
+    const int32_t *latitude_deltas = batch.latitude_deltas().data();
+    const int32_t *longitude_deltas = batch.longitude_deltas().data();
+    for (int i = 0; i < n; i++)
+    {
+        latitude_ += static_cast<uint32_t>(latitude_deltas[i]);
+        longitude_ += static_cast<uint32_t>(longitude_deltas[i]);
+        Add(static_cast<int32_t>(latitude_), static_cast<int32_t>(longitude_));
+    }
+    return true;
+}
+
+void RouteRecorder::Finish(RouteSummary *summary)
+{
+    std::chrono::system_clock::time_point end_time = std::chrono::system_clock::now();
+    summary->set_point_count(point_count_);
+    summary->set_feature_count(feature_count_);
+    summary->set_distance(static_cast<long>(distance_.Total()));
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time_);
+    summary->set_elapsed_time(secs.count());
+}
+
+void PointBatchEncoder::Add(int32_t latitude, int32_t longitude, PointBatch *batch)
+{
+    batch->add_latitude_deltas(static_cast<int32_t>(static_cast<uint32_t>(latitude) - latitude_));
+    batch->add_longitude_deltas(static_cast<int32_t>(static_cast<uint32_t>(longitude) - longitude_));
+    latitude_ = static_cast<uint32_t>(latitude);
+    longitude_ = static_cast<uint32_t>(longitude);
+}
+
+} // namespace routeguide
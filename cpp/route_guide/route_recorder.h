@@ -0,0 +1,66 @@
+#ifndef GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_RECORDER_H_
+#define GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_RECORDER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "feature_store.h"
+#include "route_distance.h"
+#include "route_guide.pb.h"
+
+namespace routeguide
+{
+
+// The RouteSummary accounting shared by RecordRoute and RecordRouteBatch:
+// points, known features passed, distance and elapsed time of one stream.
+class RouteRecorder
+{
+  public:
+    // Features are looked up in |store| for the whole stream, so a reload
+    // does not change the answer halfway through a route.
+    explicit RouteRecorder(std::shared_ptr<const FeatureStore> store);
+
+    void Add(int32_t latitude, int32_t longitude);
+    void Add(const Point &point)
+    {
+        Add(point.latitude(), point.longitude());
+    }
+
+    // Adds the points of |batch|, continuing from the last point added by a
+    // previous batch. Returns false, adding nothing, if the delta columns
+    // differ in length.
+    bool Add(const PointBatch &batch);
+
+    void Finish(RouteSummary *summary);
+
+  private:
+    std::shared_ptr<const FeatureStore> store_;
+    std::chrono::system_clock::time_point start_time_;
+    int point_count_ = 0;
+    int feature_count_ = 0;
+    RouteDistance distance_;
+    // Running sums of the batch deltas, wrapping like the protocol says.
+    uint32_t latitude_ = 0;
+    uint32_t longitude_ = 0;
+};
+
+// Packs the points of a route into PointBatch messages, keeping the delta
+// chain across the batches of one RecordRouteBatch stream.
+class PointBatchEncoder
+{
+  public:
+    void Add(int32_t latitude, int32_t longitude, PointBatch *batch);
+    void Add(const Point &point, PointBatch *batch)
+    {
+        Add(point.latitude(), point.longitude(), batch);
+    }
+
+  private:
+    uint32_t latitude_ = 0;
+    uint32_t longitude_ = 0;
+};
+
+} // namespace routeguide
+
+#endif // GRPC_COMMON_CPP_ROUTE_GUIDE_ROUTE_RECORDER_H_